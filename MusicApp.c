@@ -12,6 +12,26 @@
 #include <math.h>  // For sqrt, pow, cosf, fabsf
 #include <time.h>  // For logging timestamps
 #include <signal.h> // For signal handling
+#include <pthread.h> // For the reader/DSP and output threads
+#include <sched.h>   // For SCHED_FIFO output thread
+#include <stdatomic.h> // For the lock-free ring buffer
+#include <sys/mman.h>  // For the memory-mapped WAV source
+#include <sys/stat.h>
+#include <dirent.h>  // For directory playlists
+#include <strings.h> // strcasecmp for file extensions
+#include <limits.h>  // PATH_MAX
+#include <sys/eventfd.h> // For waking the pipeline and control threads
+#include <poll.h>        // Event-driven control loop and device waits
+#include <sys/socket.h>  // tcp: stream sources
+#include <netdb.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // SSE / AVX2 FIR kernels
+#define FIR_HAVE_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>  // NEON FIR kernel
+#define FIR_HAVE_NEON 1
+#endif
 #include "const.h"
 
 #ifndef M_PI
@@ -35,18 +55,83 @@ bool USR_BOARD_SPEAKER_MAX = true;
 playback_state_t current_state = STOPPED;
 playback_speed_t current_speed = SPEED_1_0X;
 equalizer_mode_t current_eq_mode = EQ_NORMAL;
+stretch_mode_t current_stretch_mode = STRETCH_WSOLA;
+eq_engine_t current_eq_engine = EQ_ENGINE_FIR;
+float current_speed_factor = 1.0f;
+float current_volume_db = 0.0f;
 long current_position = 0;
 long total_frames = 0;
-char playlist[10][256];
 int playlist_count = 0;
+const char *track_index_path = "music_app.index"; // -X 曲目头部索引文件，none 关闭
+int jitter_buffer_ms = DEFAULT_JITTER_BUFFER_MS;     // -J 深度[,预取] (毫秒)
+int jitter_prefetch_ms = DEFAULT_JITTER_PREFETCH_MS;
 int current_track = 0;
 long data_chunk_offset = 0; // Store the actual position of the data chunk
-bool track_change_requested = false; // Flag for manual track changes
 bool auto_next_requested = false; // Flag for automatic track changes
+bool track_header_deferred = false;
+bool gapless_enabled = true;      // -g 0 关闭无缝播放
+src_quality_t src_quality = SRC_MEDIUM; // -S off 时采样率不同仍重新配置ALSA
+bool dither_enabled = true; // 量化到设备格式时加 TPDF 抖动 (-D 0 关闭)
+int stats_interval_seconds = 0; // -T N 每 N 秒输出一行统计
+bool fast_start = false;        // -F 1 快速启动
+const char *render_path = NULL;  // -O 离线渲染的输出文件
+int ring_depth_periods = DEFAULT_RING_DEPTH_PERIODS;
+latency_profile_t latency_profile = LATENCY_NORMAL; // -L low / deep / adaptive
+int latency_level = 0;
+snd_pcm_access_t pcm_access = SND_PCM_ACCESS_RW_INTERLEAVED; // -A mmap / mmap-planar
+int output_rt_priority = DEFAULT_OUTPUT_RT_PRIORITY;
+float limiter_ceiling_db = DEFAULT_LIMITER_CEILING_DB; // -l 限幅电平 (dBFS)，off 关闭
+bool limiter_enabled = true;
+int analyzer_fps = 0;                       // -V 帧率[,快照文件]
+const char *analyzer_shm_path = NULL;
+
+// --- 播放流水线状态 ---
+// 读取/DSP线程把处理后的帧写入 playback_ring，输出线程从中取帧写入ALSA
+static audio_ring_t playback_ring;
+static pthread_t reader_thread;
+static pthread_t output_thread;
+static bool pipeline_running = false;
+static atomic_bool pipeline_stop_requested;
+static atomic_bool reader_finished;  // 读取线程已到达文件末尾(或读取出错)
+static atomic_bool output_finished;  // 输出线程已排空环形缓冲区并退出
+static atomic_bool output_failed;    // 输出线程遇到不可恢复的ALSA错误
+static snd_pcm_uframes_t pipeline_period_frames = 0;
+static bool pipeline_preloaded = false;     // 只有读取线程在运行 (快速启动预读)，输出线程还没有创建
+static unsigned int pipeline_preload_rate = 0;
+static uint64_t startup_ns = 0;             // 程序启动的时刻，首个音频的计时起点
+// ring_data: 有新帧或需要复查状态时唤醒输出线程；ring_space: 有空闲空间时唤醒读取线程；
+// control: 流水线结束、出错或越过无缝换曲边界时唤醒主线程
+static wake_event_t ring_data_event = {.fd = -1};
+static wake_event_t ring_space_event = {.fd = -1};
+static wake_event_t control_event = {.fd = -1};
+
+// 控制面 (见 const.h): 参数快照的三个槽位、控制线程到读取线程的命令队列，
+// 以及读取线程收到切歌命令后交给主线程的目标曲目 (-1 表示没有)
+static dsp_params_exchange_t dsp_params_exchange = {.middle = 1, .back = 0, .front = 2};
+static audio_ring_t control_queue;
+static atomic_int track_request = -1;
+static int requested_track = -1;    // 控制线程最近一次请求的曲目，连续切歌时从这里往后数
+
+// 定位 (见 const.h): 读取线程换到新位置后记下新音频在环形缓冲区中的起点 (+1，0 表示没有)，
+// 输出线程交叉淡化并跳过旧音频后清零。seek_skip_frames 只由读取线程访问
+static atomic_size_t seek_flush_frame;
+static atomic_uint_least64_t seek_issued_ns;
+static size_t seek_skip_frames = 0;
+static audio_block_t seek_fade_old, seek_fade_new; // 输出线程的交叉淡化缓冲区
+
+// 无缝播放: 主线程打开 gapless_next 后置位 gapless_next_ready，读取线程换源后
+// 记下换源时环形缓冲区的写入位置，输出越过该位置时主线程才更新 current_track
+static track_t gapless_next;
+static atomic_bool gapless_next_ready;
+static atomic_bool gapless_switch_pending;
+static atomic_size_t gapless_boundary_frame;
+
+// 控制循环(主线程)在需要预先打开下一首时的检查间隔；其余时间只由按键和流水线事件唤醒
+#define CONTROL_TICK_MS 250
 
 // FIR滤波器系数 - 重新设计的滤波器，具有更明显的频率响应
 // Bass Boost: 低通滤波器 + 增益，强调 < 250Hz
-static double bass_boost_coeffs[FIR_TAP_NUM] = {
+static const double bass_boost_coeffs[FIR_TAP_NUM] = {
     -0.0020, -0.0025, -0.0030, -0.0025, 0.0000, 0.0050, 0.0120, 0.0200,
      0.0280,  0.0350,  0.0400,  0.0420, 0.0400, 0.0350, 0.0280, 0.0200,
      0.0200,  0.0280,  0.0350,  0.0400, 0.0420, 0.0400, 0.0350, 0.0280,
@@ -54,7 +139,7 @@ static double bass_boost_coeffs[FIR_TAP_NUM] = {
 };
 
 // Treble Boost: 高通滤波器 + 增益，强调 > 4kHz
-static double treble_boost_coeffs[FIR_TAP_NUM] = {
+static const double treble_boost_coeffs[FIR_TAP_NUM] = {
      0.0100, -0.0150,  0.0200, -0.0250,  0.0300, -0.0350,  0.0400, -0.0450,
      0.0500, -0.0550,  0.0600, -0.0650,  0.0700, -0.0750,  0.0800,  0.4000,
      0.4000,  0.0800, -0.0750,  0.0700, -0.0650,  0.0600, -0.0550,  0.0500,
@@ -62,29 +147,44 @@ static double treble_boost_coeffs[FIR_TAP_NUM] = {
 };
 
 // Vocal Enhance: 带通滤波器，强调 300Hz-3kHz (人声频率范围)
-static double vocal_enhance_coeffs[FIR_TAP_NUM] = {
+static const double vocal_enhance_coeffs[FIR_TAP_NUM] = {
     -0.0100, -0.0080, -0.0060, -0.0040, -0.0020,  0.0000,  0.0020,  0.0040,
      0.0060,  0.0080,  0.0100,  0.0150,  0.0250,  0.0400,  0.0600,  0.0800,
      0.0800,  0.0600,  0.0400,  0.0250,  0.0150,  0.0100,  0.0080,  0.0060,
      0.0040,  0.0020,  0.0000, -0.0020, -0.0040, -0.0060, -0.0080, -0.0100
 };
 
-static short delay_buffer_left[FIR_TAP_NUM] = {0};
-static short delay_buffer_right[FIR_TAP_NUM] = {0};
-static int delay_index_left = 0;
-static int delay_index_right = 0;
+// FIR 延迟线与当前选用的内核 (见 fir_select_kernel)
+static fir_state_t fir_state;
+static float fir_effective_coeffs[4][FIR_TAP_NUM];
+static bool fir_coeffs_ready = false;
+fir_kernel_fn fir_kernel = fir_kernel_scalar;
+const char *fir_kernel_name = "scalar";
+const char *requested_fir_kernel = "auto";
+
+// 分区卷积: 启动时加载的冲激响应 (-I) 和按当前声道数创建的状态
+const char *impulse_response_path = NULL;
+static conv_ir_t *conv_ir = NULL;
+static convolver_t *conv_state = NULL;
+static bool conv_active = false;
+
+// 双二阶参数均衡器的级联状态 (见 apply_biquad_filter)
+static biquad_eq_t biquad_eq;
+static bool biquad_active = false;
+
+// 采样率转换: 曲目采样率与设备不同时在读取线程中创建 (见 apply_sample_rate_conversion)
+static resampler_t *src_state = NULL;
+// 播放器的处理链 (时间拉伸 -> 均衡器 -> 采样率转换 -> 限幅器)，节点在第一次准备处理链时插入
+static dsp_graph_t player_graph = {.lock = PTHREAD_MUTEX_INITIALIZER, .input_per_output = 1.0};
 
 // 时间拉伸插值的前一个样本存储
 static short interpolation_prev_samples[2] = {0, 0};
 
-// Phase Vocoder 相关结构和函数
-typedef struct {
-    float real;
-    float imag;
-} Complex;
-
-// 简化的FFT实现 (Cooley-Tukey algorithm)
-void fft(Complex* x, int N) {
+// Phase Vocoder 相关函数 (Complex / fft_plan_t 定义见 const.h)
+// 递归FFT (Cooley-Tukey algorithm)
+// 每一层都会 malloc/free 并重新计算 cosf/sinf，不适合实时处理；
+// 仅作为参考实现保留，供 benchmark.c 对比精度和速度，播放路径使用 fft_plan_t
+void fft_reference(Complex* x, int N) {
     if (N <= 1) return;
     
     // 分治递归
@@ -96,8 +196,8 @@ void fft(Complex* x, int N) {
         odd[i] = x[2*i + 1];
     }
     
-    fft(even, N/2);
-    fft(odd, N/2);
+    fft_reference(even, N/2);
+    fft_reference(odd, N/2);
     
     for (int k = 0; k < N/2; k++) {
         float angle = -2.0f * M_PI * k / N;
@@ -114,14 +214,14 @@ void fft(Complex* x, int N) {
     free(odd);
 }
 
-// 逆FFT
-void ifft(Complex* x, int N) {
+// 逆FFT (参考实现)
+void ifft_reference(Complex* x, int N) {
     // 共轭
     for (int i = 0; i < N; i++) {
         x[i].imag = -x[i].imag;
     }
     
-    fft(x, N);
+    fft_reference(x, N);
     
     // 共轭并缩放
     for (int i = 0; i < N; i++) {
@@ -130,6 +230,187 @@ void ifft(Complex* x, int N) {
     }
 }
 
+// --- FFT 计划 (迭代、原地、预计算旋转因子，执行时不分配内存) ---
+static int fft_log2(int n) {
+    int log2n = 0;
+    while ((1 << log2n) < n) {
+        log2n++;
+    }
+    return (1 << log2n) == n ? log2n : -1;
+}
+
+static int *fft_build_bitrev(int n) {
+    int log2n = fft_log2(n);
+    int *table = (int *)malloc(n * sizeof(int));
+    if (table == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < n; i++) {
+        int r = 0;
+        for (int b = 0; b < log2n; b++) {
+            if (i & (1 << b)) {
+                r |= 1 << (log2n - 1 - b);
+            }
+        }
+        table[i] = r;
+    }
+    return table;
+}
+
+fft_plan_t *fft_plan_create(int n) {
+    if (n < 4 || fft_log2(n) < 0) {
+        return NULL;
+    }
+
+    fft_plan_t *plan = (fft_plan_t *)calloc(1, sizeof(fft_plan_t));
+    if (plan == NULL) {
+        return NULL;
+    }
+    plan->size = n;
+    plan->log2_size = fft_log2(n);
+    plan->bitrev = fft_build_bitrev(n);
+    plan->bitrev_half = fft_build_bitrev(n / 2);
+    plan->twiddles = (Complex *)malloc((n / 2) * sizeof(Complex));
+    plan->scratch = (Complex *)malloc((n / 2 + 1) * sizeof(Complex));
+    if (plan->bitrev == NULL || plan->bitrev_half == NULL || plan->twiddles == NULL || plan->scratch == NULL) {
+        fft_plan_destroy(plan);
+        return NULL;
+    }
+
+    // 旋转因子 W_N^k = e^{-2πik/N}，用 double 计算以减少累积误差
+    for (int k = 0; k < n / 2; k++) {
+        double angle = -2.0 * M_PI * k / n;
+        plan->twiddles[k].real = (float)cos(angle);
+        plan->twiddles[k].imag = (float)sin(angle);
+    }
+    return plan;
+}
+
+void fft_plan_destroy(fft_plan_t *plan) {
+    if (plan == NULL) {
+        return;
+    }
+    free(plan->bitrev);
+    free(plan->bitrev_half);
+    free(plan->twiddles);
+    free(plan->scratch);
+    free(plan);
+}
+
+// n 点原地正变换 (n 为 plan->size 或 plan->size/2)
+// 前两级合并为一个无乘法的 radix-4 蝶形，其余各级为 radix-2
+static void fft_transform(const fft_plan_t *plan, Complex *x, int n, const int *bitrev) {
+    for (int i = 0; i < n; i++) {
+        int j = bitrev[i];
+        if (j > i) {
+            Complex tmp = x[i];
+            x[i] = x[j];
+            x[j] = tmp;
+        }
+    }
+
+    // 长度为4的块: 旋转因子只有 1 和 -i
+    for (int i = 0; i < n; i += 4) {
+        Complex a = x[i], b = x[i + 1], c = x[i + 2], d = x[i + 3];
+        Complex s0 = {a.real + b.real, a.imag + b.imag};
+        Complex s1 = {a.real - b.real, a.imag - b.imag};
+        Complex s2 = {c.real + d.real, c.imag + d.imag};
+        Complex s3 = {c.real - d.real, c.imag - d.imag};
+        x[i].real = s0.real + s2.real;       x[i].imag = s0.imag + s2.imag;
+        x[i + 2].real = s0.real - s2.real;   x[i + 2].imag = s0.imag - s2.imag;
+        // s3 * (-i)
+        x[i + 1].real = s1.real + s3.imag;   x[i + 1].imag = s1.imag - s3.real;
+        x[i + 3].real = s1.real - s3.imag;   x[i + 3].imag = s1.imag + s3.real;
+    }
+
+    for (int len = 8; len <= n; len <<= 1) {
+        int half = len >> 1;
+        int step = plan->size / len;
+        for (int i = 0; i < n; i += len) {
+            Complex *lo = x + i;
+            Complex *hi = x + i + half;
+            for (int j = 0; j < half; j++) {
+                Complex w = plan->twiddles[j * step];
+                float tr = w.real * hi[j].real - w.imag * hi[j].imag;
+                float ti = w.real * hi[j].imag + w.imag * hi[j].real;
+                hi[j].real = lo[j].real - tr;
+                hi[j].imag = lo[j].imag - ti;
+                lo[j].real += tr;
+                lo[j].imag += ti;
+            }
+        }
+    }
+}
+
+void fft_forward(const fft_plan_t *plan, Complex *x) {
+    fft_transform(plan, x, plan->size, plan->bitrev);
+}
+
+// 逆变换: conj(FFT(conj(x))) / N
+void fft_inverse(const fft_plan_t *plan, Complex *x) {
+    int n = plan->size;
+    for (int i = 0; i < n; i++) {
+        x[i].imag = -x[i].imag;
+    }
+    fft_transform(plan, x, n, plan->bitrev);
+    float scale = 1.0f / n;
+    for (int i = 0; i < n; i++) {
+        x[i].real *= scale;
+        x[i].imag = -x[i].imag * scale;
+    }
+}
+
+// 实数FFT: N 个实数输入 -> N/2+1 个频点
+// 偶/奇样本打包成 N/2 点复数序列做一次复数FFT，再用 W_N^k 拆分
+void fft_real_forward(fft_plan_t *plan, const float *input, Complex *output) {
+    int half = plan->size / 2;
+    Complex *z = plan->scratch;
+    for (int k = 0; k < half; k++) {
+        z[k].real = input[2 * k];
+        z[k].imag = input[2 * k + 1];
+    }
+    fft_transform(plan, z, half, plan->bitrev_half);
+
+    output[0].real = z[0].real + z[0].imag;
+    output[0].imag = 0.0f;
+    output[half].real = z[0].real - z[0].imag;
+    output[half].imag = 0.0f;
+    for (int k = 1; k < half; k++) {
+        Complex a = z[k];
+        Complex b = {z[half - k].real, -z[half - k].imag}; // conj(Z[N/2-k])
+        Complex even = {0.5f * (a.real + b.real), 0.5f * (a.imag + b.imag)};
+        // (a - b) / 2i
+        Complex odd = {0.5f * (a.imag - b.imag), -0.5f * (a.real - b.real)};
+        Complex w = plan->twiddles[k];
+        output[k].real = even.real + w.real * odd.real - w.imag * odd.imag;
+        output[k].imag = even.imag + w.real * odd.imag + w.imag * odd.real;
+    }
+}
+
+// 实数逆FFT: N/2+1 个频点 -> N 个实数输出 (已按 1/N 归一化)
+void fft_real_inverse(fft_plan_t *plan, const Complex *input, float *output) {
+    int half = plan->size / 2;
+    Complex *z = plan->scratch;
+    for (int k = 0; k < half; k++) {
+        Complex a = input[k];
+        Complex b = {input[half - k].real, -input[half - k].imag}; // conj(X[N/2-k])
+        Complex even = {0.5f * (a.real + b.real), 0.5f * (a.imag + b.imag)};
+        Complex diff = {0.5f * (a.real - b.real), 0.5f * (a.imag - b.imag)};
+        Complex w = plan->twiddles[k];
+        // odd = diff * conj(W_N^k)
+        Complex odd = {diff.real * w.real + diff.imag * w.imag, diff.imag * w.real - diff.real * w.imag};
+        // Z = even + i * odd，直接取共轭以便复用正变换
+        z[k].real = even.real - odd.imag;
+        z[k].imag = -(even.imag + odd.real);
+    }
+    fft_transform(plan, z, half, plan->bitrev_half);
+    float scale = 1.0f / half;
+    for (int k = 0; k < half; k++) {
+        output[2 * k] = z[k].real * scale;
+        output[2 * k + 1] = -z[k].imag * scale;
+    }
+}
+
 // 计算复数的幅度
 float complex_magnitude(Complex c) {
     return sqrtf(c.real * c.real + c.imag * c.imag);
@@ -148,14 +429,509 @@ Complex complex_from_polar(float magnitude, float phase) {
     return result;
 }
 
-// 时间拉伸缓冲区
-static short stretch_buffer[STRETCH_FRAME_SIZE * 2] = {0};
-static short overlap_buffer[STRETCH_OVERLAP_SIZE] = {0};
-static int stretch_buffer_pos = 0;
+// --- 相位声码器时间拉伸 (流式，带 identity phase locking) ---
+// 分析跳步 Ha = speed * Hs，合成跳步 Hs 固定；峰值频点按真实频率推进相位，
+// 其余频点锁定到所属峰值的相位差，避免普通相位声码器的"相位散开"(phasiness)
+phase_vocoder_t *phase_vocoder_create(int channels, unsigned int sample_rate, int max_block_frames) {
+    if (channels < 1 || channels > PV_MAX_CHANNELS) {
+        return NULL;
+    }
+
+    phase_vocoder_t *pv = (phase_vocoder_t *)calloc(1, sizeof(phase_vocoder_t));
+    if (pv == NULL) {
+        return NULL;
+    }
+    pv->fft_size = sample_rate > 48000 ? PV_FFT_SIZE_HIGH_RATE : PV_FFT_SIZE;
+    pv->hop = pv->fft_size / PV_HOP_DIVISOR;
+    pv->bins = pv->fft_size / 2 + 1;
+    pv->channels = channels;
+    pv->sample_rate = sample_rate;
+    // FIFO 在下一帧开始前还保留着上一帧的分析跳步 (最快 MAX_SPEED_FACTOR * hop)
+    pv->input_capacity = pv->fft_size + (int)(MAX_SPEED_FACTOR * pv->hop) + 1 + max_block_frames;
+    pv->ready_capacity = pv->fft_size + 4 * max_block_frames;
+    pv->block_capacity = max_block_frames;
+    pv->plan = fft_plan_create(pv->fft_size);
+    pv->window = (float *)malloc(pv->fft_size * sizeof(float));
+    pv->frame = (float *)malloc(pv->fft_size * sizeof(float));
+    pv->spectrum = (Complex *)malloc(pv->bins * sizeof(Complex));
+    pv->magnitude = (float *)malloc(pv->bins * sizeof(float));
+    pv->phase = (float *)malloc(pv->bins * sizeof(float));
+    pv->peaks = (int *)malloc(pv->bins * sizeof(int));
+    if (!pv->plan || !pv->window || !pv->frame || !pv->spectrum || !pv->magnitude || !pv->phase || !pv->peaks) {
+        phase_vocoder_destroy(pv);
+        return NULL;
+    }
+
+    for (int ch = 0; ch < channels; ch++) {
+        pv_channel_t *c = &pv->channel[ch];
+        c->input = (float *)malloc(pv->input_capacity * sizeof(float));
+        c->accum = (float *)malloc(pv->fft_size * sizeof(float));
+        c->ready = (float *)malloc(pv->ready_capacity * sizeof(float));
+        c->last_phase = (float *)malloc(pv->bins * sizeof(float));
+        c->synth_phase = (float *)malloc(pv->bins * sizeof(float));
+        if (!c->input || !c->accum || !c->ready || !c->last_phase || !c->synth_phase) {
+            phase_vocoder_destroy(pv);
+            return NULL;
+        }
+    }
+
+    // 周期 Hann 窗；分析与合成都加窗，所以按 sum(w^2) 归一化
+    for (int i = 0; i < pv->fft_size; i++) {
+        pv->window[i] = 0.5f * (1.0f - cosf(2.0f * M_PI * i / pv->fft_size));
+    }
+    float overlap_sum = 0.0f;
+    for (int i = 0; i < pv->fft_size; i += pv->hop) {
+        overlap_sum += pv->window[i] * pv->window[i];
+    }
+    pv->norm = overlap_sum > 0.0f ? 1.0f / overlap_sum : 1.0f;
+
+    phase_vocoder_reset(pv);
+    return pv;
+}
+
+void phase_vocoder_destroy(phase_vocoder_t *pv) {
+    if (pv == NULL) {
+        return;
+    }
+    for (int ch = 0; ch < PV_MAX_CHANNELS; ch++) {
+        pv_channel_t *c = &pv->channel[ch];
+        free(c->input);
+        free(c->accum);
+        free(c->ready);
+        free(c->last_phase);
+        free(c->synth_phase);
+    }
+    fft_plan_destroy(pv->plan);
+    free(pv->window);
+    free(pv->frame);
+    free(pv->spectrum);
+    free(pv->magnitude);
+    free(pv->phase);
+    free(pv->peaks);
+    free(pv);
+}
+
+void phase_vocoder_reset(phase_vocoder_t *pv) {
+    for (int ch = 0; ch < pv->channels; ch++) {
+        pv_channel_t *c = &pv->channel[ch];
+        c->input_fill = 0;
+        c->input_pos = 0.0;
+        c->ready_fill = 0;
+        c->primed = false;
+        memset(c->accum, 0, pv->fft_size * sizeof(float));
+    }
+}
+
+static float pv_wrap_phase(float phase) {
+    return phase - 2.0f * (float)M_PI * rintf(phase / (2.0f * (float)M_PI));
+}
+
+// 对一个声道处理一帧: 分析 -> 相位推进/锁定 -> 合成 -> 重叠相加，输出 Hs 个样本
+static void pv_process_frame(phase_vocoder_t *pv, pv_channel_t *c, int start, int analysis_hop) {
+    int n = pv->fft_size;
+    int bins = pv->bins;
+    const float *window = pv->window;
+
+    for (int i = 0; i < n; i++) {
+        pv->frame[i] = c->input[start + i] * window[i];
+    }
+    fft_real_forward(pv->plan, pv->frame, pv->spectrum);
+    for (int k = 0; k < bins; k++) {
+        pv->magnitude[k] = complex_magnitude(pv->spectrum[k]);
+        pv->phase[k] = complex_phase(pv->spectrum[k]);
+    }
+
+    if (!c->primed || analysis_hop <= 0) {
+        memcpy(c->synth_phase, pv->phase, bins * sizeof(float));
+        c->primed = true;
+    } else {
+        // 找局部峰值 (比左右各两个频点都大)
+        int peak_count = 0;
+        for (int k = 2; k < bins - 2; k++) {
+            float m = pv->magnitude[k];
+            if (m > pv->magnitude[k - 1] && m > pv->magnitude[k - 2] &&
+                m >= pv->magnitude[k + 1] && m >= pv->magnitude[k + 2]) {
+                pv->peaks[peak_count++] = k;
+            }
+        }
+
+        float hop_ratio = (float)pv->hop / analysis_hop;
+        if (peak_count == 0) {
+            // 没有峰值 (静音等)，退化为普通相位声码器
+            for (int k = 0; k < bins; k++) {
+                float omega = 2.0f * (float)M_PI * k / n;
+                float delta = pv_wrap_phase(pv->phase[k] - c->last_phase[k] - omega * analysis_hop);
+                c->synth_phase[k] += (omega * analysis_hop + delta) * hop_ratio;
+            }
+        } else {
+            int region_start = 0;
+            for (int p = 0; p < peak_count; p++) {
+                int peak = pv->peaks[p];
+                int region_end = (p + 1 < peak_count) ? (peak + pv->peaks[p + 1]) / 2 : bins - 1;
+
+                float omega = 2.0f * (float)M_PI * peak / n;
+                float delta = pv_wrap_phase(pv->phase[peak] - c->last_phase[peak] - omega * analysis_hop);
+                float peak_phase = c->synth_phase[peak] + (omega * analysis_hop + delta) * hop_ratio;
+
+                // 区域内的频点保持与峰值相同的相位差
+                for (int k = region_start; k <= region_end; k++) {
+                    if (k != peak) {
+                        c->synth_phase[k] = peak_phase + pv->phase[k] - pv->phase[peak];
+                    }
+                }
+                c->synth_phase[peak] = peak_phase;
+                region_start = region_end + 1;
+            }
+        }
+        for (int k = 0; k < bins; k++) {
+            c->synth_phase[k] = pv_wrap_phase(c->synth_phase[k]);
+        }
+    }
+    memcpy(c->last_phase, pv->phase, bins * sizeof(float));
+
+    for (int k = 0; k < bins; k++) {
+        pv->spectrum[k] = complex_from_polar(pv->magnitude[k], c->synth_phase[k]);
+    }
+    fft_real_inverse(pv->plan, pv->spectrum, pv->frame);
+
+    float norm = pv->norm;
+    for (int i = 0; i < n; i++) {
+        c->accum[i] += pv->frame[i] * window[i] * norm;
+    }
+
+    // 前 Hs 个样本已完成重叠相加
+    memcpy(c->ready + c->ready_fill, c->accum, pv->hop * sizeof(float));
+    c->ready_fill += pv->hop;
+    memmove(c->accum, c->accum + pv->hop, (n - pv->hop) * sizeof(float));
+    memset(c->accum + n - pv->hop, 0, pv->hop * sizeof(float));
+}
+
+// 在所有声道上同步处理所有可用的分析帧
+static void pv_run_frames(phase_vocoder_t *pv, float speed_factor) {
+    double analysis_hop = speed_factor * pv->hop;
+    pv_channel_t *c0 = &pv->channel[0];
+
+    while (1) {
+        int start = (int)c0->input_pos;
+        if (start + pv->fft_size > c0->input_fill || c0->ready_fill + pv->hop > pv->ready_capacity) {
+            break;
+        }
+        // 把FIFO前移到帧起点，start 就是这一帧实际的分析跳步
+        for (int ch = 0; ch < pv->channels; ch++) {
+            pv_channel_t *c = &pv->channel[ch];
+            pv_process_frame(pv, c, start, start);
+            memmove(c->input, c->input + start, (c->input_fill - start) * sizeof(float));
+            c->input_fill -= start;
+            c->input_pos = c->input_pos - start + analysis_hop;
+        }
+    }
+}
+
+// 平面 float 输入/输出；返回写出的帧数，未能输出的样本保留到下一次调用
+int phase_vocoder_process(phase_vocoder_t *pv, float *const *input, int input_frames,
+                          float *const *output, int max_output_frames, float speed_factor) {
+    int channels = pv->channels;
+    int consumed = 0;
+
+    while (consumed < input_frames) {
+        int space = pv->input_capacity - pv->channel[0].input_fill;
+        int chunk = input_frames - consumed;
+        if (chunk > space) {
+            chunk = space;
+        }
+        if (chunk == 0) {
+            // 输出队列已满且输入FIFO也满: 丢弃剩余输入，避免阻塞读取线程
+            log_program_info("WARNING", "Phase vocoder queue full, dropping input");
+            break;
+        }
+        for (int ch = 0; ch < channels; ch++) {
+            pv_channel_t *c = &pv->channel[ch];
+            memcpy(c->input + c->input_fill, input[ch] + consumed, chunk * sizeof(float));
+            c->input_fill += chunk;
+        }
+        consumed += chunk;
+        pv_run_frames(pv, speed_factor);
+    }
+
+    int frames_out = pv->channel[0].ready_fill;
+    if (frames_out > max_output_frames) {
+        frames_out = max_output_frames;
+    }
+    for (int ch = 0; ch < channels; ch++) {
+        pv_channel_t *c = &pv->channel[ch];
+        memcpy(output[ch], c->ready, frames_out * sizeof(float));
+        memmove(c->ready, c->ready + frames_out, (c->ready_fill - frames_out) * sizeof(float));
+        c->ready_fill -= frames_out;
+    }
+    return frames_out;
+}
+
+// 点积，4路累加器便于编译器向量化 (WSOLA 相关搜索的热点)
+float dsp_dot_product(const float *a, const float *b, int n) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++) {
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+// --- WSOLA 时间拉伸 (流式，支持 MIN_SPEED_FACTOR..MAX_SPEED_FACTOR 任意速度) ---
+// 第 k 个输出帧放在 k*Hs，输入名义位置为 k*Ha (Ha = speed*Hs)；在 ±Δ 范围内
+// 寻找与上一帧"自然延续"最相似的段落，保证重叠区波形对齐
+wsola_t *wsola_create(int channels, unsigned int sample_rate, int max_block_frames) {
+    if (channels < 1 || channels > WSOLA_MAX_CHANNELS) {
+        return NULL;
+    }
+
+    wsola_t *w = (wsola_t *)calloc(1, sizeof(wsola_t));
+    if (w == NULL) {
+        return NULL;
+    }
+    int frame_size = (int)(sample_rate * WSOLA_FRAME_MS / 1000) & ~1;
+    if (frame_size < 64) {
+        frame_size = 64;
+    }
+    w->frame_size = frame_size;
+    w->hop = frame_size / 2;
+    w->search = w->hop / 2;
+    w->channels = channels;
+    w->sample_rate = sample_rate;
+    // 最坏情况 (4x) 下一帧需要 Ha + 2Δ + N 个样本
+    w->input_capacity = (int)(MAX_SPEED_FACTOR * w->hop) + 2 * w->search + 2 * frame_size + max_block_frames;
+    w->ready_capacity = frame_size + 4 * max_block_frames;
+    w->block_capacity = max_block_frames;
+    w->window = (float *)malloc(frame_size * sizeof(float));
+    w->mix = (float *)malloc(w->input_capacity * sizeof(float));
+    w->energy_prefix = (double *)malloc((w->input_capacity + 1) * sizeof(double));
+    if (!w->window || !w->mix || !w->energy_prefix) {
+        wsola_destroy(w);
+        return NULL;
+    }
+    for (int ch = 0; ch < channels; ch++) {
+        wsola_channel_t *c = &w->channel[ch];
+        c->input = (float *)malloc(w->input_capacity * sizeof(float));
+        c->overlap = (float *)malloc(w->hop * sizeof(float));
+        c->ready = (float *)malloc(w->ready_capacity * sizeof(float));
+        if (!c->input || !c->overlap || !c->ready) {
+            wsola_destroy(w);
+            return NULL;
+        }
+    }
+
+    // 周期 Hann 窗，50% 重叠时 w[i] + w[i+N/2] = 1
+    for (int i = 0; i < frame_size; i++) {
+        w->window[i] = 0.5f * (1.0f - cosf(2.0f * M_PI * i / frame_size));
+    }
+
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg), "WSOLA initialized: N=%d, Hs=%d, search=%d, input capacity=%d",
+             w->frame_size, w->hop, w->search, w->input_capacity);
+    log_program_info("INFO", info_msg);
+
+    wsola_reset(w);
+    return w;
+}
+
+void wsola_destroy(wsola_t *w) {
+    if (w == NULL) {
+        return;
+    }
+    for (int ch = 0; ch < WSOLA_MAX_CHANNELS; ch++) {
+        free(w->channel[ch].input);
+        free(w->channel[ch].overlap);
+        free(w->channel[ch].ready);
+    }
+    free(w->window);
+    free(w->mix);
+    free(w->energy_prefix);
+    free(w);
+}
+
+void wsola_reset(wsola_t *w) {
+    w->input_fill = 0;
+    w->ready_fill = 0;
+    w->nominal_pos = 0.0;
+    w->prev_pos = 0;
+    w->primed = false;
+    for (int ch = 0; ch < w->channels; ch++) {
+        memset(w->channel[ch].overlap, 0, w->hop * sizeof(float));
+    }
+}
+
+// 在 [lo, hi] 中寻找与模板归一化互相关最大的起点
+static int wsola_best_offset(wsola_t *w, int lo, int hi) {
+    int len = w->hop;
+    const float *mix = w->mix;
+    const float *templ = mix + w->prev_pos + w->hop;
+
+    double *prefix = w->energy_prefix;
+    prefix[lo] = 0.0;
+    for (int i = lo; i < hi + len; i++) {
+        prefix[i + 1] = prefix[i] + (double)mix[i] * mix[i];
+    }
+
+    // 能量下限只防止静音时除零 (满幅为 ±1.0，远低于任何可闻信号的窗口能量)，不代表噪声电平
+    const float energy_floor = 1e-12f;
+    int best = lo;
+    float best_score = -INFINITY;
+    for (int s = lo; s <= hi; s += WSOLA_COARSE_STEP) {
+        float energy = (float)(prefix[s + len] - prefix[s]);
+        float score = dsp_dot_product(templ, mix + s, len) / sqrtf(energy + energy_floor);
+        if (score > best_score) {
+            best_score = score;
+            best = s;
+        }
+    }
+
+    int fine_lo = best - WSOLA_COARSE_STEP + 1 < lo ? lo : best - WSOLA_COARSE_STEP + 1;
+    int fine_hi = best + WSOLA_COARSE_STEP - 1 > hi ? hi : best + WSOLA_COARSE_STEP - 1;
+    int coarse_best = best;
+    for (int s = fine_lo; s <= fine_hi; s++) {
+        if (s == coarse_best) {
+            continue;
+        }
+        float energy = (float)(prefix[s + len] - prefix[s]);
+        float score = dsp_dot_product(templ, mix + s, len) / sqrtf(energy + energy_floor);
+        if (score > best_score) {
+            best_score = score;
+            best = s;
+        }
+    }
+    return best;
+}
+
+static void wsola_run_frames(wsola_t *w, float speed_factor) {
+    int n = w->frame_size;
+    int hop = w->hop;
+    double analysis_hop = speed_factor * hop;
+
+    while (w->ready_fill + hop <= w->ready_capacity) {
+        int nominal = (int)lrint(w->nominal_pos);
+        int start;
+        if (!w->primed) {
+            if (nominal + n > w->input_fill) {
+                break;
+            }
+            start = nominal;
+        } else {
+            int lo = nominal - w->search;
+            int hi = nominal + w->search;
+            if (lo < 0) lo = 0;
+            if (hi + n > w->input_fill) {
+                break;
+            }
+            if (hi < lo) hi = lo;
+            start = wsola_best_offset(w, lo, hi);
+        }
+
+        // 前半帧与上一帧的后半部分重叠相加后输出，后半帧留作下一次的重叠
+        for (int ch = 0; ch < w->channels; ch++) {
+            wsola_channel_t *c = &w->channel[ch];
+            const float *seg = c->input + start;
+            float *dst = c->ready + w->ready_fill;
+            for (int i = 0; i < hop; i++) {
+                dst[i] = c->overlap[i] + seg[i] * w->window[i];
+                c->overlap[i] = seg[hop + i] * w->window[hop + i];
+            }
+        }
+        w->ready_fill += hop;
+        w->primed = true;
+        w->prev_pos = start;
+        w->nominal_pos += analysis_hop;
+
+        // 丢弃不再需要的输入: 保留下一帧模板和搜索窗口的起点
+        int keep_from = start + hop;
+        int next_lo = (int)lrint(w->nominal_pos) - w->search;
+        if (next_lo < keep_from) keep_from = next_lo;
+        if (keep_from > w->input_fill) keep_from = w->input_fill;
+        if (keep_from > 0) {
+            int remain = w->input_fill - keep_from;
+            for (int ch = 0; ch < w->channels; ch++) {
+                memmove(w->channel[ch].input, w->channel[ch].input + keep_from, remain * sizeof(float));
+            }
+            memmove(w->mix, w->mix + keep_from, remain * sizeof(float));
+            w->input_fill = remain;
+            w->prev_pos -= keep_from;
+            w->nominal_pos -= keep_from;
+        }
+    }
+}
+
+// 平面 float 输入/输出；剩余输入和重叠状态保留到下一次调用
+int wsola_process(wsola_t *w, float *const *input, int input_frames,
+                  float *const *output, int max_output_frames, float speed_factor) {
+    int channels = w->channels;
+    float mix_scale = 1.0f / channels;
+    int consumed = 0;
+
+    if (speed_factor < MIN_SPEED_FACTOR) speed_factor = MIN_SPEED_FACTOR;
+    if (speed_factor > MAX_SPEED_FACTOR) speed_factor = MAX_SPEED_FACTOR;
+
+    while (consumed < input_frames) {
+        int chunk = input_frames - consumed;
+        int space = w->input_capacity - w->input_fill;
+        if (chunk > space) {
+            chunk = space;
+        }
+        if (chunk == 0) {
+            log_program_info("WARNING", "WSOLA queue full, dropping input");
+            break;
+        }
+        float *mix = w->mix + w->input_fill;
+        for (int ch = 0; ch < channels; ch++) {
+            const float *src = input[ch] + consumed;
+            memcpy(w->channel[ch].input + w->input_fill, src, chunk * sizeof(float));
+            if (ch == 0) {
+                memcpy(mix, src, chunk * sizeof(float));
+            } else {
+                for (int i = 0; i < chunk; i++) {
+                    mix[i] += src[i];
+                }
+            }
+        }
+        if (channels > 1) {
+            for (int i = 0; i < chunk; i++) {
+                mix[i] *= mix_scale;
+            }
+        }
+        w->input_fill += chunk;
+        consumed += chunk;
+        wsola_run_frames(w, speed_factor);
+    }
+
+    int frames_out = w->ready_fill < max_output_frames ? w->ready_fill : max_output_frames;
+    for (int ch = 0; ch < channels; ch++) {
+        wsola_channel_t *c = &w->channel[ch];
+        memcpy(output[ch], c->ready, frames_out * sizeof(float));
+        memmove(c->ready, c->ready + frames_out, (w->ready_fill - frames_out) * sizeof(float));
+    }
+    w->ready_fill -= frames_out;
+    return frames_out;
+}
 
-// 日志文件指针
+// 日志文件指针 (异步模式下只由日志线程访问)
 static FILE* log_file = NULL;
 
+// 异步日志状态: log_start 之前 (以及 benchmark) 同步写文件，log_stop 之后丢弃
+enum { LOG_MODE_SYNC = 0, LOG_MODE_ASYNC, LOG_MODE_CLOSED };
+static atomic_int log_mode = LOG_MODE_SYNC;
+static log_cell_t log_queue[LOG_QUEUE_SIZE];
+static atomic_size_t log_enqueue_pos;
+static size_t log_dequeue_pos;          // 只由日志线程使用
+static log_repeat_slot_t log_repeat[LOG_REPEAT_SLOTS];
+static atomic_uint_least64_t log_dropped_pending;   // 尚未写进日志的丢弃条数
+static atomic_uint_least64_t log_dropped_total;
+static atomic_uint_least64_t log_suppressed_total;
+static atomic_bool log_stop_requested;
+static pthread_t log_thread;
+
 
 void set_volume_by_level_idx(int level_idx) {
     if (mixer_elem == NULL) {
@@ -291,8 +1067,26 @@ bool init_mixer() {
     return true;
 }
 
+// 没有混音器时调整处理链中的软件音量 (读取线程从下一块开始过渡)
+static void adjust_soft_volume(float delta_db) {
+    float db = control_params.volume_db + delta_db;
+    if (db > 0.0f) db = 0.0f;
+    if (db < SOFT_VOLUME_MIN_DB) db = SOFT_VOLUME_MIN_DB;
+    if (db == control_params.volume_db) {
+        printf(delta_db > 0.0f ? "Volume at maximum level.\n" : "Volume at minimum level.\n");
+        return;
+    }
+    control_params.volume_db = db;
+    dsp_params_publish();
+    log_user_operation(delta_db > 0.0f ? "VOLUME_UP" : "VOLUME_DOWN", "SUCCESS");
+    printf("软件音量: %.0f dB%s\n", db, dsp_path_supported(&wav_header) ? "" : " (当前格式不经过处理链，不生效)");
+}
+
 void increase_volume() {
-    if (!mixer_handle || !mixer_elem) return;
+    if (!mixer_handle || !mixer_elem) {
+        adjust_soft_volume(SOFT_VOLUME_STEP_DB);
+        return;
+    }
     if (current_volume_level_idx < NUM_VOLUME_LEVELS - 1) {
         set_volume_by_level_idx(current_volume_level_idx + 1);
     } else {
@@ -301,7 +1095,10 @@ void increase_volume() {
 }
 
 void decrease_volume() {
-    if (!mixer_handle || !mixer_elem) return;
+    if (!mixer_handle || !mixer_elem) {
+        adjust_soft_volume(-SOFT_VOLUME_STEP_DB);
+        return;
+    }
     if (current_volume_level_idx > 0) {
         set_volume_by_level_idx(current_volume_level_idx - 1);
     } else {
@@ -310,642 +1107,6987 @@ void decrease_volume() {
 }
 
 // 日志功能实现
-void write_log(const char* type, const char* message) {
-    if (log_file == NULL) {
-        log_file = fopen("music_app.log", "a");
-        if (log_file == NULL) {
-            return;
-        }
-    }
-    
-    time_t now;
-    struct tm *tm_info;
+static void log_format_record(const log_record_t *record) {
+    struct tm tm_info;
     char timestamp[20];
-    
-    time(&now);
-    tm_info = localtime(&now);
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
-    
-    fprintf(log_file, "[%s] %s: %s\n", timestamp, type, message);
-    fflush(log_file);
-}
 
-void log_user_operation(const char* operation, const char* result) {
-    char log_msg[LOG_BUFFER_SIZE];
-    snprintf(log_msg, sizeof(log_msg), "User operation '%s' - %s", operation, result);
-    write_log("USER", log_msg);
+    localtime_r(&record->time.tv_sec, &tm_info);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+
+    if (record->repeated > 0) {
+        fprintf(log_file, "[%s] %s: %s (%u repeats suppressed)\n", timestamp, record->type, record->message,
+                record->repeated);
+    } else {
+        fprintf(log_file, "[%s] %s: %s\n", timestamp, record->type, record->message);
+    }
 }
 
-void log_program_info(const char* info_type, const char* message) {
-    char log_msg[LOG_BUFFER_SIZE];
-    snprintf(log_msg, sizeof(log_msg), "%s: %s", info_type, message);
-    write_log("SYSTEM", log_msg);
+static void log_fill_record(log_record_t *record, const struct timespec *now, uint32_t repeated,
+                            const char *type, const char *message) {
+    record->time = *now;
+    record->repeated = repeated;
+    strncpy(record->type, type, sizeof(record->type) - 1);
+    record->type[sizeof(record->type) - 1] = '\0';
+    strncpy(record->message, message, sizeof(record->message) - 1);
+    record->message[sizeof(record->message) - 1] = '\0';
 }
 
-bool debug_msg(int result, const char *str) {
-    if (result < 0) {
-        char error_msg[LOG_BUFFER_SIZE];
-        snprintf(error_msg, sizeof(error_msg), "%s failed! result = %d, err_info = %s", str, result, snd_strerror(result));
-        log_program_info("ERROR", error_msg);
-        exit(1);
+// 多生产者入队: 抢到位置后再写槽位，最后发布序号；队列满返回 false，从不等待
+static bool log_enqueue(const struct timespec *now, uint32_t repeated, const char *type, const char *message) {
+    size_t pos = atomic_load_explicit(&log_enqueue_pos, memory_order_relaxed);
+    log_cell_t *cell;
+    for (;;) {
+        cell = &log_queue[pos & (LOG_QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&log_enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // 日志线程还没取走一圈之前的记录
+        } else {
+            pos = atomic_load_explicit(&log_enqueue_pos, memory_order_relaxed);
+        }
     }
+    log_fill_record(&cell->record, now, repeated, type, message);
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
     return true;
 }
 
-// 重置音频处理状态
-void reset_audio_processing_state() {
-    // 清空FIR滤波器延迟缓冲区
-    memset(delay_buffer_left, 0, sizeof(delay_buffer_left));
-    memset(delay_buffer_right, 0, sizeof(delay_buffer_right));
-    delay_index_left = 0;
-    delay_index_right = 0;
-    
-    // 清空插值历史
-    interpolation_prev_samples[0] = 0;
-    interpolation_prev_samples[1] = 0;
-    
-    // 清空时间拉伸缓冲区
-    memset(stretch_buffer, 0, sizeof(stretch_buffer));
-    memset(overlap_buffer, 0, sizeof(overlap_buffer));
-    
-    // 重置时间拉伸算法中的静态变量
-    reset_time_stretch_static_vars();
+// 日志线程: 写出队列中所有已发布的记录，整批只 fflush 一次
+static void log_drain() {
+    int written = 0;
+    for (;;) {
+        log_cell_t *cell = &log_queue[log_dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+        if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != log_dequeue_pos + 1) {
+            break;
+        }
+        if (log_file) {
+            log_format_record(&cell->record);
+        }
+        atomic_store_explicit(&cell->sequence, log_dequeue_pos + LOG_QUEUE_SIZE, memory_order_release);
+        log_dequeue_pos++;
+        written++;
+    }
+
+    uint64_t dropped = atomic_exchange_explicit(&log_dropped_pending, 0, memory_order_relaxed);
+    if (dropped > 0 && log_file) {
+        log_record_t notice;
+        char message[64];
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        snprintf(message, sizeof(message), "LOG: %llu messages dropped (queue full)", (unsigned long long)dropped);
+        log_fill_record(&notice, &now, 0, "SYSTEM", message);
+        log_format_record(&notice);
+        written++;
+    }
+    if (written > 0 && log_file) {
+        fflush(log_file);
+    }
 }
 
-bool open_music_file(const char *path_name) {
-    if (fp != NULL) {
-        fclose(fp);
+static void *log_thread_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        // 先读停止标志再清空队列，保证 log_stop 之前入队的记录都会写出
+        bool stopping = atomic_load_explicit(&log_stop_requested, memory_order_acquire);
+        log_drain();
+        if (stopping) {
+            break;
+        }
+        usleep(LOG_FLUSH_INTERVAL_MS * 1000);
     }
-    
-    fp = fopen(path_name, "rb");
-    if (fp == NULL) {
+    return NULL;
+}
+
+// 限流: 同一 type + message 在窗口内再次出现时只计数；返回 true 表示本条应省略，
+// 否则 *repeated 是上一窗口里被省略的条数。散列冲突或并发时最多多记/少记一条，不影响正确性
+static bool log_rate_limited(const char *type, const char *message, uint64_t now_ns, uint32_t *repeated) {
+    uint64_t hash = 1469598103934665603ull;
+    for (const char *p = type; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ull;
+    }
+    hash = (hash ^ 0xff) * 1099511628211ull;
+    for (const char *p = message; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ull;
+    }
+
+    log_repeat_slot_t *slot = &log_repeat[hash % LOG_REPEAT_SLOTS];
+    if (atomic_load_explicit(&slot->hash, memory_order_relaxed) == hash &&
+        now_ns - atomic_load_explicit(&slot->last_ns, memory_order_relaxed) < LOG_REPEAT_WINDOW_MS * 1000000ull) {
+        atomic_fetch_add_explicit(&slot->suppressed, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&log_suppressed_total, 1, memory_order_relaxed);
+        return true;
+    }
+    uint64_t previous = atomic_exchange_explicit(&slot->hash, hash, memory_order_relaxed);
+    atomic_store_explicit(&slot->last_ns, now_ns, memory_order_relaxed);
+    uint32_t missed = atomic_exchange_explicit(&slot->suppressed, 0, memory_order_relaxed);
+    *repeated = previous == hash ? missed : 0;
+    return false;
+}
+
+void write_log(const char* type, const char* message) {
+    int mode = atomic_load_explicit(&log_mode, memory_order_acquire);
+    if (mode == LOG_MODE_CLOSED) {
+        return;
+    }
+
+    struct timespec now;
+    uint32_t repeated = 0;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (log_rate_limited(type, message, monotonic_ns(), &repeated)) {
+        return;
+    }
+
+    if (mode == LOG_MODE_ASYNC) {
+        if (!log_enqueue(&now, repeated, type, message)) {
+            atomic_fetch_add_explicit(&log_dropped_pending, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&log_dropped_total, 1, memory_order_relaxed);
+        }
+        return;
+    }
+
+    // 日志线程启动之前: 同步写
+    if (log_file == NULL) {
+        log_file = fopen("music_app.log", "a");
+        if (log_file == NULL) {
+            return;
+        }
+    }
+    log_record_t record;
+    log_fill_record(&record, &now, repeated, type, message);
+    log_format_record(&record);
+    fflush(log_file);
+}
+
+// 启动日志线程，之后 write_log 只入队；exit() 时经 atexit 自动 log_stop，不丢尾部记录
+void log_start() {
+    if (atomic_load(&log_mode) != LOG_MODE_SYNC) {
+        return;
+    }
+    if (log_file == NULL) {
+        log_file = fopen("music_app.log", "a");
+        if (log_file == NULL) {
+            return;
+        }
+    }
+    for (size_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+        atomic_init(&log_queue[i].sequence, i);
+    }
+    atomic_store(&log_enqueue_pos, 0);
+    log_dequeue_pos = 0;
+    atomic_store(&log_stop_requested, false);
+    if (pthread_create(&log_thread, NULL, log_thread_main, NULL) != 0) {
+        log_program_info("LOG", "Failed to start logger thread, logging synchronously");
+        return;
+    }
+    atomic_store_explicit(&log_mode, LOG_MODE_ASYNC, memory_order_release);
+    atexit(log_stop);
+}
+
+void log_stop() {
+    int mode = atomic_exchange(&log_mode, LOG_MODE_CLOSED);
+    if (mode == LOG_MODE_CLOSED) {
+        return;
+    }
+    if (mode == LOG_MODE_ASYNC) {
+        atomic_store_explicit(&log_stop_requested, true, memory_order_release);
+        pthread_join(log_thread, NULL);
+    }
+    if (log_file) {
+        fclose(log_file);
+        log_file = NULL;
+    }
+}
+
+uint64_t log_dropped_count() {
+    return atomic_load_explicit(&log_dropped_total, memory_order_relaxed);
+}
+
+uint64_t log_suppressed_count() {
+    return atomic_load_explicit(&log_suppressed_total, memory_order_relaxed);
+}
+
+void log_user_operation(const char* operation, const char* result) {
+    char log_msg[LOG_BUFFER_SIZE];
+    snprintf(log_msg, sizeof(log_msg), "User operation '%s' - %s", operation, result);
+    write_log("USER", log_msg);
+}
+
+void log_program_info(const char* info_type, const char* message) {
+    // 调用者的消息本身最长 LOG_BUFFER_SIZE，再留出类型前缀的位置
+    char log_msg[LOG_BUFFER_SIZE + 32];
+    snprintf(log_msg, sizeof(log_msg), "%s: %s", info_type, message);
+    write_log("SYSTEM", log_msg);
+}
+
+bool debug_msg(int result, const char *str) {
+    if (result < 0) {
         char error_msg[LOG_BUFFER_SIZE];
-        snprintf(error_msg, sizeof(error_msg), "Error opening WAV file: %s", path_name);
+        snprintf(error_msg, sizeof(error_msg), "%s failed! result = %d, err_info = %s", str, result, snd_strerror(result));
         log_program_info("ERROR", error_msg);
+        exit(1);
+    }
+    return true;
+}
+
+// 重置音频处理状态
+void reset_audio_processing_state() {
+    // 清空插值历史
+    interpolation_prev_samples[0] = 0;
+    interpolation_prev_samples[1] = 0;
+
+    // 处理链各节点: 时间拉伸缓冲区、均衡器延迟线、重采样器的历史和相位
+    if (player_graph.count > 0) {
+        dsp_graph_reset(&player_graph);
+    } else {
+        reset_fir_state();
+        reset_time_stretch_static_vars();
+        resampler_reset(src_state);
+    }
+}
+
+// --- 音乐数据源 (mmap / stdio 回退) ---
+bool audio_source_open(audio_source_t *src, FILE *file, long data_offset, size_t data_bytes) {
+    struct stat st;
+    memset(src, 0, sizeof(*src));
+    src->file = file;
+    src->data_bytes = data_bytes;
+
+    // 只映射普通文件；管道、字符设备等走 stdio
+    if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= data_offset) {
         return false;
     }
-    
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (map == MAP_FAILED) {
+        // 32位系统上几个小时的WAV可能超出地址空间
+        char warn_msg[LOG_BUFFER_SIZE];
+        snprintf(warn_msg, sizeof(warn_msg), "mmap failed (%s), using stdio", strerror(errno));
+        log_program_info("WARNING", warn_msg);
+        return false;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    src->map = (const unsigned char *)map;
+    src->map_size = (size_t)st.st_size;
+    src->data = src->map + data_offset;
+    // 头部声明的长度可能大于实际文件 (录音中断、流式写出的WAV)
+    if (src->data_bytes > src->map_size - (size_t)data_offset) {
+        src->data_bytes = src->map_size - (size_t)data_offset;
+    }
+    return true;
+}
+
+void audio_source_close(audio_source_t *src) {
+    if (src->decoder != NULL && src->decoder->close != NULL) {
+        src->decoder->close(src);
+    }
+    // 先停接收线程，再关闭它读取的描述符
+    if (src->stream != NULL) {
+        stream_buffer_close(src->stream);
+    }
+    if (src->map != NULL) {
+        munmap((void *)src->map, src->map_size);
+    }
+    if (src->file != NULL) {
+        fclose(src->file);
+    }
+    memset(src, 0, sizeof(*src));
+}
+
+// 从第 frame 帧起最多读 frames 帧，*out 指向数据，返回实际帧数
+size_t audio_source_read(audio_source_t *src, size_t frame, size_t frames,
+                         unsigned char *copy_buf, const unsigned char **out) {
+    return src->decoder->read_frames(src, frame, frames, copy_buf, out);
+}
+
+void audio_source_seek(audio_source_t *src, size_t frame) {
+    src->decoder->seek_frame(src, frame);
+}
+
+// WAV: 映射时 *out 直接指向映射 (零拷贝)；stdio 时读入 buf，位置由文件位置隐含
+static size_t wav_read_frames(audio_source_t *src, size_t frame, size_t frames,
+                              unsigned char *buf, const unsigned char **out) {
+    size_t offset = frame * src->frame_bytes;
+    size_t bytes = frames * src->frame_bytes;
+    if (src->stream != NULL) {
+        // 流不能定位，offset 就是已经读走的字节数
+        *out = buf;
+        if (offset >= src->data_bytes) {
+            return 0;
+        }
+        return stream_buffer_read(src->stream, buf, bytes < src->data_bytes - offset ? bytes : src->data_bytes - offset) /
+               src->frame_bytes;
+    }
+    if (src->map == NULL) {
+        *out = buf;
+        return fread(buf, 1, bytes, src->file) / src->frame_bytes;
+    }
+
+    if (offset >= src->data_bytes) {
+        *out = NULL;
+        return 0;
+    }
+    if (bytes > src->data_bytes - offset) {
+        bytes = src->data_bytes - offset;
+    }
+    *out = src->data + offset;
+    // data 块起点按规范是偶数偏移；损坏的文件里若没有对齐，复制一份避免非对齐的样本访问
+    if (((uintptr_t)*out & 1) != 0) {
+        memcpy(buf, *out, bytes);
+        *out = buf;
+    }
+    return bytes / src->frame_bytes;
+}
+
+// 映射时只需提示内核预读新位置附近的数据，下一次读取按 offset 取指针
+static void wav_seek_frame(audio_source_t *src, size_t frame) {
+    size_t offset = frame * src->frame_bytes;
+    if (src->stream != NULL) {
+        return;
+    }
+    if (src->map == NULL) {
+        fseek(src->file, data_chunk_offset + (long)offset, SEEK_SET);
+        return;
+    }
+    if (offset >= src->data_bytes) {
+        return;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = ((size_t)(src->data - src->map) + offset) / page * page;
+    size_t length = buffer_size * 4;
+    if (start + length > src->map_size) {
+        length = src->map_size - start;
+    }
+    madvise((void *)(src->map + start), length, MADV_WILLNEED);
+}
+
+void close_music_file() {
+    audio_source_close(&music_source);
+    fp = NULL;
+}
+
+// --- 播放列表 ---
+static char *playlist_pool = NULL;
+static size_t playlist_pool_used = 0, playlist_pool_capacity = 0;
+static size_t *playlist_offsets = NULL;
+static int playlist_capacity = 0;
+
+bool playlist_add(const char *path) {
+    size_t len = strlen(path) + 1;
+    if (playlist_count == playlist_capacity) {
+        int capacity = playlist_capacity ? playlist_capacity * 2 : 16;
+        size_t *offsets = (size_t *)realloc(playlist_offsets, capacity * sizeof(size_t));
+        if (offsets == NULL) {
+            return false;
+        }
+        playlist_offsets = offsets;
+        playlist_capacity = capacity;
+    }
+    if (playlist_pool_used + len > playlist_pool_capacity) {
+        size_t capacity = playlist_pool_capacity ? playlist_pool_capacity : 4096;
+        while (capacity < playlist_pool_used + len) {
+            capacity *= 2;
+        }
+        char *pool = (char *)realloc(playlist_pool, capacity);
+        if (pool == NULL) {
+            return false;
+        }
+        playlist_pool = pool;
+        playlist_pool_capacity = capacity;
+    }
+    memcpy(playlist_pool + playlist_pool_used, path, len);
+    playlist_offsets[playlist_count++] = playlist_pool_used;
+    playlist_pool_used += len;
+    return true;
+}
+
+const char *playlist_path(int index) {
+    return playlist_pool + playlist_offsets[index];
+}
+
+void playlist_free() {
+    free(playlist_pool);
+    free(playlist_offsets);
+    playlist_pool = NULL;
+    playlist_offsets = NULL;
+    playlist_pool_used = playlist_pool_capacity = 0;
+    playlist_count = playlist_capacity = 0;
+}
+
+static bool path_has_extension(const char *path, const char *ext) {
+    size_t len = strlen(path), ext_len = strlen(ext);
+    return len > ext_len && strcasecmp(path + len - ext_len, ext) == 0;
+}
+
+// 递归加入目录中的 .wav 和 .flac，scandir + alphasort 保证每次顺序相同；跳过隐藏文件
+static void playlist_scan_dir(const char *dir, int depth) {
+    struct dirent **names;
+    int n = scandir(dir, &names, NULL, alphasort);
+    if (n < 0) {
+        char warn_msg[LOG_BUFFER_SIZE];
+        snprintf(warn_msg, sizeof(warn_msg), "Cannot read directory %s: %s", dir, strerror(errno));
+        log_program_info("WARNING", warn_msg);
+        return;
+    }
+    char path[PATH_MAX];
+    for (int i = 0; i < n; i++) {
+        const char *name = names[i]->d_name;
+        struct stat st;
+        if (name[0] != '.' && snprintf(path, sizeof(path), "%s/%s", dir, name) < (int)sizeof(path) &&
+            stat(path, &st) == 0) {
+            if (S_ISDIR(st.st_mode) && depth < PLAYLIST_MAX_DEPTH) {
+                playlist_scan_dir(path, depth + 1);
+            } else if (S_ISREG(st.st_mode) && (path_has_extension(name, ".wav") || path_has_extension(name, ".flac"))) {
+                playlist_add(path);
+            }
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+// M3U: 每行一个路径，# 开头的是注释/扩展信息；相对路径相对于列表文件所在目录
+static bool playlist_load_m3u(const char *list_path) {
+    FILE *file = fopen(list_path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    const char *slash = strrchr(list_path, '/');
+    int dir_len = slash ? (int)(slash - list_path) : 0;
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    char path[PATH_MAX];
+    while (getline(&line, &line_capacity, file) != -1) {
+        char *entry = line + strspn(line, " \t");
+        entry[strcspn(entry, "\r\n")] = '\0';
+        if (entry[0] == '\0' || entry[0] == '#') {
+            continue;
+        }
+        if (entry[0] == '/' || dir_len == 0) {
+            playlist_add(entry);
+        } else if (snprintf(path, sizeof(path), "%.*s/%s", dir_len, list_path, entry) < (int)sizeof(path)) {
+            playlist_add(path);
+        }
+    }
+    free(line);
+    fclose(file);
+    return true;
+}
+
+// -m 的参数: 目录、M3U 列表或单个文件；返回是否至少加入了一首
+bool playlist_load(const char *arg) {
+    int before = playlist_count;
+    struct stat st;
+    if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode)) {
+        playlist_scan_dir(arg, 0);
+    } else if (path_has_extension(arg, ".m3u") || path_has_extension(arg, ".m3u8")) {
+        if (!playlist_load_m3u(arg)) {
+            return false;
+        }
+    } else {
+        playlist_add(arg);
+    }
+
+    if (playlist_count - before > 1) {
+        char info_msg[LOG_BUFFER_SIZE];
+        snprintf(info_msg, sizeof(info_msg), "Playlist: %d tracks from %s", playlist_count - before, arg);
+        log_program_info("INFO", info_msg);
+    }
+    return playlist_count > before;
+}
+
+// --- 曲目头部索引 ---
+// 条目数组 + 字符串池 + 开放寻址散列表 (槽里存条目下标 + 1，0 表示空)，只由主线程访问
+static track_index_entry_t *track_index_entries = NULL;
+static int track_index_count = 0, track_index_capacity = 0;
+static char *track_index_pool = NULL;
+static size_t track_index_pool_used = 0, track_index_pool_capacity = 0;
+static uint32_t *track_index_slots = NULL;
+static size_t track_index_slot_count = 0;
+static bool track_index_loaded = false, track_index_dirty = false;
+
+static uint64_t track_index_hash(const char *path, size_t len) {
+    uint64_t hash = 1469598103934665603ull;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)path[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// 返回 path 对应的槽位 (找到时槽非空)
+static size_t track_index_slot(const char *path, size_t len) {
+    size_t mask = track_index_slot_count - 1;
+    size_t slot = track_index_hash(path, len) & mask;
+    while (track_index_slots[slot] != 0) {
+        const track_index_entry_t *entry = &track_index_entries[track_index_slots[slot] - 1];
+        if (entry->path_len == len && memcmp(track_index_pool + entry->path_offset, path, len) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// 保持装载因子不超过 1/2
+static bool track_index_rehash(size_t min_entries) {
+    size_t slot_count = 64;
+    while (slot_count < min_entries * 2) {
+        slot_count <<= 1;
+    }
+    if (slot_count <= track_index_slot_count) {
+        return true;
+    }
+    uint32_t *slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+    if (slots == NULL) {
+        return false;
+    }
+    free(track_index_slots);
+    track_index_slots = slots;
+    track_index_slot_count = slot_count;
+    for (int i = 0; i < track_index_count; i++) {
+        const track_index_entry_t *entry = &track_index_entries[i];
+        track_index_slots[track_index_slot(track_index_pool + entry->path_offset, entry->path_len)] = (uint32_t)i + 1;
+    }
+    return true;
+}
+
+// 查找或新增 path 的记录，新增的记录内容清零
+static track_index_entry_t *track_index_put(const char *path, size_t len) {
+    if (!track_index_rehash((size_t)track_index_count + 1)) {
+        return NULL;
+    }
+    size_t slot = track_index_slot(path, len);
+    if (track_index_slots[slot] != 0) {
+        return &track_index_entries[track_index_slots[slot] - 1];
+    }
+    if (track_index_count == track_index_capacity) {
+        int capacity = track_index_capacity ? track_index_capacity * 2 : 64;
+        track_index_entry_t *entries = (track_index_entry_t *)realloc(track_index_entries, capacity * sizeof(*entries));
+        if (entries == NULL) {
+            return NULL;
+        }
+        track_index_entries = entries;
+        track_index_capacity = capacity;
+    }
+    if (track_index_pool_used + len > track_index_pool_capacity) {
+        size_t capacity = track_index_pool_capacity ? track_index_pool_capacity : 4096;
+        while (capacity < track_index_pool_used + len) {
+            capacity *= 2;
+        }
+        char *pool = (char *)realloc(track_index_pool, capacity);
+        if (pool == NULL) {
+            return NULL;
+        }
+        track_index_pool = pool;
+        track_index_pool_capacity = capacity;
+    }
+    memcpy(track_index_pool + track_index_pool_used, path, len);
+    track_index_entry_t *entry = &track_index_entries[track_index_count];
+    memset(entry, 0, sizeof(*entry));
+    entry->path_offset = (uint32_t)track_index_pool_used;
+    entry->path_len = (uint32_t)len;
+    track_index_pool_used += len;
+    track_index_slots[slot] = (uint32_t)++track_index_count;
+    return entry;
+}
+
+static uint64_t stat_mtime_ns(const struct stat *st) {
+    return (uint64_t)st->st_mtim.tv_sec * 1000000000ull + (uint64_t)st->st_mtim.tv_nsec;
+}
+
+// 文件头: magic, version, 头部结构体大小, 条目数；每个条目: 定长字段 + 路径字节
+bool track_index_load(const char *path) {
+    track_index_loaded = true;
+    if (path == NULL) {
+        return false;
+    }
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    uint32_t head[4];
+    bool ok = fread(head, sizeof(head), 1, file) == 1 && head[0] == TRACK_INDEX_MAGIC &&
+              head[1] == TRACK_INDEX_VERSION && head[2] == sizeof(struct WAV_HEADER);
+    char name[PATH_MAX];
+    for (uint32_t i = 0; ok && i < head[3]; i++) {
+        track_index_entry_t record;
+        ok = fread(&record, sizeof(record), 1, file) == 1 && record.path_len <= sizeof(name) &&
+             fread(name, 1, record.path_len, file) == record.path_len;
+        track_index_entry_t *entry = ok ? track_index_put(name, record.path_len) : NULL;
+        if (entry != NULL) {
+            record.path_offset = entry->path_offset;
+            *entry = record;
+        }
+    }
+    fclose(file);
+    if (!ok) {
+        log_program_info("WARNING", "Track index is damaged or from another version, rebuilding");
+    }
     char info_msg[LOG_BUFFER_SIZE];
-    snprintf(info_msg, sizeof(info_msg), "Successfully opened file: %s", path_name);
+    snprintf(info_msg, sizeof(info_msg), "Track index: %d entries from %s", track_index_count, path);
     log_program_info("INFO", info_msg);
+    return ok;
+}
+
+// 先写临时文件再 rename，写到一半退出也不会留下损坏的索引
+bool track_index_save() {
+    if (!track_index_dirty || track_index_path == NULL) {
+        return true;
+    }
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", track_index_path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    uint32_t head[4] = {TRACK_INDEX_MAGIC, TRACK_INDEX_VERSION, sizeof(struct WAV_HEADER), (uint32_t)track_index_count};
+    bool ok = fwrite(head, sizeof(head), 1, file) == 1;
+    for (int i = 0; ok && i < track_index_count; i++) {
+        const track_index_entry_t *entry = &track_index_entries[i];
+        ok = fwrite(entry, sizeof(*entry), 1, file) == 1 &&
+             fwrite(track_index_pool + entry->path_offset, 1, entry->path_len, file) == entry->path_len;
+    }
+    ok = fclose(file) == 0 && ok && rename(tmp_path, track_index_path) == 0;
+    if (!ok) {
+        char error_msg[LOG_BUFFER_SIZE];
+        snprintf(error_msg, sizeof(error_msg), "Failed to write track index %s", track_index_path);
+        log_program_info("ERROR", error_msg);
+        unlink(tmp_path);
+        return false;
+    }
+    track_index_dirty = false;
+    return true;
+}
+
+void track_index_free() {
+    free(track_index_entries);
+    free(track_index_pool);
+    free(track_index_slots);
+    track_index_entries = NULL;
+    track_index_pool = NULL;
+    track_index_slots = NULL;
+    track_index_count = track_index_capacity = 0;
+    track_index_pool_used = track_index_pool_capacity = 0;
+    track_index_slot_count = 0;
+}
+
+// 修改时间和大小都一致时返回缓存的记录，第一次查询时加载索引文件
+static const track_index_entry_t *track_index_lookup(const char *path, const struct stat *st) {
+    if (!track_index_loaded) {
+        track_index_load(track_index_path);
+    }
+    if (track_index_path == NULL || track_index_count == 0) {
+        return NULL;
+    }
+    size_t slot = track_index_slot(path, strlen(path));
+    if (track_index_slots[slot] == 0) {
+        return NULL;
+    }
+    const track_index_entry_t *entry = &track_index_entries[track_index_slots[slot] - 1];
+    if (entry->mtime_ns != stat_mtime_ns(st) || entry->size != (uint64_t)st->st_size) {
+        return NULL;
+    }
+    return entry;
+}
+
+static void track_index_store(const char *path, const struct stat *st, const track_t *track) {
+    if (track_index_path == NULL) {
+        return;
+    }
+    track_index_entry_t *entry = track_index_put(path, strlen(path));
+    if (entry == NULL) {
+        return;
+    }
+    entry->mtime_ns = stat_mtime_ns(st);
+    entry->size = (uint64_t)st->st_size;
+    entry->header = track->header;
+    entry->data_chunk_offset = track->data_chunk_offset;
+    track_index_dirty = true;
+}
+
+// 向前跳过 bytes 字节；不能定位的输入 (管道、套接字) 读出来丢掉
+static bool file_skip(FILE *file, long bytes) {
+    if (fseek(file, bytes, SEEK_CUR) == 0) {
+        return true;
+    }
+    unsigned char discard[4096];
+    while (bytes > 0) {
+        size_t chunk = bytes < (long)sizeof(discard) ? (size_t)bytes : sizeof(discard);
+        if (fread(discard, 1, chunk, file) != chunk) {
+            return false;
+        }
+        bytes -= (long)chunk;
+    }
+    return true;
+}
+
+// 解析 RIFF 头部并找到 data 块，返回后文件位置在 data 块起点
+static bool parse_wav_header(FILE *file, track_t *track) {
     // Read the basic WAV header first (up to format chunk)
-    fread(&wav_header.chunk_id, 1, 4, fp);           // "RIFF"
-    fread(&wav_header.chunk_size, 1, 4, fp);         // File size - 8
-    fread(&wav_header.format, 1, 4, fp);             // "WAVE"
-    fread(&wav_header.sub_chunk1_id, 1, 4, fp);      // "fmt "
-    fread(&wav_header.sub_chunk1_size, 1, 4, fp);    // Format chunk size
+    fread(&track->header.chunk_id, 1, 4, file);           // "RIFF"
+    fread(&track->header.chunk_size, 1, 4, file);         // File size - 8
+    fread(&track->header.format, 1, 4, file);             // "WAVE"
+    fread(&track->header.sub_chunk1_id, 1, 4, file);      // "fmt "
+    fread(&track->header.sub_chunk1_size, 1, 4, file);    // Format chunk size
     
-    if (strncmp(wav_header.chunk_id, "RIFF", 4) != 0 ||
-        strncmp(wav_header.format, "WAVE", 4) != 0 ||
-        strncmp(wav_header.sub_chunk1_id, "fmt ", 4) != 0) {
+    if (strncmp(track->header.chunk_id, "RIFF", 4) != 0 ||
+        strncmp(track->header.format, "WAVE", 4) != 0 ||
+        strncmp(track->header.sub_chunk1_id, "fmt ", 4) != 0) {
         log_program_info("ERROR", "File does not appear to be a valid WAV file (missing RIFF/WAVE/fmt markers)");
-        fclose(fp);
-        fp = NULL;
         return false;
     }
     
     // Read the format chunk data
-    fread(&wav_header.audio_format, 1, 2, fp);
-    fread(&wav_header.num_channels, 1, 2, fp);
-    fread(&wav_header.sample_rate, 1, 4, fp);
-    fread(&wav_header.byte_rate, 1, 4, fp);
-    fread(&wav_header.block_align, 1, 2, fp);
-    fread(&wav_header.bits_per_sample, 1, 2, fp);
+    fread(&track->header.audio_format, 1, 2, file);
+    fread(&track->header.num_channels, 1, 2, file);
+    fread(&track->header.sample_rate, 1, 4, file);
+    fread(&track->header.byte_rate, 1, 4, file);
+    fread(&track->header.block_align, 1, 2, file);
+    fread(&track->header.bits_per_sample, 1, 2, file);
     
     // Skip any extra bytes in the format chunk
-    long fmt_extra_bytes = wav_header.sub_chunk1_size - 16;
+    // 位置自己累计: 管道上 ftell 不可用
+    long position = 36;
+    long fmt_extra_bytes = track->header.sub_chunk1_size - 16;
     if (fmt_extra_bytes > 0) {
-        fseek(fp, fmt_extra_bytes, SEEK_CUR);
+        file_skip(file, fmt_extra_bytes);
+        position += fmt_extra_bytes;
     }
     
     // Now search for the data chunk
     char chunk_id[4];
     uint32_t chunk_size;
-    data_chunk_offset = 0;
+    track->data_chunk_offset = 0;
     
-    while (fread(chunk_id, 1, 4, fp) == 4) {
-        fread(&chunk_size, 1, 4, fp);
+    while (fread(chunk_id, 1, 4, file) == 4) {
+        fread(&chunk_size, 1, 4, file);
+        position += 8;
         
         if (strncmp(chunk_id, "data", 4) == 0) {
             // Found the data chunk
-            wav_header.sub_chunk2_size = chunk_size;
-            memcpy(wav_header.sub_chunk2_id, chunk_id, 4);
-            data_chunk_offset = ftell(fp);
+            track->header.sub_chunk2_size = chunk_size;
+            memcpy(track->header.sub_chunk2_id, chunk_id, 4);
+            track->data_chunk_offset = position;
             break;
         } else {
             // Skip this chunk
-            fseek(fp, chunk_size, SEEK_CUR);
+            if (!file_skip(file, chunk_size)) {
+                break;
+            }
+            position += chunk_size;
         }
     }
     
-    if (data_chunk_offset == 0) {
+    if (track->data_chunk_offset == 0) {
         log_program_info("ERROR", "Could not find data chunk in WAV file");
-        fclose(fp);
-        fp = NULL;
         return false;
     }
-    
-    // 计算总帧数
-    total_frames = wav_header.sub_chunk2_size / wav_header.block_align;
-    current_position = 0;
-    printf("------------- WAV Header Info -------------\n");
-    printf("RIFF ID: %.4s, Chunk Size: %u, Format: %.4s\n", wav_header.chunk_id, wav_header.chunk_size, wav_header.format);
-    printf("Subchunk1 ID: %.4s, Subchunk1 Size: %u\n", wav_header.sub_chunk1_id, wav_header.sub_chunk1_size);
-    printf("Audio Format: %u (1=PCM), Num Channels: %u\n", wav_header.audio_format, wav_header.num_channels);
-    printf("Sample Rate: %u, Byte Rate: %u\n", wav_header.sample_rate, wav_header.byte_rate);
-    printf("Block Align: %u, Bits Per Sample: %u\n", wav_header.block_align, wav_header.bits_per_sample);
-    printf("Data ID: %.4s, Data Size: %u\n", wav_header.sub_chunk2_id, wav_header.sub_chunk2_size);
-    printf("Data chunk starts at offset: %ld\n", data_chunk_offset);
-    printf("-----------------------------------------\n");
-    
-    // 重置音频处理状态以避免静态变量污染
-    reset_audio_processing_state();
     return true;
 }
 
-// FIR滤波器实现
-// 添加重置标志
-static bool need_reset_static_vars = false;
+// WAV: 索引命中时跳过 RIFF 块遍历；普通文件映射到内存，其它输入经抖动缓冲区读取
+static bool wav_open(track_t *track, FILE *file, const char *path_name, const struct stat *st) {
+    bool regular = st != NULL;
+    char info_msg[LOG_BUFFER_SIZE];
+
+    // 索引命中时跳过 RIFF 块遍历，直接定位到 data 块
+    const track_index_entry_t *cached = regular ? track_index_lookup(path_name, st) : NULL;
+    if (cached != NULL) {
+        track->header = cached->header;
+        track->data_chunk_offset = cached->data_chunk_offset;
+        fseek(file, track->data_chunk_offset, SEEK_SET);
+    } else if (parse_wav_header(file, track)) {
+        if (regular) {
+            track_index_store(path_name, st, track);
+        }
+    } else {
+        return false;
+    }
+
+    // 流式写出的 WAV 给不出长度 (0 或 0xFFFFFFFF)，一直读到文件末尾
+    size_t data_bytes = track->header.sub_chunk2_size;
+    if (data_bytes == 0 || data_bytes == 0xFFFFFFFFu) {
+        data_bytes = SIZE_MAX;
+    }
+    if (track->header.block_align == 0) {
+        log_program_info("ERROR", "WAV block align is 0");
+        return false;
+    }
+
+    // 普通文件映射到内存，失败时继续用 stdio 读取；其它输入经抖动缓冲区读取
+    if (!regular) {
+        if (!stream_source_open(&track->source, file, track->header.block_align, data_bytes, track->header.byte_rate)) {
+            log_program_info("ERROR", "Failed to start the stream receiver");
+            return false;
+        }
+        snprintf(info_msg, sizeof(info_msg), "PCM source: stream (jitter buffer %zu bytes, prefetch %zu)",
+                 track->source.stream->ring.capacity, track->source.stream->prefetch_bytes);
+    } else {
+        bool mapped = audio_source_open(&track->source, file, track->data_chunk_offset, data_bytes);
+        snprintf(info_msg, sizeof(info_msg), "PCM source: %s", mapped ? "mmap" : "stdio");
+    }
+    log_program_info("INFO", info_msg);
+
+    track->source.frame_bytes = track->header.block_align;
+    // 长度未知的流 total_frames 为 0 (不显示进度)
+    track->total_frames = track->source.data_bytes != SIZE_MAX
+        ? (long)(track->source.data_bytes / track->header.block_align) : 0;
+    return true;
+}
+
+static const audio_decoder_ops_t wav_decoder = {
+    .name = "WAV", .probe = NULL, .open = wav_open, .read_frames = wav_read_frames,
+    .seek_frame = wav_seek_frame, .close = NULL
+};
+
+// --- FLAC 解码器 ---
+static uint16_t flac_crc16_table[256];
+static bool flac_crc16_ready = false;
+
+// 帧头 CRC-8 (多项式 0x07)，帧头最多 16 字节，逐位计算即可
+static uint8_t flac_crc8(const unsigned char *p, size_t n) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < n; i++) {
+        crc ^= p[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (uint8_t)(crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+        }
+    }
+    return crc;
+}
+
+// 整帧 CRC-16 (多项式 0x8005)；表在第一次打开 FLAC 时由主线程建好，之后只读
+static uint16_t flac_crc16(const unsigned char *p, size_t n) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < n; i++) {
+        crc = (uint16_t)((crc << 8) ^ flac_crc16_table[(crc >> 8) ^ p[i]]);
+    }
+    return crc;
+}
+
+static void flac_crc16_init() {
+    if (flac_crc16_ready) {
+        return;
+    }
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = (uint16_t)(i << 8);
+        for (int b = 0; b < 8; b++) {
+            crc = (uint16_t)(crc & 0x8000 ? (crc << 1) ^ 0x8005 : crc << 1);
+        }
+        flac_crc16_table[i] = crc;
+    }
+    flac_crc16_ready = true;
+}
+
+static void flac_bits_init(flac_bits_t *br, const unsigned char *data, size_t size) {
+    br->data = data;
+    br->size = size;
+    br->pos = 0;
+    br->cache = 0;
+    br->bits = 0;
+    br->overrun = false;
+}
+
+static inline void flac_bits_refill(flac_bits_t *br) {
+    while (br->bits <= 56 && br->pos < br->size) {
+        br->cache |= (uint64_t)br->data[br->pos++] << (56 - br->bits);
+        br->bits += 8;
+    }
+}
+
+// 读 n (<= 32) 位无符号数；越过末尾时置 overrun 并返回 0
+static inline uint32_t flac_bits_read(flac_bits_t *br, int n) {
+    if (n == 0) {
+        return 0;
+    }
+    if (br->bits < n) {
+        flac_bits_refill(br);
+        if (br->bits < n) {
+            br->overrun = true;
+            br->cache = 0;
+            br->bits = 0;
+            return 0;
+        }
+    }
+    uint32_t v = (uint32_t)(br->cache >> (64 - n));
+    br->cache <<= n;
+    br->bits -= n;
+    return v;
+}
+
+static inline int32_t flac_bits_read_signed(flac_bits_t *br, int n) {
+    if (n == 0) {
+        return 0;
+    }
+    return (int32_t)(flac_bits_read(br, n) << (32 - n)) >> (32 - n);
+}
+
+// 一元码: 1 之前 0 的个数
+static inline uint32_t flac_bits_unary(flac_bits_t *br) {
+    uint32_t zeros = 0;
+    for (;;) {
+        if (br->cache != 0) {
+            int lz = __builtin_clzll(br->cache);
+            br->cache = (br->cache << lz) << 1;
+            br->bits -= lz + 1;
+            return zeros + (uint32_t)lz;
+        }
+        zeros += (uint32_t)br->bits;
+        br->bits = 0;
+        flac_bits_refill(br);
+        if (br->bits == 0) {
+            br->overrun = true;
+            return 0;
+        }
+    }
+}
+
+// 已经完整读入的字节数 (调用前先对齐到字节)
+static size_t flac_bits_consumed(flac_bits_t *br) {
+    int partial = br->bits & 7;
+    br->cache <<= partial;
+    br->bits -= partial;
+    return br->pos - (size_t)(br->bits / 8);
+}
+
+// 分区 Rice 编码的残差，写到 out[order..block_size)
+static bool flac_read_residual(flac_bits_t *br, int block_size, int order, int32_t *out) {
+    int method = (int)flac_bits_read(br, 2);
+    if (method > 1) {
+        return false;
+    }
+    int param_bits = method == 0 ? 4 : 5;
+    uint32_t escape = method == 0 ? 15 : 31;
+    int partition_order = (int)flac_bits_read(br, 4);
+    int partition_size = block_size >> partition_order;
+    if ((partition_size << partition_order) != block_size || partition_size < order) {
+        return false;
+    }
+    int n = order;
+    for (int p = 0; p < (1 << partition_order); p++) {
+        int count = p == 0 ? partition_size - order : partition_size;
+        uint32_t k = flac_bits_read(br, param_bits);
+        if (k == escape) {
+            int raw_bits = (int)flac_bits_read(br, 5);
+            for (int i = 0; i < count; i++) {
+                out[n++] = flac_bits_read_signed(br, raw_bits);
+            }
+        } else {
+            for (int i = 0; i < count; i++) {
+                uint32_t u = (flac_bits_unary(br) << k) | flac_bits_read(br, (int)k);
+                out[n++] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+            }
+        }
+        if (br->overrun) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 一个声道的子帧，bits 为该声道的样本位数 (侧声道多 1 位)
+static bool flac_decode_subframe(flac_bits_t *br, int block_size, int bits, int32_t *out) {
+    if (flac_bits_read(br, 1) != 0) {
+        return false;
+    }
+    int type = (int)flac_bits_read(br, 6);
+    int wasted = 0;
+    if (flac_bits_read(br, 1)) {
+        wasted = (int)flac_bits_unary(br) + 1;
+        if (wasted >= bits) {
+            return false;
+        }
+        bits -= wasted;
+    }
+
+    if (type == 0) {
+        int32_t value = flac_bits_read_signed(br, bits);
+        for (int i = 0; i < block_size; i++) {
+            out[i] = value;
+        }
+    } else if (type == 1) {
+        for (int i = 0; i < block_size; i++) {
+            out[i] = flac_bits_read_signed(br, bits);
+        }
+    } else if (type >= 8 && type <= 12) {
+        // 固定多项式预测，阶数 0-4
+        int order = type - 8;
+        if (order > block_size) {
+            return false;
+        }
+        for (int i = 0; i < order; i++) {
+            out[i] = flac_bits_read_signed(br, bits);
+        }
+        if (!flac_read_residual(br, block_size, order, out)) {
+            return false;
+        }
+        for (int i = order; i < block_size; i++) {
+            int64_t prediction;
+            switch (order) {
+                case 0: prediction = 0; break;
+                case 1: prediction = out[i - 1]; break;
+                case 2: prediction = 2 * (int64_t)out[i - 1] - out[i - 2]; break;
+                case 3: prediction = 3 * ((int64_t)out[i - 1] - out[i - 2]) + out[i - 3]; break;
+                default: prediction = 4 * ((int64_t)out[i - 1] + out[i - 3]) - 6 * (int64_t)out[i - 2] - out[i - 4]; break;
+            }
+            out[i] = (int32_t)(out[i] + prediction);
+        }
+    } else if (type >= 32) {
+        // 线性预测，阶数 1-32
+        int order = type - 31;
+        if (order > block_size) {
+            return false;
+        }
+        for (int i = 0; i < order; i++) {
+            out[i] = flac_bits_read_signed(br, bits);
+        }
+        int precision = (int)flac_bits_read(br, 4) + 1;
+        int shift = flac_bits_read_signed(br, 5);
+        if (precision == 16 || shift < 0) {
+            return false;
+        }
+        int32_t coefs[FLAC_MAX_LPC_ORDER];
+        for (int j = 0; j < order; j++) {
+            coefs[j] = flac_bits_read_signed(br, precision);
+        }
+        if (!flac_read_residual(br, block_size, order, out)) {
+            return false;
+        }
+        for (int i = order; i < block_size; i++) {
+            int64_t sum = 0;
+            for (int j = 0; j < order; j++) {
+                sum += (int64_t)coefs[j] * out[i - 1 - j];
+            }
+            out[i] = (int32_t)(out[i] + (sum >> shift));
+        }
+    } else {
+        return false;
+    }
+    if (br->overrun) {
+        return false;
+    }
+    if (wasted > 0) {
+        for (int i = 0; i < block_size; i++) {
+            out[i] = (int32_t)((uint32_t)out[i] << wasted);
+        }
+    }
+    return true;
+}
+
+// 解析 pos 处的帧头 (同步码、保留位、与 STREAMINFO 一致的声道数和位深、CRC-8 都要对)
+static bool flac_parse_frame_header(const flac_decoder_t *d, size_t pos, flac_frame_header_t *h) {
+    // 帧头最长 16 字节，复制出来后不必逐字节检查越界
+    unsigned char p[16] = {0};
+    size_t avail = d->size - pos;
+    memcpy(p, d->data + pos, avail < sizeof(p) ? avail : sizeof(p));
+    if (avail < 6 || p[0] != 0xFF || (p[1] & 0xFE) != 0xF8 || (p[3] & 1) != 0) {
+        return false;
+    }
+    static const int sample_bits[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+    int block_code = p[2] >> 4, rate_code = p[2] & 15;
+    int channel_mode = p[3] >> 4, bits_code = (p[3] >> 1) & 7;
+    if (block_code == 0 || rate_code == 15 || channel_mode > 10 || bits_code == 3 ||
+        (bits_code != 0 && sample_bits[bits_code] != d->bits) ||
+        (channel_mode < 8 ? channel_mode + 1 : 2) != d->channels) {
+        return false;
+    }
+
+    // 定长块是帧号，变长块是样本号，都按 UTF-8 的方式编码
+    size_t n = 4;
+    uint64_t number = p[n++];
+    int extra;
+    if (number < 0x80) {
+        extra = 0;
+    } else if (number >= 0xC0 && number < 0xFF) {
+        extra = __builtin_clz(~((uint32_t)number << 24)) - 1;
+        number &= 0x3F >> extra;
+    } else {
+        return false;
+    }
+    for (int i = 0; i < extra; i++, n++) {
+        if ((p[n] & 0xC0) != 0x80) {
+            return false;
+        }
+        number = (number << 6) | (p[n] & 0x3F);
+    }
+
+    int block_size;
+    if (block_code == 1) {
+        block_size = 192;
+    } else if (block_code <= 5) {
+        block_size = 576 << (block_code - 2);
+    } else if (block_code == 6) {
+        block_size = p[n++] + 1;
+    } else if (block_code == 7) {
+        block_size = (p[n] << 8 | p[n + 1]) + 1;
+        n += 2;
+    } else {
+        block_size = 256 << (block_code - 8);
+    }
+    n += rate_code == 12 ? 1 : rate_code >= 13 ? 2 : 0;
+    if (n + 1 > avail || block_size > d->max_block || flac_crc8(p, n) != p[n]) {
+        return false;
+    }
+
+    h->sample = (p[1] & 1) ? number : number * (uint64_t)d->min_block;
+    h->block_size = block_size;
+    h->channel_mode = channel_mode;
+    h->header_bytes = (int)n + 1;
+    return true;
+}
+
+// 从 pos 起向后找第一个有效帧头，找不到返回 d->size
+static size_t flac_find_frame(const flac_decoder_t *d, size_t pos, flac_frame_header_t *h) {
+    while (pos + 1 < d->size) {
+        const unsigned char *hit = memchr(d->data + pos, 0xFF, d->size - pos - 1);
+        if (hit == NULL) {
+            break;
+        }
+        pos = (size_t)(hit - d->data);
+        if (flac_parse_frame_header(d, pos, h)) {
+            return pos;
+        }
+        pos++;
+    }
+    return d->size;
+}
+
+// 解码 pos 处的一帧 (帧头已解析) 并做声道去相关，*end 为下一帧起点；CRC-16 不符返回 false
+static bool flac_decode_frame(flac_decoder_t *d, size_t pos, const flac_frame_header_t *h, size_t *end) {
+    flac_bits_t br;
+    flac_bits_init(&br, d->data + pos + h->header_bytes, d->size - pos - h->header_bytes);
+    for (int ch = 0; ch < d->channels; ch++) {
+        bool side = (h->channel_mode == 8 && ch == 1) || (h->channel_mode == 9 && ch == 0) ||
+                    (h->channel_mode == 10 && ch == 1);
+        if (!flac_decode_subframe(&br, h->block_size, d->bits + side, d->decoded[ch])) {
+            return false;
+        }
+    }
+    size_t frame_bytes = (size_t)h->header_bytes + flac_bits_consumed(&br);
+    if (frame_bytes + 2 > d->size - pos ||
+        flac_crc16(d->data + pos, frame_bytes) != (d->data[pos + frame_bytes] << 8 | d->data[pos + frame_bytes + 1])) {
+        return false;
+    }
+    *end = pos + frame_bytes + 2;
+
+    int32_t *a = d->decoded[0], *b = d->decoded[1];
+    switch (h->channel_mode) {
+        case 8: // 左/侧: 右 = 左 - 侧
+            for (int i = 0; i < h->block_size; i++) {
+                b[i] = a[i] - b[i];
+            }
+            break;
+        case 9: // 侧/右: 左 = 侧 + 右
+            for (int i = 0; i < h->block_size; i++) {
+                a[i] += b[i];
+            }
+            break;
+        case 10: // 中/侧: 中间值丢掉的最低位由侧声道的奇偶补回
+            for (int i = 0; i < h->block_size; i++) {
+                int32_t mid = (int32_t)((uint32_t)a[i] << 1) | (b[i] & 1);
+                a[i] = (mid + b[i]) >> 1;
+                b[i] = (mid - b[i]) >> 1;
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+// 解码下一帧到 decoded。帧头无效时向后找下一个帧头；缺失的样本和校验失败的帧都用静音代替，
+// 样本号保持连续 (调用方按帧数推进 current_position)。返回 false 表示没有更多帧
+static bool flac_next_block(flac_decoder_t *d) {
+    uint64_t expected = d->block_sample + (uint64_t)d->block_frames;
+    if (d->total_samples > 0 && expected >= d->total_samples) {
+        return false;
+    }
+    flac_frame_header_t h;
+    size_t pos = d->next;
+    if (pos >= d->size) {
+        return false;
+    }
+    if (!flac_parse_frame_header(d, pos, &h)) {
+        pos = flac_find_frame(d, pos + 1, &h);
+        if (pos >= d->size) {
+            return false;
+        }
+    }
+
+    d->block_sample = expected;
+    if (h.sample > expected) {
+        uint64_t gap = h.sample - expected;
+        d->block_frames = gap < (uint64_t)d->max_block ? (int)gap : d->max_block;
+        for (int ch = 0; ch < d->channels; ch++) {
+            memset(d->decoded[ch], 0, (size_t)d->block_frames * sizeof(int32_t));
+        }
+        d->next = pos;
+        return true;
+    }
+
+    size_t end;
+    d->block_frames = h.block_size;
+    if (flac_decode_frame(d, pos, &h, &end)) {
+        d->next = end;
+        return true;
+    }
+    d->corrupt_frames++;
+    char warn_msg[LOG_BUFFER_SIZE];
+    snprintf(warn_msg, sizeof(warn_msg), "FLAC frame at sample %llu failed to decode, playing silence",
+             (unsigned long long)h.sample);
+    log_program_info("WARNING", warn_msg);
+    for (int ch = 0; ch < d->channels; ch++) {
+        memset(d->decoded[ch], 0, (size_t)h.block_size * sizeof(int32_t));
+    }
+    flac_frame_header_t skipped;
+    d->next = flac_find_frame(d, pos + 1, &skipped);
+    return true;
+}
+
+// decoded 中从 offset 起的 frames 帧按输出格式交错写入 dst
+static void flac_store_pcm(const flac_decoder_t *d, int offset, int frames, unsigned char *dst) {
+    int channels = d->channels;
+    int bytes = d->container_bytes;
+    int shift = bytes * 8 - d->bits;
+    size_t stride = (size_t)channels * bytes;
+    for (int ch = 0; ch < channels; ch++) {
+        const int32_t *x = d->decoded[ch] + offset;
+        unsigned char *o = dst + (size_t)ch * bytes;
+        if (bytes == 1) {
+            for (int i = 0; i < frames; i++, o += stride) {
+                o[0] = (unsigned char)(((uint32_t)x[i] << shift) + 128);
+            }
+        } else if (bytes == 2) {
+            for (int i = 0; i < frames; i++, o += stride) {
+                uint32_t v = (uint32_t)x[i] << shift;
+                o[0] = (unsigned char)v;
+                o[1] = (unsigned char)(v >> 8);
+            }
+        } else {
+            for (int i = 0; i < frames; i++, o += stride) {
+                uint32_t v = (uint32_t)x[i] << shift;
+                o[0] = (unsigned char)v;
+                o[1] = (unsigned char)(v >> 8);
+                o[2] = (unsigned char)(v >> 16);
+            }
+        }
+    }
+}
+
+// 定位到 target: 目标已在解码好的帧中时什么都不做；否则取 SEEKTABLE 中不晚于目标的最后一点
+// (没有时从第一帧开始)，与下一点之间相距较远时按帧头样本号二分，再只解析帧头逐帧向后跳，
+// 停在包含目标的帧上，下一次读取时才解码这一帧
+static void flac_seek(flac_decoder_t *d, uint64_t target) {
+    d->position = target;
+    if (target >= d->block_sample && target < d->block_sample + (uint64_t)d->block_frames) {
+        return;
+    }
+    d->block_sample = target;
+    d->block_frames = 0;
+    if (d->total_samples > 0 && target >= d->total_samples) {
+        d->next = d->size;
+        return;
+    }
+
+    size_t lo = 0, hi = d->size;
+    for (int i = 0; i < d->seek_count; i++) {
+        if (d->seek_points[i].sample <= target) {
+            lo = (size_t)d->seek_points[i].offset;
+        } else {
+            hi = (size_t)d->seek_points[i].offset;
+            break;
+        }
+    }
+    flac_frame_header_t h;
+    while (hi - lo > FLAC_BISECT_BYTES) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t found = flac_find_frame(d, mid, &h);
+        if (found < hi && h.sample <= target) {
+            lo = found;
+        } else {
+            hi = mid;
+        }
+    }
+
+    size_t pos = flac_find_frame(d, lo, &h);
+    while (pos < d->size && h.sample + (uint64_t)h.block_size <= target) {
+        flac_frame_header_t next;
+        size_t next_pos = flac_find_frame(d, pos + (size_t)h.header_bytes, &next);
+        // 帧数据中偶然通过校验的假帧头: 样本号必须向前
+        while (next_pos < d->size && next.sample <= h.sample) {
+            next_pos = flac_find_frame(d, next_pos + 1, &next);
+        }
+        if (next_pos >= d->size || next.sample > target) {
+            // 目标在最后一帧之后或落在缺失的帧里: 从下一帧开始，缺的部分由 flac_next_block 补静音
+            d->next = next_pos;
+            return;
+        }
+        pos = next_pos;
+        h = next;
+    }
+    d->next = pos;
+    if (pos < d->size && h.sample <= target) {
+        d->block_sample = h.sample;
+    }
+}
+
+static size_t flac_read_frames(audio_source_t *src, size_t frame, size_t frames,
+                               unsigned char *buf, const unsigned char **out) {
+    flac_decoder_t *d = (flac_decoder_t *)src->codec;
+    *out = buf;
+    if (frame != d->position) {
+        flac_seek(d, frame);
+    }
+    size_t done = 0;
+    while (done < frames) {
+        uint64_t end = d->block_sample + (uint64_t)d->block_frames;
+        if (d->position < d->block_sample || d->position >= end) {
+            if (!flac_next_block(d)) {
+                break;
+            }
+            continue;
+        }
+        size_t count = end - d->position < frames - done ? (size_t)(end - d->position) : frames - done;
+        flac_store_pcm(d, (int)(d->position - d->block_sample), (int)count, buf + done * src->frame_bytes);
+        done += count;
+        d->position += count;
+    }
+    return done;
+}
+
+static void flac_seek_frame(audio_source_t *src, size_t frame) {
+    flac_decoder_t *d = (flac_decoder_t *)src->codec;
+    flac_seek(d, frame);
+    if (d->next < d->size) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t start = (size_t)(d->data + d->next - src->map) / page * page;
+        size_t length = buffer_size;
+        if (start + length > src->map_size) {
+            length = src->map_size - start;
+        }
+        madvise((void *)(src->map + start), length, MADV_WILLNEED);
+    }
+}
+
+static void flac_close(audio_source_t *src) {
+    flac_decoder_t *d = (flac_decoder_t *)src->codec;
+    if (d == NULL) {
+        return;
+    }
+    for (int ch = 0; ch < FLAC_MAX_CHANNELS; ch++) {
+        free(d->decoded[ch]);
+    }
+    free(d->seek_points);
+    free(d);
+    src->codec = NULL;
+}
+
+static bool flac_probe(const unsigned char *magic, size_t bytes) {
+    return bytes >= 4 && memcmp(magic, "fLaC", 4) == 0;
+}
+
+static uint64_t flac_read_be(const unsigned char *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// 映射整个文件，解析 STREAMINFO 和 SEEKTABLE；格式信息按解码输出填写 (相当于转成 WAV 后的头部)
+static bool flac_open(track_t *track, FILE *file, const char *path_name, const struct stat *st) {
+    (void)path_name;
+    audio_source_t *src = &track->source;
+    if (st == NULL || !audio_source_open(src, file, 0, SIZE_MAX)) {
+        log_program_info("ERROR", "FLAC input must be a regular file that can be memory-mapped");
+        return false;
+    }
+    flac_decoder_t *d = (flac_decoder_t *)calloc(1, sizeof(*d));
+    if (d == NULL) {
+        return false;
+    }
+    src->codec = d;
+
+    const unsigned char *p = src->map;
+    size_t size = src->map_size, pos = 4;
+    bool last = false, have_info = false;
+    while (!last) {
+        if (pos + 4 > size) {
+            log_program_info("ERROR", "Truncated FLAC metadata");
+            return false;
+        }
+        last = (p[pos] & 0x80) != 0;
+        int type = p[pos] & 0x7F;
+        size_t length = (size_t)flac_read_be(p + pos + 1, 3);
+        pos += 4;
+        if (length > size - pos) {
+            log_program_info("ERROR", "Truncated FLAC metadata");
+            return false;
+        }
+        if (type == 0 && length >= 34) {
+            const unsigned char *info = p + pos;
+            d->min_block = (int)flac_read_be(info, 2);
+            d->max_block = (int)flac_read_be(info + 2, 2);
+            d->min_frame_bytes = (int)flac_read_be(info + 4, 3);
+            uint64_t v = flac_read_be(info + 10, 8);
+            d->sample_rate = (unsigned int)(v >> 44);
+            d->channels = (int)((v >> 41) & 7) + 1;
+            d->bits = (int)((v >> 36) & 31) + 1;
+            d->total_samples = v & 0xFFFFFFFFFULL;
+            have_info = true;
+        } else if (type == 3) {
+            // 占位点 (样本号全 1) 不要；点按样本号升序排列
+            int count = (int)(length / 18);
+            d->seek_points = (flac_seek_point_t *)malloc((size_t)(count > 0 ? count : 1) * sizeof(flac_seek_point_t));
+            if (d->seek_points == NULL) {
+                return false;
+            }
+            for (int i = 0; i < count; i++) {
+                const unsigned char *point = p + pos + (size_t)i * 18;
+                uint64_t sample = flac_read_be(point, 8);
+                if (sample != UINT64_MAX && (d->seek_count == 0 || sample > d->seek_points[d->seek_count - 1].sample)) {
+                    d->seek_points[d->seek_count].sample = sample;
+                    d->seek_points[d->seek_count].offset = flac_read_be(point + 8, 8);
+                    d->seek_count++;
+                }
+            }
+        }
+        pos += length;
+    }
+
+    char info_msg[LOG_BUFFER_SIZE];
+    if (!have_info || d->sample_rate == 0 || d->bits < 4 || d->bits > FLAC_MAX_BITS ||
+        d->min_block < 16 || d->max_block < d->min_block) {
+        snprintf(info_msg, sizeof(info_msg), "Unsupported FLAC stream (%d bits, block %d-%d)",
+                 d->bits, d->min_block, d->max_block);
+        log_program_info("ERROR", info_msg);
+        return false;
+    }
+    for (int ch = 0; ch < d->channels; ch++) {
+        d->decoded[ch] = (int32_t *)malloc((size_t)d->max_block * sizeof(int32_t));
+        if (d->decoded[ch] == NULL) {
+            return false;
+        }
+    }
+    // 偏移超出文件的点 (截断的文件) 丢掉
+    while (d->seek_count > 0 && d->seek_points[d->seek_count - 1].offset >= size - pos) {
+        d->seek_count--;
+    }
+    d->data = p + pos;
+    d->size = size - pos;
+    d->container_bytes = d->bits <= 8 ? 1 : d->bits <= 16 ? 2 : 3;
+    flac_crc16_init();
+
+    struct WAV_HEADER *h = &track->header;
+    memcpy(h->chunk_id, "RIFF", 4);
+    memcpy(h->format, "WAVE", 4);
+    memcpy(h->sub_chunk1_id, "fmt ", 4);
+    memcpy(h->sub_chunk2_id, "data", 4);
+    h->sub_chunk1_size = 16;
+    h->audio_format = 1;
+    h->num_channels = (uint16_t)d->channels;
+    h->sample_rate = d->sample_rate;
+    h->bits_per_sample = (uint16_t)(d->container_bytes * 8);
+    h->block_align = (uint16_t)(d->container_bytes * d->channels);
+    h->byte_rate = d->sample_rate * h->block_align;
+    uint64_t pcm_bytes = d->total_samples * h->block_align;
+    h->sub_chunk2_size = pcm_bytes > UINT32_MAX - 36 ? UINT32_MAX - 36 : (uint32_t)pcm_bytes;
+    h->chunk_size = 36 + h->sub_chunk2_size;
+    track->data_chunk_offset = (long)pos;
+    track->total_frames = (long)d->total_samples;
+
+    src->data = d->data;
+    src->data_bytes = d->size;
+    src->frame_bytes = h->block_align;
+    snprintf(info_msg, sizeof(info_msg), "FLAC source: %u Hz, %d channels, %d bits, %llu samples, %d seek points",
+             d->sample_rate, d->channels, d->bits, (unsigned long long)d->total_samples, d->seek_count);
+    log_program_info("INFO", info_msg);
+    return true;
+}
+
+static const audio_decoder_ops_t flac_decoder = {
+    .name = "FLAC", .probe = flac_probe, .open = flac_open, .read_frames = flac_read_frames,
+    .seek_frame = flac_seek_frame, .close = flac_close
+};
+
+// 按文件开头的标识选择解码器，都不认识时按 WAV 解析 (由它报告格式错误)
+static const audio_decoder_ops_t *const track_decoders[] = {&flac_decoder};
+
+bool open_track(const char *path_name, track_t *track) {
+    memset(track, 0, sizeof(*track));
+    FILE *file = stream_fopen(path_name);
+    if (file == NULL) {
+        char error_msg[LOG_BUFFER_SIZE];
+        snprintf(error_msg, sizeof(error_msg), "Error opening WAV file: %s", path_name);
+        log_program_info("ERROR", error_msg);
+        return false;
+    }
+    
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg), "Successfully opened file: %s", path_name);
+    log_program_info("INFO", info_msg);
+
+    // 不能定位的输入关掉 stdio 缓冲: 解析头部时不多读，之后接收线程直接从描述符接着读
+    struct stat st;
+    bool regular = fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode);
+    if (!regular) {
+        setvbuf(file, NULL, _IONBF, 0);
+    }
+
+    // 流式输入读出的字节退不回去，只按 WAV 解析
+    const audio_decoder_ops_t *decoder = &wav_decoder;
+    if (regular) {
+        unsigned char magic[16];
+        size_t got = fread(magic, 1, sizeof(magic), file);
+        rewind(file);
+        for (size_t i = 0; i < sizeof(track_decoders) / sizeof(track_decoders[0]); i++) {
+            if (track_decoders[i]->probe(magic, got)) {
+                decoder = track_decoders[i];
+                break;
+            }
+        }
+    }
+    if (!decoder->open(track, file, path_name, regular ? &st : NULL)) {
+        // 失败时 source 可能还没有接管文件；已接管的连同解码器状态由 close_track 释放
+        if (track->source.file == NULL) {
+            fclose(file);
+        }
+        track->source.decoder = decoder;
+        close_track(track);
+        return false;
+    }
+    track->source.decoder = decoder;
+
+    strncpy(track->path, path_name, sizeof(track->path) - 1);
+    return true;
+}
+
+void close_track(track_t *track) {
+    audio_source_close(&track->source);
+}
+
+// 让解析好的曲目成为当前曲目 (wav_header / fp / music_source 等全局变量)
+static void install_track(track_t *track) {
+    wav_header = track->header;
+    data_chunk_offset = track->data_chunk_offset;
+    music_source = track->source;
+    fp = music_source.file;
+    total_frames = track->total_frames;
+    current_position = 0;
+    memset(&track->source, 0, sizeof(track->source)); // 所有权转给 music_source
+}
+
+// 当前曲目的文件头信息
+void print_track_header() {
+    if (music_source.decoder == &flac_decoder) {
+        const flac_decoder_t *d = (const flac_decoder_t *)music_source.codec;
+        printf("------------- FLAC Stream Info -------------\n");
+        printf("Sample Rate: %u, Num Channels: %d, Bits Per Sample: %d\n", d->sample_rate, d->channels, d->bits);
+        printf("Block Size: %d - %d, Total Samples: %llu\n", d->min_block, d->max_block,
+               (unsigned long long)d->total_samples);
+        printf("Seek Points: %d, First frame at offset: %ld\n", d->seek_count, data_chunk_offset);
+        printf("Decoded as: PCM %u bit, Block Align: %u\n", wav_header.bits_per_sample, wav_header.block_align);
+        printf("-----------------------------------------\n");
+        return;
+    }
+
+    printf("------------- WAV Header Info -------------\n");
+    printf("RIFF ID: %.4s, Chunk Size: %u, Format: %.4s\n", wav_header.chunk_id, wav_header.chunk_size, wav_header.format);
+    printf("Subchunk1 ID: %.4s, Subchunk1 Size: %u\n", wav_header.sub_chunk1_id, wav_header.sub_chunk1_size);
+    printf("Audio Format: %u (1=PCM), Num Channels: %u\n", wav_header.audio_format, wav_header.num_channels);
+    printf("Sample Rate: %u, Byte Rate: %u\n", wav_header.sample_rate, wav_header.byte_rate);
+    printf("Block Align: %u, Bits Per Sample: %u\n", wav_header.block_align, wav_header.bits_per_sample);
+    printf("Data ID: %.4s, Data Size: %u\n", wav_header.sub_chunk2_id, wav_header.sub_chunk2_size);
+    printf("Data chunk starts at offset: %ld\n", data_chunk_offset);
+    printf("-----------------------------------------\n");
+}
+
+bool open_music_file(const char *path_name) {
+    close_music_file();
+
+    track_t track;
+    if (!open_track(path_name, &track)) {
+        return false;
+    }
+    install_track(&track);
+    if (!track_header_deferred) {
+        print_track_header();
+    }
+    
+    // 重置音频处理状态以避免静态变量污染
+    reset_audio_processing_state();
+    return true;
+}
+
+// FIR滤波器实现
+// 添加重置标志
+static bool need_reset_static_vars = false;
+// 流式拉伸实例 (只在读取/DSP线程中使用)
+static phase_vocoder_t *time_stretch_pv = NULL;
+static wsola_t *time_stretch_wsola = NULL;
+static bool time_stretch_stale = false;
+// 最近一块实际使用的算法，可能与发布的 current_stretch_mode 不同 (只由读取/DSP 线程访问)
+static stretch_mode_t time_stretch_mode = STRETCH_WSOLA;
+static bool time_stretch_substituted = false;   // 已记录过换用算法的日志，恢复所选算法后清除
+
+void reset_time_stretch_static_vars() {
+    need_reset_static_vars = true;
+}
+
+// 相位声码器和WSOLA跨块保存状态，慢速时读取线程按速度比例减少读取量
+bool stretch_mode_is_streaming(stretch_mode_t mode) {
+    return mode == STRETCH_PHASE_VOCODER || mode == STRETCH_WSOLA;
+}
+
+// 流式拉伸: 声道数或采样率变化时重建实例，否则在块之间保持状态
+static bool apply_streaming_stretch(const audio_block_t *input, audio_block_t *output, float speed_factor,
+                                    stretch_mode_t mode) {
+    int num_channels = input->channels;
+    int max_block_frames = buffer_size / wav_header.block_align;
+    bool reset = time_stretch_stale || need_reset_static_vars;
+    int frames_out;
+
+    if (mode == STRETCH_PHASE_VOCODER) {
+        // 块长变大 (延迟换档) 时 FIFO 容量也要重建
+        if (time_stretch_pv == NULL || time_stretch_pv->channels != num_channels ||
+            time_stretch_pv->sample_rate != wav_header.sample_rate ||
+            time_stretch_pv->block_capacity < max_block_frames) {
+            phase_vocoder_destroy(time_stretch_pv);
+            time_stretch_pv = phase_vocoder_create(num_channels, wav_header.sample_rate, max_block_frames);
+            reset = false;
+        }
+        if (time_stretch_pv == NULL) {
+            return false;
+        }
+        if (reset) {
+            phase_vocoder_reset(time_stretch_pv);
+        }
+        frames_out = phase_vocoder_process(time_stretch_pv, input->channel, input->frames,
+                                           output->channel, output->capacity, speed_factor);
+    } else {
+        if (time_stretch_wsola == NULL || time_stretch_wsola->channels != num_channels ||
+            time_stretch_wsola->sample_rate != wav_header.sample_rate ||
+            time_stretch_wsola->block_capacity < max_block_frames) {
+            wsola_destroy(time_stretch_wsola);
+            time_stretch_wsola = wsola_create(num_channels, wav_header.sample_rate, max_block_frames);
+            reset = false;
+        }
+        if (time_stretch_wsola == NULL) {
+            return false;
+        }
+        if (reset) {
+            wsola_reset(time_stretch_wsola);
+        }
+        frames_out = wsola_process(time_stretch_wsola, input->channel, input->frames,
+                                   output->channel, output->capacity, speed_factor);
+    }
+
+    time_stretch_stale = false;
+    need_reset_static_vars = false;
+    output->frames = frames_out;
+    return true;
+}
+
+// 保持音调的时间拉伸算法，output->capacity 为最多输出的帧数。current_stretch_mode 来自控制线程
+// 发布的参数，这里不改写；所选算法用不了时只对当前块换用别的算法
+void apply_time_stretch(const audio_block_t *input, audio_block_t *output, float speed_factor) {
+    int num_channels = input->channels;
+    output->channels = num_channels;
+    output->frames = 0;
+    
+    if (speed_factor <= 0.0f || speed_factor == 1.0f) {
+        // 无变化，直接复制
+        int copy_frames = input->frames < output->capacity ? input->frames : output->capacity;
+        for (int ch = 0; ch < num_channels; ch++) {
+            memcpy(output->channel[ch], input->channel[ch], copy_frames * sizeof(float));
+        }
+        output->frames = copy_frames;
+        // 流式拉伸的历史状态已与当前位置脱节，下次使用时重新开始
+        time_stretch_stale = true;
+        return;
+    }
+    
+    stretch_mode_t mode = current_stretch_mode;
+    bool substituted = false;
+    // 低延迟档位的块 (或曲目末尾的块) 可能比 PSOLA 的分析帧还短，这一块改用 WSOLA
+    if (mode == STRETCH_PSOLA && input->frames < PSOLA_FRAME_SIZE) {
+        if (!time_stretch_substituted) {
+            log_program_info("WARNING", "Block shorter than a PSOLA frame, using WSOLA for it");
+        }
+        mode = STRETCH_WSOLA;
+        substituted = true;
+    }
+    if (stretch_mode_is_streaming(mode)) {
+        if (apply_streaming_stretch(input, output, speed_factor, mode)) {
+            time_stretch_mode = mode;
+            time_stretch_substituted = substituted;
+            return;
+        }
+        if (!time_stretch_substituted) {
+            log_program_info("ERROR", "Failed to create time-stretch engine, using PSOLA instead");
+        }
+        mode = STRETCH_PSOLA;
+        substituted = true;
+    }
+    time_stretch_mode = mode;
+    time_stretch_substituted = substituted;
+    // PSOLA 路径不保留跨块状态，切回流式算法时需要重新开始
+    time_stretch_stale = true;
+    
+    // Debug output
+    static bool debug_printed = false;
+    if (!debug_printed || need_reset_static_vars) {
+        printf("[%.2fx Pitch-Preserving PSOLA] Channels: %d\n", speed_factor, num_channels);
+        debug_printed = true;
+    }
+    
+    // Clear output buffer
+    for (int ch = 0; ch < num_channels; ch++) {
+        memset(output->channel[ch], 0, output->capacity * sizeof(float));
+    }
+    
+    // PSOLA parameters: 固定合成跳步，分析跳步随速度变化 (0.5x 时为 64/128)
+    int frame_size = PSOLA_FRAME_SIZE;                      // Analysis frame size
+    int synthesis_hop = 128;                                // Output hop size (25% of frame)
+    int analysis_hop = (int)(synthesis_hop * speed_factor); // Variable input hop
+    
+    if (analysis_hop <= 0) analysis_hop = 1;
+    
+    // Create normalized window for perfect reconstruction with given hop size
+    // 窗口只取决于帧长和合成跳步，与速度无关
+    static float psola_window[PSOLA_FRAME_SIZE];
+    static bool window_initialized = false;
+    
+    if (!window_initialized) {
+        for (int i = 0; i < frame_size; i++) {
+            float window_val = 0.5f * (1.0f - cosf(2.0f * M_PI * i / (frame_size - 1)));
+            float overlap_sum = 0.0f;
+            
+            // Sum overlapping windows
+            for (int j = -2; j <= 2; j++) {
+                int offset = j * synthesis_hop;
+                if (i + offset >= 0 && i + offset < frame_size) {
+                    overlap_sum += 0.5f * (1.0f - cosf(2.0f * M_PI * (i + offset) / (frame_size - 1)));
+                }
+            }
+            
+            if (overlap_sum > 0.0f) {
+                psola_window[i] = window_val / overlap_sum;
+            } else {
+                psola_window[i] = window_val;
+            }
+        }
+        
+        window_initialized = true;
+    }
+    
+    // PSOLA main processing loop (以帧为单位，各声道独立重叠相加，超出满幅的部分交给处理链末端的限幅器)
+    int input_pos = 0;
+    int output_pos = 0;
+    
+    while (input_pos + frame_size <= input->frames && 
+           output_pos + frame_size <= output->capacity) {
+        for (int ch = 0; ch < num_channels; ch++) {
+            const float *src = input->channel[ch] + input_pos;
+            float *dst = output->channel[ch] + output_pos;
+            for (int i = 0; i < frame_size; i++) {
+                dst[i] += src[i] * psola_window[i];
+            }
+        }
+        
+        // Advance positions according to PSOLA hop sizes
+        input_pos += analysis_hop;
+        output_pos += synthesis_hop;
+    }
+    
+    output->frames = output_pos;
+    
+    // Reset the flag after processing
+    need_reset_static_vars = false;
+}
+
+// --- 样本格式转换: 交错的文件/设备格式 <-> 平面 float (满幅 ±1.0) ---
+// 最常见的 16 位单声道/立体声使用 SSE2 / NEON，其余格式和声道数走标量循环
+int sample_format_bytes(sample_format_t format) {
+    switch (format) {
+        case SAMPLE_U8: return 1;
+        case SAMPLE_S16: return 2;
+        case SAMPLE_S24_3: return 3;
+        case SAMPLE_S24:
+        case SAMPLE_S32:
+        case SAMPLE_FLOAT: return 4;
+        default: return 0;
+    }
+}
+
+// 有效位数 (浮点按 32 计)，用来判断输出是否比输入更粗需要抖动
+int sample_format_bits(sample_format_t format) {
+    switch (format) {
+        case SAMPLE_U8: return 8;
+        case SAMPLE_S16: return 16;
+        case SAMPLE_S24_3:
+        case SAMPLE_S24: return 24;
+        case SAMPLE_S32:
+        case SAMPLE_FLOAT: return 32;
+        default: return 0;
+    }
+}
+
+const char *sample_format_name(sample_format_t format) {
+    switch (format) {
+        case SAMPLE_U8: return "U8";
+        case SAMPLE_S16: return "S16_LE";
+        case SAMPLE_S24_3: return "S24_3LE";
+        case SAMPLE_S24: return "S24_LE";
+        case SAMPLE_S32: return "S32_LE";
+        case SAMPLE_FLOAT: return "FLOAT_LE";
+        default: return "unknown";
+    }
+}
+
+// 由 fmt 块推断样本格式: 24 位按 block_align 区分 3 字节和 4 字节容器
+sample_format_t sample_format_from_wav(const struct WAV_HEADER *header) {
+    if (header->num_channels == 0 || header->block_align % header->num_channels != 0) {
+        return SAMPLE_FORMAT_UNKNOWN;
+    }
+    int container = header->block_align / header->num_channels;
+    if (header->audio_format == 3) {
+        return header->bits_per_sample == 32 && container == 4 ? SAMPLE_FLOAT : SAMPLE_FORMAT_UNKNOWN;
+    }
+    if (header->audio_format != 1 && header->audio_format != 0xFFFE) {
+        return SAMPLE_FORMAT_UNKNOWN;
+    }
+    switch (header->bits_per_sample) {
+        case 8: return container == 1 ? SAMPLE_U8 : SAMPLE_FORMAT_UNKNOWN;
+        case 16: return container == 2 ? SAMPLE_S16 : SAMPLE_FORMAT_UNKNOWN;
+        case 24: return container == 3 ? SAMPLE_S24_3 : container == 4 ? SAMPLE_S24 : SAMPLE_FORMAT_UNKNOWN;
+        case 32: return container == 4 ? SAMPLE_S32 : SAMPLE_FORMAT_UNKNOWN;
+        default: return SAMPLE_FORMAT_UNKNOWN;
+    }
+}
+
+// 只支持小端格式，大端设备格式 (-f 162 等) 时源数据原样输出
+sample_format_t sample_format_from_pcm(snd_pcm_format_t format) {
+    switch (format) {
+        case SND_PCM_FORMAT_U8: return SAMPLE_U8;
+        case SND_PCM_FORMAT_S16_LE: return SAMPLE_S16;
+        case SND_PCM_FORMAT_S24_3LE: return SAMPLE_S24_3;
+        case SND_PCM_FORMAT_S24_LE: return SAMPLE_S24;
+        case SND_PCM_FORMAT_S32_LE: return SAMPLE_S32;
+        case SND_PCM_FORMAT_FLOAT_LE: return SAMPLE_FLOAT;
+        default: return SAMPLE_FORMAT_UNKNOWN;
+    }
+}
+
+// 每个声道至少容纳 frames 帧，只在块变大时重新分配
+static size_t audio_align_up(size_t bytes) {
+    return (bytes + AUDIO_BLOCK_ALIGN - 1) & ~(size_t)(AUDIO_BLOCK_ALIGN - 1);
+}
+
+// 单独分配的块 (基准测试等处理链以外的用途)；容量不够时重新分配，原有样本不保留
+bool audio_block_reserve(audio_block_t *block, int channels, int frames) {
+    if (channels < 1 || channels > FIR_MAX_CHANNELS) {
+        return false;
+    }
+    block->channels = channels;
+    if (frames <= block->capacity) {
+        return true;
+    }
+    for (int ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+        free(block->channel[ch]);
+        block->channel[ch] = NULL;
+        void *data = NULL;
+        if (posix_memalign(&data, AUDIO_BLOCK_ALIGN, audio_align_up((size_t)frames * sizeof(float))) != 0) {
+            block->capacity = 0;
+            return false;
+        }
+        block->channel[ch] = (float *)data;
+    }
+    block->capacity = frames;
+    return true;
+}
+
+void audio_block_free(audio_block_t *block) {
+    for (int ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+        free(block->channel[ch]);
+        block->channel[ch] = NULL;
+    }
+    block->capacity = 0;
+    block->frames = 0;
+}
+
+// 在内存池中切出一个块所需的字节数
+size_t audio_block_bytes(int channels, int frames) {
+    return (size_t)channels * audio_align_up((size_t)frames * sizeof(float));
+}
+
+// 清空内存池并保证至少有 bytes 字节；已有的池足够大时不重新分配，之前切出的块全部失效
+bool audio_arena_reserve(audio_arena_t *arena, size_t bytes) {
+    arena->used = 0;
+    if (bytes <= arena->size) {
+        return true;
+    }
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    void *data = NULL;
+    if (posix_memalign(&data, AUDIO_BLOCK_ALIGN, audio_align_up(bytes)) != 0) {
+        return false;
+    }
+    arena->base = (unsigned char *)data;
+    arena->size = audio_align_up(bytes);
+    return true;
+}
+
+void *audio_arena_alloc(audio_arena_t *arena, size_t bytes) {
+    bytes = audio_align_up(bytes);
+    if (arena->base == NULL || bytes > arena->size - arena->used) {
+        return NULL;
+    }
+    void *p = arena->base + arena->used;
+    arena->used += bytes;
+    return p;
+}
+
+bool audio_block_carve(audio_arena_t *arena, audio_block_t *block, int channels, int frames) {
+    if (channels < 1 || channels > FIR_MAX_CHANNELS) {
+        return false;
+    }
+    memset(block, 0, sizeof(*block));
+    for (int ch = 0; ch < channels; ch++) {
+        block->channel[ch] = (float *)audio_arena_alloc(arena, (size_t)frames * sizeof(float));
+        if (block->channel[ch] == NULL) {
+            return false;
+        }
+    }
+    block->channels = channels;
+    block->capacity = frames;
+    return true;
+}
+
+void audio_arena_free(audio_arena_t *arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+// --- 运行统计 ---
+static pipeline_stats_t pipeline_stats;
+static const char *const stage_names[STAGE_COUNT] = {"read", "stretch", "eq", "src", "limit", "convert", "write", "seek", "analyze"};
+
+// 每个计数器只有一个写线程，不需要原子读改写
+#define STATS_ADD(field, value) \
+    atomic_store_explicit(&(field), atomic_load_explicit(&(field), memory_order_relaxed) + (value), memory_order_relaxed)
+#define STATS_SET(field, value) atomic_store_explicit(&(field), (value), memory_order_relaxed)
+#define STATS_GET(field) atomic_load_explicit(&(field), memory_order_relaxed)
+
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// 桶号: 4 us 以下每微秒一个桶，之后每倍频程4个桶 (相邻桶相差 12%~25%)
+static int stats_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    if (us < 4) {
+        return (int)us;
+    }
+    int msb = 63 - __builtin_clzll(us);
+    int bucket = (msb - 1) * 4 + (int)((us >> (msb - 2)) & 3);
+    return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+// 桶的上界 (纳秒)
+static uint64_t stats_bucket_upper_ns(int bucket) {
+    if (bucket < 4) {
+        return (uint64_t)(bucket + 1) * 1000;
+    }
+    int msb = bucket / 4 + 1;
+    uint64_t step = 1ull << (msb - 2);
+    return ((1ull << msb) + (uint64_t)(bucket % 4 + 1) * step) * 1000;
+}
+
+void stats_reset() {
+    memset(&pipeline_stats, 0, sizeof(pipeline_stats));
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        pipeline_stats.stage[i].name = stage_names[i];
+    }
+    STATS_SET(pipeline_stats.ring_fill_min, UINT64_MAX);
+    STATS_SET(pipeline_stats.pcm_delay_min, INT64_MAX);
+    STATS_SET(pipeline_stats.pcm_delay_max, INT64_MIN);
+}
+
+void stats_record(stage_stats_t *stats, uint64_t ns) {
+    STATS_ADD(stats->count, 1);
+    STATS_ADD(stats->total_ns, ns);
+    if (ns > STATS_GET(stats->max_ns)) {
+        STATS_SET(stats->max_ns, ns);
+    }
+    STATS_ADD(stats->buckets[stats_bucket(ns)], 1);
+}
+
+// 直方图上的分位数，返回所在桶的上界 (不超过最大值)
+uint64_t stats_percentile_ns(const stage_stats_t *stats, double fraction) {
+    uint64_t total = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        total += STATS_GET(stats->buckets[b]);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)ceil(fraction * total);
+    uint64_t seen = 0;
+    uint64_t max_ns = STATS_GET(stats->max_ns);
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += STATS_GET(stats->buckets[b]);
+        if (seen >= target && seen > 0) {
+            uint64_t upper = stats_bucket_upper_ns(b);
+            return upper < max_ns ? upper : max_ns;
+        }
+    }
+    return max_ns;
+}
+
+// 输出线程调用
+static void stats_note_output(size_t ring_fill) {
+    STATS_SET(pipeline_stats.ring_fill, ring_fill);
+    if (ring_fill < STATS_GET(pipeline_stats.ring_fill_min)) {
+        STATS_SET(pipeline_stats.ring_fill_min, ring_fill);
+    }
+}
+
+static void stats_note_pcm_delay(snd_pcm_sframes_t delay) {
+    STATS_SET(pipeline_stats.pcm_delay, delay);
+    STATS_SET(pipeline_stats.pcm_delay_ns, monotonic_ns());
+    if (delay < STATS_GET(pipeline_stats.pcm_delay_min)) {
+        STATS_SET(pipeline_stats.pcm_delay_min, delay);
+    }
+    if (delay > STATS_GET(pipeline_stats.pcm_delay_max)) {
+        STATS_SET(pipeline_stats.pcm_delay_max, delay);
+    }
+    atomic_store_explicit(&pipeline_stats.delay_valid, true, memory_order_relaxed);
+}
+
+void print_stats() {
+    double block_ms = 0.0;
+    if (wav_header.block_align > 0 && wav_header.sample_rate > 0) {
+        block_ms = (double)(buffer_size / wav_header.block_align) * 1000.0 / wav_header.sample_rate;
+    }
+    printf("\n=== 运行统计 (每块 %.1f ms 音频) ===\n", block_ms);
+    // 表头和 -T 输出的字段名一致; write 包含等待设备缓冲区腾出空间的时间
+    printf("%-8s %10s %10s %10s %10s %10s\n", "stage", "count", "avg_us", "p50_us", "p99_us", "max_us");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const stage_stats_t *st = &pipeline_stats.stage[i];
+        uint64_t count = STATS_GET(st->count);
+        printf("%-8s %10llu %10.1f %10.1f %10.1f %10.1f\n", stage_names[i], (unsigned long long)count,
+               count > 0 ? STATS_GET(st->total_ns) / 1000.0 / count : 0.0,
+               stats_percentile_ns(st, 0.50) / 1000.0, stats_percentile_ns(st, 0.99) / 1000.0,
+               STATS_GET(st->max_ns) / 1000.0);
+    }
+    uint64_t ring_min = STATS_GET(pipeline_stats.ring_fill_min);
+    printf("欠载: %llu 次, 环形缓冲区读空: %llu 次, 流式输入重新缓冲: %llu 次\n",
+           (unsigned long long)STATS_GET(pipeline_stats.underruns),
+           (unsigned long long)STATS_GET(pipeline_stats.ring_empty),
+           (unsigned long long)STATS_GET(pipeline_stats.stream_rebuffers));
+    printf("限幅器衰减: %llu 帧\n", (unsigned long long)STATS_GET(pipeline_stats.limited_frames));
+    if (playback_ring.capacity > 0) {
+        printf("环形缓冲区: %llu/%zu 帧 (最低 %llu)\n", (unsigned long long)STATS_GET(pipeline_stats.ring_fill),
+               playback_ring.capacity, ring_min == UINT64_MAX ? 0ull : (unsigned long long)ring_min);
+    }
+    if (atomic_load_explicit(&pipeline_stats.delay_valid, memory_order_relaxed)) {
+        printf("snd_pcm_delay: %lld 帧 (最小 %lld, 最大 %lld)\n",
+               (long long)STATS_GET(pipeline_stats.pcm_delay), (long long)STATS_GET(pipeline_stats.pcm_delay_min),
+               (long long)STATS_GET(pipeline_stats.pcm_delay_max));
+    }
+    if (STATS_GET(pipeline_stats.first_audio_ns) != 0) {
+        printf("首个音频: 启动后 %.1f ms\n", STATS_GET(pipeline_stats.first_audio_ns) / 1e6);
+    }
+    print_zones();
+    printf("日志: 丢弃 %llu 条, 重复省略 %llu 条\n", (unsigned long long)log_dropped_count(),
+           (unsigned long long)log_suppressed_count());
+    printf("==============\n\n");
+}
+
+// 统计的 key=value 字段 (各阶段耗时单位为微秒)，-T 和离线渲染的报告行共用
+static void stats_print_fields() {
+    uint64_t ring_min = STATS_GET(pipeline_stats.ring_fill_min);
+    printf(" underruns=%llu ring_empty=%llu stream_rebuffers=%llu limited_frames=%llu ring_fill=%llu ring_fill_min=%llu",
+           (unsigned long long)STATS_GET(pipeline_stats.underruns),
+           (unsigned long long)STATS_GET(pipeline_stats.ring_empty),
+           (unsigned long long)STATS_GET(pipeline_stats.stream_rebuffers),
+           (unsigned long long)STATS_GET(pipeline_stats.limited_frames),
+           (unsigned long long)STATS_GET(pipeline_stats.ring_fill),
+           ring_min == UINT64_MAX ? 0ull : (unsigned long long)ring_min);
+    if (atomic_load_explicit(&pipeline_stats.delay_valid, memory_order_relaxed)) {
+        printf(" pcm_delay=%lld pcm_delay_min=%lld pcm_delay_max=%lld",
+               (long long)STATS_GET(pipeline_stats.pcm_delay), (long long)STATS_GET(pipeline_stats.pcm_delay_min),
+               (long long)STATS_GET(pipeline_stats.pcm_delay_max));
+    }
+    printf(" log_dropped=%llu log_suppressed=%llu", (unsigned long long)log_dropped_count(),
+           (unsigned long long)log_suppressed_count());
+    if (STATS_GET(pipeline_stats.first_audio_ns) != 0) {
+        printf(" first_audio_ms=%.1f", STATS_GET(pipeline_stats.first_audio_ns) / 1e6);
+    }
+    for (int i = 0; i < output_zone_count; i++) {
+        const output_zone_t *z = &output_zones[i];
+        printf(" zone%d_error_us=%lld zone%d_ppm=%.1f zone%d_underruns=%llu zone%d_dropped=%llu zone%d_resyncs=%llu",
+               i + 1, (long long)STATS_GET(z->error_us), i + 1, STATS_GET(z->correction_ppb) / 1000.0,
+               i + 1, (unsigned long long)STATS_GET(z->underruns), i + 1, (unsigned long long)STATS_GET(z->dropped_frames),
+               i + 1, (unsigned long long)STATS_GET(z->resyncs));
+    }
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const stage_stats_t *st = &pipeline_stats.stage[i];
+        printf(" %s_count=%llu %s_p50_us=%.1f %s_p99_us=%.1f %s_max_us=%.1f",
+               stage_names[i], (unsigned long long)STATS_GET(st->count),
+               stage_names[i], stats_percentile_ns(st, 0.50) / 1000.0,
+               stage_names[i], stats_percentile_ns(st, 0.99) / 1000.0,
+               stage_names[i], STATS_GET(st->max_ns) / 1000.0);
+    }
+}
+
+// -T 统计行的起点和上一次输出的时刻，只由主线程访问
+static uint64_t stats_start_ns = 0, stats_last_ns = 0;
+
+// 主线程每次轮询: 开启 -T 时按间隔输出一行 key=value
+void stats_poll() {
+    if (stats_interval_seconds <= 0) {
+        return;
+    }
+    uint64_t now = monotonic_ns();
+    if (stats_start_ns == 0) {
+        stats_start_ns = stats_last_ns = now;
+        return;
+    }
+    if (now - stats_last_ns < (uint64_t)stats_interval_seconds * 1000000000ull) {
+        return;
+    }
+    stats_last_ns = now;
+
+    printf("stats uptime_s=%.1f", (now - stats_start_ns) / 1e9);
+    stats_print_fields();
+    printf("\n");
+    fflush(stdout);
+}
+
+// 距下一行 -T 统计的毫秒数 (主线程据此决定 poll 的超时)，未开启时为 -1
+int stats_poll_timeout_ms() {
+    if (stats_interval_seconds <= 0) {
+        return -1;
+    }
+    if (stats_start_ns == 0) {
+        return 0;
+    }
+    uint64_t due = stats_last_ns + (uint64_t)stats_interval_seconds * 1000000000ull;
+    uint64_t now = monotonic_ns();
+    return due <= now ? 0 : (int)((due - now + 999999) / 1000000);
+}
+
+// --- DSP 处理链执行器 ---
+void dsp_graph_init(dsp_graph_t *graph) {
+    memset(graph, 0, sizeof(*graph));
+    pthread_mutex_init(&graph->lock, NULL);
+    graph->input_per_output = 1.0;
+}
+
+// 在 index 处插入节点 (超出范围时追加)；节点先复位，可以交叉淡化的节点从直通淡入
+bool dsp_graph_insert(dsp_graph_t *graph, int index, dsp_node_t *node) {
+    pthread_mutex_lock(&graph->lock);
+    if (graph->count >= DSP_GRAPH_MAX_NODES) {
+        pthread_mutex_unlock(&graph->lock);
+        return false;
+    }
+    if (index < 0 || index > graph->count) {
+        index = graph->count;
+    }
+    memmove(&graph->nodes[index + 1], &graph->nodes[index], (graph->count - index) * sizeof(graph->nodes[0]));
+    graph->nodes[index] = node;
+    graph->count++;
+    if (node->ops->reset != NULL) {
+        node->ops->reset(node);
+    }
+    node->remove_pending = false;
+    // 自动旁路的节点从旁路开始，第一块就需要启用时再淡入
+    node->bypassed = atomic_load(&node->bypass_requested) || node->ops->auto_bypass;
+    node->fade_remaining = node->ops->same_length && !node->bypassed ? DSP_BYPASS_FADE_FRAMES : 0;
+    pthread_mutex_unlock(&graph->lock);
+    return true;
+}
+
+static void dsp_graph_unlink(dsp_graph_t *graph, int index) {
+    memmove(&graph->nodes[index], &graph->nodes[index + 1], (graph->count - index - 1) * sizeof(graph->nodes[0]));
+    graph->count--;
+}
+
+// 可以交叉淡化的节点先淡出，下一次处理淡出完成后才真正摘除，在此之前调用者不能释放节点
+bool dsp_graph_remove(dsp_graph_t *graph, dsp_node_t *node) {
+    pthread_mutex_lock(&graph->lock);
+    for (int i = 0; i < graph->count; i++) {
+        if (graph->nodes[i] != node) {
+            continue;
+        }
+        if (node->ops->same_length && !node->bypassed) {
+            node->remove_pending = true;
+        } else {
+            dsp_graph_unlink(graph, i);
+        }
+        pthread_mutex_unlock(&graph->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&graph->lock);
+    return false;
+}
+
+// 任何线程都可以调用，下一块开始生效
+void dsp_node_set_bypass(dsp_node_t *node, bool bypass) {
+    atomic_store(&node->bypass_requested, bypass);
+}
+
+// 交叉淡化: out = dry + (out - dry) * w，w 在 fade_remaining 帧内从 0 到 1 (启用) 或从 1 到 0 (旁路)
+static void dsp_node_crossfade(dsp_node_t *node, const audio_block_t *dry, audio_block_t *out) {
+    int n = out->frames;
+    int fade = node->fade_remaining < n ? node->fade_remaining : n;
+    for (int ch = 0; ch < out->channels; ch++) {
+        float *y = out->channel[ch];
+        const float *x = dry->channel[ch];
+        int remaining = node->fade_remaining;
+        for (int i = 0; i < fade; i++, remaining--) {
+            float w = (float)remaining / DSP_BYPASS_FADE_FRAMES;
+            if (!node->bypassed) {
+                w = 1.0f - w;
+            }
+            y[i] = x[i] + (y[i] - x[i]) * w;
+        }
+        if (node->bypassed) {
+            memcpy(y + fade, x + fade, (size_t)(n - fade) * sizeof(float));
+        }
+    }
+    node->fade_remaining -= fade;
+}
+
+// 依次执行各节点，返回最后的输出块 (出错返回 NULL)；*modified 表示是否有节点改变了信号
+audio_block_t *dsp_graph_process(dsp_graph_t *graph, audio_block_t *input, bool *modified) {
+    audio_block_t *block = input;
+    bool changed = false;
+    double latency = 0.0, input_per_output = 1.0;
+
+    pthread_mutex_lock(&graph->lock);
+    for (int i = 0; i < graph->count; i++) {
+        dsp_node_t *node = graph->nodes[i];
+        const dsp_node_ops_t *ops = node->ops;
+
+        // 旁路状态变化: 长度不变的节点交叉淡化，其他节点在块边界直接切换，重新启用时复位
+        bool want_bypass = atomic_load(&node->bypass_requested) || node->remove_pending || (ops->auto_bypass && !changed);
+        if (want_bypass != node->bypassed) {
+            node->bypassed = want_bypass;
+            node->fade_remaining = ops->same_length ? DSP_BYPASS_FADE_FRAMES : 0;
+            if (!want_bypass && ops->reset != NULL) {
+                ops->reset(node);
+            }
+        }
+        // 干信号块放不下这一块时不能交叉淡化，切换直接完成 (刚旁路的节点走下面的旁路路径)
+        if (node->fade_remaining > 0 &&
+            (block->frames > graph->dry.capacity || block->channels > graph->dry.channels)) {
+            node->fade_remaining = 0;
+        }
+        if (node->bypassed && node->fade_remaining == 0) {
+            if (node->remove_pending) {
+                node->remove_pending = false;
+                dsp_graph_unlink(graph, i);
+                i--;
+            }
+            continue;
+        }
+
+        bool fading = node->fade_remaining > 0;
+        if (fading) {
+            for (int ch = 0; ch < block->channels; ch++) {
+                memcpy(graph->dry.channel[ch], block->channel[ch], (size_t)block->frames * sizeof(float));
+            }
+        }
+        uint64_t started = node->stats != NULL ? monotonic_ns() : 0;
+        audio_block_t *out = ops->process(node, block);
+        if (node->stats != NULL) {
+            stats_record(node->stats, monotonic_ns() - started);
+        }
+        if (out == NULL) {
+            pthread_mutex_unlock(&graph->lock);
+            return NULL;
+        }
+        if (fading) {
+            dsp_node_crossfade(node, &graph->dry, out);
+        }
+        changed = changed || fading || ops->transparent == NULL || !ops->transparent(node);
+
+        if (ops->latency != NULL) {
+            latency += ops->latency(node) * input_per_output;
+        }
+        if (ops->input_per_output != NULL) {
+            input_per_output *= ops->input_per_output(node);
+        }
+        block = out;
+    }
+    graph->latency = latency;
+    graph->input_per_output = input_per_output;
+    pthread_mutex_unlock(&graph->lock);
+
+    *modified = changed;
+    return block;
+}
+
+// 复位所有节点；正在进行的旁路切换直接完成 (信号本来就从静止开始)
+void dsp_graph_reset(dsp_graph_t *graph) {
+    pthread_mutex_lock(&graph->lock);
+    for (int i = 0; i < graph->count; i++) {
+        dsp_node_t *node = graph->nodes[i];
+        if (node->ops->reset != NULL) {
+            node->ops->reset(node);
+        }
+        node->fade_remaining = 0;
+    }
+    graph->latency = 0.0;
+    pthread_mutex_unlock(&graph->lock);
+}
+
+// 最近一块处理后处理链内部缓存的源帧数；*input_per_output 为每个输出帧对应的源帧数
+double dsp_graph_latency(dsp_graph_t *graph, double *input_per_output) {
+    pthread_mutex_lock(&graph->lock);
+    double latency = graph->latency;
+    if (input_per_output != NULL) {
+        *input_per_output = graph->input_per_output;
+    }
+    pthread_mutex_unlock(&graph->lock);
+    return latency;
+}
+
+static void s16_to_float(const int16_t *src, int channels, int frames, float *const *dst) {
+    const float scale = 1.0f / 32768.0f;
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 s = _mm_set1_ps(scale);
+    if (channels == 2) {
+        for (; i + 4 <= frames; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+            // 16 位符号扩展到 32 位: 放到高半部分再算术右移
+            __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)); // L0 R0 L1 R1
+            __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)); // L2 R2 L3 R3
+            _mm_storeu_ps(dst[0] + i, _mm_mul_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)), s));
+            _mm_storeu_ps(dst[1] + i, _mm_mul_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)), s));
+        }
+    } else if (channels == 1) {
+        for (; i + 8 <= frames; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_storeu_ps(dst[0] + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), s));
+            _mm_storeu_ps(dst[0] + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), s));
+        }
+    }
+#elif FIR_HAVE_NEON
+    const float32x4_t s = vdupq_n_f32(scale);
+    if (channels == 2) {
+        for (; i + 8 <= frames; i += 8) {
+            int16x8x2_t v = vld2q_s16(src + 2 * i);
+            for (int ch = 0; ch < 2; ch++) {
+                vst1q_f32(dst[ch] + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[ch]))), s));
+                vst1q_f32(dst[ch] + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[ch]))), s));
+            }
+        }
+    } else if (channels == 1) {
+        for (; i + 8 <= frames; i += 8) {
+            int16x8_t v = vld1q_s16(src + i);
+            vst1q_f32(dst[0] + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), s));
+            vst1q_f32(dst[0] + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), s));
+        }
+    }
+#endif
+    for (int ch = 0; ch < channels; ch++) {
+        float *d = dst[ch];
+        for (int j = i; j < frames; j++) {
+            d[j] = src[j * channels + ch] * scale;
+        }
+    }
+}
+
+// 交错的 format 样本 -> 平面 float；src 只需按字节对齐
+void pcm_to_float(const unsigned char *src, sample_format_t format, int channels, int frames, float *const *dst) {
+    switch (format) {
+        case SAMPLE_S16:
+            s16_to_float((const int16_t *)src, channels, frames, dst);
+            return;
+        case SAMPLE_U8:
+            for (int ch = 0; ch < channels; ch++) {
+                for (int i = 0; i < frames; i++) {
+                    dst[ch][i] = ((int)src[i * channels + ch] - 128) * (1.0f / 128.0f);
+                }
+            }
+            return;
+        case SAMPLE_S24_3:
+            for (int ch = 0; ch < channels; ch++) {
+                const unsigned char *p = src + 3 * ch;
+                for (int i = 0; i < frames; i++, p += 3 * channels) {
+                    int32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+                    v = (v ^ 0x800000) - 0x800000; // 符号扩展
+                    dst[ch][i] = v * (1.0f / 8388608.0f);
+                }
+            }
+            return;
+        case SAMPLE_S24:
+        case SAMPLE_S32: {
+            // S24_LE 的高字节不保证是符号扩展，左移后再算术右移回来
+            int shift = format == SAMPLE_S24 ? 8 : 0;
+            float scale = format == SAMPLE_S24 ? 1.0f / 8388608.0f : 1.0f / 2147483648.0f;
+            for (int ch = 0; ch < channels; ch++) {
+                for (int i = 0; i < frames; i++) {
+                    int32_t v;
+                    memcpy(&v, src + 4 * (i * channels + ch), 4);
+                    v = (int32_t)((uint32_t)v << shift) >> shift;
+                    dst[ch][i] = v * scale;
+                }
+            }
+            return;
+        }
+        case SAMPLE_FLOAT:
+            for (int ch = 0; ch < channels; ch++) {
+                for (int i = 0; i < frames; i++) {
+                    memcpy(&dst[ch][i], src + 4 * (i * channels + ch), 4);
+                }
+            }
+            return;
+        default:
+            return;
+    }
+}
+
+// 四舍五入 (远离零)，与 SIMD 路径的结果一致；lrint 在 -O2 下不会内联
+static inline int16_t float_to_s16_sample(float x) {
+    if (x > 32767.0f) x = 32767.0f;
+    if (x < -32768.0f) x = -32768.0f;
+    return (int16_t)(x >= 0.0f ? x + 0.5f : x - 0.5f);
+}
+
+static inline int32_t double_to_int_sample(double x, double lo, double hi) {
+    if (x > hi) x = hi;
+    if (x < lo) x = lo;
+    return (int32_t)(x >= 0.0 ? x + 0.5 : x - 0.5);
+}
+
+// noise 为交错排列的抖动 (单位 LSB)，NULL 表示不加；第 i 帧乘以 gain + gain_step * i (软件音量)，
+// 与定标合并成一次乘法，gain 为 1、gain_step 为 0 时结果与不带增益时逐位相同
+static void float_to_s16(float *const *src, int channels, int frames, int16_t *dst, const float *noise,
+                         float gain, float gain_step) {
+    const float scale = 32768.0f;
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 ramp = _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(gain_step));
+    const __m128 lo_limit = _mm_set1_ps(-32768.0f);
+    const __m128 hi_limit = _mm_set1_ps(32767.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    if (channels <= 2) {
+        int step = channels == 2 ? 4 : 8;
+        for (; i + step <= frames; i += step) {
+            __m128 a, b;
+            __m128 g = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(gain + gain_step * i), ramp), s);
+            if (channels == 2) {
+                __m128 l = _mm_mul_ps(_mm_loadu_ps(src[0] + i), g);
+                __m128 r = _mm_mul_ps(_mm_loadu_ps(src[1] + i), g);
+                a = _mm_unpacklo_ps(l, r); // L0 R0 L1 R1
+                b = _mm_unpackhi_ps(l, r); // L2 R2 L3 R3
+            } else {
+                __m128 g_next = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(gain + gain_step * (i + 4)), ramp), s);
+                a = _mm_mul_ps(_mm_loadu_ps(src[0] + i), g);
+                b = _mm_mul_ps(_mm_loadu_ps(src[0] + i + 4), g_next);
+            }
+            if (noise != NULL) {
+                a = _mm_add_ps(a, _mm_loadu_ps(noise + i * channels));
+                b = _mm_add_ps(b, _mm_loadu_ps(noise + i * channels + 4));
+            }
+            // 先限幅 (cvtt 溢出时得到 INT_MIN)，再加上带符号的 0.5 后截断
+            a = _mm_min_ps(_mm_max_ps(a, lo_limit), hi_limit);
+            b = _mm_min_ps(_mm_max_ps(b, lo_limit), hi_limit);
+            a = _mm_add_ps(a, _mm_or_ps(_mm_and_ps(a, sign), half));
+            b = _mm_add_ps(b, _mm_or_ps(_mm_and_ps(b, sign), half));
+            __m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+            _mm_storeu_si128((__m128i *)(dst + i * channels), packed);
+        }
+    }
+#elif defined(__aarch64__)
+    const float32x4_t s = vdupq_n_f32(scale);
+    const float ramp_init[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    const float32x4_t ramp = vmulq_n_f32(vld1q_f32(ramp_init), gain_step);
+    const float32x4_t lo_limit = vdupq_n_f32(-32768.0f);
+    const float32x4_t hi_limit = vdupq_n_f32(32767.0f);
+    if (channels == 2) {
+        for (; i + 4 <= frames; i += 4) {
+            float32x4_t g = vmulq_f32(vaddq_f32(vdupq_n_f32(gain + gain_step * i), ramp), s);
+            float32x4_t l = vmulq_f32(vld1q_f32(src[0] + i), g);
+            float32x4_t r = vmulq_f32(vld1q_f32(src[1] + i), g);
+            if (noise != NULL) {
+                float32x4x2_t n = vld2q_f32(noise + 2 * i);
+                l = vaddq_f32(l, n.val[0]);
+                r = vaddq_f32(r, n.val[1]);
+            }
+            int16x4x2_t out;
+            // vcvtaq: 就近舍入，0.5 远离零，与标量路径一致
+            out.val[0] = vmovn_s32(vcvtaq_s32_f32(vminq_f32(vmaxq_f32(l, lo_limit), hi_limit)));
+            out.val[1] = vmovn_s32(vcvtaq_s32_f32(vminq_f32(vmaxq_f32(r, lo_limit), hi_limit)));
+            vst2_s16(dst + 2 * i, out);
+        }
+    } else if (channels == 1) {
+        for (; i + 4 <= frames; i += 4) {
+            float32x4_t g = vmulq_f32(vaddq_f32(vdupq_n_f32(gain + gain_step * i), ramp), s);
+            float32x4_t x = vmulq_f32(vld1q_f32(src[0] + i), g);
+            if (noise != NULL) {
+                x = vaddq_f32(x, vld1q_f32(noise + i));
+            }
+            vst1_s16(dst + i, vmovn_s32(vcvtaq_s32_f32(vminq_f32(vmaxq_f32(x, lo_limit), hi_limit))));
+        }
+    }
+#endif
+    for (int ch = 0; ch < channels; ch++) {
+        const float *p = src[ch];
+        for (int j = i; j < frames; j++) {
+            float x = p[j] * (scale * (gain + gain_step * j));
+            if (noise != NULL) {
+                x += noise[j * channels + ch];
+            }
+            dst[j * channels + ch] = float_to_s16_sample(x);
+        }
+    }
+}
+
+static void float_to_pcm_frames(float *const *src, int channels, int frames, sample_format_t format,
+                                unsigned char *dst, const float *noise, float gain, float gain_step) {
+    switch (format) {
+        case SAMPLE_S16:
+            float_to_s16(src, channels, frames, (int16_t *)dst, noise, gain, gain_step);
+            return;
+        case SAMPLE_U8:
+            for (int ch = 0; ch < channels; ch++) {
+                for (int i = 0; i < frames; i++) {
+                    float x = src[ch][i] * (gain + gain_step * i) * 128.0f + (noise != NULL ? noise[i * channels + ch] : 0.0f);
+                    dst[i * channels + ch] = (unsigned char)(double_to_int_sample(x, -128.0, 127.0) + 128);
+                }
+            }
+            return;
+        case SAMPLE_S24_3:
+            for (int ch = 0; ch < channels; ch++) {
+                unsigned char *p = dst + 3 * ch;
+                for (int i = 0; i < frames; i++, p += 3 * channels) {
+                    float x = src[ch][i] * (gain + gain_step * i);
+                    int32_t v = double_to_int_sample(x * 8388608.0, -8388608.0, 8388607.0);
+                    p[0] = (unsigned char)v;
+                    p[1] = (unsigned char)(v >> 8);
+                    p[2] = (unsigned char)(v >> 16);
+                }
+            }
+            return;
+        case SAMPLE_S24:
+        case SAMPLE_S32: {
+            double scale = format == SAMPLE_S24 ? 8388608.0 : 2147483648.0;
+            for (int ch = 0; ch < channels; ch++) {
+                for (int i = 0; i < frames; i++) {
+                    float x = src[ch][i] * (gain + gain_step * i);
+                    int32_t v = double_to_int_sample(x * scale, -scale, scale - 1.0);
+                    memcpy(dst + 4 * (i * channels + ch), &v, 4);
+                }
+            }
+            return;
+        }
+        case SAMPLE_FLOAT:
+            for (int ch = 0; ch < channels; ch++) {
+                for (int i = 0; i < frames; i++) {
+                    float x = src[ch][i] * (gain + gain_step * i);
+                    memcpy(dst + 4 * (i * channels + ch), &x, 4);
+                }
+            }
+            return;
+        default:
+            return;
+    }
+}
+
+// TPDF 抖动: 两个 [0,1) 均匀随机数之和减 1，范围 ±1 LSB，与信号无关的量化误差
+static void dither_fill(uint32_t *seed, float *noise, int n) {
+    uint32_t state = *seed;
+    for (int i = 0; i < n; i++) {
+        state = state * 1664525u + 1013904223u;
+        float a = (float)(state >> 8) * (1.0f / 16777216.0f);
+        state = state * 1664525u + 1013904223u;
+        float b = (float)(state >> 8) * (1.0f / 16777216.0f);
+        noise[i] = a + b - 1.0f;
+    }
+    *seed = state;
+}
+
+// 平面 float -> 交错的 format 样本，超出满幅的部分削波；dither_seed 非 NULL 时
+// 8/16 位输出加 TPDF 抖动 (24/32 位的量化噪声已低于 float 精度，不需要)
+void float_to_pcm(float *const *src, int channels, int frames, sample_format_t format,
+                  unsigned char *dst, uint32_t *dither_seed) {
+    float_to_pcm_gain(src, channels, frames, format, dst, dither_seed, 1.0f, 0.0f);
+}
+
+// 同上，第 i 帧先乘以 gain + gain_step * i (软件音量的线性过渡)，与格式转换在同一遍中完成
+void float_to_pcm_gain(float *const *src, int channels, int frames, sample_format_t format,
+                       unsigned char *dst, uint32_t *dither_seed, float gain, float gain_step) {
+    if (dither_seed == NULL || (format != SAMPLE_U8 && format != SAMPLE_S16)) {
+        float_to_pcm_frames(src, channels, frames, format, dst, NULL, gain, gain_step);
+        return;
+    }
+    float noise[DITHER_CHUNK_FRAMES * FIR_MAX_CHANNELS];
+    int frame_bytes = sample_format_bytes(format) * channels;
+    for (int start = 0; start < frames; start += DITHER_CHUNK_FRAMES) {
+        int n = frames - start < DITHER_CHUNK_FRAMES ? frames - start : DITHER_CHUNK_FRAMES;
+        float *chunk[FIR_MAX_CHANNELS];
+        for (int ch = 0; ch < channels; ch++) {
+            chunk[ch] = src[ch] + start;
+        }
+        dither_fill(dither_seed, noise, n * channels);
+        float_to_pcm_frames(chunk, channels, n, format, dst + (size_t)start * frame_bytes, noise,
+                            gain + gain_step * start, gain_step);
+    }
+}
+
+// --- FIR 内核: 标量参考实现 + SSE / AVX2 / NEON，启动时按CPU支持选择 ---
+// 向量化方式: 一次计算4/8个相邻输出，每个抽头广播一个系数，与延迟线的非对齐加载相乘累加
+void fir_kernel_scalar(const float *coeffs, const float *line, float *out, int n, int taps) {
+    for (int i = 0; i < n; i++) {
+        float acc = 0.0f;
+        for (int j = 0; j < taps; j++) {
+            acc += coeffs[j] * line[i + j];
+        }
+        out[i] = acc;
+    }
+}
+
+#if FIR_HAVE_X86
+__attribute__((target("sse")))
+static void fir_kernel_sse(const float *coeffs, const float *line, float *out, int n, int taps) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        for (int j = 0; j < taps; j++) {
+            __m128 c = _mm_set1_ps(coeffs[j]);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(c, _mm_loadu_ps(line + i + j)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(c, _mm_loadu_ps(line + i + j + 4)));
+        }
+        _mm_storeu_ps(out + i, acc0);
+        _mm_storeu_ps(out + i + 4, acc1);
+    }
+    fir_kernel_scalar(coeffs, line + i, out + i, n - i, taps);
+}
+
+__attribute__((target("avx2,fma")))
+static void fir_kernel_avx2(const float *coeffs, const float *line, float *out, int n, int taps) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        for (int j = 0; j < taps; j++) {
+            __m256 c = _mm256_set1_ps(coeffs[j]);
+            acc0 = _mm256_fmadd_ps(c, _mm256_loadu_ps(line + i + j), acc0);
+            acc1 = _mm256_fmadd_ps(c, _mm256_loadu_ps(line + i + j + 8), acc1);
+        }
+        _mm256_storeu_ps(out + i, acc0);
+        _mm256_storeu_ps(out + i + 8, acc1);
+    }
+    fir_kernel_sse(coeffs, line + i, out + i, n - i, taps);
+}
+#endif
+
+#if FIR_HAVE_NEON
+static void fir_kernel_neon(const float *coeffs, const float *line, float *out, int n, int taps) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        float32x4_t acc0 = vdupq_n_f32(0.0f);
+        float32x4_t acc1 = vdupq_n_f32(0.0f);
+        for (int j = 0; j < taps; j++) {
+            acc0 = vmlaq_n_f32(acc0, vld1q_f32(line + i + j), coeffs[j]);
+            acc1 = vmlaq_n_f32(acc1, vld1q_f32(line + i + j + 4), coeffs[j]);
+        }
+        vst1q_f32(out + i, acc0);
+        vst1q_f32(out + i + 4, acc1);
+    }
+    fir_kernel_scalar(coeffs, line + i, out + i, n - i, taps);
+}
+#endif
+
+// 按名称查找当前CPU可用的内核，不可用时返回 NULL
+fir_kernel_fn fir_kernel_lookup(const char *name) {
+    if (strcmp(name, "scalar") == 0) {
+        return fir_kernel_scalar;
+    }
+#if FIR_HAVE_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse") == 0 && __builtin_cpu_supports("sse")) {
+        return fir_kernel_sse;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return fir_kernel_avx2;
+    }
+#endif
+#if FIR_HAVE_NEON
+    if (strcmp(name, "neon") == 0) {
+        return fir_kernel_neon;
+    }
+#endif
+    return NULL;
+}
+
+// 选择FIR内核；requested 为 NULL 或 "auto" 时选最快的可用内核
+const char *fir_select_kernel(const char *requested) {
+    const char *candidates[] = {"avx2", "neon", "sse", "scalar"};
+
+    if (requested != NULL && strcmp(requested, "auto") != 0) {
+        fir_kernel_fn fn = fir_kernel_lookup(requested);
+        if (fn != NULL) {
+            fir_kernel = fn;
+            fir_kernel_name = requested;
+            return fir_kernel_name;
+        }
+        char warn_msg[LOG_BUFFER_SIZE];
+        snprintf(warn_msg, sizeof(warn_msg), "FIR kernel '%s' not available on this CPU, using auto", requested);
+        log_program_info("WARNING", warn_msg);
+    }
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        fir_kernel_fn fn = fir_kernel_lookup(candidates[i]);
+        if (fn != NULL) {
+            fir_kernel = fn;
+            fir_kernel_name = candidates[i];
+            break;
+        }
+    }
+    return fir_kernel_name;
+}
+
+// 有效系数: gain * mix * h[j] + (1 - mix) * δ[j]，再反转以便与线性延迟线按时间顺序相乘
+static void fir_build_effective_coeffs(equalizer_mode_t mode, float *out) {
+    const double* coeffs;
+    double gain = 1.0;
+    double mix_ratio = 0.7;  // Mix 70% filtered + 30% original for more natural sound
+
+    switch(mode) {
+        case EQ_BASS_BOOST:
+            coeffs = bass_boost_coeffs;
+            gain = 2.0;  // Boost gain for bass
+            break;
+        case EQ_TREBLE_BOOST:
+            coeffs = treble_boost_coeffs;
+            gain = 1.5;  // Moderate gain for treble
+            break;
+        case EQ_VOCAL_ENHANCE:
+            coeffs = vocal_enhance_coeffs;
+            gain = 1.8;  // Boost vocals
+            mix_ratio = 0.6;  // Less mixing for vocals
+            break;
+        default:
+            memset(out, 0, FIR_TAP_NUM * sizeof(float));
+            out[FIR_TAP_NUM - 1] = 1.0f;
+            return;
+    }
+
+    for (int j = 0; j < FIR_TAP_NUM; j++) {
+        double c = coeffs[j] * gain * mix_ratio;
+        if (j == 0) {
+            c += 1.0 - mix_ratio;
+        }
+        out[FIR_TAP_NUM - 1 - j] = (float)c;
+    }
+}
+
+// 确保每个声道的延迟线能容纳 frames 帧 (只在块大小变大时重新分配)
+static bool fir_ensure_capacity(int channels, int frames) {
+    if (frames <= fir_state.capacity) {
+        return true;
+    }
+    int history = FIR_TAP_NUM - 1;
+    for (int ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+        float *line = (float *)realloc(fir_state.line[ch], (history + frames) * sizeof(float));
+        if (line == NULL) {
+            return false;
+        }
+        if (fir_state.capacity == 0) {
+            memset(line, 0, history * sizeof(float));
+        }
+        fir_state.line[ch] = line;
+    }
+    fir_state.capacity = frames;
+    (void)channels;
+    return true;
+}
+
+void reset_fir_state() {
+    convolver_reset(conv_state);
+    memset(biquad_eq.z, 0, sizeof(biquad_eq.z));
+    if (fir_state.capacity == 0) {
+        return;
+    }
+    for (int ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+        memset(fir_state.line[ch], 0, (FIR_TAP_NUM - 1) * sizeof(float));
+    }
+}
+
+// --- 分区卷积均衡器 ---
+conv_ir_t *conv_ir_create(const float *taps, int length, int channels, unsigned int sample_rate) {
+    if (length <= 0 || channels <= 0 || channels > FIR_MAX_CHANNELS) {
+        return NULL;
+    }
+    conv_ir_t *ir = (conv_ir_t *)calloc(1, sizeof(conv_ir_t));
+    if (ir == NULL) {
+        return NULL;
+    }
+    ir->block = CONV_BLOCK_SIZE;
+    ir->bins = CONV_BLOCK_SIZE + 1;
+    ir->partitions = (length + CONV_BLOCK_SIZE - 1) / CONV_BLOCK_SIZE;
+    ir->channels = channels;
+    ir->taps = length;
+    ir->sample_rate = sample_rate;
+    ir->plan = fft_plan_create(2 * CONV_BLOCK_SIZE);
+    ir->spectra = (Complex *)malloc((size_t)channels * ir->partitions * ir->bins * sizeof(Complex));
+    float *padded = (float *)calloc(2 * CONV_BLOCK_SIZE, sizeof(float));
+    if (ir->plan == NULL || ir->spectra == NULL || padded == NULL) {
+        free(padded);
+        conv_ir_destroy(ir);
+        return NULL;
+    }
+
+    // 每个分区补零到 2B 后变换，重叠保留时取逆变换的后 B 个样本
+    for (int ch = 0; ch < channels; ch++) {
+        const float *h = taps + (size_t)ch * length;
+        for (int p = 0; p < ir->partitions; p++) {
+            int start = p * CONV_BLOCK_SIZE;
+            int count = length - start < CONV_BLOCK_SIZE ? length - start : CONV_BLOCK_SIZE;
+            memset(padded, 0, 2 * CONV_BLOCK_SIZE * sizeof(float));
+            memcpy(padded, h + start, count * sizeof(float));
+            fft_real_forward(ir->plan, padded,
+                             ir->spectra + ((size_t)ch * ir->partitions + p) * ir->bins);
+        }
+    }
+    free(padded);
+    return ir;
+}
+
+void conv_ir_destroy(conv_ir_t *ir) {
+    if (ir == NULL) {
+        return;
+    }
+    fft_plan_destroy(ir->plan);
+    free(ir->spectra);
+    free(ir);
+}
+
+// WAV 冲激响应: PCM 16/24/32 位或 32 位浮点，任意声道数 (不超过 FIR_MAX_CHANNELS)
+static conv_ir_t *conv_ir_load_wav(FILE *file, const char *path) {
+    char chunk_id[4];
+    uint32_t chunk_size;
+    uint16_t format = 0, channels = 0, bits = 0;
+    uint32_t sample_rate = 0;
+    unsigned char *data = NULL;
+    uint32_t data_size = 0;
+
+    fseek(file, 12, SEEK_SET); // 跳过 RIFF/长度/WAVE
+    while (fread(chunk_id, 1, 4, file) == 4 && fread(&chunk_size, 1, 4, file) == 4) {
+        long next = ftell(file) + chunk_size + (chunk_size & 1);
+        if (strncmp(chunk_id, "fmt ", 4) == 0 && chunk_size >= 16) {
+            unsigned char fmt[40] = {0};
+            size_t fmt_bytes = chunk_size < sizeof(fmt) ? chunk_size : sizeof(fmt);
+            if (fread(fmt, 1, fmt_bytes, file) != fmt_bytes) {
+                break;
+            }
+            memcpy(&format, fmt, 2);
+            memcpy(&channels, fmt + 2, 2);
+            memcpy(&sample_rate, fmt + 4, 4);
+            memcpy(&bits, fmt + 14, 2);
+            if (format == 0xFFFE && fmt_bytes >= 26) {
+                memcpy(&format, fmt + 24, 2); // WAVE_FORMAT_EXTENSIBLE 的子格式
+            }
+        } else if (strncmp(chunk_id, "data", 4) == 0) {
+            data = (unsigned char *)malloc(chunk_size);
+            if (data == NULL || fread(data, 1, chunk_size, file) != chunk_size) {
+                break;
+            }
+            data_size = chunk_size;
+        }
+        if (data != NULL && channels != 0) {
+            break;
+        }
+        fseek(file, next, SEEK_SET);
+    }
+
+    int bytes = bits / 8;
+    bool supported = (format == 1 && (bits == 16 || bits == 24 || bits == 32)) || (format == 3 && bits == 32);
+    if (data == NULL || channels == 0 || channels > FIR_MAX_CHANNELS || !supported) {
+        char error_msg[LOG_BUFFER_SIZE];
+        snprintf(error_msg, sizeof(error_msg), "Unsupported impulse response WAV: %s (format %u, %u bits, %u channels)",
+                 path, format, bits, channels);
+        log_program_info("ERROR", error_msg);
+        free(data);
+        return NULL;
+    }
+
+    int length = data_size / (bytes * channels);
+    if (length > CONV_MAX_TAPS) {
+        log_program_info("WARNING", "Impulse response truncated to CONV_MAX_TAPS");
+        length = CONV_MAX_TAPS;
+    }
+    float *taps = (float *)malloc((size_t)length * channels * sizeof(float));
+    if (taps == NULL) {
+        free(data);
+        return NULL;
+    }
+    for (int i = 0; i < length; i++) {
+        for (int ch = 0; ch < channels; ch++) {
+            const unsigned char *s = data + ((size_t)i * channels + ch) * bytes;
+            float v;
+            if (format == 3) {
+                memcpy(&v, s, 4);
+            } else if (bits == 16) {
+                v = (int16_t)(s[0] | (s[1] << 8)) / 32768.0f;
+            } else if (bits == 24) {
+                int32_t x = (int32_t)((uint32_t)s[0] << 8 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 24);
+                v = (float)(x / 2147483648.0);
+            } else {
+                int32_t x;
+                memcpy(&x, s, 4);
+                v = (float)(x / 2147483648.0);
+            }
+            taps[(size_t)ch * length + i] = v;
+        }
+    }
+    free(data);
+
+    conv_ir_t *ir = conv_ir_create(taps, length, channels, sample_rate);
+    free(taps);
+    return ir;
+}
+
+// 文本系数文件: 空白或逗号分隔的浮点数，'#' 到行尾为注释，单声道
+static conv_ir_t *conv_ir_load_text(FILE *file) {
+    int capacity = 1024, length = 0;
+    float *taps = (float *)malloc(capacity * sizeof(float));
+    char line[1024];
+
+    while (taps != NULL && fgets(line, sizeof(line), file) != NULL) {
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char *cursor = line;
+        while (*cursor != '\0') {
+            char *end;
+            float v = strtof(cursor, &end);
+            if (end == cursor) {
+                cursor++; // 跳过分隔符
+                continue;
+            }
+            cursor = end;
+            if (length == CONV_MAX_TAPS) {
+                continue;
+            }
+            if (length == capacity) {
+                capacity *= 2;
+                float *grown = (float *)realloc(taps, capacity * sizeof(float));
+                if (grown == NULL) {
+                    free(taps);
+                    return NULL;
+                }
+                taps = grown;
+            }
+            taps[length++] = v;
+        }
+    }
+    if (taps == NULL || length == 0) {
+        log_program_info("ERROR", "Coefficient file contains no taps");
+        free(taps);
+        return NULL;
+    }
+
+    conv_ir_t *ir = conv_ir_create(taps, length, 1, 0);
+    free(taps);
+    return ir;
+}
+
+conv_ir_t *conv_ir_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        char error_msg[LOG_BUFFER_SIZE];
+        snprintf(error_msg, sizeof(error_msg), "Error opening impulse response: %s", path);
+        log_program_info("ERROR", error_msg);
+        return NULL;
+    }
+
+    char magic[12] = {0};
+    size_t got = fread(magic, 1, sizeof(magic), file);
+    conv_ir_t *ir;
+    if (got == sizeof(magic) && strncmp(magic, "RIFF", 4) == 0 && strncmp(magic + 8, "WAVE", 4) == 0) {
+        ir = conv_ir_load_wav(file, path);
+    } else {
+        rewind(file);
+        ir = conv_ir_load_text(file);
+    }
+    fclose(file);
+
+    if (ir != NULL) {
+        char info_msg[LOG_BUFFER_SIZE];
+        snprintf(info_msg, sizeof(info_msg), "Impulse response %s: %d taps, %d channel(s), %d partitions of %d, latency %d frames",
+                 path, ir->taps, ir->channels, ir->partitions, ir->block, ir->block);
+        log_program_info("INFO", info_msg);
+    }
+    return ir;
+}
+
+convolver_t *convolver_create(const conv_ir_t *ir, int channels) {
+    if (ir == NULL || channels <= 0 || channels > FIR_MAX_CHANNELS) {
+        return NULL;
+    }
+    convolver_t *c = (convolver_t *)calloc(1, sizeof(convolver_t));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->ir = ir;
+    c->channels = channels;
+    c->accum = (Complex *)malloc(ir->bins * sizeof(Complex));
+    c->time = (float *)malloc(2 * ir->block * sizeof(float));
+    bool ok = c->accum != NULL && c->time != NULL;
+    for (int ch = 0; ch < channels && ok; ch++) {
+        conv_channel_t *cc = &c->channel[ch];
+        cc->input = (float *)malloc(2 * ir->block * sizeof(float));
+        cc->output = (float *)malloc(ir->block * sizeof(float));
+        cc->fdl = (Complex *)malloc((size_t)ir->partitions * ir->bins * sizeof(Complex));
+        ok = cc->input != NULL && cc->output != NULL && cc->fdl != NULL;
+    }
+    if (!ok) {
+        convolver_destroy(c);
+        return NULL;
+    }
+    convolver_reset(c);
+    return c;
+}
+
+void convolver_destroy(convolver_t *c) {
+    if (c == NULL) {
+        return;
+    }
+    for (int ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+        free(c->channel[ch].input);
+        free(c->channel[ch].output);
+        free(c->channel[ch].fdl);
+    }
+    free(c->accum);
+    free(c->time);
+    free(c);
+}
+
+void convolver_reset(convolver_t *c) {
+    if (c == NULL) {
+        return;
+    }
+    const conv_ir_t *ir = c->ir;
+    for (int ch = 0; ch < c->channels; ch++) {
+        memset(c->channel[ch].input, 0, 2 * ir->block * sizeof(float));
+        memset(c->channel[ch].output, 0, ir->block * sizeof(float));
+        memset(c->channel[ch].fdl, 0, (size_t)ir->partitions * ir->bins * sizeof(Complex));
+    }
+    c->pos = 0;
+    c->fdl_head = 0;
+}
+
+// acc += x * h，逐频点复数乘加
+static void conv_complex_mac(const Complex *x, const Complex *h, Complex *acc, int n) {
+    for (int k = 0; k < n; k++) {
+        acc[k].real += x[k].real * h[k].real - x[k].imag * h[k].imag;
+        acc[k].imag += x[k].real * h[k].imag + x[k].imag * h[k].real;
+    }
+}
+
+// 一个完整块: 新输入谱进入延迟线，与各分区谱相乘累加后逆变换
+static void conv_process_block(convolver_t *c) {
+    const conv_ir_t *ir = c->ir;
+    int B = ir->block, bins = ir->bins, P = ir->partitions;
+
+    c->fdl_head = c->fdl_head + 1 == P ? 0 : c->fdl_head + 1;
+    for (int ch = 0; ch < c->channels; ch++) {
+        conv_channel_t *cc = &c->channel[ch];
+        const Complex *spectra = ir->spectra + (size_t)(ch < ir->channels ? ch : 0) * P * bins;
+
+        fft_real_forward(ir->plan, cc->input, cc->fdl + (size_t)c->fdl_head * bins);
+
+        // 分区 p 与 p 块之前的输入谱相乘
+        memset(c->accum, 0, bins * sizeof(Complex));
+        int idx = c->fdl_head;
+        for (int p = 0; p < P; p++) {
+            conv_complex_mac(cc->fdl + (size_t)idx * bins, spectra + (size_t)p * bins, c->accum, bins);
+            idx = idx == 0 ? P - 1 : idx - 1;
+        }
+
+        fft_real_inverse(ir->plan, c->accum, c->time);
+        memcpy(cc->output, c->time + B, B * sizeof(float));
+        memcpy(cc->input, cc->input + B, B * sizeof(float));
+    }
+}
+
+// 平面 float 输入输出，frames 任意；输出比输入延迟 B 帧，input 与 output 可以相同
+void convolver_process(convolver_t *c, float *const *input, float *const *output, int frames) {
+    int B = c->ir->block;
+    int num_channels = c->channels;
+    int done = 0;
+
+    while (done < frames) {
+        int n = B - c->pos;
+        if (n > frames - done) {
+            n = frames - done;
+        }
+        for (int ch = 0; ch < num_channels; ch++) {
+            conv_channel_t *cc = &c->channel[ch];
+            memcpy(cc->input + B + c->pos, input[ch] + done, n * sizeof(float));
+            memcpy(output[ch] + done, cc->output + c->pos, n * sizeof(float));
+        }
+        c->pos += n;
+        done += n;
+        if (c->pos == B) {
+            conv_process_block(c);
+            c->pos = 0;
+        }
+    }
+}
+
+// 卷积模式下的均衡器: 声道数变化时重建状态，从其他模式切回时清空状态
+static bool apply_convolution_filter(const audio_block_t *input, audio_block_t *output) {
+    int num_channels = input->channels;
+    if (conv_ir == NULL) {
+        return false;
+    }
+    if (conv_state == NULL || conv_state->channels != num_channels) {
+        convolver_destroy(conv_state);
+        conv_state = convolver_create(conv_ir, num_channels);
+        if (conv_state == NULL) {
+            return false;
+        }
+    } else if (!conv_active) {
+        convolver_reset(conv_state);
+    }
+    conv_active = true;
+
+    convolver_process(conv_state, input->channel, output->channel, input->frames);
+    return true;
+}
+
+// --- 参数均衡器 (双二阶级联) ---
+// 各预设的频段，与 FIR 系数表对应的模式一一对应；freq 为 0 的频段直通
+static const eq_band_t biquad_presets[4][BIQUAD_MAX_BANDS] = {
+    [EQ_NORMAL] = {{0}},
+    [EQ_BASS_BOOST] = {
+        {BIQUAD_LOW_SHELF, 120.0, 0.707, 6.0},
+        {BIQUAD_PEAKING, 60.0, 1.0, 2.0},
+    },
+    [EQ_TREBLE_BOOST] = {
+        {BIQUAD_HIGH_SHELF, 6000.0, 0.707, 5.0},
+        {BIQUAD_PEAKING, 12000.0, 1.2, 2.0},
+    },
+    [EQ_VOCAL_ENHANCE] = {
+        {BIQUAD_LOW_SHELF, 150.0, 0.707, -3.0},
+        {BIQUAD_PEAKING, 1500.0, 0.9, 3.0},
+        {BIQUAD_PEAKING, 3000.0, 1.2, 2.0},
+    },
+};
+
+// RBJ Audio EQ Cookbook 公式，结果按 a0 归一化
+void biquad_design(const eq_band_t *band, unsigned int sample_rate, biquad_coeffs_t *out) {
+    if (band->freq <= 0.0 || sample_rate == 0) {
+        out->b0 = 1.0;
+        out->b1 = out->b2 = out->a1 = out->a2 = 0.0;
+        return;
+    }
+    double freq = band->freq;
+    if (freq > 0.45 * sample_rate) {
+        freq = 0.45 * sample_rate; // 低采样率时避免超过奈奎斯特频率
+    }
+    double A = pow(10.0, band->gain_db / 40.0);
+    double w0 = 2.0 * M_PI * freq / sample_rate;
+    double cos_w0 = cos(w0);
+    double alpha = sin(w0) / (2.0 * band->q);
+    double sqrt_a = 2.0 * sqrt(A) * alpha;
+    double b0, b1, b2, a0, a1, a2;
+
+    switch (band->type) {
+        case BIQUAD_LOW_SHELF:
+            b0 = A * ((A + 1) - (A - 1) * cos_w0 + sqrt_a);
+            b1 = 2 * A * ((A - 1) - (A + 1) * cos_w0);
+            b2 = A * ((A + 1) - (A - 1) * cos_w0 - sqrt_a);
+            a0 = (A + 1) + (A - 1) * cos_w0 + sqrt_a;
+            a1 = -2 * ((A - 1) + (A + 1) * cos_w0);
+            a2 = (A + 1) + (A - 1) * cos_w0 - sqrt_a;
+            break;
+        case BIQUAD_HIGH_SHELF:
+            b0 = A * ((A + 1) + (A - 1) * cos_w0 + sqrt_a);
+            b1 = -2 * A * ((A - 1) + (A + 1) * cos_w0);
+            b2 = A * ((A + 1) + (A - 1) * cos_w0 - sqrt_a);
+            a0 = (A + 1) - (A - 1) * cos_w0 + sqrt_a;
+            a1 = 2 * ((A - 1) - (A + 1) * cos_w0);
+            a2 = (A + 1) - (A - 1) * cos_w0 - sqrt_a;
+            break;
+        case BIQUAD_PEAKING:
+        default:
+            b0 = 1 + alpha * A;
+            b1 = -2 * cos_w0;
+            b2 = 1 - alpha * A;
+            a0 = 1 + alpha / A;
+            a1 = -2 * cos_w0;
+            a2 = 1 - alpha / A;
+            break;
+    }
+    out->b0 = b0 / a0;
+    out->b1 = b1 / a0;
+    out->b2 = b2 / a0;
+    out->a1 = a1 / a0;
+    out->a2 = a2 / a0;
+}
+
+// 初始为直通系数、零状态，第一次设置模式时从直通平滑过渡
+void biquad_eq_init(biquad_eq_t *eq) {
+    memset(eq, 0, sizeof(*eq));
+    eq->mode = EQ_NORMAL;
+    for (int b = 0; b < BIQUAD_MAX_BANDS; b++) {
+        eq->current[b].b0 = 1.0;
+        eq->target[b].b0 = 1.0;
+    }
+}
+
+// 改变目标模式: 从当前系数 (可能还在上一次过渡中) 线性过渡，延迟线不清空；
+// 采样率改变 (换曲) 时直接切换并清空状态
+void biquad_eq_set_mode(biquad_eq_t *eq, equalizer_mode_t mode, unsigned int sample_rate) {
+    bool snap = eq->sample_rate != 0 && eq->sample_rate != sample_rate;
+    int preset = (mode >= EQ_NORMAL && mode <= EQ_VOCAL_ENHANCE) ? mode : EQ_NORMAL;
+
+    eq->mode = mode;
+    eq->sample_rate = sample_rate;
+    eq->target_bands = 0;
+    for (int b = 0; b < BIQUAD_MAX_BANDS; b++) {
+        biquad_design(&biquad_presets[preset][b], sample_rate, &eq->target[b]);
+        if (biquad_presets[preset][b].freq > 0.0) {
+            eq->target_bands = b + 1;
+        }
+    }
+    if (snap) {
+        memcpy(eq->current, eq->target, sizeof(eq->current));
+        memset(eq->z, 0, sizeof(eq->z));
+        eq->ramp_remaining = 0;
+        eq->active_bands = eq->target_bands;
+        return;
+    }
+    // 过渡期间新旧预设用到的频段都要计算
+    if (eq->target_bands > eq->active_bands) {
+        eq->active_bands = eq->target_bands;
+    }
+
+    int ramp = (int)(sample_rate * BIQUAD_RAMP_MS / 1000);
+    if (ramp < 1) ramp = 1;
+    for (int b = 0; b < BIQUAD_MAX_BANDS; b++) {
+        const biquad_coeffs_t *c = &eq->current[b], *t = &eq->target[b];
+        eq->step[b].b0 = (t->b0 - c->b0) / ramp;
+        eq->step[b].b1 = (t->b1 - c->b1) / ramp;
+        eq->step[b].b2 = (t->b2 - c->b2) / ramp;
+        eq->step[b].a1 = (t->a1 - c->a1) / ramp;
+        eq->step[b].a2 = (t->a2 - c->a2) / ramp;
+    }
+    eq->ramp_remaining = ramp;
+}
+
+// 一个频段的转置直接II型；先算与 y 无关的部分，缩短跨样本的依赖链
+#define BIQUAD_TICK(c, z0, z1, x) do {                 \
+        double y_ = (c).b0 * (x) + (z0);               \
+        (z0) = ((c).b1 * (x) + (z1)) - (c).a1 * y_;    \
+        (z1) = (c).b2 * (x) - (c).a2 * y_;             \
+        (x) = y_;                                      \
+    } while (0)
+
+// 系数不变时的主循环: 系数和状态放在局部变量里，两个声道一组交替计算，
+// 让两条互不依赖的递推链重叠执行 (单个IIR受乘加延迟限制)
+static void biquad_eq_run_steady(biquad_eq_t *eq, float *const *input, float *const *output,
+                                 int start, int frames, int channels) {
+    int bands = eq->active_bands;
+    biquad_coeffs_t c[BIQUAD_MAX_BANDS];
+    memcpy(c, eq->current, sizeof(c));
+
+    int ch = 0;
+    for (; ch + 2 <= channels; ch += 2) {
+        // z[b][k][声道对]，两个声道的同一运算相邻，编译器可以打包成一条SIMD指令
+        double z[BIQUAD_MAX_BANDS][2][2];
+        for (int b = 0; b < BIQUAD_MAX_BANDS; b++) {
+            for (int k = 0; k < 2; k++) {
+                z[b][k][0] = eq->z[ch][b][k];
+                z[b][k][1] = eq->z[ch + 1][b][k];
+            }
+        }
+        const float *in0 = input[ch], *in1 = input[ch + 1];
+        float *out0 = output[ch], *out1 = output[ch + 1];
+        for (int i = start; i < start + frames; i++) {
+            // 微小偏置防止静音时状态衰减成非规格化数
+            double x[2] = {in0[i] + BIQUAD_DENORMAL_GUARD, in1[i] + BIQUAD_DENORMAL_GUARD};
+#pragma GCC unroll 4
+            for (int b = 0; b < BIQUAD_MAX_BANDS; b++) {
+                double y[2];
+                for (int p = 0; p < 2; p++) {
+                    y[p] = c[b].b0 * x[p] + z[b][0][p];
+                    z[b][0][p] = (c[b].b1 * x[p] + z[b][1][p]) - c[b].a1 * y[p];
+                    z[b][1][p] = c[b].b2 * x[p] - c[b].a2 * y[p];
+                    x[p] = y[p];
+                }
+            }
+            out0[i] = (float)x[0];
+            out1[i] = (float)x[1];
+        }
+        for (int b = 0; b < BIQUAD_MAX_BANDS; b++) {
+            for (int k = 0; k < 2; k++) {
+                eq->z[ch][b][k] = z[b][k][0];
+                eq->z[ch + 1][b][k] = z[b][k][1];
+            }
+        }
+    }
+    for (; ch < channels; ch++) {
+        double za[BIQUAD_MAX_BANDS][2];
+        memcpy(za, eq->z[ch], sizeof(za));
+        for (int i = start; i < start + frames; i++) {
+            double xa = input[ch][i] + BIQUAD_DENORMAL_GUARD;
+            for (int b = 0; b < bands; b++) {
+                BIQUAD_TICK(c[b], za[b][0], za[b][1], xa);
+            }
+            output[ch][i] = (float)xa;
+        }
+        memcpy(eq->z[ch], za, sizeof(za));
+    }
+}
+
+// 平面 float 输入输出 (可以原地)；过渡期间每帧更新一次系数，各声道使用相同的系数轨迹
+void biquad_eq_process(biquad_eq_t *eq, float *const *input, float *const *output, int frames, int channels) {
+    // 正常模式且过渡完成时直通，状态清零以便下次从静止开始
+    if (eq->mode == EQ_NORMAL && eq->ramp_remaining == 0) {
+        for (int ch = 0; ch < channels; ch++) {
+            if (output[ch] != input[ch]) {
+                memcpy(output[ch], input[ch], (size_t)frames * sizeof(float));
+            }
+        }
+        memset(eq->z, 0, sizeof(eq->z));
+        return;
+    }
+
+    int i = 0;
+    for (; i < frames && eq->ramp_remaining > 0; i++) {
+        for (int b = 0; b < eq->active_bands; b++) {
+            biquad_coeffs_t *c = &eq->current[b];
+            const biquad_coeffs_t *s = &eq->step[b];
+            c->b0 += s->b0;
+            c->b1 += s->b1;
+            c->b2 += s->b2;
+            c->a1 += s->a1;
+            c->a2 += s->a2;
+        }
+        if (--eq->ramp_remaining == 0) {
+            memcpy(eq->current, eq->target, sizeof(eq->current));
+            // 不再计算的频段此时已是直通系数，残余状态可以丢弃
+            for (int ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+                for (int b = eq->target_bands; b < eq->active_bands; b++) {
+                    eq->z[ch][b][0] = eq->z[ch][b][1] = 0.0;
+                }
+            }
+            eq->active_bands = eq->target_bands;
+        }
+
+        for (int ch = 0; ch < channels; ch++) {
+            double x = input[ch][i] + BIQUAD_DENORMAL_GUARD;
+            for (int b = 0; b < eq->active_bands; b++) {
+                BIQUAD_TICK(eq->current[b], eq->z[ch][b][0], eq->z[ch][b][1], x);
+            }
+            output[ch][i] = (float)x;
+        }
+    }
+    if (i < frames) {
+        biquad_eq_run_steady(eq, input, output, i, frames - i, channels);
+    }
+}
+
+static void apply_biquad_filter(const audio_block_t *input, audio_block_t *output, equalizer_mode_t mode) {
+
+    // 从其他引擎切换过来时延迟线已过期，从直通重新过渡
+    if (!biquad_active) {
+        biquad_eq_init(&biquad_eq);
+        biquad_active = true;
+    }
+    if ((int)mode != biquad_eq.mode || biquad_eq.sample_rate != wav_header.sample_rate) {
+        biquad_eq_set_mode(&biquad_eq, mode, wav_header.sample_rate);
+    }
+    biquad_eq_process(&biquad_eq, input->channel, output->channel, input->frames, input->channels);
+}
+
+// 平面 float 输入输出，output 需能容纳 input->frames 帧；output 可以就是 input (原地处理)
+void apply_fir_filter(const audio_block_t *input, audio_block_t *output, equalizer_mode_t mode) {
+    int num_channels = input->channels;
+    int frames_in_block = input->frames;
+    int history = FIR_TAP_NUM - 1;
+    output->channels = num_channels;
+    output->frames = frames_in_block;
+
+    if (mode == EQ_CONVOLUTION) {
+        if (apply_convolution_filter(input, output)) {
+            biquad_active = false;
+            return;
+        }
+        mode = EQ_NORMAL; // 冲激响应不可用时直通
+    }
+    conv_active = false;
+
+    if (current_eq_engine == EQ_ENGINE_BIQUAD) {
+        apply_biquad_filter(input, output, mode);
+        return;
+    }
+    biquad_active = false;
+
+    if (!fir_coeffs_ready) {
+        for (int m = 0; m < 4; m++) {
+            fir_build_effective_coeffs((equalizer_mode_t)m, fir_effective_coeffs[m]);
+        }
+        fir_coeffs_ready = true;
+    }
+    bool have_lines = fir_ensure_capacity(num_channels, frames_in_block);
+
+    for (int ch = 0; ch < num_channels; ch++) {
+        if (!have_lines) {
+            if (output->channel[ch] != input->channel[ch]) {
+                memcpy(output->channel[ch], input->channel[ch], frames_in_block * sizeof(float));
+            }
+            continue;
+        }
+        float *line = fir_state.line[ch];
+
+        // 接在线性延迟线的历史样本之后
+        memcpy(line + history, input->channel[ch], frames_in_block * sizeof(float));
+
+        if (mode == EQ_NORMAL) {
+            // 无滤波，直接复制，但保持历史样本连续，切换模式时不会有跳变
+            if (output->channel[ch] != input->channel[ch]) {
+                memcpy(output->channel[ch], input->channel[ch], frames_in_block * sizeof(float));
+            }
+        } else {
+            // 内核从延迟线读取输入，output 与 input 相同时也可以原地处理
+            fir_kernel(fir_effective_coeffs[mode], line, output->channel[ch], frames_in_block, FIR_TAP_NUM);
+        }
+
+        // 最后 FIR_TAP_NUM-1 个样本成为下一块的历史
+        memmove(line, line + frames_in_block, history * sizeof(float));
+    }
+}
+
+// --- 采样率转换 ---
+static unsigned int src_gcd(unsigned int a, unsigned int b) {
+    while (b != 0) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// 第一类零阶修正贝塞尔函数，Kaiser 窗用
+static double src_bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+// 各档位: 每相抽头数、Kaiser beta、通带截止 (相对两者中较低的奈奎斯特频率)
+static void src_quality_params(src_quality_t quality, int *taps, double *beta, double *rolloff) {
+    switch (quality) {
+        case SRC_FAST:
+            *taps = 16; *beta = 5.0; *rolloff = 0.85;
+            break;
+        case SRC_HIGH:
+            *taps = 64; *beta = 9.0; *rolloff = 0.95;
+            break;
+        case SRC_MEDIUM:
+        default:
+            *taps = 32; *beta = 7.0; *rolloff = 0.91;
+            break;
+    }
+}
+
+// adjustable 时总走插值路径，之后可以用 resampler_set_ratio 微调比例 (多区域输出的漂移补偿)
+static resampler_t *resampler_build(unsigned int in_rate, unsigned int out_rate, int channels, src_quality_t quality,
+                                    bool adjustable) {
+    if (in_rate == 0 || out_rate == 0 || channels <= 0 || channels > FIR_MAX_CHANNELS || quality == SRC_OFF) {
+        return NULL;
+    }
+    resampler_t *r = (resampler_t *)calloc(1, sizeof(resampler_t));
+    if (r == NULL) {
+        return NULL;
+    }
+    double beta, rolloff;
+    src_quality_params(quality, &r->taps, &beta, &rolloff);
+    // 降采样时截止频率按比例降低，抽头数同比增加，使过渡带相对输出采样率保持不变
+    if (out_rate < in_rate) {
+        r->taps = ((int)ceil(r->taps * (double)in_rate / out_rate) + 3) & ~3;
+    }
+    unsigned int g = src_gcd(in_rate, out_rate);
+    r->in_rate = in_rate;
+    r->out_rate = out_rate;
+    r->channels = channels;
+    r->quality = quality;
+    r->L = (int)(out_rate / g);
+    r->M = (int)(in_rate / g);
+    r->exact = !adjustable && r->L <= SRC_MAX_EXACT_PHASES;
+    r->phases = r->exact ? r->L : SRC_INTERP_PHASES + 1;
+    r->step = ((uint64_t)in_rate << 32) / out_rate;
+    r->coeffs = (float *)malloc((size_t)r->phases * r->taps * sizeof(float));
+    if (r->coeffs == NULL) {
+        free(r);
+        return NULL;
+    }
+
+    // 相位 p 对应输出时刻落在窗口中心样本之后 p/相数 个输入样本处；
+    // 降采样时截止频率跟随输出的奈奎斯特频率，避免混叠
+    int half = r->taps / 2;
+    int divisions = r->exact ? r->L : SRC_INTERP_PHASES;
+    double cutoff = 0.5 * rolloff * (out_rate < in_rate ? (double)out_rate / in_rate : 1.0);
+    double i0_beta = src_bessel_i0(beta);
+    for (int p = 0; p < r->phases; p++) {
+        float *c = r->coeffs + (size_t)p * r->taps;
+        double sum = 0.0;
+        for (int j = 0; j < r->taps; j++) {
+            double d = j - (half - 1) - (double)p / divisions;
+            double x = 2.0 * cutoff * d;
+            double sinc = fabs(x) < 1e-12 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            double w = d / half;
+            double window = fabs(w) >= 1.0 ? 0.0 : src_bessel_i0(beta * sqrt(1.0 - w * w)) / i0_beta;
+            c[j] = (float)(2.0 * cutoff * sinc * window);
+            sum += c[j];
+        }
+        // 每相直流增益归一化为 1，避免随相位变化的直流纹波
+        for (int j = 0; j < r->taps; j++) {
+            c[j] = (float)(c[j] / sum);
+        }
+    }
+
+    resampler_reset(r);
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg), "Resampler %u -> %u Hz: %s path (L=%d, M=%d), %d taps",
+             in_rate, out_rate, r->exact ? "exact polyphase" : "interpolated", r->L, r->M, r->taps);
+    log_program_info("INFO", info_msg);
+    return r;
+}
+
+resampler_t *resampler_create(unsigned int in_rate, unsigned int out_rate, int channels, src_quality_t quality) {
+    return resampler_build(in_rate, out_rate, channels, quality, false);
+}
+
+resampler_t *resampler_create_adjustable(unsigned int in_rate, unsigned int out_rate, int channels, src_quality_t quality) {
+    return resampler_build(in_rate, out_rate, channels, quality, true);
+}
+
+// ratio > 1 时每个输出样本前进更多输入 (消费得更快)；只对插值路径有效
+void resampler_set_ratio(resampler_t *r, double ratio) {
+    if (r != NULL && !r->exact) {
+        r->step = (uint64_t)((double)r->in_rate / r->out_rate * ratio * 4294967296.0 + 0.5);
+    }
+}
+
+void resampler_destroy(resampler_t *r) {
+    if (r == NULL) {
+        return;
+    }
+    for (int ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+        free(r->line[ch]);
+    }
+    free(r->coeffs);
+    free(r);
+}
+
+void resampler_reset(resampler_t *r) {
+    if (r == NULL) {
+        return;
+    }
+    r->phase = 0;
+    r->frac = 0;
+    r->index = 0;
+    for (int ch = 0; ch < r->channels; ch++) {
+        if (r->line[ch] != NULL) {
+            memset(r->line[ch], 0, (r->taps - 1) * sizeof(float));
+        }
+    }
+}
+
+int resampler_max_output(const resampler_t *r, int input_frames) {
+    return (int)(((uint64_t)input_frames + r->taps) * r->out_rate / r->in_rate) + 2;
+}
+
+static bool resampler_ensure_capacity(resampler_t *r, int frames) {
+    if (frames <= r->capacity) {
+        return true;
+    }
+    int history = r->taps - 1;
+    for (int ch = 0; ch < r->channels; ch++) {
+        float *line = (float *)realloc(r->line[ch], (history + frames) * sizeof(float));
+        if (line == NULL) {
+            return false;
+        }
+        if (r->capacity == 0) {
+            memset(line, 0, history * sizeof(float));
+        }
+        r->line[ch] = line;
+    }
+    r->capacity = frames;
+    return true;
+}
+
+// 平面 float 输入输出，返回输出帧数；输出时刻跨块连续
+int resampler_process(resampler_t *r, float *const *input, int input_frames, float *const *output, int max_output_frames) {
+    int channels = r->channels;
+    int taps = r->taps;
+    int history = taps - 1;
+    if (!resampler_ensure_capacity(r, input_frames)) {
+        return 0;
+    }
+
+    for (int ch = 0; ch < channels; ch++) {
+        memcpy(r->line[ch] + history, input[ch], input_frames * sizeof(float));
+    }
+
+    int line_len = history + input_frames;
+    int index = r->index;
+    int produced = 0;
+    if (r->exact) {
+        // 有理数路径: 每个输出前进 M/L 个输入样本，相位用整数累加，没有漂移也不需要插值
+        int phase = r->phase;
+        while (index + taps <= line_len && produced < max_output_frames) {
+            const float *c = r->coeffs + (size_t)phase * taps;
+            for (int ch = 0; ch < channels; ch++) {
+                output[ch][produced] = dsp_dot_product(c, r->line[ch] + index, taps);
+            }
+            produced++;
+            phase += r->M;
+            index += phase / r->L;
+            phase %= r->L;
+        }
+        r->phase = phase;
+    } else {
+        // 任意比例: 32位小数位置，取相邻两相的结果线性插值
+        uint64_t frac = r->frac;
+        while (index + taps <= line_len && produced < max_output_frames) {
+            uint64_t scaled = frac * SRC_INTERP_PHASES;
+            int p = (int)(scaled >> 32);
+            float alpha = (float)(scaled & 0xFFFFFFFFu) * (1.0f / 4294967296.0f);
+            const float *c0 = r->coeffs + (size_t)p * taps;
+            const float *c1 = c0 + taps;
+            for (int ch = 0; ch < channels; ch++) {
+                const float *x = r->line[ch] + index;
+                float y0 = dsp_dot_product(c0, x, taps);
+                float y1 = dsp_dot_product(c1, x, taps);
+                output[ch][produced] = y0 + alpha * (y1 - y0);
+            }
+            produced++;
+            frac += r->step;
+            index += (int)(frac >> 32);
+            frac &= 0xFFFFFFFFu;
+        }
+        r->frac = frac;
+    }
+
+    // 最后 taps-1 个样本成为下一块的历史，窗口起点随之平移
+    for (int ch = 0; ch < channels; ch++) {
+        memmove(r->line[ch], r->line[ch] + input_frames, history * sizeof(float));
+    }
+    r->index = index - input_frames;
+    return produced;
+}
+
+// 样本格式可识别、声道数不超过 FIR_MAX_CHANNELS 且设备格式已知时走浮点处理链，
+// 否则源数据原样写入设备 (不做任何处理)
+bool dsp_path_supported(const struct WAV_HEADER *header) {
+    return device_format != SAMPLE_FORMAT_UNKNOWN && sample_format_from_wav(header) != SAMPLE_FORMAT_UNKNOWN &&
+           header->num_channels > 0 && header->num_channels <= FIR_MAX_CHANNELS;
+}
+
+// 走浮点处理链的曲目可以在软件中转换到设备采样率
+bool sample_rate_conversion_usable(const struct WAV_HEADER *header) {
+    return src_quality != SRC_OFF && dsp_path_supported(header);
+}
+
+// 当前曲目需要的重采样器；参数变化 (换曲、无缝切换到不同采样率的曲目) 时重建实例
+static bool sample_rate_converter_prepare(int channels) {
+    if (src_state == NULL || src_state->in_rate != wav_header.sample_rate || src_state->out_rate != rate ||
+        src_state->channels != channels || src_state->quality != src_quality) {
+        resampler_destroy(src_state);
+        src_state = resampler_create(wav_header.sample_rate, rate, channels, src_quality);
+        if (src_state == NULL) {
+            log_program_info("ERROR", "Failed to create resampler");
+            return false;
+        }
+    }
+    return true;
+}
+
+// 把 input 转换到设备采样率写入 output，output 的容量由 dsp_chain_prepare 按最大块长留足
+static bool apply_sample_rate_conversion(const audio_block_t *input, audio_block_t *output) {
+    if (!sample_rate_converter_prepare(input->channels)) {
+        return false;
+    }
+    output->channels = input->channels;
+    output->frames = resampler_process(src_state, input->channel, input->frames, output->channel, output->capacity);
+    return true;
+}
+
+// --- 前瞻峰值限幅器 (见 const.h) ---
+limiter_t *limiter_create(int channels, unsigned int sample_rate, int max_block_frames, float ceiling_db) {
+    if (channels <= 0 || channels > FIR_MAX_CHANNELS || sample_rate == 0 || max_block_frames <= 0) {
+        return NULL;
+    }
+    limiter_t *l = (limiter_t *)calloc(1, sizeof(limiter_t));
+    if (l == NULL) {
+        return NULL;
+    }
+    l->channels = channels;
+    l->sample_rate = sample_rate;
+    l->lookahead = (int)(sample_rate * LIMITER_LOOKAHEAD_MS / 1000.0 + 0.5);
+    if (l->lookahead < 1) {
+        l->lookahead = 1;
+    }
+    l->capacity = max_block_frames;
+    // 均值和乘法的舍入误差约 1 ulp，内部上限留出百万分之一的余量
+    l->ceiling = powf(10.0f, ceiling_db / 20.0f) * 0.999999f;
+    l->release = (float)(1.0 - exp(-1000.0 / (LIMITER_RELEASE_MS * sample_rate)));
+    int window = l->lookahead + 1;
+    bool ok = true;
+    for (int ch = 0; ch < channels; ch++) {
+        l->line[ch] = (float *)malloc((size_t)(l->lookahead + max_block_frames) * sizeof(float));
+        ok = ok && l->line[ch] != NULL;
+    }
+    l->gain = (float *)malloc((size_t)max_block_frames * sizeof(float));
+    l->max_value = (float *)malloc((size_t)window * sizeof(float));
+    l->max_index = (long *)malloc((size_t)window * sizeof(long));
+    l->hold = (float *)malloc((size_t)window * sizeof(float));
+    if (!ok || l->gain == NULL || l->max_value == NULL || l->max_index == NULL || l->hold == NULL) {
+        limiter_destroy(l);
+        return NULL;
+    }
+    limiter_reset(l);
+    return l;
+}
+
+void limiter_destroy(limiter_t *l) {
+    if (l == NULL) {
+        return;
+    }
+    for (int ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+        free(l->line[ch]);
+    }
+    free(l->gain);
+    free(l->max_value);
+    free(l->max_index);
+    free(l->hold);
+    free(l);
+}
+
+void limiter_reset(limiter_t *l) {
+    if (l == NULL) {
+        return;
+    }
+    int window = l->lookahead + 1;
+    for (int i = 0; i < window; i++) {
+        l->hold[i] = 1.0f;
+    }
+    l->hold_sum = window;
+    l->hold_pos = 0;
+    l->envelope = 1.0f;
+    l->max_head = 0;
+    l->max_count = 0;
+    l->frame = 0;
+    l->primed = false;
+}
+
+// dst = src * gain，逐帧增益对所有声道相同
+static void limiter_apply_gain(const float *gain, const float *src, float *dst, int n) {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), _mm_loadu_ps(gain + i)));
+    }
+#elif defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(dst + i, vmulq_f32(vld1q_f32(src + i), vld1q_f32(gain + i)));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = src[i] * gain[i];
+    }
+}
+
+// 输出第 n 帧是输入第 n-L 帧乘以 mean(env[n-L..n])，env[k] <= ceiling / max|x[k-L..k]|，
+// 所以均值中的每一项都已经 <= ceiling / |x[n-L]|，峰值不会超过 ceiling
+int limiter_process(limiter_t *l, float *const *samples, int frames) {
+    int lookahead = l->lookahead;
+    int window = lookahead + 1;
+    int channels = l->channels;
+    if (!l->primed) {
+        for (int ch = 0; ch < channels; ch++) {
+            for (int i = 0; i < lookahead; i++) {
+                l->line[ch][i] = samples[ch][0];
+            }
+        }
+        // 填入的 L 帧当作第 -L..-1 帧，同样进入峰值窗口和增益历史，输出开头也不会越过上限
+        float peak = 0.0f;
+        for (int ch = 0; ch < channels; ch++) {
+            peak = fmaxf(peak, fabsf(samples[ch][0]));
+        }
+        float g = l->ceiling / fmaxf(peak, l->ceiling);
+        for (int i = 0; i < window; i++) {
+            l->hold[i] = g;
+        }
+        l->hold_sum = (double)g * window;
+        l->envelope = g;
+        l->max_value[0] = peak;
+        l->max_index[0] = l->frame - 1;
+        l->max_head = 0;
+        l->max_count = 1;
+        l->primed = true;
+    }
+    for (int ch = 0; ch < channels; ch++) {
+        memcpy(l->line[ch] + lookahead, samples[ch], (size_t)frames * sizeof(float));
+    }
+
+    // 先求每帧各声道的最大绝对值 (可向量化)，放在 gain 中，再逐帧算增益
+    float *gain = l->gain;
+    memset(gain, 0, (size_t)frames * sizeof(float));
+    for (int ch = 0; ch < channels; ch++) {
+        const float *x = samples[ch];
+        for (int i = 0; i < frames; i++) {
+            gain[i] = fmaxf(gain[i], fabsf(x[i]));
+        }
+    }
+
+    // 状态先搬到局部变量，避免每帧经过指针写回 (gain/hold 的写入会让编译器假定别名)
+    const float inv_window = 1.0f / window;
+    const float ceiling = l->ceiling;
+    const float release = l->release;
+    float *max_value = l->max_value;
+    long *max_index = l->max_index;
+    float *hold = l->hold;
+    int head = l->max_head;
+    int count = l->max_count;
+    int hold_pos = l->hold_pos;
+    long frame = l->frame;
+    float envelope = l->envelope;
+    double hold_sum = l->hold_sum;
+    int limited = 0;
+    for (int i = 0; i < frames; i++) {
+        float peak = gain[i];
+        // 最近 L+1 帧峰值的滑动最大值 (单调递减队列)
+        long n = frame++;
+        if (count > 0 && max_index[head] <= n - window) {
+            head = head + 1 == window ? 0 : head + 1;
+            count--;
+        }
+        int tail = head + count;
+        tail -= tail >= window ? window : 0;
+        while (count > 0) {
+            int last = tail == 0 ? window - 1 : tail - 1;
+            if (max_value[last] > peak) {
+                break;
+            }
+            tail = last;
+            count--;
+        }
+        max_value[tail] = peak;
+        max_index[tail] = n;
+        count++;
+
+        float target = ceiling / fmaxf(max_value[head], ceiling);
+        envelope = fminf(target, envelope + (target - envelope) * release);
+        hold_sum += envelope - hold[hold_pos];
+        hold[hold_pos] = envelope;
+        if (++hold_pos == window) {
+            // 每绕一圈重新求和，累加误差不会让静止时的增益偏离 1
+            hold_pos = 0;
+            double sum = 0.0;
+            for (int k = 0; k < window; k++) {
+                sum += hold[k];
+            }
+            hold_sum = sum;
+        }
+        float g = fminf((float)hold_sum * inv_window, 1.0f);
+        gain[i] = g;
+        limited += g < 1.0f;
+    }
+    l->max_head = head;
+    l->max_count = count;
+    l->hold_pos = hold_pos;
+    l->frame = frame;
+    l->envelope = envelope;
+    l->hold_sum = hold_sum;
+
+    for (int ch = 0; ch < channels; ch++) {
+        limiter_apply_gain(gain, l->line[ch], samples[ch], frames);
+        memmove(l->line[ch], l->line[ch] + frames, (size_t)lookahead * sizeof(float));
+    }
+    return limited;
+}
+
+// 处理链末端的限幅器，按设备采样率和声道数创建，块长变大时重建
+static limiter_t *limiter_state = NULL;
+
+static bool limiter_prepare(int channels, int max_frames) {
+    if (limiter_state == NULL || limiter_state->channels != channels || limiter_state->sample_rate != rate ||
+        limiter_state->capacity < max_frames) {
+        limiter_destroy(limiter_state);
+        limiter_state = limiter_create(channels, rate, max_frames, limiter_ceiling_db);
+        if (limiter_state == NULL) {
+            log_program_info("ERROR", "Failed to create output limiter");
+            return false;
+        }
+    }
+    return true;
+}
+
+// 播放控制功能
+void toggle_pause() {
+    if (current_state == PLAYING) {
+        current_state = PAUSED;
+        log_user_operation("PAUSE", "SUCCESS");
+        printf("暂停播放\n");
+    } else if (current_state == PAUSED) {
+        current_state = PLAYING;
+        wake_event_signal(&ring_space_event);
+        wake_event_signal(&ring_data_event);
+        zones_wake();
+        log_user_operation("RESUME", "SUCCESS");
+        printf("继续播放\n");
+    }
+}
+
+void next_track() {
+    if (playlist_count <= 1) {
+        log_user_operation("NEXT_TRACK", "FAILED - No more tracks");
+        printf("没有下一首歌曲\n");
+        return;
+    }
+    
+    int base = requested_track >= 0 ? requested_track : current_track;
+    int target = (base + 1) % playlist_count;
+    if (!control_send(CONTROL_CMD_TRACK, target)) {
+        log_user_operation("NEXT_TRACK", "FAILED - Control queue full");
+        return;
+    }
+    requested_track = target;
+    log_user_operation("NEXT_TRACK", "SUCCESS");
+    printf("切换到下一首: %s\n", playlist_path(target));
+}
+
+void previous_track() {
+    if (playlist_count <= 1) {
+        log_user_operation("PREVIOUS_TRACK", "FAILED - No more tracks");
+        printf("没有上一首歌曲\n");
+        return;
+    }
+    
+    int base = requested_track >= 0 ? requested_track : current_track;
+    int target = (base - 1 + playlist_count) % playlist_count;
+    if (!control_send(CONTROL_CMD_TRACK, target)) {
+        log_user_operation("PREVIOUS_TRACK", "FAILED - Control queue full");
+        return;
+    }
+    requested_track = target;
+    log_user_operation("PREVIOUS_TRACK", "SUCCESS");
+    printf("切换到上一首: %s\n", playlist_path(target));
+}
+
+void change_speed() {
+    const float speed_presets[] = {0.5f, 1.0f, 1.5f, 2.0f};
+    current_speed = (current_speed + 1) % 4;
+    control_params.speed_factor = speed_presets[current_speed];
+    dsp_params_publish();
+    log_user_operation("CHANGE_SPEED", "SUCCESS");
+    printf("播放速度切换为: %.2fx\n", control_params.speed_factor);
+}
+
+// 连续调整速度，范围 MIN_SPEED_FACTOR..MAX_SPEED_FACTOR
+void adjust_speed(float delta) {
+    float speed = control_params.speed_factor + delta;
+    if (speed < MIN_SPEED_FACTOR) speed = MIN_SPEED_FACTOR;
+    if (speed > MAX_SPEED_FACTOR) speed = MAX_SPEED_FACTOR;
+    // 消除累加误差，使 1.0x 能精确回到直通路径
+    control_params.speed_factor = roundf(speed / SPEED_STEP) * SPEED_STEP;
+    dsp_params_publish();
+    log_user_operation("ADJUST_SPEED", "SUCCESS");
+    printf("播放速度: %.2fx\n", control_params.speed_factor);
+}
+
+void seek_forward() {
+    if (current_state == STOPPED) {
+        log_user_operation("SEEK_FORWARD", "FAILED - Not playing");
+        return;
+    }
+    if (music_source.stream != NULL) {
+        log_user_operation("SEEK_FORWARD", "FAILED - Streaming input");
+        printf("流式输入不支持快进/快退\n");
+        return;
+    }
+    
+    // 读取线程在下一块开始前移动读取位置
+    long seek_frames = 10 * wav_header.sample_rate; // 10秒
+    if (!control_send(CONTROL_CMD_SEEK, seek_frames)) {
+        log_user_operation("SEEK_FORWARD", "FAILED - Control queue full");
+        return;
+    }
+    log_user_operation("SEEK_FORWARD", "SUCCESS");
+    printf("快进10秒\n");
+}
+
+void seek_backward() {
+    if (current_state == STOPPED) {
+        log_user_operation("SEEK_BACKWARD", "FAILED - Not playing");
+        return;
+    }
+    if (music_source.stream != NULL) {
+        log_user_operation("SEEK_BACKWARD", "FAILED - Streaming input");
+        printf("流式输入不支持快进/快退\n");
+        return;
+    }
+    
+    // 读取线程在下一块开始前移动读取位置
+    long seek_frames = 10 * wav_header.sample_rate; // 10秒
+    if (!control_send(CONTROL_CMD_SEEK, -seek_frames)) {
+        log_user_operation("SEEK_BACKWARD", "FAILED - Control queue full");
+        return;
+    }
+    log_user_operation("SEEK_BACKWARD", "SUCCESS");
+    printf("快退10秒\n");
+}
+
+void toggle_equalizer() {
+    // 加载了冲激响应时卷积模式也参与循环
+    int num_modes = conv_ir != NULL ? 5 : 4;
+    control_params.eq_mode = (control_params.eq_mode + 1) % num_modes;
+    dsp_params_publish();
+    const char* eq_names[] = {"正常", "低音增强", "高音增强", "人声增强", "卷积(IR)"};
+    log_user_operation("TOGGLE_EQUALIZER", "SUCCESS");
+    printf("均衡器模式: %s\n", eq_names[control_params.eq_mode]);
+}
+
+void toggle_eq_engine() {
+    control_params.eq_engine = control_params.eq_engine == EQ_ENGINE_FIR ? EQ_ENGINE_BIQUAD : EQ_ENGINE_FIR;
+    dsp_params_publish();
+    const char* engine_names[] = {"FIR", "双二阶"};
+    log_user_operation("TOGGLE_EQ_ENGINE", "SUCCESS");
+    printf("均衡器引擎: %s\n", engine_names[control_params.eq_engine]);
+}
+
+void toggle_stretch_mode() {
+    control_params.stretch_mode = (control_params.stretch_mode + 1) % NUM_STRETCH_MODES;
+    dsp_params_publish();
+    const char* stretch_names[] = {"PSOLA", "相位声码器", "WSOLA"};
+    log_user_operation("TOGGLE_STRETCH_MODE", "SUCCESS");
+    printf("变速算法: %s\n", stretch_names[control_params.stretch_mode]);
+}
+
+// 正在播放的位置: 读取位置减去处理链内部缓存、环形缓冲区和声卡缓冲区 (snd_pcm_delay) 中
+// 尚未播放的样本 (折算成源帧)。定位后环形缓冲区中等待丢弃的旧音频不计入
+long playback_position() {
+    long position = current_position;
+    if (pipeline_running) {
+        double input_per_output = 1.0;
+        double pending = dsp_graph_latency(&player_graph, &input_per_output);
+        size_t queued = audio_ring_fill(&playback_ring);
+        size_t flush = atomic_load(&seek_flush_frame);
+        if (flush != 0) {
+            queued = atomic_load_explicit(&playback_ring.write_pos, memory_order_acquire) - (flush - 1);
+        }
+        if (atomic_load_explicit(&pipeline_stats.delay_valid, memory_order_relaxed)) {
+            int64_t delay = STATS_GET(pipeline_stats.pcm_delay);
+            queued += delay > 0 ? (size_t)delay : 0;
+        }
+        pending += (double)queued * input_per_output;
+        position -= (long)pending;
+    }
+    return position > 0 ? position : 0;
+}
+
+void print_status() {
+    const char* state_names[] = {"播放中", "已暂停", "已停止"};
+    const char* eq_names[] = {"正常", "低音增强", "高音增强", "人声增强", "卷积(IR)"};
+    const char* stretch_names[] = {"PSOLA", "相位声码器", "WSOLA"};
+    const char* engine_names[] = {"FIR", "双二阶"};
+    
+    printf("\n=== 播放状态 ===\n");
+    if (playlist_count > 0) {
+        printf("当前曲目: %d/%d - %s\n", current_track + 1, playlist_count, playlist_path(current_track));
+    }
+    printf("播放状态: %s\n", state_names[current_state]);
+    printf("播放速度: %.2fx\n", control_params.speed_factor);
+    printf("均衡器: %s (%s)\n", eq_names[control_params.eq_mode], engine_names[control_params.eq_engine]);
+    printf("变速算法: %s\n", stretch_names[control_params.stretch_mode]);
+    if (mixer_elem != NULL) {
+        printf("音量: 混音器 %d/%d 档\n", current_volume_level_idx + 1, NUM_VOLUME_LEVELS);
+    } else {
+        printf("音量: 软件 %.0f dB\n", control_params.volume_db);
+    }
+    if (total_frames > 0) {
+        long position = playback_position();
+        printf("进度: %ld/%ld (%.1f%%)\n", position, total_frames,
+               (double)position / total_frames * 100.0);
+        double latency = dsp_graph_latency(&player_graph, NULL);
+        if (latency > 0.0) {
+            printf("处理延迟: %.1f ms\n", latency * 1000.0 / wav_header.sample_rate);
+        }
+    }
+    if (music_source.stream != NULL) {
+        printf("流式输入: 已读取 %.1f 秒, 抖动缓冲区 %zu/%zu 字节%s\n",
+               (double)current_position / wav_header.sample_rate, audio_ring_fill(&music_source.stream->ring),
+               music_source.stream->ring.capacity, atomic_load(&music_source.stream->eof) ? " (已结束)" : "");
+    }
+    printf("==============\n\n");
+}
+
+void handle_user_input(char input) {
+    switch(input) {
+        case ' ': // 空格 - 暂停/继续
+            toggle_pause();
+            break;
+        case 'n': // 下一首
+            next_track();
+            break;
+        case 'p': // 上一首
+            previous_track();
+            break;
+        case 's': // 切换速度
+            if (current_state != STOPPED) {
+                change_speed();
+            } else {
+                log_user_operation("CHANGE_SPEED", "FAILED - Not playing");
+            }
+            break;
+        case '[': // 减速
+        case ']': // 加速
+            if (current_state != STOPPED) {
+                adjust_speed(input == '[' ? -SPEED_STEP : SPEED_STEP);
+            } else {
+                log_user_operation("ADJUST_SPEED", "FAILED - Not playing");
+            }
+            break;
+        case 'f': // 快进
+            if (current_state != STOPPED) {
+                seek_forward();
+            } else {
+                log_user_operation("SEEK_FORWARD", "FAILED - Not playing");
+            }
+            break;
+        case 'b': // 快退
+            if (current_state != STOPPED) {
+                seek_backward();
+            } else {
+                log_user_operation("SEEK_BACKWARD", "FAILED - Not playing");
+            }
+            break;
+        case 'e': // 均衡器
+            toggle_equalizer();
+            break;
+        case 'E': // 切换均衡器引擎
+            toggle_eq_engine();
+            break;
+        case 't': // 切换时间拉伸算法
+            toggle_stretch_mode();
+            break;
+        case '+': // 增加音量
+            increase_volume();
+            break;
+        case '-': // 减少音量
+            decrease_volume();
+            break;
+        case 'i': // 信息
+            print_status();
+            break;
+        case 'd': // 运行统计
+            print_stats();
+            break;
+        case 'v': // 电平和频谱
+            print_levels();
+            break;
+        case 'q': // 退出
+            log_user_operation("QUIT", "SUCCESS");
+            printf("退出程序\n");
+            exit(0);
+            break;
+        case 'h': // 帮助
+            printf("\n=== 操作帮助 ===\n");
+            printf("空格: 暂停/继续\n");
+            printf("n: 下一首\n");
+            printf("p: 上一首\n");
+            printf("s: 切换速度 (0.5x/1x/1.5x/2x)\n");
+            printf("[/]: 减速/加速 0.05x (0.25x - 4x)\n");
+            printf("f: 快进10秒\n");
+            printf("b: 快退10秒\n");
+            printf("e: 切换均衡器模式 (用 -I 加载冲激响应时包含卷积模式)\n");
+            printf("E: 切换均衡器引擎 (FIR/双二阶)\n");
+            printf("t: 切换变速算法 (PSOLA/相位声码器/WSOLA)\n");
+            printf("d: 运行统计 (各阶段耗时、欠载、缓冲区填充)\n");
+            printf("v: 电平和频谱 (需要 -V)\n");
+            printf("+/-: 音量调节\n");
+            printf("i: 显示状态信息\n");
+            printf("h: 显示帮助\n");
+            printf("q: 退出\n");
+            printf("=================\n\n");
+            break;
+        default:
+            break;
+    }
+}
+
+// --- 线程唤醒事件 ---
+bool wake_event_init(wake_event_t *ev) {
+    ev->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    atomic_init(&ev->waiting, false);
+    return ev->fd >= 0;
+}
+
+void wake_event_close(wake_event_t *ev) {
+    if (ev->fd >= 0) {
+        close(ev->fd);
+        ev->fd = -1;
+    }
+}
+
+// 等待方: 置位后必须再检查一次条件，避免与通知方的竞争丢失唤醒
+void wake_event_arm(wake_event_t *ev) {
+    atomic_store(&ev->waiting, true);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void wake_event_disarm(wake_event_t *ev) {
+    atomic_store(&ev->waiting, false);
+}
+
+// 清空计数 (fd 与其它描述符一起 poll 到可读之后调用)
+void wake_event_clear(wake_event_t *ev) {
+    uint64_t count;
+    ssize_t got = read(ev->fd, &count, sizeof(count));
+    (void)got;
+}
+
+// 阻塞到被通知或超时，然后取消等待标志
+void wake_event_wait(wake_event_t *ev, int timeout_ms) {
+    struct pollfd pfd = {.fd = ev->fd, .events = POLLIN};
+    if (poll(&pfd, 1, timeout_ms) > 0) {
+        wake_event_clear(ev);
+    }
+    wake_event_disarm(ev);
+}
+
+// 通知方: 先发布数据 (release)，再检查是否有线程在等待
+void wake_event_signal(wake_event_t *ev) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (ev->fd < 0 || !atomic_load(&ev->waiting)) {
+        return;
+    }
+    uint64_t one = 1;
+    ssize_t put = write(ev->fd, &one, sizeof(one));
+    (void)put;
+}
+
+// --- 无锁SPSC环形缓冲区 ---
+bool audio_ring_init(audio_ring_t *ring, size_t min_frames, size_t frame_bytes) {
+    size_t capacity = 1;
+    while (capacity < min_frames) {
+        capacity <<= 1;
+    }
+
+    ring->data = (unsigned char *)malloc(capacity * frame_bytes);
+    if (ring->data == NULL) {
+        return false;
+    }
+    ring->capacity = capacity;
+    ring->frame_bytes = frame_bytes;
+    atomic_init(&ring->write_pos, 0);
+    atomic_init(&ring->read_pos, 0);
+    return true;
+}
+
+void audio_ring_free(audio_ring_t *ring) {
+    free(ring->data);
+    ring->data = NULL;
+    ring->capacity = 0;
+}
+
+// 只能在生产者和消费者都停止时调用
+void audio_ring_reset(audio_ring_t *ring) {
+    atomic_store(&ring->write_pos, 0);
+    atomic_store(&ring->read_pos, 0);
+}
+
+size_t audio_ring_fill(audio_ring_t *ring) {
+    size_t write_pos = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+    size_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+    return write_pos - read_pos;
+}
+
+size_t audio_ring_space(audio_ring_t *ring) {
+    return ring->capacity - audio_ring_fill(ring);
+}
+
+// 生产者: 写入最多 frames 帧，返回实际写入的帧数
+size_t audio_ring_write(audio_ring_t *ring, const void *src, size_t frames) {
+    size_t write_pos = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    size_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+    size_t space = ring->capacity - (write_pos - read_pos);
+    if (frames > space) {
+        frames = space;
+    }
+    if (frames == 0) {
+        return 0;
+    }
+
+    size_t start = write_pos & (ring->capacity - 1);
+    size_t first = ring->capacity - start;
+    if (first > frames) {
+        first = frames;
+    }
+    memcpy(ring->data + start * ring->frame_bytes, src, first * ring->frame_bytes);
+    if (frames > first) {
+        memcpy(ring->data, (const unsigned char *)src + first * ring->frame_bytes,
+               (frames - first) * ring->frame_bytes);
+    }
+
+    atomic_store_explicit(&ring->write_pos, write_pos + frames, memory_order_release);
+    return frames;
+}
+
+// 生产者: 返回可连续写入的帧数，*ptr 指向环形缓冲区内部；写好后用 audio_ring_commit 发布
+size_t audio_ring_reserve(audio_ring_t *ring, unsigned char **ptr) {
+    size_t write_pos = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    size_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+    size_t space = ring->capacity - (write_pos - read_pos);
+    size_t start = write_pos & (ring->capacity - 1);
+    size_t contiguous = ring->capacity - start;
+
+    *ptr = ring->data + start * ring->frame_bytes;
+    return space < contiguous ? space : contiguous;
+}
+
+void audio_ring_commit(audio_ring_t *ring, size_t frames) {
+    size_t write_pos = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    atomic_store_explicit(&ring->write_pos, write_pos + frames, memory_order_release);
+}
+
+// 消费者: 返回可连续读取的帧数，*ptr 指向环形缓冲区内部 (零拷贝交给 snd_pcm_writei 或 mmap 区域)
+size_t audio_ring_peek(audio_ring_t *ring, unsigned char **ptr) {
+    size_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    size_t write_pos = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+    size_t available = write_pos - read_pos;
+    size_t start = read_pos & (ring->capacity - 1);
+    size_t contiguous = ring->capacity - start;
+
+    *ptr = ring->data + start * ring->frame_bytes;
+    return available < contiguous ? available : contiguous;
+}
+
+void audio_ring_consume(audio_ring_t *ring, size_t frames) {
+    size_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    atomic_store_explicit(&ring->read_pos, read_pos + frames, memory_order_release);
+}
+
+// --- 控制面: 参数快照和命令队列 ---
+// 软件音量 (dB) 对应的线性增益，只衰减
+static float soft_volume_gain(float db) {
+    return db >= 0.0f ? 1.0f : powf(10.0f, db / 20.0f);
+}
+
+// 上一块结束时的软件增益，新的一块从这里过渡到 current_volume_db (启动线程之后只由读取线程访问)
+static float soft_volume_applied = 1.0f;
+
+// 选项解析完、启动任何线程之前调用，三个槽位都从选项设置的 current_* 开始
+void dsp_params_init() {
+    control_params.speed_factor = current_speed_factor;
+    control_params.eq_mode = current_eq_mode;
+    control_params.eq_engine = current_eq_engine;
+    control_params.stretch_mode = current_stretch_mode;
+    control_params.volume_db = current_volume_db;
+    soft_volume_applied = soft_volume_gain(current_volume_db); // -v 的初始音量不需要过渡
+    for (int i = 0; i < 3; i++) {
+        dsp_params_exchange.slot[i] = control_params;
+    }
+}
+
+// 控制线程: 把 control_params 写进自己的槽位，和中间槽位交换
+void dsp_params_publish() {
+    dsp_params_exchange_t *ex = &dsp_params_exchange;
+    ex->slot[ex->back] = control_params;
+    unsigned int previous = atomic_exchange_explicit(&ex->middle, ex->back | DSP_PARAMS_FRESH, memory_order_acq_rel);
+    ex->back = previous & ~DSP_PARAMS_FRESH;
+}
+
+// 拥有处理链的线程在块开始时调用: 有新发布的快照时换到手上并写进 current_*
+bool dsp_params_sync() {
+    dsp_params_exchange_t *ex = &dsp_params_exchange;
+    if ((atomic_load_explicit(&ex->middle, memory_order_relaxed) & DSP_PARAMS_FRESH) == 0) {
+        return false;
+    }
+    unsigned int previous = atomic_exchange_explicit(&ex->middle, ex->front, memory_order_acq_rel);
+    ex->front = previous & ~DSP_PARAMS_FRESH;
+
+    const dsp_params_t *params = &ex->slot[ex->front];
+    current_speed_factor = params->speed_factor;
+    current_eq_mode = params->eq_mode;
+    current_eq_engine = params->eq_engine;
+    current_stretch_mode = params->stretch_mode;
+    current_volume_db = params->volume_db;
+    return true;
+}
+
+// 控制线程: 命令入队并唤醒读取线程 (暂停时它睡在 ring_space_event 上)
+bool control_send(control_cmd_type_t type, long value) {
+    control_cmd_t cmd = {.type = type, .value = value, .issued_ns = monotonic_ns()};
+    if (audio_ring_write(&control_queue, &cmd, 1) != 1) {
+        log_program_info("WARNING", "Control queue full, command dropped");
+        return false;
+    }
+    wake_event_signal(&ring_space_event);
+    return true;
+}
+
+// --- 流式输入 (抖动缓冲区) ---
+// "host:port" (IPv6 地址写成 [addr]:port)，返回已连接的套接字
+static int stream_connect_tcp(const char *spec) {
+    char host[256];
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || colon == spec || (size_t)(colon - spec) >= sizeof(host)) {
+        return -1;
+    }
+    if (spec[0] == '[' && colon[-1] == ']') {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - spec - 2), spec + 1);
+    } else {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+    }
+
+    struct addrinfo hints, *addrs;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, colon + 1, &hints, &addrs);
+    if (err != 0) {
+        char error_msg[LOG_BUFFER_SIZE];
+        // 主机名最长 255 字节，截到半个缓冲区，给错误原因留出位置
+        snprintf(error_msg, sizeof(error_msg), "Cannot resolve %.*s: %s", (int)sizeof(error_msg) / 2, host,
+                 gai_strerror(err));
+        log_program_info("ERROR", error_msg);
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = addrs; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    return fd;
+}
+
+// 播放列表条目对应的输入: "-" 是标准输入 (复制一份描述符，关闭曲目时不关掉 0 号)，
+// tcp:主机:端口 连接网络源，其它按文件打开 (命名管道会等到写端打开)
+FILE *stream_fopen(const char *path_name) {
+    int fd = -1;
+    if (strcmp(path_name, STREAM_STDIN_NAME) == 0) {
+        fd = dup(STDIN_FILENO);
+    } else if (strncmp(path_name, STREAM_TCP_PREFIX, strlen(STREAM_TCP_PREFIX)) == 0) {
+        fd = stream_connect_tcp(path_name + strlen(STREAM_TCP_PREFIX));
+    } else {
+        return fopen(path_name, "rb");
+    }
+    FILE *file = fd >= 0 ? fdopen(fd, "rb") : NULL;
+    if (file == NULL && fd >= 0) {
+        close(fd);
+    }
+    return file;
+}
+
+// 接收线程: 有空间时 poll 描述符和 space_event，满了只等 space_event (读取线程取走数据或要求停止)
+static void *stream_receiver_main(void *arg) {
+    stream_buffer_t *sb = (stream_buffer_t *)arg;
+    struct pollfd pfds[2] = {{.fd = sb->space_event.fd, .events = POLLIN}, {.fd = sb->fd, .events = POLLIN}};
+
+    while (!atomic_load(&sb->stop)) {
+        unsigned char *dst;
+        size_t space = audio_ring_reserve(&sb->ring, &dst);
+        wake_event_arm(&sb->space_event);
+        if (atomic_load(&sb->stop)) {
+            wake_event_disarm(&sb->space_event);
+            break;
+        }
+        int ret = poll(pfds, space > 0 ? 2 : 1, PIPELINE_WAIT_TIMEOUT_MS);
+        wake_event_disarm(&sb->space_event);
+        if (ret > 0 && (pfds[0].revents & POLLIN)) {
+            wake_event_clear(&sb->space_event);
+        }
+        if (ret <= 0 || space == 0 || (pfds[1].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+            continue;
+        }
+
+        ssize_t got = read(sb->fd, dst, space);
+        if (got > 0) {
+            audio_ring_commit(&sb->ring, (size_t)got);
+            if (audio_ring_fill(&sb->ring) >= atomic_load(&sb->wanted_bytes)) {
+                wake_event_signal(&sb->data_event);
+            }
+        } else if (got == 0 || (errno != EINTR && errno != EAGAIN)) {
+            if (got < 0) {
+                char error_msg[LOG_BUFFER_SIZE];
+                snprintf(error_msg, sizeof(error_msg), "Stream read failed: %s", strerror(errno));
+                log_program_info("ERROR", error_msg);
+            } else {
+                log_program_info("PLAYBACK", "Stream closed by sender");
+            }
+            atomic_store(&sb->eof, true);
+            wake_event_signal(&sb->data_event);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void stream_buffer_free(stream_buffer_t *sb) {
+    audio_ring_free(&sb->ring);
+    wake_event_close(&sb->data_event);
+    wake_event_close(&sb->space_event);
+    free(sb);
+}
+
+// 解析完头部后调用，file 的位置在 data 块起点；缓冲区深度和预取水位按该曲目的字节率换算
+bool stream_source_open(audio_source_t *src, FILE *file, size_t frame_bytes, size_t data_bytes, uint32_t byte_rate) {
+    memset(src, 0, sizeof(*src));
+    stream_buffer_t *sb = (stream_buffer_t *)calloc(1, sizeof(*sb));
+    if (sb == NULL) {
+        return false;
+    }
+    sb->fd = fileno(file);
+    sb->frame_bytes = frame_bytes;
+    sb->buffering = true; // 先填到预取水位再开始播放
+    sb->data_event.fd = sb->space_event.fd = -1;
+
+    // 至少放得下两块读取数据，预取水位不超过深度的一半 (留出继续接收的余量)
+    size_t depth = (size_t)((uint64_t)byte_rate * jitter_buffer_ms / 1000);
+    if (depth < buffer_size * 2) {
+        depth = buffer_size * 2;
+    }
+    sb->prefetch_bytes = (size_t)((uint64_t)byte_rate * jitter_prefetch_ms / 1000);
+    if (sb->prefetch_bytes > depth / 2) {
+        sb->prefetch_bytes = depth / 2;
+    }
+    atomic_init(&sb->wanted_bytes, SIZE_MAX);
+    atomic_init(&sb->eof, false);
+    atomic_init(&sb->stop, false);
+
+    if (!audio_ring_init(&sb->ring, depth, 1) || !wake_event_init(&sb->data_event) ||
+        !wake_event_init(&sb->space_event) || pthread_create(&sb->thread, NULL, stream_receiver_main, sb) != 0) {
+        stream_buffer_free(sb);
+        return false;
+    }
+
+    src->file = file;
+    src->data_bytes = data_bytes;
+    src->stream = sb;
+    return true;
+}
+
+// 读取线程: 取 bytes 字节 (整帧)。不够时进入缓冲状态，等到预取水位或对端关闭；
+// 同时等 ring_space_event，pipeline_stop 能打断等待 (此时返回 0)
+size_t stream_buffer_read(stream_buffer_t *sb, unsigned char *dst, size_t bytes) {
+    bytes -= bytes % sb->frame_bytes;
+    if (bytes > sb->ring.capacity) {
+        bytes = sb->ring.capacity - sb->ring.capacity % sb->frame_bytes;
+    }
+    if (!sb->buffering && audio_ring_fill(&sb->ring) < bytes && !atomic_load(&sb->eof)) {
+        sb->buffering = true;
+        STATS_ADD(pipeline_stats.stream_rebuffers, 1);
+        log_program_info("WARNING", "Stream buffer ran dry, rebuffering");
+    }
+
+    size_t wanted = sb->buffering && sb->prefetch_bytes > bytes ? sb->prefetch_bytes : bytes;
+    struct pollfd pfds[2] = {{.fd = sb->data_event.fd, .events = POLLIN}, {.fd = ring_space_event.fd, .events = POLLIN}};
+    while (audio_ring_fill(&sb->ring) < wanted && !atomic_load(&sb->eof)) {
+        atomic_store(&sb->wanted_bytes, wanted);
+        wake_event_arm(&sb->data_event);
+        wake_event_arm(&ring_space_event);
+        pfds[0].revents = pfds[1].revents = 0;
+        if (!atomic_load(&pipeline_stop_requested) && audio_ring_fill(&sb->ring) < wanted && !atomic_load(&sb->eof)) {
+            poll(pfds, 2, PIPELINE_WAIT_TIMEOUT_MS);
+        }
+        wake_event_disarm(&sb->data_event);
+        wake_event_disarm(&ring_space_event);
+        if (pfds[0].revents & POLLIN) {
+            wake_event_clear(&sb->data_event);
+        }
+        if (pfds[1].revents & POLLIN) {
+            wake_event_clear(&ring_space_event);
+        }
+        if (atomic_load(&pipeline_stop_requested)) {
+            atomic_store(&sb->wanted_bytes, SIZE_MAX);
+            return 0;
+        }
+    }
+    atomic_store(&sb->wanted_bytes, SIZE_MAX);
+    sb->buffering = false;
+
+    size_t fill = audio_ring_fill(&sb->ring);
+    if (bytes > fill) {
+        bytes = fill - fill % sb->frame_bytes; // 对端已关闭，交出剩下的整帧
+    }
+    size_t done = 0;
+    while (done < bytes) {
+        unsigned char *src;
+        size_t chunk = audio_ring_peek(&sb->ring, &src);
+        if (chunk > bytes - done) {
+            chunk = bytes - done;
+        }
+        memcpy(dst + done, src, chunk);
+        audio_ring_consume(&sb->ring, chunk);
+        done += chunk;
+    }
+    wake_event_signal(&sb->space_event);
+    return done;
+}
+
+// 停止接收线程并释放缓冲区；描述符随 audio_source_t 的 file 一起关闭
+void stream_buffer_close(stream_buffer_t *sb) {
+    atomic_store(&sb->stop, true);
+    wake_event_signal(&sb->space_event);
+    pthread_join(sb->thread, NULL);
+    stream_buffer_free(sb);
+}
+
+// --- 电平/频谱分析 (见 const.h) ---
+// 分析节点 (拥有处理链的线程) 先声明要写到哪里 (analyzer_claimed)，写完历史缓冲区再推进 analyzer_written；
+// 分析线程直接在历史缓冲区上计算，算完复查 analyzer_claimed，计算期间被覆盖的帧整帧放弃
+static float *analyzer_history[FIR_MAX_CHANNELS];
+static atomic_size_t analyzer_written, analyzer_claimed;
+static atomic_int analyzer_channels;
+static atomic_uint analyzer_rate;
+static analyzer_snapshot_t *analyzer_snapshot = NULL;  // 堆上分配，或映射的 -V 文件
+static bool analyzer_snapshot_mapped = false;
+static pthread_t analyzer_thread;
+static bool analyzer_running = false;
+static atomic_bool analyzer_stop_requested;
+static wake_event_t analyzer_event = {.fd = -1};
+// 以下只由分析线程访问
+static fft_plan_t *analyzer_plan = NULL;
+static float *analyzer_mix = NULL;         // 各声道平均并加窗后的一帧
+static float *analyzer_magnitude = NULL;   // 归一化的线性幅度 (满幅正弦为 1)
+static Complex *analyzer_spectrum = NULL;
+static float analyzer_window[ANALYZER_FFT_SIZE];
+static analyzer_snapshot_t analyzer_next;  // 正在计算的一帧，峰值和频段的回落从上一帧接着算
+
+// 拥有处理链的线程调用: 只做复制，块比历史缓冲区还长时只留最后一段
+static void analyzer_tap_write(const audio_block_t *block) {
+    if (analyzer_history[0] == NULL || block->frames <= 0) {
+        return;
+    }
+    const size_t mask = ANALYZER_HISTORY_FRAMES - 1;
+    size_t frames = (size_t)block->frames;
+    size_t skip = frames > ANALYZER_HISTORY_FRAMES ? frames - ANALYZER_HISTORY_FRAMES : 0;
+    size_t pos = atomic_load_explicit(&analyzer_written, memory_order_relaxed);
+    atomic_store_explicit(&analyzer_claimed, pos + frames, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    size_t start = (pos + skip) & mask;
+    size_t count = frames - skip;
+    size_t first = count < ANALYZER_HISTORY_FRAMES - start ? count : ANALYZER_HISTORY_FRAMES - start;
+    for (int ch = 0; ch < block->channels; ch++) {
+        const float *src = block->channel[ch] + skip;
+        memcpy(analyzer_history[ch] + start, src, first * sizeof(float));
+        memcpy(analyzer_history[ch], src + first, (count - first) * sizeof(float));
+    }
+    atomic_store_explicit(&analyzer_channels, block->channels, memory_order_relaxed);
+    atomic_store_explicit(&analyzer_rate, wav_header.sample_rate, memory_order_relaxed);
+    atomic_store_explicit(&analyzer_written, pos + frames, memory_order_release);
+}
+
+static float analyzer_power_db(double power) {
+    float db = power > 0.0 ? (float)(10.0 * log10(power)) : ANALYZER_FLOOR_DB;
+    return db > ANALYZER_FLOOR_DB ? db : ANALYZER_FLOOR_DB;
+}
+
+// 上升立即跟随，下降按 ANALYZER_FALL_DB_PER_S 回落
+static float analyzer_ballistics(float measured, float previous, float fall_db) {
+    float held = previous - fall_db;
+    return measured > held ? measured : held;
+}
+
+// 频段按对数频率等分 ANALYZER_MIN_HZ .. min(ANALYZER_MAX_HZ, 奈奎斯特频率)
+static void analyzer_set_format(analyzer_snapshot_t *next, unsigned int sample_rate, int channels) {
+    double top = sample_rate / 2.0 < ANALYZER_MAX_HZ ? sample_rate / 2.0 : ANALYZER_MAX_HZ;
+    for (int b = 0; b <= ANALYZER_BANDS; b++) {
+        next->band_hz[b] = (float)(ANALYZER_MIN_HZ * pow(top / ANALYZER_MIN_HZ, (double)b / ANALYZER_BANDS));
+    }
+    for (int b = 0; b < ANALYZER_BANDS; b++) {
+        next->band_db[b] = ANALYZER_FLOOR_DB;
+    }
+    for (int ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+        next->rms_db[ch] = next->peak_db[ch] = ANALYZER_FLOOR_DB;
+    }
+    next->sample_rate = sample_rate;
+    next->channels = (uint32_t)channels;
+}
+
+// 分析一帧，返回 false 表示还没有数据或窗口在计算期间被覆盖 (这一帧不发布)
+static bool analyzer_update(double elapsed_s) {
+    size_t written = atomic_load_explicit(&analyzer_written, memory_order_acquire);
+    int channels = atomic_load_explicit(&analyzer_channels, memory_order_relaxed);
+    unsigned int sample_rate = atomic_load_explicit(&analyzer_rate, memory_order_relaxed);
+    if (channels <= 0 || sample_rate == 0) {
+        return false;
+    }
+
+    // 对齐到正在听到的位置: 分析节点之后还有环形缓冲区和声卡缓冲区 (设备采样率的帧) 没有播放
+    double queued = (double)audio_ring_fill(&playback_ring);
+    if (atomic_load_explicit(&pipeline_stats.delay_valid, memory_order_relaxed)) {
+        int64_t delay = STATS_GET(pipeline_stats.pcm_delay);
+        queued += delay > 0 ? (double)delay : 0.0;
+    }
+    if (rate > 0) {
+        queued = queued * sample_rate / rate;
+    }
+    size_t level_frames = sample_rate / (unsigned int)analyzer_fps;
+    if (level_frames > ANALYZER_HISTORY_FRAMES / 2) level_frames = ANALYZER_HISTORY_FRAMES / 2;
+    if (level_frames == 0) level_frames = 1;
+    size_t span = level_frames > ANALYZER_FFT_SIZE ? level_frames : ANALYZER_FFT_SIZE;
+    size_t lag = (size_t)queued;
+    if (lag > ANALYZER_HISTORY_FRAMES - span) {
+        lag = ANALYZER_HISTORY_FRAMES - span;
+    }
+    if (written < span + lag) {
+        if (written < span) {
+            return false;
+        }
+        lag = written - span;   // 刚开始播放，历史还不够长
+    }
+    size_t end = written - lag;
+    const size_t mask = ANALYZER_HISTORY_FRAMES - 1;
+
+    analyzer_snapshot_t *next = &analyzer_next;
+    if (next->sample_rate != sample_rate || next->channels != (uint32_t)channels) {
+        analyzer_set_format(next, sample_rate, channels);
+    }
+    float fall_db = (float)(ANALYZER_FALL_DB_PER_S * elapsed_s);
+
+    float rms_db[FIR_MAX_CHANNELS], peak_db[FIR_MAX_CHANNELS];
+    memset(analyzer_mix, 0, ANALYZER_FFT_SIZE * sizeof(float));
+    for (int ch = 0; ch < channels; ch++) {
+        const float *hist = analyzer_history[ch];
+        double sum = 0.0;
+        float peak = 0.0f;
+        for (size_t i = end - level_frames; i != end; i++) {
+            float x = hist[i & mask];
+            sum += (double)x * x;
+            float a = fabsf(x);
+            peak = a > peak ? a : peak;
+        }
+        rms_db[ch] = analyzer_power_db(sum / level_frames);
+        peak_db[ch] = analyzer_power_db((double)peak * peak);
+        size_t start = end - ANALYZER_FFT_SIZE;
+        for (int i = 0; i < ANALYZER_FFT_SIZE; i++) {
+            analyzer_mix[i] += hist[(start + i) & mask];
+        }
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&analyzer_claimed, memory_order_relaxed) - (end - span) > ANALYZER_HISTORY_FRAMES) {
+        return false;
+    }
+
+    for (int ch = 0; ch < channels; ch++) {
+        next->rms_db[ch] = rms_db[ch];
+        next->peak_db[ch] = analyzer_ballistics(peak_db[ch], next->peak_db[ch], fall_db);
+    }
+    float mix_gain = 1.0f / channels;
+    for (int i = 0; i < ANALYZER_FFT_SIZE; i++) {
+        analyzer_mix[i] *= analyzer_window[i] * mix_gain;
+    }
+    fft_real_forward(analyzer_plan, analyzer_mix, analyzer_spectrum);
+    // Hann 窗的相干增益为 0.5，单边谱再乘 2: 满幅正弦的峰值频点为 1
+    const float scale = 4.0f / ANALYZER_FFT_SIZE;
+    for (int k = 0; k < ANALYZER_BINS; k++) {
+        analyzer_magnitude[k] = complex_magnitude(analyzer_spectrum[k]) * scale;
+        next->magnitude_db[k] = analyzer_power_db((double)analyzer_magnitude[k] * analyzer_magnitude[k]);
+    }
+
+    // 频段电平: 频段内各频点的功率和除以 Hann 窗的等效噪声带宽 (1.5 个频点)，正弦落在哪个频段都读 0 dB；
+    // 低频段窄到不含任何频点时，取频段几何中心处相邻频点的线性插值
+    double bin_hz = (double)sample_rate / ANALYZER_FFT_SIZE;
+    for (int b = 0; b < ANALYZER_BANDS; b++) {
+        int lo = (int)ceil(next->band_hz[b] / bin_hz);
+        int hi = (int)ceil(next->band_hz[b + 1] / bin_hz);
+        if (hi > ANALYZER_BINS) hi = ANALYZER_BINS;
+        float level;
+        if (lo < hi) {
+            double power = 0.0;
+            for (int k = lo; k < hi; k++) {
+                power += (double)analyzer_magnitude[k] * analyzer_magnitude[k];
+            }
+            level = analyzer_power_db(power / 1.5);
+        } else {
+            double pos = sqrt((double)next->band_hz[b] * next->band_hz[b + 1]) / bin_hz;
+            int k = (int)pos;
+            if (k >= ANALYZER_BINS - 1) k = ANALYZER_BINS - 2;
+            double frac = pos - k;
+            double mag = analyzer_magnitude[k] * (1.0 - frac) + analyzer_magnitude[k + 1] * frac;
+            level = analyzer_power_db(mag * mag);
+        }
+        next->band_db[b] = analyzer_ballistics(level, next->band_db[b], fall_db);
+    }
+    next->timestamp_ns = monotonic_ns();
+    return true;
+}
+
+// 序号为奇数期间写入，读取方看到奇数或前后序号不同就重读；magic 等固定字段在启动时写好
+static void analyzer_publish(const analyzer_snapshot_t *next) {
+    analyzer_snapshot_t *snap = analyzer_snapshot;
+    const size_t offset = offsetof(analyzer_snapshot_t, sample_rate);
+    uint32_t sequence = atomic_load_explicit(&snap->sequence, memory_order_relaxed);
+    atomic_store_explicit(&snap->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy((unsigned char *)snap + offset, (const unsigned char *)next + offset, sizeof(*snap) - offset);
+    atomic_store_explicit(&snap->sequence, sequence + 2, memory_order_release);
+}
+
+// 任何线程都可以调用，不会阻塞分析线程；还没有发布过任何一帧时返回 false
+bool analyzer_read(analyzer_snapshot_t *out) {
+    const analyzer_snapshot_t *snap = analyzer_snapshot;
+    if (snap == NULL) {
+        return false;
+    }
+    for (int attempt = 0; attempt < 100; attempt++) {
+        uint32_t before = atomic_load_explicit(&snap->sequence, memory_order_acquire);
+        if (before & 1u) {
+            sched_yield();
+            continue;
+        }
+        memcpy(out, snap, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&snap->sequence, memory_order_relaxed) == before) {
+            return before != 0;
+        }
+    }
+    return false;
+}
+
+// 按 analyzer_fps 定时分析；落后时不补帧
+static void *analyzer_thread_main(void *arg) {
+    (void)arg;
+    uint64_t period_ns = 1000000000ull / (uint64_t)analyzer_fps;
+    uint64_t last = monotonic_ns();
+    uint64_t next_due = last + period_ns;
+    while (!atomic_load(&analyzer_stop_requested)) {
+        uint64_t now = monotonic_ns();
+        if (now < next_due) {
+            wake_event_arm(&analyzer_event);
+            if (atomic_load(&analyzer_stop_requested)) {
+                wake_event_disarm(&analyzer_event);
+                break;
+            }
+            wake_event_wait(&analyzer_event, (int)((next_due - now + 999999) / 1000000));
+            continue;
+        }
+        if (analyzer_update((now - last) / 1e9)) {
+            analyzer_publish(&analyzer_next);
+            stats_record(&pipeline_stats.stage[STAGE_ANALYZE], monotonic_ns() - now);
+        }
+        last = now;
+        next_due += period_ns;
+        if (next_due <= now) {
+            next_due = now + period_ns;
+        }
+    }
+    return NULL;
+}
+
+// 快照放在堆上，或映射到 analyzer_shm_path 供其他进程读取
+static bool analyzer_snapshot_create() {
+    if (analyzer_shm_path == NULL) {
+        analyzer_snapshot = (analyzer_snapshot_t *)calloc(1, sizeof(analyzer_snapshot_t));
+        return analyzer_snapshot != NULL;
+    }
+    int fd = open(analyzer_shm_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, sizeof(analyzer_snapshot_t)) == 0) {
+        map = mmap(NULL, sizeof(analyzer_snapshot_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    analyzer_snapshot = (analyzer_snapshot_t *)map;
+    analyzer_snapshot_mapped = true;
+    memset(analyzer_snapshot, 0, sizeof(*analyzer_snapshot));
+    return true;
+}
+
+static void analyzer_free() {
+    fft_plan_destroy(analyzer_plan);
+    analyzer_plan = NULL;
+    free(analyzer_history[0]);
+    memset(analyzer_history, 0, sizeof(analyzer_history));
+    free(analyzer_mix);
+    free(analyzer_magnitude);
+    free(analyzer_spectrum);
+    analyzer_mix = analyzer_magnitude = NULL;
+    analyzer_spectrum = NULL;
+    if (analyzer_snapshot_mapped) {
+        munmap(analyzer_snapshot, sizeof(*analyzer_snapshot));
+    } else {
+        free(analyzer_snapshot);
+    }
+    analyzer_snapshot = NULL;
+    analyzer_snapshot_mapped = false;
+    wake_event_close(&analyzer_event);
+}
+
+// 在第一次启动流水线之前调用 (分析节点看到历史缓冲区后才开始复制)；-V 未开启时什么都不做
+bool analyzer_start() {
+    if (analyzer_fps <= 0 || analyzer_running) {
+        return true;
+    }
+    float *history = (float *)calloc((size_t)FIR_MAX_CHANNELS * ANALYZER_HISTORY_FRAMES, sizeof(float));
+    analyzer_plan = fft_plan_create(ANALYZER_FFT_SIZE);
+    analyzer_mix = (float *)malloc(ANALYZER_FFT_SIZE * sizeof(float));
+    analyzer_magnitude = (float *)malloc(ANALYZER_BINS * sizeof(float));
+    analyzer_spectrum = (Complex *)malloc(ANALYZER_BINS * sizeof(Complex));
+    if (history != NULL) {
+        for (int ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+            analyzer_history[ch] = history + (size_t)ch * ANALYZER_HISTORY_FRAMES;
+        }
+    }
+    if (history == NULL || analyzer_plan == NULL || analyzer_mix == NULL || analyzer_magnitude == NULL ||
+        analyzer_spectrum == NULL || !analyzer_snapshot_create() || !wake_event_init(&analyzer_event)) {
+        log_program_info("ERROR", "Failed to set up the level/spectrum analyzer");
+        analyzer_free();
+        return false;
+    }
+    for (int i = 0; i < ANALYZER_FFT_SIZE; i++) {
+        analyzer_window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / ANALYZER_FFT_SIZE);
+    }
+    memset(&analyzer_next, 0, sizeof(analyzer_next));
+    analyzer_snapshot->magic = ANALYZER_MAGIC;
+    analyzer_snapshot->version = ANALYZER_VERSION;
+    analyzer_snapshot->fft_size = analyzer_next.fft_size = ANALYZER_FFT_SIZE;
+    analyzer_snapshot->bands = analyzer_next.bands = ANALYZER_BANDS;
+    analyzer_snapshot->fps = analyzer_next.fps = (uint32_t)analyzer_fps;
+    atomic_store(&analyzer_written, 0);
+    atomic_store(&analyzer_claimed, 0);
+    atomic_store(&analyzer_channels, 0);
+    atomic_store(&analyzer_stop_requested, false);
+
+    // 分析只是显示用，让给所有普通线程: SCHED_IDLE 不需要特权，不支持时退回默认调度
+    pthread_attr_t attr;
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_IDLE);
+    pthread_attr_setschedparam(&attr, &param);
+    int err = pthread_create(&analyzer_thread, &attr, analyzer_thread_main, NULL);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        log_program_info("WARNING", "SCHED_IDLE not available for the analyzer thread, using default scheduling");
+        err = pthread_create(&analyzer_thread, NULL, analyzer_thread_main, NULL);
+    }
+    if (err != 0) {
+        log_program_info("ERROR", "Failed to create analyzer thread");
+        analyzer_free();
+        return false;
+    }
+    analyzer_running = true;
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg), "Level/spectrum analyzer running at %d fps%s%s", analyzer_fps,
+             analyzer_shm_path != NULL ? ", snapshot mapped to " : "", analyzer_shm_path != NULL ? analyzer_shm_path : "");
+    log_program_info("INFO", info_msg);
+    return true;
+}
+
+// 流水线停止之后调用
+void analyzer_stop() {
+    if (!analyzer_running) {
+        return;
+    }
+    atomic_store(&analyzer_stop_requested, true);
+    wake_event_signal(&analyzer_event);
+    pthread_join(analyzer_thread, NULL);
+    analyzer_running = false;
+    analyzer_free();
+}
+
+// 'v' 键: 每声道电平和按频段的简易频谱 (-60..0 dB 映射到10级字符)
+void print_levels() {
+    if (analyzer_fps <= 0) {
+        printf("电平表未开启 (用 -V 开启)\n");
+        return;
+    }
+    analyzer_snapshot_t snap;
+    if (!analyzer_read(&snap)) {
+        printf("电平表: 暂无数据\n");
+        return;
+    }
+    static const char shades[] = " .:-=+*#%@";
+    char bars[ANALYZER_BANDS + 1];
+    for (int b = 0; b < ANALYZER_BANDS; b++) {
+        int level = (int)((snap.band_db[b] + 60.0f) / 60.0f * 9.0f + 0.5f);
+        bars[b] = shades[level < 0 ? 0 : level > 9 ? 9 : level];
+    }
+    bars[ANALYZER_BANDS] = '\0';
+
+    printf("\n=== 电平 (%u Hz, %u 声道) ===\n", snap.sample_rate, snap.channels);
+    for (uint32_t ch = 0; ch < snap.channels && ch < FIR_MAX_CHANNELS; ch++) {
+        printf("声道 %u: RMS %6.1f dBFS, 峰值 %6.1f dBFS\n", ch + 1, snap.rms_db[ch], snap.peak_db[ch]);
+    }
+    printf("频谱: %.0f Hz |%s| %.0f Hz\n", snap.band_hz[0], bars, snap.band_hz[ANALYZER_BANDS]);
+    printf("==============\n\n");
+}
+
+// 读取线程的浮点处理链: 源数据 -> dsp_input -> 时间拉伸 -> dsp_stretched -> 均衡器 (原地) -> 分析 (-V，只复制)
+// -> 重采样 -> dsp_resampled -> 限幅器 (原地)，最后直接转换成设备格式写进环形缓冲区 (离线渲染时写进 dsp_output)。
+// 所有块都从 dsp_arena 中切分
+static audio_arena_t dsp_arena;
+static audio_block_t dsp_input, dsp_stretched, dsp_resampled;
+static unsigned char *dsp_output = NULL;
+static uint32_t dither_seed = 0x9E3779B9u;
+
+// 时间拉伸节点: 原速时直通
+static audio_block_t *stretch_node_process(dsp_node_t *node, audio_block_t *input) {
+    float speed_factor = current_speed_factor;
+    if (speed_factor == 1.0f) {
+        // 流式拉伸的历史状态已与当前位置脱节，下次使用时重新开始
+        time_stretch_stale = true;
+        return input;
+    }
+    apply_time_stretch(input, node->output, speed_factor);
+    return node->output;
+}
+
+static void stretch_node_reset(dsp_node_t *node) {
+    (void)node;
+    reset_time_stretch_static_vars();
+}
+
+// 流式算法输入FIFO中尚未分析的样本，加上已合成未输出的样本 (按速度折算回输入帧)
+static double stretch_node_latency(const dsp_node_t *node) {
+    (void)node;
+    float speed_factor = current_speed_factor;
+    if (speed_factor == 1.0f || time_stretch_stale) {
+        return 0.0;
+    }
+    if (time_stretch_mode == STRETCH_PHASE_VOCODER && time_stretch_pv != NULL) {
+        const pv_channel_t *c = &time_stretch_pv->channel[0];
+        return (c->input_fill - c->input_pos) + (double)c->ready_fill * speed_factor;
+    }
+    if (time_stretch_mode == STRETCH_WSOLA && time_stretch_wsola != NULL) {
+        const wsola_t *w = time_stretch_wsola;
+        return (w->input_fill - w->nominal_pos) + (double)w->ready_fill * speed_factor;
+    }
+    return 0.0;
+}
+
+static double stretch_node_input_per_output(const dsp_node_t *node) {
+    (void)node;
+    return current_speed_factor;
+}
+
+static bool stretch_node_transparent(const dsp_node_t *node) {
+    (void)node;
+    return current_speed_factor == 1.0f;
+}
+
+// 均衡器节点: 原地处理，正常模式下也运行以保持延迟线连续
+static audio_block_t *eq_node_process(dsp_node_t *node, audio_block_t *input) {
+    (void)node;
+    apply_fir_filter(input, input, current_eq_mode);
+    return input;
+}
+
+static void eq_node_reset(dsp_node_t *node) {
+    (void)node;
+    reset_fir_state();
+}
+
+// FIR 的干信号没有延迟，双二阶是最小相位；只有分区卷积有固定的一个分区的延迟
+static double eq_node_latency(const dsp_node_t *node) {
+    (void)node;
+    return conv_active ? CONV_BLOCK_SIZE : 0.0;
+}
+
+static bool eq_node_transparent(const dsp_node_t *node) {
+    (void)node;
+    return current_eq_mode == EQ_NORMAL && !(biquad_active && biquad_eq.ramp_remaining > 0);
+}
+
+// 采样率转换节点: 曲目采样率与设备相同或不能转换时直通
+static bool src_node_converting() {
+    return wav_header.sample_rate != rate && sample_rate_conversion_usable(&wav_header);
+}
+
+static audio_block_t *src_node_process(dsp_node_t *node, audio_block_t *input) {
+    if (!src_node_converting()) {
+        return input;
+    }
+    return apply_sample_rate_conversion(input, node->output) ? node->output : NULL;
+}
+
+static void src_node_reset(dsp_node_t *node) {
+    (void)node;
+    resampler_reset(src_state);
+}
+
+// 对称 sinc 滤波器的群延迟为半个滤波器长度 (输入帧)
+static double src_node_latency(const dsp_node_t *node) {
+    (void)node;
+    return src_node_converting() && src_state != NULL ? src_state->taps / 2.0 : 0.0;
+}
+
+static double src_node_input_per_output(const dsp_node_t *node) {
+    (void)node;
+    return src_node_converting() ? (double)wav_header.sample_rate / rate : 1.0;
+}
+
+static bool src_node_transparent(const dsp_node_t *node) {
+    (void)node;
+    return !src_node_converting();
+}
+
+// 分析节点: 把均衡器之后的样本复制给电平/频谱分析 (-V)，信号原样通过
+static audio_block_t *analyzer_node_process(dsp_node_t *node, audio_block_t *input) {
+    (void)node;
+    analyzer_tap_write(input);
+    return input;
+}
+
+static bool analyzer_node_transparent(const dsp_node_t *node) {
+    (void)node;
+    return true;
+}
+
+// 限幅器节点: 前面的节点改变过信号时才启用，启用/旁路切换时交叉淡化
+static audio_block_t *limiter_node_process(dsp_node_t *node, audio_block_t *input) {
+    (void)node;
+    limiter_t *l = limiter_state;
+    if (l == NULL || input->channels != l->channels || input->frames > l->capacity) {
+        return input;
+    }
+    STATS_ADD(pipeline_stats.limited_frames, (uint64_t)limiter_process(l, input->channel, input->frames));
+    return input;
+}
+
+static void limiter_node_reset(dsp_node_t *node) {
+    (void)node;
+    limiter_reset(limiter_state);
+}
+
+// 前瞻的延迟，按设备采样率的帧数 (执行器按之前各节点的速度比折算回源帧)
+static double limiter_node_latency(const dsp_node_t *node) {
+    (void)node;
+    return limiter_state != NULL ? limiter_state->lookahead : 0.0;
+}
+
+static const dsp_node_ops_t stretch_node_ops = {
+    .name = "stretch", .process = stretch_node_process, .reset = stretch_node_reset,
+    .latency = stretch_node_latency, .input_per_output = stretch_node_input_per_output,
+    .transparent = stretch_node_transparent, .same_length = false, .auto_bypass = false
+};
+static const dsp_node_ops_t eq_node_ops = {
+    .name = "equalizer", .process = eq_node_process, .reset = eq_node_reset,
+    .latency = eq_node_latency, .input_per_output = NULL,
+    .transparent = eq_node_transparent, .same_length = true, .auto_bypass = false
+};
+static const dsp_node_ops_t src_node_ops = {
+    .name = "resampler", .process = src_node_process, .reset = src_node_reset,
+    .latency = src_node_latency, .input_per_output = src_node_input_per_output,
+    .transparent = src_node_transparent, .same_length = false, .auto_bypass = false
+};
+static const dsp_node_ops_t analyzer_node_ops = {
+    .name = "analyzer", .process = analyzer_node_process, .reset = NULL,
+    .latency = NULL, .input_per_output = NULL,
+    .transparent = analyzer_node_transparent, .same_length = false, .auto_bypass = false
+};
+static const dsp_node_ops_t limiter_node_ops = {
+    .name = "limiter", .process = limiter_node_process, .reset = limiter_node_reset,
+    .latency = limiter_node_latency, .input_per_output = NULL,
+    .transparent = NULL, .same_length = true, .auto_bypass = true
+};
+static dsp_node_t stretch_node = {.ops = &stretch_node_ops, .output = &dsp_stretched,
+                                  .stats = &pipeline_stats.stage[STAGE_STRETCH]};
+static dsp_node_t eq_node = {.ops = &eq_node_ops, .stats = &pipeline_stats.stage[STAGE_EQ]};
+static dsp_node_t src_node = {.ops = &src_node_ops, .output = &dsp_resampled,
+                              .stats = &pipeline_stats.stage[STAGE_SRC]};
+static dsp_node_t analyzer_node = {.ops = &analyzer_node_ops};
+static dsp_node_t limiter_node = {.ops = &limiter_node_ops, .stats = &pipeline_stats.stage[STAGE_LIMIT]};
+
+// 按当前曲目的格式切分处理链的各个块，并预先分配 FIR 延迟线和重采样器；
+// 打开曲目和无缝换源时调用 (都由拥有处理链的线程调用)，之后读取循环中不再分配内存
+static bool dsp_chain_prepare() {
+    if (!dsp_path_supported(&wav_header)) {
+        return true;
+    }
+    int channels = wav_header.num_channels;
+    int max_block_frames = buffer_size / wav_header.block_align;
+    // 最慢速度下 PSOLA 输出约为输入的 1/MIN_SPEED_FACTOR 倍，另留一帧的余量
+    int max_stretched_frames = (int)(max_block_frames / MIN_SPEED_FACTOR) + 1024;
+    int max_output_frames = max_stretched_frames;
+    if (wav_header.sample_rate != rate && sample_rate_conversion_usable(&wav_header)) {
+        if (!sample_rate_converter_prepare(channels) || !resampler_ensure_capacity(src_state, max_stretched_frames)) {
+            return false;
+        }
+        int resampled_frames = resampler_max_output(src_state, max_stretched_frames);
+        if (resampled_frames > max_output_frames) {
+            max_output_frames = resampled_frames;
+        }
+    }
+    fir_ensure_capacity(channels, max_stretched_frames);
+    if (limiter_enabled && !limiter_prepare(channels, max_output_frames)) {
+        return false;
+    }
+
+    if (player_graph.count == 0) {
+        dsp_graph_insert(&player_graph, -1, &stretch_node);
+        dsp_graph_insert(&player_graph, -1, &eq_node);
+        if (analyzer_fps > 0) {
+            dsp_graph_insert(&player_graph, -1, &analyzer_node);
+        }
+        dsp_graph_insert(&player_graph, -1, &src_node);
+        if (limiter_enabled) {
+            dsp_graph_insert(&player_graph, -1, &limiter_node);
+        }
+        dsp_graph_reset(&player_graph);
+    }
+
+    // 旁路切换时的干信号块按处理链中最长的块分配
+    size_t output_bytes = (size_t)max_output_frames * channels * sample_format_bytes(device_format);
+    size_t arena_bytes = audio_block_bytes(channels, max_block_frames) +
+                         audio_block_bytes(channels, max_stretched_frames) +
+                         audio_block_bytes(channels, max_output_frames) * 2 + audio_align_up(output_bytes);
+    pthread_mutex_lock(&player_graph.lock);
+    bool carved = audio_arena_reserve(&dsp_arena, arena_bytes) &&
+                  audio_block_carve(&dsp_arena, &player_graph.dry, channels, max_output_frames);
+    pthread_mutex_unlock(&player_graph.lock);
+    if (!carved ||
+        !audio_block_carve(&dsp_arena, &dsp_input, channels, max_block_frames) ||
+        !audio_block_carve(&dsp_arena, &dsp_stretched, channels, max_stretched_frames) ||
+        !audio_block_carve(&dsp_arena, &dsp_resampled, channels, max_output_frames) ||
+        (dsp_output = (unsigned char *)audio_arena_alloc(&dsp_arena, output_bytes)) == NULL) {
+        log_program_info("ERROR", "Failed to allocate DSP buffers");
+        dsp_input.capacity = 0;
+        return false;
+    }
+    return true;
+}
+
+// 从当前位置读取 read_bytes 字节，转换成 float 后依次应用时间拉伸、均衡器和采样率转换；*out 描述
+// 处理结果 (格式不支持或未被改变时直接是源数据)，到设备格式的转换由 processed_block_emit 写进目标缓冲区
+// 返回读取的字节数，0 表示文件结束，<0 表示出错
+static int process_source_bytes(processed_block_t *out, size_t read_bytes) {
+    memset(out, 0, sizeof(*out));
+    const unsigned char *source_bytes = NULL;
+    uint64_t read_started = monotonic_ns();
+    size_t frames_read = audio_source_read(&music_source, (size_t)current_position, read_bytes / wav_header.block_align,
+                                           buff, &source_bytes);
+    int read_ret = (int)(frames_read * wav_header.block_align);
+    current_position += (long)frames_read;
+    stats_record(&pipeline_stats.stage[STAGE_READ], monotonic_ns() - read_started);
+
+    if (read_ret == 0) {
+        if (music_source.map == NULL && ferror(fp)) {
+            log_program_info("ERROR", "Error reading PCM data from file");
+            return -1;
+        }
+        log_program_info("PLAYBACK", "End of current track");
+        return 0;
+    }
+
+    snd_pcm_uframes_t frames_to_write = frames_read;
+
+    if ((size_t)read_ret < read_bytes) {
+        log_program_info("PLAYBACK", "End of music file (partial buffer read)");
+        // 播放最后一块数据，下次读取返回0时会触发切换
+    }
+
+    if (!dsp_path_supported(&wav_header)) {
+        // 不支持的格式: 源数据直接写入环形缓冲区
+        out->bytes = source_bytes;
+        out->frames = frames_to_write;
+        out->frame_bytes = wav_header.block_align;
+        return read_ret;
+    }
+
+    int channels = wav_header.num_channels;
+    if ((int)frames_to_write > dsp_input.capacity || dsp_input.channels != channels) {
+        log_program_info("ERROR", "DSP buffers not prepared for this track");
+        return -1;
+    }
+    sample_format_t input_format = sample_format_from_wav(&wav_header);
+    uint64_t convert_started = monotonic_ns();
+    pcm_to_float(source_bytes, input_format, channels, (int)frames_to_write, dsp_input.channel);
+    dsp_input.frames = (int)frames_to_write;
+    uint64_t convert_ns = monotonic_ns() - convert_started;
+
+    // 时间拉伸 -> 均衡器 -> 采样率转换，由处理链按节点顺序执行
+    bool modified = false;
+    audio_block_t *block = dsp_graph_process(&player_graph, &dsp_input, &modified);
+    if (block == NULL) {
+        return -1;
+    }
+
+    out->convert_ns = convert_ns;
+    out->frame_bytes = (size_t)sample_format_bytes(device_format) * channels;
+    // 软件音量: 与上一块结束时不同就在本块内线性过渡到新的增益
+    float target_gain = soft_volume_gain(current_volume_db);
+    out->gain = soft_volume_applied;
+    out->gain_step = 0.0f;
+    if (target_gain != soft_volume_applied && block->frames > 0) {
+        out->gain_step = (target_gain - soft_volume_applied) / block->frames;
+        soft_volume_applied = target_gain;
+    }
+    bool gain_applied = out->gain != 1.0f || out->gain_step != 0.0f;
+
+    // 信号未被改变且格式相同时直接输出源数据，S32 等超出 float 精度的格式也保持比特精确
+    if (!modified && !gain_applied && input_format == device_format) {
+        out->bytes = source_bytes;
+        out->frames = frames_to_write;
+        return read_ret;
+    }
+
+    // 信号被处理过或设备位数更少时，转换成设备格式时抖动
+    bool requantize = modified || gain_applied || sample_format_bits(input_format) > sample_format_bits(device_format);
+    out->block = block;
+    out->dither = dither_enabled && requantize;
+    out->frames = block->frames;
+    return read_ret;
+}
+
+// 读取并处理下一块
+static int read_and_process_block(processed_block_t *out) {
+    // 块边界: 取控制线程最新发布的参数，本块内不再变化
+    dsp_params_sync();
+    float speed_factor = current_speed_factor;
+
+    // 流式拉伸在块之间保留多余的输出，慢速时按比例少读，使每块的输出量接近 buffer_size
+    size_t read_bytes = buffer_size;
+    if (stretch_mode_is_streaming(current_stretch_mode) && speed_factor < 1.0f) {
+        read_bytes = (size_t)(buffer_size * speed_factor) / wav_header.block_align * wav_header.block_align;
+        if (read_bytes == 0) {
+            read_bytes = wav_header.block_align;
+        }
+    }
+    return process_source_bytes(out, read_bytes);
+}
+
+// 把处理结果中 [offset, offset + frames) 的帧以设备格式写到 dst: 直通时复制，否则直接在 dst 上做
+// 最后一次格式转换 (分段调用时抖动状态连续)
+static void processed_block_emit(processed_block_t *pb, size_t offset, size_t frames, unsigned char *dst) {
+    if (pb->block == NULL) {
+        memcpy(dst, pb->bytes + offset * pb->frame_bytes, frames * pb->frame_bytes);
+        return;
+    }
+    float *src[FIR_MAX_CHANNELS];
+    for (int ch = 0; ch < pb->block->channels; ch++) {
+        src[ch] = pb->block->channel[ch] + offset;
+    }
+    uint64_t started = monotonic_ns();
+    float_to_pcm_gain(src, pb->block->channels, (int)frames, device_format, dst, pb->dither ? &dither_seed : NULL,
+                      pb->gain + pb->gain_step * offset, pb->gain_step);
+    pb->convert_ns += monotonic_ns() - started;
+}
+
+// --- 无缝播放 ---
+// 读取线程: 当前曲目读完时换到已预先打开的下一首，不重置DSP状态 (两首歌当作连续的流)
+static bool gapless_switch_source() {
+    if (!atomic_load_explicit(&gapless_next_ready, memory_order_acquire)) {
+        return false;
+    }
+    close_music_file();
+    install_track(&gapless_next);
+    if (!dsp_chain_prepare()) {
+        atomic_store(&gapless_next_ready, false);
+        return false;
+    }
+
+    atomic_store(&gapless_boundary_frame, atomic_load_explicit(&playback_ring.write_pos, memory_order_relaxed));
+    atomic_store(&gapless_next_ready, false);
+    atomic_store(&gapless_switch_pending, true);
+    log_program_info("PLAYBACK", "Gapless source switch");
+    return true;
+}
+
+// 输出已越过换源边界，主线程还没有更新曲目信息
+static bool gapless_boundary_crossed() {
+    return atomic_load(&gapless_switch_pending) &&
+           atomic_load_explicit(&playback_ring.read_pos, memory_order_acquire) >= atomic_load(&gapless_boundary_frame);
+}
+
+// 读取/输出线程的等待: 置位后复查 blocked()，没有停止请求且仍被阻塞时睡到对方通知
+static void pipeline_wait(wake_event_t *ev, bool (*blocked)(void)) {
+    wake_event_arm(ev);
+    if (!atomic_load(&pipeline_stop_requested) && blocked()) {
+        wake_event_wait(ev, PIPELINE_WAIT_TIMEOUT_MS);
+    } else {
+        wake_event_disarm(ev);
+    }
+}
+
+// 暂停时读取线程仍要执行排队的命令
+static bool playback_paused() {
+    return current_state == PAUSED && audio_ring_fill(&control_queue) == 0;
+}
+
+static bool ring_full() {
+    return audio_ring_space(&playback_ring) == 0;
+}
+
+// reader_finished 在最后一次写入之后才置位，所以空且已结束时输出线程不再等待
+static bool ring_starved() {
+    return audio_ring_fill(&playback_ring) == 0 && !atomic_load(&reader_finished);
+}
+
+// 读取线程执行定位: 从目标前 SEEK_PREROLL_MS 处重新开始，把预读部分送过处理链后丢弃输出，
+// 再让下一次写入跳过处理链内部积压的帧 (按当前的延迟估计换算成输出帧)，最后通知输出线程
+// 新音频从环形缓冲区的哪一帧开始
+static void seek_to(long target, uint64_t issued_ns) {
+    long preroll = (long)wav_header.sample_rate * SEEK_PREROLL_MS / 1000;
+    if (!dsp_path_supported(&wav_header) || preroll > target) {
+        preroll = dsp_path_supported(&wav_header) ? target : 0;
+    }
+    current_position = target - preroll;
+    audio_source_seek(&music_source, (size_t)current_position);
+    dsp_graph_reset(&player_graph);
+    seek_skip_frames = 0;
+
+    long block_frames = (long)(buffer_size / wav_header.block_align);
+    while (current_position < target) {
+        long frames = target - current_position < block_frames ? target - current_position : block_frames;
+        processed_block_t discarded;
+        if (process_source_bytes(&discarded, (size_t)frames * wav_header.block_align) <= 0) {
+            break;
+        }
+    }
+    if (preroll > 0) {
+        double input_per_output = 1.0;
+        double pending = dsp_graph_latency(&player_graph, &input_per_output);
+        seek_skip_frames = (size_t)(pending / input_per_output + 0.5);
+    }
+
+    atomic_store(&seek_issued_ns, issued_ns);
+    atomic_store(&seek_flush_frame, atomic_load_explicit(&playback_ring.write_pos, memory_order_relaxed) + 1);
+    zones_flush();
+    wake_event_signal(&ring_data_event);
+}
+
+// 读取线程在块边界执行排队的命令；切歌时把目标交给主线程并返回 false，读取线程随即结束，
+// 之后的命令留给下一首的读取线程
+static bool control_run_commands() {
+    unsigned char *ptr;
+    while (audio_ring_peek(&control_queue, &ptr) > 0) {
+        control_cmd_t cmd;
+        memcpy(&cmd, ptr, sizeof(cmd));
+        audio_ring_consume(&control_queue, 1);
+
+        if (cmd.type == CONTROL_CMD_TRACK) {
+            atomic_store(&track_request, (int)cmd.value);
+            wake_event_signal(&control_event);
+            return false;
+        }
+        if (music_source.stream != NULL || total_frames <= 0) {
+            continue;
+        }
+        // 相对的是正在播放的位置，而不是已经读到的位置
+        long target = playback_position() + cmd.value;
+        if (target >= total_frames) {
+            target = total_frames - 1;
+        }
+        if (target < 0) {
+            target = 0;
+        }
+        seek_to(target, cmd.issued_ns);
+    }
+    return true;
+}
+
+// 读取/DSP线程: 生产者
+static void *reader_thread_main(void *arg) {
+    (void)arg;
+
+    while (!atomic_load(&pipeline_stop_requested)) {
+        if (!control_run_commands()) {
+            break;
+        }
+        if (current_state == PAUSED) {
+            pipeline_wait(&ring_space_event, playback_paused);
+            continue;
+        }
+
+        processed_block_t processed;
+        int read_ret = read_and_process_block(&processed);
+        if (read_ret == 0 && gapless_switch_source()) {
+            continue;
+        }
+        if (read_ret <= 0) {
+            break;
+        }
+
+        // 直接写进环形缓冲区的空闲区域 (最后的格式转换也在这里完成)，空间不足时等待输出线程消费；
+        // 定位后先跳过处理链中还对应目标之前的帧
+        size_t done = seek_skip_frames < processed.frames ? seek_skip_frames : processed.frames;
+        seek_skip_frames -= done;
+        while (done < processed.frames && !atomic_load(&pipeline_stop_requested)) {
+            unsigned char *dst;
+            size_t space = audio_ring_reserve(&playback_ring, &dst);
+            if (space == 0) {
+                pipeline_wait(&ring_space_event, ring_full);
+                continue;
+            }
+            size_t n = processed.frames - done < space ? processed.frames - done : space;
+            processed_block_emit(&processed, done, n, dst);
+            zones_feed(dst, n);
+            audio_ring_commit(&playback_ring, n);
+            wake_event_signal(&ring_data_event);
+            done += n;
+        }
+        stats_record(&pipeline_stats.stage[STAGE_CONVERT], processed.convert_ns);
+    }
+
+    atomic_store(&reader_finished, true);
+    wake_event_signal(&ring_data_event);
+    zones_wake();
+    return NULL;
+}
+
+// mmap 模式等待设备可写: 同时 poll ALSA 的描述符和 ring_data_event (pipeline_stop 会通知它)，
+// 设备状态 (欠载等) 留给随后的 snd_pcm_avail_update 报告
+static int output_wait_device() {
+    struct pollfd pfds[OUTPUT_MAX_POLL_FDS + 1];
+    int count = snd_pcm_poll_descriptors(pcm_handle, pfds, OUTPUT_MAX_POLL_FDS);
+    if (count < 0) {
+        return count;
+    }
+    pfds[count] = (struct pollfd){.fd = ring_data_event.fd, .events = POLLIN};
+
+    wake_event_arm(&ring_data_event);
+    int ret = atomic_load(&pipeline_stop_requested) ? 0 : poll(pfds, count + 1, PIPELINE_WAIT_TIMEOUT_MS);
+    wake_event_disarm(&ring_data_event);
+    if (ret < 0) {
+        return errno == EINTR ? 0 : -errno;
+    }
+    if (ret > 0) {
+        if (pfds[count].revents & POLLIN) {
+            wake_event_clear(&ring_data_event);
+        }
+        unsigned short revents;
+        snd_pcm_poll_descriptors_revents(pcm_handle, pfds, count, &revents);
+    }
+    return 0;
+}
+
+// mmap 输出: 把环形缓冲区中的帧直接复制进声卡的 DMA 区域，省去 snd_pcm_writei 内部的中间缓冲。
+// 非交错 (mmap-planar) 时按每个声道的 addr/first/step 拆分。返回写入的帧数，<0 为 ALSA 错误码
+static snd_pcm_sframes_t output_write_mmap(const unsigned char *src, snd_pcm_uframes_t frames) {
+    size_t frame_bytes = playback_ring.frame_bytes;
+    int channels = wav_header.num_channels;
+    size_t sample_bytes = frame_bytes / channels;
+    snd_pcm_uframes_t done = 0;
+
+    while (done < frames && !atomic_load(&pipeline_stop_requested)) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm_handle);
+        if (avail < 0) {
+            return avail;
+        }
+        if (avail == 0) {
+            // mmap 模式下没有 writei 的自动启动，缓冲区填满后要手动 start
+            if (snd_pcm_state(pcm_handle) == SND_PCM_STATE_PREPARED) {
+                snd_pcm_start(pcm_handle);
+            }
+            int err = output_wait_device();
+            if (err < 0) {
+                return err;
+            }
+            continue;
+        }
+
+        const snd_pcm_channel_area_t *areas;
+        snd_pcm_uframes_t offset;
+        snd_pcm_uframes_t n = frames - done;
+        if ((snd_pcm_uframes_t)avail < n) {
+            n = avail;
+        }
+        int err = snd_pcm_mmap_begin(pcm_handle, &areas, &offset, &n);
+        if (err < 0) {
+            return err;
+        }
+
+        const unsigned char *in = src + done * frame_bytes;
+        unsigned char *base = (unsigned char *)areas[0].addr;
+        if (areas[0].step == frame_bytes * 8 && areas[0].first == 0) {
+            // 交错: 一次连续复制
+            memcpy(base + offset * frame_bytes, in, n * frame_bytes);
+        } else {
+            for (int ch = 0; ch < channels; ch++) {
+                unsigned char *out = (unsigned char *)areas[ch].addr + areas[ch].first / 8 + offset * (areas[ch].step / 8);
+                for (snd_pcm_uframes_t i = 0; i < n; i++) {
+                    memcpy(out + i * (areas[ch].step / 8), in + i * frame_bytes + ch * sample_bytes, sample_bytes);
+                }
+            }
+        }
+
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm_handle, offset, n);
+        if (committed < 0) {
+            return committed;
+        }
+        if ((snd_pcm_uframes_t)committed != n) {
+            return -EPIPE;
+        }
+        done += n;
+    }
+    return done;
+}
+
+// 环形缓冲区中从 pos 开始的 frames 帧 (可能绕过末尾) 与平面 float 之间转换，交叉淡化用
+static void ring_frames_to_float(audio_ring_t *ring, size_t pos, int frames, float *const *dst) {
+    int channels = wav_header.num_channels;
+    size_t start = pos & (ring->capacity - 1);
+    int first = ring->capacity - start < (size_t)frames ? (int)(ring->capacity - start) : frames;
+    pcm_to_float(ring->data + start * ring->frame_bytes, device_format, channels, first, dst);
+    if (first < frames) {
+        float *rest[FIR_MAX_CHANNELS];
+        for (int ch = 0; ch < channels; ch++) {
+            rest[ch] = dst[ch] + first;
+        }
+        pcm_to_float(ring->data, device_format, channels, frames - first, rest);
+    }
+}
+
+static void ring_frames_from_float(audio_ring_t *ring, size_t pos, int frames, float *const *src) {
+    int channels = wav_header.num_channels;
+    size_t start = pos & (ring->capacity - 1);
+    int first = ring->capacity - start < (size_t)frames ? (int)(ring->capacity - start) : frames;
+    float_to_pcm(src, channels, first, device_format, ring->data + start * ring->frame_bytes, NULL);
+    if (first < frames) {
+        float *rest[FIR_MAX_CHANNELS];
+        for (int ch = 0; ch < channels; ch++) {
+            rest[ch] = src[ch] + first;
+        }
+        float_to_pcm(rest, channels, frames - first, device_format, ring->data, NULL);
+    }
+}
+
+// 输出线程处理定位分两步。先取出接下来本该播放的旧音频 (最多 SEEK_CROSSFADE_MS) 转成 float，
+// 并立即丢弃新音频起点之前的所有帧，让读取线程有空间写入；等新音频够一次淡化时做等功率
+// 交叉淡化，结果写回新音频开头 (这段已提交、只属于消费方)。直通 (不经处理链) 的格式不淡化
+static int seek_fade_frames = 0;    // 只由输出线程访问: 已取出、等待与新音频混合的旧音频帧数
+
+static void seek_take_old_audio(size_t flush) {
+    audio_ring_t *ring = &playback_ring;
+    size_t flush_frame = flush - 1;
+    size_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    size_t old_frames = flush_frame - read_pos;
+    if (old_frames > (size_t)seek_fade_old.capacity) {
+        old_frames = (size_t)seek_fade_old.capacity;
+    }
+    seek_fade_frames = 0;
+    if (old_frames > 0 && dsp_path_supported(&wav_header) && device_format != SAMPLE_FORMAT_UNKNOWN) {
+        ring_frames_to_float(ring, read_pos, (int)old_frames, seek_fade_old.channel);
+        seek_fade_frames = (int)old_frames;
+    }
+    audio_ring_consume(ring, flush_frame - read_pos);
+    wake_event_signal(&ring_space_event);
+    // 期间读取线程又定位了一次时保留新的请求
+    atomic_compare_exchange_strong(&seek_flush_frame, &flush, 0);
+    if (seek_fade_frames == 0) {
+        stats_record(&pipeline_stats.stage[STAGE_SEEK], monotonic_ns() - atomic_load(&seek_issued_ns));
+    }
+}
+
+// 新音频还不够一次交叉淡化，读取线程也还没结束
+static bool seek_fade_starved() {
+    return seek_fade_frames > 0 && !atomic_load(&reader_finished) &&
+           audio_ring_fill(&playback_ring) < (size_t)seek_fade_frames;
+}
+
+// 新音频不够时返回 false，由调用方等待
+static bool seek_mix_new_audio() {
+    if (seek_fade_starved()) {
+        return false;
+    }
+    audio_ring_t *ring = &playback_ring;
+    size_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    size_t fade = audio_ring_fill(ring) < (size_t)seek_fade_frames ? audio_ring_fill(ring) : (size_t)seek_fade_frames;
+    int channels = wav_header.num_channels;
+    ring_frames_to_float(ring, read_pos, (int)fade, seek_fade_new.channel);
+    for (size_t i = 0; i < fade; i++) {
+        float theta = (float)M_PI * 0.5f * ((float)i + 0.5f) / (float)fade;
+        float fade_out = cosf(theta), fade_in = sinf(theta);
+        for (int ch = 0; ch < channels; ch++) {
+            seek_fade_new.channel[ch][i] = seek_fade_old.channel[ch][i] * fade_out +
+                                           seek_fade_new.channel[ch][i] * fade_in;
+        }
+    }
+    ring_frames_from_float(ring, read_pos, (int)fade, seek_fade_new.channel);
+    seek_fade_frames = 0;
+    stats_record(&pipeline_stats.stage[STAGE_SEEK], monotonic_ns() - atomic_load(&seek_issued_ns));
+    return true;
+}
+
+// 输出线程: 消费者，唯一向声卡写数据的线程 (snd_pcm_writei 或 mmap)
+static void *output_thread_main(void *arg) {
+    (void)arg;
+    bool started = false, starving = false;
+
+    while (!atomic_load(&pipeline_stop_requested)) {
+        if (current_state == PAUSED) {
+            pipeline_wait(&ring_data_event, playback_paused);
+            continue;
+        }
+
+        unsigned char *ptr;
+        size_t available = audio_ring_peek(&playback_ring, &ptr);
+        // 在 peek 之后检查: 读取线程先发布起点再提交新帧，看到了新帧就一定看到了起点
+        size_t flush = atomic_load(&seek_flush_frame);
+        if (flush != 0) {
+            seek_take_old_audio(flush);
+            continue;
+        }
+        if (seek_fade_frames > 0 && !seek_mix_new_audio()) {
+            pipeline_wait(&ring_data_event, seek_fade_starved);
+            continue;
+        }
+        if (available == 0) {
+            // reader_finished 在最后一次写入之后才置位，所以这里再检查一次填充量
+            if (atomic_load(&reader_finished) && audio_ring_fill(&playback_ring) == 0) {
+                break;
+            }
+            // 开始输出之后读空说明读取/DSP 跟不上，每次连续读空只计一次
+            if (started && !starving) {
+                STATS_ADD(pipeline_stats.ring_empty, 1);
+                starving = true;
+            }
+            pipeline_wait(&ring_data_event, ring_starved);
+            continue;
+        }
+        if (available > pipeline_period_frames) {
+            available = pipeline_period_frames;
+        }
+
+        starving = false;
+        stats_note_output(audio_ring_fill(&playback_ring));
+
+        uint64_t write_started = monotonic_ns();
+        bool use_mmap = pcm_access != SND_PCM_ACCESS_RW_INTERLEAVED;
+        snd_pcm_sframes_t frames_written_alsa = use_mmap ? output_write_mmap(ptr, available)
+                                                         : snd_pcm_writei(pcm_handle, ptr, available);
+        stats_record(&pipeline_stats.stage[STAGE_WRITE], monotonic_ns() - write_started);
+        if (frames_written_alsa < 0) {
+            if (frames_written_alsa == -EPIPE) {
+                STATS_ADD(pipeline_stats.underruns, 1);
+                log_program_info("WARNING", "Audio underrun occurred, preparing interface");
+                snd_pcm_prepare(pcm_handle);
+                wake_event_signal(&control_event); // 自适应延迟据此升档
+                continue;
+            }
+            char error_msg[LOG_BUFFER_SIZE];
+            snprintf(error_msg, sizeof(error_msg), "Error from %s: %s",
+                     use_mmap ? "snd_pcm_mmap_commit" : "snd_pcm_writei", snd_strerror(frames_written_alsa));
+            log_program_info("ERROR", error_msg);
+            atomic_store(&output_failed, true);
+            break;
+        }
+        audio_ring_consume(&playback_ring, frames_written_alsa);
+        wake_event_signal(&ring_space_event);
+        if (gapless_boundary_crossed()) {
+            wake_event_signal(&control_event);
+        }
+        if (STATS_GET(pipeline_stats.first_audio_ns) == 0) {
+            STATS_SET(pipeline_stats.first_audio_ns, monotonic_ns() - startup_ns);
+            wake_event_signal(&control_event); // 主线程报告，快速启动时再做推迟的初始化
+        }
+        started = true;
+
+        snd_pcm_sframes_t delay;
+        if (snd_pcm_delay(pcm_handle, &delay) == 0) {
+            stats_note_pcm_delay(delay);
+        }
+    }
+
+    atomic_store(&output_finished, true);
+    wake_event_signal(&control_event);
+    return NULL;
+}
+
+// 创建输出线程 (主输出和各区域)，允许时使用 SCHED_FIFO，否则回退到默认调度
+static bool create_output_thread(pthread_t *thread, void *(*start)(void *), void *arg) {
+    if (output_rt_priority > 0) {
+        int prio = output_rt_priority;
+        if (prio < sched_get_priority_min(SCHED_FIFO)) prio = sched_get_priority_min(SCHED_FIFO);
+        if (prio > sched_get_priority_max(SCHED_FIFO)) prio = sched_get_priority_max(SCHED_FIFO);
+
+        pthread_attr_t attr;
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = prio;
+        pthread_attr_init(&attr);
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+        int err = pthread_create(thread, &attr, start, arg);
+        pthread_attr_destroy(&attr);
+
+        char info_msg[LOG_BUFFER_SIZE];
+        if (err == 0) {
+            snprintf(info_msg, sizeof(info_msg), "Output thread running with SCHED_FIFO priority %d", prio);
+            log_program_info("INFO", info_msg);
+            return true;
+        }
+        snprintf(info_msg, sizeof(info_msg), "SCHED_FIFO priority %d not permitted (%s), using default scheduling", prio, strerror(err));
+        log_program_info("WARNING", info_msg);
+    }
+    return pthread_create(thread, NULL, start, arg) == 0;
+}
+
+// --- 多区域输出 (见 const.h) ---
+static const char *zone_eq_names[] = {"normal", "bass", "treble", "vocal"};
+
+// -Z 设备[@eq=模式][@vol=dB][@rate=Hz]；ALSA 设备名中可能有 ':' 和 ','，所以用 '@' 分隔
+bool zone_parse(const char *spec) {
+    if (output_zone_count >= MAX_ZONES - 1) {
+        fprintf(stderr, "At most %d extra output zones are supported.\n", MAX_ZONES - 1);
+        return false;
+    }
+    char *copy = strdup(spec);
+    if (copy == NULL) {
+        return false;
+    }
+    output_zone_t *z = &output_zones[output_zone_count];
+    memset(z, 0, sizeof(*z));
+    z->device = copy;
+    z->eq_mode = EQ_NORMAL;
+    z->gain = 1.0f;
+    z->data_event.fd = -1;
+
+    char *save = NULL;
+    strtok_r(copy, "@", &save);
+    for (char *opt = strtok_r(NULL, "@", &save); opt != NULL; opt = strtok_r(NULL, "@", &save)) {
+        bool ok = false;
+        if (strncmp(opt, "eq=", 3) == 0) {
+            for (int m = EQ_NORMAL; m <= EQ_VOCAL_ENHANCE; m++) {
+                if (strcmp(opt + 3, zone_eq_names[m]) == 0) {
+                    z->eq_mode = (equalizer_mode_t)m;
+                    ok = true;
+                }
+            }
+        } else if (strncmp(opt, "vol=", 4) == 0) {
+            float db = (float)atof(opt + 4);
+            ok = db >= -60.0f && db <= 12.0f;
+            z->gain = powf(10.0f, db / 20.0f);
+        } else if (strncmp(opt, "rate=", 5) == 0) {
+            z->requested_rate = (unsigned int)atoi(opt + 5);
+            ok = z->requested_rate >= 8000;
+        }
+        if (!ok) {
+            fprintf(stderr, "Invalid zone option '%s' (eq=normal|bass|treble|vocal, vol=-60..12, rate=Hz)\n", opt);
+            free(copy);
+            return false;
+        }
+    }
+    if (copy[0] == '\0') {
+        free(copy);
+        return false;
+    }
+    output_zone_count++;
+    return true;
+}
+
+// 按主输出的格式、周期和缓冲区大小配置区域的设备；采样率未指定时跟随主输出
+static bool zone_configure(output_zone_t *z, int channels) {
+    snd_pcm_drop(z->pcm);
+    snd_pcm_hw_params_t *params;
+    if (snd_pcm_hw_params_malloc(&params) < 0) {
+        return false;
+    }
+    unsigned int zone_rate = z->requested_rate ? z->requested_rate : rate;
+    snd_pcm_uframes_t period = (snd_pcm_uframes_t)((uint64_t)(period_size / wav_header.block_align) * zone_rate / rate);
+    snd_pcm_uframes_t buffer = (snd_pcm_uframes_t)((uint64_t)frames * zone_rate / rate);
+    int err = snd_pcm_hw_params_any(z->pcm, params);
+    if (err >= 0) err = snd_pcm_hw_params_set_access(z->pcm, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+    if (err >= 0) err = snd_pcm_hw_params_set_format(z->pcm, params, pcm_format);
+    if (err >= 0) err = snd_pcm_hw_params_set_rate_near(z->pcm, params, &zone_rate, 0);
+    if (err >= 0) err = snd_pcm_hw_params_set_channels(z->pcm, params, channels);
+    if (err >= 0) err = snd_pcm_hw_params_set_buffer_size_near(z->pcm, params, &buffer);
+    if (err >= 0) err = snd_pcm_hw_params_set_period_size_near(z->pcm, params, &period, 0);
+    if (err >= 0) err = snd_pcm_hw_params(z->pcm, params);
+    if (err >= 0) {
+        snd_pcm_hw_params_get_period_size(params, &z->period_frames, 0);
+        snd_pcm_hw_params_get_buffer_size(params, &z->buffer_frames);
+    }
+    snd_pcm_hw_params_free(params);
+
+    char msg[LOG_BUFFER_SIZE];
+    if (err < 0) {
+        snprintf(msg, sizeof(msg), "Zone %s: failed to configure device: %s", z->device, snd_strerror(err));
+        log_program_info("ERROR", msg);
+        return false;
+    }
+    snd_pcm_prepare(z->pcm);
+    z->rate = zone_rate;
+    z->channels = channels;
+    snprintf(msg, sizeof(msg), "Zone %s: %u Hz, %d channels, period %lu frames, buffer %lu frames",
+             z->device, z->rate, channels, z->period_frames, z->buffer_frames);
+    log_program_info("INFO", msg);
+    return true;
+}
+
+// 主输出配置好之后打开各区域的设备；打不开的区域跳过，不影响主输出
+void zones_open() {
+    for (int i = 0; i < output_zone_count; i++) {
+        output_zone_t *z = &output_zones[i];
+        int err = snd_pcm_open(&z->pcm, z->device, stream, 0);
+        if (err < 0 || !wake_event_init(&z->data_event) || !zone_configure(z, wav_header.num_channels)) {
+            printf("Warning: output zone %s could not be opened (%s), skipped\n", z->device,
+                   err < 0 ? snd_strerror(err) : "configuration failed");
+            if (err >= 0) {
+                snd_pcm_close(z->pcm);
+            }
+            wake_event_close(&z->data_event);
+            z->pcm = NULL;
+            continue;
+        }
+        printf("输出区域 %d: %s, %u Hz, 均衡器 %s, 音量 %+.1f dB\n", i + 1, z->device, z->rate,
+               zone_eq_names[z->eq_mode], 20.0f * log10f(z->gain));
+    }
+}
+
+void zones_close() {
+    for (int i = 0; i < output_zone_count; i++) {
+        output_zone_t *z = &output_zones[i];
+        if (z->pcm != NULL) {
+            snd_pcm_drain(z->pcm);
+            snd_pcm_close(z->pcm);
+            z->pcm = NULL;
+        }
+        wake_event_close(&z->data_event);
+        free((void *)z->device);
+        z->device = NULL;
+    }
+    output_zone_count = 0;
+}
+
+static void zone_release(output_zone_t *z) {
+    audio_ring_free(&z->ring);
+    audio_block_free(&z->in);
+    audio_block_free(&z->out);
+    free(z->pcm_buf);
+    z->pcm_buf = NULL;
+    resampler_destroy(z->src);
+    z->src = NULL;
+    limiter_destroy(z->limiter);
+    z->limiter = NULL;
+}
+
+// 按当前曲目分配区域线程的缓冲区 (线程里不再分配)。ring 要容纳主环形缓冲区和两边声卡缓冲区的差，
+// 稳态下不会溢出；漂移积分项跨曲目保留，换曲后不必重新收敛
+static bool zone_prepare(output_zone_t *z) {
+    int channels = z->channels;
+    z->chunk_frames = (int)((uint64_t)z->period_frames * rate / z->rate);
+    if (z->chunk_frames < 64) {
+        z->chunk_frames = 64;
+    }
+    size_t ring_frames = playback_ring.capacity * 2 + frames * 2 + (size_t)z->buffer_frames * rate / z->rate * 2;
+    src_quality_t quality = src_quality != SRC_OFF ? src_quality : SRC_FAST;
+    z->src = resampler_create_adjustable(rate, z->rate, channels, quality);
+    if (z->src == NULL || !resampler_ensure_capacity(z->src, z->chunk_frames) ||
+        !audio_ring_init(&z->ring, ring_frames, playback_ring.frame_bytes)) {
+        return false;
+    }
+    // 比例最多快 ZONE_MAX_DRIFT_PPM，输出按两倍留余量
+    int out_frames = resampler_max_output(z->src, z->chunk_frames) + z->chunk_frames / 500 + 8;
+    z->pcm_buf = (unsigned char *)malloc((size_t)out_frames * channels * sample_format_bytes(device_format));
+    if (!audio_block_reserve(&z->in, channels, z->chunk_frames) || !audio_block_reserve(&z->out, channels, out_frames) ||
+        z->pcm_buf == NULL) {
+        return false;
+    }
+    if (limiter_enabled) {
+        z->limiter = limiter_create(channels, z->rate, out_frames, limiter_ceiling_db);
+        if (z->limiter == NULL) {
+            return false;
+        }
+    }
+    biquad_eq_init(&z->eq);
+    biquad_eq_set_mode(&z->eq, z->eq_mode, z->rate);
+
+    z->dither_seed = 0x9E3779B9u ^ (uint32_t)(z - output_zones + 1);
+    z->fade_frames = (int)(z->rate * ZONE_FADE_MS / 1000) + 1;
+    z->fade_remaining = 0;
+    z->extra_latency = (double)z->src->taps / 2.0 / rate + (z->limiter ? (double)z->limiter->lookahead / z->rate : 0.0);
+    z->error_avg = 0.0;
+    z->measured_ns = 0;
+    z->settle_until_ns = monotonic_ns() + ZONE_SETTLE_MS * 1000000ull;
+    resampler_set_ratio(z->src, 1.0 + ZONE_KI * z->integral);
+    atomic_store(&z->flush_frame, 0);
+    atomic_store(&z->finished, false);
+    return true;
+}
+
+// 环形缓冲区中尚未播放的帧；定位后等待丢弃的旧音频不计入
+static size_t zone_ring_queued(audio_ring_t *ring, size_t flush) {
+    if (flush != 0) {
+        return atomic_load_explicit(&ring->write_pos, memory_order_acquire) - (flush - 1);
+    }
+    return audio_ring_fill(ring);
+}
+
+// 主输出的端到端延迟 (秒): 主环形缓冲区中的帧加上声卡缓冲区；输出线程只在写入后取样 snd_pcm_delay，
+// 按之后经过的时间外推
+static bool zone_master_latency(double *latency) {
+    if (!atomic_load_explicit(&pipeline_stats.delay_valid, memory_order_relaxed)) {
+        return false;
+    }
+    double elapsed = (double)(monotonic_ns() - STATS_GET(pipeline_stats.pcm_delay_ns)) * 1e-9;
+    double delay = (double)STATS_GET(pipeline_stats.pcm_delay) - elapsed * rate;
+    if (delay < 0.0) {
+        delay = 0.0;
+    }
+    size_t queued = zone_ring_queued(&playback_ring, atomic_load(&seek_flush_frame));
+    *latency = ((double)queued + delay) / rate;
+    return true;
+}
+
+// 写入 frames 帧；欠载后重新准备设备，并在稳定后重新对齐。返回 false 表示不可恢复的错误
+static bool zone_write(output_zone_t *z, const unsigned char *buf, int frames) {
+    size_t frame_bytes = (size_t)sample_format_bytes(device_format) * z->channels;
+    int done = 0;
+    while (done < frames && !atomic_load(&pipeline_stop_requested)) {
+        snd_pcm_sframes_t n = snd_pcm_writei(z->pcm, buf + done * frame_bytes, frames - done);
+        if (n == -EPIPE) {
+            STATS_ADD(z->underruns, 1);
+            snd_pcm_prepare(z->pcm);
+            z->settle_until_ns = monotonic_ns() + ZONE_SETTLE_MS * 1000000ull;
+            continue;
+        }
+        if (n < 0) {
+            char msg[LOG_BUFFER_SIZE];
+            snprintf(msg, sizeof(msg), "Zone %s: snd_pcm_writei failed: %s", z->device, snd_strerror((int)n));
+            log_program_info("ERROR", msg);
+            return false;
+        }
+        done += (int)n;
+    }
+    return true;
+}
+
+// 误差过大时一次性对齐: 区域晚了就从 ring 中丢掉相应的帧，早了就先写一段静音
+static void zone_resync(output_zone_t *z, double error) {
+    if (error > 0.0) {
+        size_t drop = (size_t)(error * rate);
+        size_t queued = audio_ring_fill(&z->ring);
+        audio_ring_consume(&z->ring, drop < queued ? drop : queued);
+    } else {
+        int silence = (int)(-error * z->rate);
+        if (silence > (int)z->rate) {
+            silence = (int)z->rate;
+        }
+        for (int ch = 0; ch < z->channels; ch++) {
+            memset(z->out.channel[ch], 0, (size_t)z->out.capacity * sizeof(float));
+        }
+        while (silence > 0) {
+            int n = silence < z->out.capacity ? silence : z->out.capacity;
+            float_to_pcm(z->out.channel, z->channels, n, device_format, z->pcm_buf, NULL);
+            if (!zone_write(z, z->pcm_buf, n)) {
+                break;
+            }
+            silence -= n;
+        }
+    }
+    z->error_avg = 0.0;
+    z->measured_ns = 0;
+    z->settle_until_ns = monotonic_ns() + ZONE_SETTLE_MS * 1000000ull;
+    STATS_ADD(z->resyncs, 1);
+    char msg[LOG_BUFFER_SIZE];
+    snprintf(msg, sizeof(msg), "Zone %s: resync by %+.1f ms", z->device, error * 1000.0);
+    log_program_info("INFO", msg);
+}
+
+// 每次写入后: 区域的端到端延迟 (ring + 重采样/限幅 + 声卡缓冲区) 减去主输出的延迟即对齐误差 (正数表示
+// 区域晚)。平滑后经 PI 控制器得到比例调整: 区域晚时多消费输入，积分项抵消两块声卡时钟的固定偏差
+static void zone_track_master(output_zone_t *z) {
+    uint64_t now = monotonic_ns();
+    double master;
+    snd_pcm_sframes_t delay;
+    // 定位后旧音频还没丢弃时不测量 (重新对齐也不能越过新音频的起点)
+    if (now < z->settle_until_ns || atomic_load(&z->flush_frame) != 0 || !zone_master_latency(&master) ||
+        snd_pcm_delay(z->pcm, &delay) < 0) {
+        return;
+    }
+    double queued = (double)audio_ring_fill(&z->ring);
+    double error = queued / rate + (double)(delay > 0 ? delay : 0) / z->rate + z->extra_latency - master;
+    if (fabs(error) * 1000.0 > ZONE_RESYNC_MS) {
+        zone_resync(z, error);
+        return;
+    }
+
+    double dt = z->measured_ns != 0 ? (double)(now - z->measured_ns) * 1e-9 : 0.0;
+    z->measured_ns = now;
+    z->error_avg += dt / (ZONE_ERROR_TAU_S + dt) * (error - z->error_avg);
+    double limit = ZONE_MAX_DRIFT_PPM * 1e-6;
+    z->integral += z->error_avg * dt;
+    if (ZONE_KI * z->integral > limit) z->integral = limit / ZONE_KI;
+    if (ZONE_KI * z->integral < -limit) z->integral = -limit / ZONE_KI;
+    double correction = ZONE_KP * z->error_avg + ZONE_KI * z->integral;
+    if (correction > limit) correction = limit;
+    if (correction < -limit) correction = -limit;
+    resampler_set_ratio(z->src, 1.0 + correction);
+
+    STATS_SET(z->error_us, (int64_t)(z->error_avg * 1e6));
+    STATS_SET(z->correction_ppb, (int64_t)(correction * 1e9));
+}
+
+// 音量，定位后的新音频先淡入
+static void zone_apply_gain(output_zone_t *z, int frames) {
+    int i = 0;
+    for (; i < frames && z->fade_remaining > 0; i++, z->fade_remaining--) {
+        float g = z->gain * (1.0f - (float)z->fade_remaining / z->fade_frames);
+        for (int ch = 0; ch < z->channels; ch++) {
+            z->out.channel[ch][i] *= g;
+        }
+    }
+    if (z->gain == 1.0f) {
+        return;
+    }
+    for (int ch = 0; ch < z->channels; ch++) {
+        float *x = z->out.channel[ch];
+        for (int j = i; j < frames; j++) {
+            x[j] *= z->gain;
+        }
+    }
+}
+
+static bool zone_starved(output_zone_t *z) {
+    return audio_ring_fill(&z->ring) == 0 && !atomic_load(&reader_finished);
+}
+
+// 区域线程: 从自己的 ring 取帧，处理后写进自己的声卡
+static void *zone_thread_main(void *arg) {
+    output_zone_t *z = (output_zone_t *)arg;
+    int channels = z->channels;
+
+    while (!atomic_load(&pipeline_stop_requested)) {
+        if (current_state == PAUSED) {
+            pipeline_wait(&z->data_event, playback_paused);
+            continue;
+        }
+        unsigned char *ptr;
+        size_t available = audio_ring_peek(&z->ring, &ptr);
+        // 与主输出相同: 在 peek 之后检查定位
+        size_t flush = atomic_load(&z->flush_frame);
+        if (flush != 0) {
+            audio_ring_consume(&z->ring, flush - 1 - atomic_load_explicit(&z->ring.read_pos, memory_order_relaxed));
+            atomic_compare_exchange_strong(&z->flush_frame, &flush, 0);
+            z->fade_remaining = z->fade_frames;
+            continue;
+        }
+        if (available == 0) {
+            if (atomic_load(&reader_finished) && audio_ring_fill(&z->ring) == 0) {
+                break;
+            }
+            wake_event_arm(&z->data_event);
+            if (!atomic_load(&pipeline_stop_requested) && zone_starved(z)) {
+                wake_event_wait(&z->data_event, PIPELINE_WAIT_TIMEOUT_MS);
+            } else {
+                wake_event_disarm(&z->data_event);
+            }
+            continue;
+        }
+        if (available > (size_t)z->chunk_frames) {
+            available = (size_t)z->chunk_frames;
+        }
+
+        pcm_to_float(ptr, device_format, channels, (int)available, z->in.channel);
+        audio_ring_consume(&z->ring, available);
+        int produced = resampler_process(z->src, z->in.channel, (int)available, z->out.channel, z->out.capacity);
+        biquad_eq_process(&z->eq, z->out.channel, z->out.channel, produced, channels);
+        zone_apply_gain(z, produced);
+        if (z->limiter != NULL) {
+            limiter_process(z->limiter, z->out.channel, produced);
+        }
+        float_to_pcm(z->out.channel, channels, produced, device_format, z->pcm_buf,
+                     dither_enabled ? &z->dither_seed : NULL);
+        if (!zone_write(z, z->pcm_buf, produced)) {
+            break;
+        }
+        zone_track_master(z);
+    }
+
+    atomic_store(&z->finished, true);
+    wake_event_signal(&control_event);
+    return NULL;
+}
+
+// 流水线启动时调用 (读取线程创建之前；快速启动时在预读之后，区域由重新对齐补上与主输出的差)；
+// 已在运行的区域跳过，准备失败只影响该区域
+bool zones_start() {
+    if (output_zone_count == 0) {
+        return true;
+    }
+    if (!dsp_path_supported(&wav_header)) {
+        log_program_info("WARNING", "Output zones need the DSP path, zones are silent for this track");
+        return true;
+    }
+    for (int i = 0; i < output_zone_count; i++) {
+        output_zone_t *z = &output_zones[i];
+        if (z->pcm == NULL || atomic_load(&z->running)) {
+            continue;
+        }
+        if ((z->channels != wav_header.num_channels && !zone_configure(z, wav_header.num_channels)) ||
+            !zone_prepare(z)) {
+            zone_release(z);
+            continue;
+        }
+        if (!create_output_thread(&z->thread, zone_thread_main, z)) {
+            log_program_info("ERROR", "Failed to create zone output thread");
+            zone_release(z);
+            continue;
+        }
+        atomic_store_explicit(&z->running, true, memory_order_release);
+    }
+    return true;
+}
+
+// pipeline_stop 置位停止请求并回收读取/输出线程之后调用
+void zones_stop() {
+    for (int i = 0; i < output_zone_count; i++) {
+        output_zone_t *z = &output_zones[i];
+        if (!atomic_load(&z->running)) {
+            continue;
+        }
+        wake_event_signal(&z->data_event);
+        pthread_join(z->thread, NULL);
+        zone_release(z);
+        atomic_store(&z->running, false);
+    }
+}
+
+// 读取线程: 与写进主环形缓冲区的同一段帧 (设备格式)
+void zones_feed(const unsigned char *data, size_t count) {
+    for (int i = 0; i < output_zone_count; i++) {
+        output_zone_t *z = &output_zones[i];
+        if (!atomic_load_explicit(&z->running, memory_order_acquire)) {
+            continue;
+        }
+        if (audio_ring_space(&z->ring) < count) {
+            STATS_ADD(z->dropped_frames, count);
+            continue;
+        }
+        audio_ring_write(&z->ring, data, count);
+        wake_event_signal(&z->data_event);
+    }
+}
+
+// 读取线程定位后: 各区域从当前写入位置开始播放新音频
+void zones_flush() {
+    for (int i = 0; i < output_zone_count; i++) {
+        output_zone_t *z = &output_zones[i];
+        if (atomic_load_explicit(&z->running, memory_order_acquire)) {
+            atomic_store(&z->flush_frame, atomic_load_explicit(&z->ring.write_pos, memory_order_relaxed) + 1);
+            wake_event_signal(&z->data_event);
+        }
+    }
+}
+
+void zones_wake() {
+    for (int i = 0; i < output_zone_count; i++) {
+        if (atomic_load_explicit(&output_zones[i].running, memory_order_acquire)) {
+            wake_event_signal(&output_zones[i].data_event);
+        }
+    }
+}
+
+// 所有运行中的区域都已排空 (主输出结束后再等它们播完)
+bool zones_finished() {
+    for (int i = 0; i < output_zone_count; i++) {
+        if (atomic_load(&output_zones[i].running) && !atomic_load(&output_zones[i].finished)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void print_zones() {
+    for (int i = 0; i < output_zone_count; i++) {
+        output_zone_t *z = &output_zones[i];
+        if (z->pcm == NULL) {
+            printf("区域 %d (%s): 未打开\n", i + 1, z->device);
+            continue;
+        }
+        printf("区域 %d (%s): 对齐误差 %+.2f ms, 漂移补偿 %+.1f ppm, 欠载 %llu 次, 丢弃 %llu 帧, 重新对齐 %llu 次\n",
+               i + 1, z->device, STATS_GET(z->error_us) / 1000.0, STATS_GET(z->correction_ppb) / 1000.0,
+               (unsigned long long)STATS_GET(z->underruns), (unsigned long long)STATS_GET(z->dropped_frames),
+               (unsigned long long)STATS_GET(z->resyncs));
+    }
+}
+
+// 分配环形缓冲区和交叉淡化缓冲区，复位线程间的标志 (还没有线程在运行)
+static bool pipeline_prepare(snd_pcm_uframes_t period_frames) {
+    pipeline_period_frames = period_frames > 0 ? period_frames : 1;
+
+    // 环形缓冲区至少容纳 ring_depth_periods 个ALSA周期，以及一整块读取数据
+    size_t ring_frames = (size_t)ring_depth_periods * pipeline_period_frames;
+    size_t block_frames = buffer_size / wav_header.block_align;
+    if (ring_frames < block_frames) {
+        ring_frames = block_frames;
+    }
+    if (!dsp_chain_prepare()) {
+        return false;
+    }
+
+    // 环形缓冲区中是设备格式的帧
+    size_t frame_bytes = dsp_path_supported(&wav_header)
+        ? (size_t)sample_format_bytes(device_format) * wav_header.num_channels : wav_header.block_align;
+    if (!audio_ring_init(&playback_ring, ring_frames, frame_bytes)) {
+        log_program_info("ERROR", "Failed to allocate playback ring buffer");
+        return false;
+    }
+
+    // 交叉淡化缓冲区按设备采样率分配，输出线程里不再分配
+    int fade_frames = (int)((uint64_t)rate * SEEK_CROSSFADE_MS / 1000);
+    if (!audio_block_reserve(&seek_fade_old, wav_header.num_channels, fade_frames) ||
+        !audio_block_reserve(&seek_fade_new, wav_header.num_channels, fade_frames)) {
+        log_program_info("ERROR", "Failed to allocate seek crossfade buffers");
+        audio_ring_free(&playback_ring);
+        return false;
+    }
+    seek_skip_frames = 0;
+    seek_fade_frames = 0;
+    atomic_store(&seek_flush_frame, 0);
+
+    atomic_store(&pipeline_stop_requested, false);
+    atomic_store(&reader_finished, false);
+    atomic_store(&output_finished, false);
+    atomic_store(&output_failed, false);
+    return true;
+}
+
+static void pipeline_log_started(const char *what) {
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg), "Pipeline %s: ring %zu frames (%d periods of %lu frames)",
+             what, playback_ring.capacity, ring_depth_periods, pipeline_period_frames);
+    log_program_info("INFO", info_msg);
+}
+
+// 快速启动: 按请求的周期和当前采样率准备流水线，只启动读取线程，第一批缓冲区的读取、解码和处理
+// 与声卡的打开和协商并行；之后的 pipeline_start 接上输出线程。流式输入无法重读，不预读
+bool pipeline_preload(snd_pcm_uframes_t period_frames) {
+    if (pipeline_running) {
+        pipeline_stop();
+    }
+    if (music_source.stream != NULL || !pipeline_prepare(period_frames)) {
+        return false;
+    }
+    if (pthread_create(&reader_thread, NULL, reader_thread_main, NULL) != 0) {
+        log_program_info("ERROR", "Failed to create reader thread");
+        audio_ring_free(&playback_ring);
+        audio_block_free(&seek_fade_old);
+        audio_block_free(&seek_fade_new);
+        return false;
+    }
+    pipeline_preload_rate = rate;
+    pipeline_preloaded = true;
+    pipeline_running = true;
+    pipeline_log_started("preloading");
+    return true;
+}
+
+// 预读的音频还能用: 设备给出的采样率与预读时相同，环形缓冲区也容纳得下实际周期的 ring_depth_periods 倍。
+// 预读期间读取线程在读 rate，调用者要等这里决定之后 (不合适时先 pipeline_stop) 才能改写 rate
+bool pipeline_preload_fits(snd_pcm_uframes_t period_frames, unsigned int device_rate) {
+    return pipeline_preloaded && device_rate == pipeline_preload_rate &&
+           playback_ring.capacity >= (size_t)ring_depth_periods * period_frames;
+}
+
+bool pipeline_start(snd_pcm_uframes_t period_frames) {
+    if (pipeline_preloaded) {
+        // 读取线程已经在往环形缓冲区里写，设备的实际周期只影响每次写入的帧数
+        pipeline_preloaded = false;
+        pipeline_period_frames = period_frames > 0 ? period_frames : 1;
+        zones_start();
+        if (!create_output_thread(&output_thread, output_thread_main, NULL)) {
+            log_program_info("ERROR", "Failed to create output thread");
+            pipeline_preloaded = true; // pipeline_stop 不等待输出线程
+            pipeline_stop();
+            return false;
+        }
+        pipeline_log_started("started after preload");
+        return true;
+    }
+    if (pipeline_running) {
+        pipeline_stop();
+    }
+    if (!pipeline_prepare(period_frames)) {
+        return false;
+    }
+
+    if (!create_output_thread(&output_thread, output_thread_main, NULL)) {
+        log_program_info("ERROR", "Failed to create output thread");
+        audio_ring_free(&playback_ring);
+        return false;
+    }
+    zones_start();
+    if (pthread_create(&reader_thread, NULL, reader_thread_main, NULL) != 0) {
+        log_program_info("ERROR", "Failed to create reader thread");
+        atomic_store(&pipeline_stop_requested, true);
+        pthread_join(output_thread, NULL);
+        zones_stop();
+        audio_ring_free(&playback_ring);
+        return false;
+    }
+
+    pipeline_log_started("started");
+    pipeline_running = true;
+    return true;
+}
+
+// 停止并回收线程，丢弃环形缓冲区中尚未播放的数据
+void pipeline_stop() {
+    if (!pipeline_running) {
+        return;
+    }
+    atomic_store(&pipeline_stop_requested, true);
+    wake_event_signal(&ring_space_event);
+    wake_event_signal(&ring_data_event);
+    pthread_join(reader_thread, NULL);
+    if (!pipeline_preloaded) {
+        pthread_join(output_thread, NULL);
+    }
+    zones_stop();
+    audio_ring_free(&playback_ring);
+    audio_block_free(&seek_fade_old);
+    audio_block_free(&seek_fade_new);
+    atomic_store(&seek_flush_frame, 0);
+    pipeline_preloaded = false;
+    pipeline_running = false;
+}
 
-void reset_time_stretch_static_vars() {
-    need_reset_static_vars = true;
+// 三个唤醒事件和控制命令队列在整个播放过程中复用，播放开始前创建一次
+bool pipeline_events_init() {
+    if (!wake_event_init(&ring_data_event) || !wake_event_init(&ring_space_event) ||
+        !wake_event_init(&control_event) ||
+        !audio_ring_init(&control_queue, CONTROL_QUEUE_DEPTH, sizeof(control_cmd_t))) {
+        log_program_info("ERROR", "Failed to create eventfd for the playback pipeline");
+        pipeline_events_close();
+        return false;
+    }
+    return true;
 }
 
-// 保持音调的时间拉伸算法 - 恢复到工作状态
-void apply_time_stretch(short* input, short* output, int input_length, int* output_length, float speed_factor, int max_output_length) {
-    *output_length = 0;
-    
-    if (speed_factor <= 0.0f || speed_factor == 1.0f) {
-        // 无变化，直接复制
-        int copy_length = input_length < max_output_length ? input_length : max_output_length;
-        for (int i = 0; i < copy_length; i++) {
-            output[i] = input[i];
-        }
-        *output_length = copy_length;
-        return;
+void pipeline_events_close() {
+    wake_event_close(&ring_data_event);
+    wake_event_close(&ring_space_event);
+    wake_event_close(&control_event);
+    audio_ring_free(&control_queue);
+}
+
+// 延迟档位阶梯: 周期时长 x 周期数
+static const latency_level_t latency_levels[LATENCY_LEVELS] = {
+    {2500, 2}, {5000, 2}, {10000, 2}, {20000, 2}, {40000, 3}, {80000, 4},
+};
+
+// --- 离线渲染 ---
+// 44 字节的 WAV 头；data_bytes 先写 0 占位，渲染结束后回填
+static bool render_write_header(FILE *file, uint16_t audio_format, uint16_t channels, uint32_t sample_rate,
+                                uint16_t bits_per_sample, uint16_t block_align, uint64_t data_bytes) {
+    struct WAV_HEADER header;
+    uint32_t data_size = data_bytes > UINT32_MAX - 36 ? UINT32_MAX - 36 : (uint32_t)data_bytes;
+    memcpy(header.chunk_id, "RIFF", 4);
+    header.chunk_size = 36 + data_size;
+    memcpy(header.format, "WAVE", 4);
+    memcpy(header.sub_chunk1_id, "fmt ", 4);
+    header.sub_chunk1_size = 16;
+    header.audio_format = audio_format;
+    header.num_channels = channels;
+    header.sample_rate = sample_rate;
+    header.byte_rate = sample_rate * block_align;
+    header.block_align = block_align;
+    header.bits_per_sample = bits_per_sample;
+    memcpy(header.sub_chunk2_id, "data", 4);
+    header.sub_chunk2_size = data_size;
+    return fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+// 下一首能否接着写进同一个输出: 声道数相同，采样率相同或可以重采样；不走处理链时格式必须完全一致
+static bool render_track_compatible(const struct WAV_HEADER *previous) {
+    if (wav_header.num_channels != device_channels) {
+        return false;
     }
-    
-    int num_channels = wav_header.num_channels;
-    
-    // Debug output
-    static bool debug_printed = false;
-    if (!debug_printed || need_reset_static_vars) {
-        printf("[%.1fx Pitch-Preserving PSOLA] Channels: %d\n", speed_factor, num_channels);
-        debug_printed = true;
+    if (dsp_path_supported(&wav_header) && dsp_path_supported(previous)) {
+        return wav_header.sample_rate == rate || sample_rate_conversion_usable(&wav_header);
     }
-    
-    // Clear output buffer
-    for (int i = 0; i < max_output_length; i++) {
-        output[i] = 0;
+    return !dsp_path_supported(&wav_header) && !dsp_path_supported(previous) &&
+           wav_header.sample_rate == previous->sample_rate &&
+           wav_header.bits_per_sample == previous->bits_per_sample && wav_header.block_align == previous->block_align;
+}
+
+// 在主线程中按顺序处理整个播放列表一遍，不经过环形缓冲区和输出线程，
+// 读取、拉伸、均衡、重采样和格式转换与播放时完全相同；返回进程退出码
+int render_playlist() {
+    // 不能重采样时 (-S off) 按播放时重新配置设备的做法，直接用文件的采样率
+    if (wav_header.sample_rate != rate && !sample_rate_conversion_usable(&wav_header)) {
+        rate = wav_header.sample_rate;
     }
-    
-    // Simple granular synthesis with fixed parameters
-    int grain_size = 256;  // Smaller grains for less artifacts
-    
-    printf("[%.1fx] Using simple granular synthesis, grain size: %d\n", speed_factor, grain_size);
-    
-    // Simple approach based on speed factor
-    int input_pos = 0;
-    int output_pos = 0;
-    
-    if (speed_factor == 0.5f) {
-        // Proper PSOLA implementation for 0.5x speed with pitch preservation
-        printf("[0.5x] Using proper PSOLA algorithm\n");
-        
-        // PSOLA parameters - carefully chosen for pitch preservation
-        int frame_size = 512;           // Analysis frame size
-        int synthesis_hop = 128;        // Output hop size (25% of frame)
-        int analysis_hop = 64;          // Input hop size (12.5% of frame for 0.5x)
-        // Ratio: 64/128 = 0.5 for true 0.5x speed
-        
-        printf("[0.5x PSOLA] Frame: %d, Analysis hop: %d, Synthesis hop: %d\n", 
-               frame_size, analysis_hop, synthesis_hop);
-        
-        // Create normalized window for perfect reconstruction with given hop size
-        static float psola_window[512];
-        static bool window_initialized = false;
-        
-        if (!window_initialized || need_reset_static_vars) {
-            // Calculate window normalization for this hop size
-            float norm_factor = 0.0f;
-            
-            // Calculate overlap sum for normalization
-            for (int i = 0; i < frame_size; i++) {
-                float window_val = 0.5f * (1.0f - cosf(2.0f * M_PI * i / (frame_size - 1)));
-                float overlap_sum = 0.0f;
-                
-                // Sum overlapping windows
-                for (int j = -2; j <= 2; j++) {
-                    int offset = j * synthesis_hop;
-                    if (i + offset >= 0 && i + offset < frame_size) {
-                        overlap_sum += 0.5f * (1.0f - cosf(2.0f * M_PI * (i + offset) / (frame_size - 1)));
-                    }
-                }
-                
-                if (overlap_sum > 0.0f) {
-                    psola_window[i] = window_val / overlap_sum;
-                } else {
-                    psola_window[i] = window_val;
-                }
-            }
-            
-            window_initialized = true;
+    bool to_file = strcmp(render_path, RENDER_NULL_SINK) != 0;
+    bool through_dsp = dsp_path_supported(&wav_header);
+    uint16_t out_format = through_dsp ? (device_format == SAMPLE_FLOAT ? 3 : 1) : wav_header.audio_format;
+    uint16_t out_bits = through_dsp ? (uint16_t)sample_format_bits(device_format) : wav_header.bits_per_sample;
+    uint16_t frame_bytes = through_dsp ? (uint16_t)(sample_format_bytes(device_format) * device_channels)
+                                       : wav_header.block_align;
+    unsigned int out_rate = through_dsp ? rate : wav_header.sample_rate;
+
+    FILE *out = NULL;
+    if (to_file) {
+        out = fopen(render_path, "wb");
+        if (out == NULL || !render_write_header(out, out_format, device_channels, out_rate, out_bits, frame_bytes, 0)) {
+            fprintf(stderr, "Failed to create render output: %s\n", render_path);
+            if (out) fclose(out);
+            return EXIT_FAILURE;
         }
-        
-        // PSOLA main processing loop
-        int input_pos = 0;
-        int output_pos = 0;
-        
-        while (input_pos + frame_size <= input_length && 
-               output_pos + frame_size <= max_output_length) {
-            
-            // Extract and window the analysis frame
-            for (int i = 0; i < frame_size; i++) {
-                for (int ch = 0; ch < num_channels; ch++) {
-                    int in_idx = input_pos + i * num_channels + ch;
-                    int out_idx = output_pos + i * num_channels + ch;
-                    
-                    if (in_idx < input_length && out_idx < max_output_length) {
-                        // Apply normalized PSOLA window to input sample
-                        float windowed_sample = input[in_idx] * psola_window[i];
-                        
-                        // Overlap-add to output with proper normalization
-                        output[out_idx] += (short)(windowed_sample);
-                        
-                        // Prevent clipping
-                        if (output[out_idx] > 32767) output[out_idx] = 32767;
-                        if (output[out_idx] < -32768) output[out_idx] = -32768;
-                    }
-                }
-            }
-            
-            // Advance positions according to PSOLA hop sizes
-            input_pos += analysis_hop * num_channels;
-            output_pos += synthesis_hop * num_channels;
+    }
+    if (!dsp_chain_prepare()) {
+        if (out) fclose(out);
+        return EXIT_FAILURE;
+    }
+
+    printf("离线渲染: %d 首 -> %s (%u Hz, %u 声道, %u 位)\n", playlist_count,
+           to_file ? render_path : "丢弃", out_rate, device_channels, out_bits);
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg), "Offline render started: %s", to_file ? render_path : RENDER_NULL_SINK);
+    log_program_info("RENDER", info_msg);
+
+    current_state = PLAYING;
+    int status = EXIT_SUCCESS;
+    int tracks_done = 0;
+    uint64_t source_frames = 0, output_frames = 0;
+    uint64_t started = monotonic_ns();
+    for (;;) {
+        processed_block_t processed;
+        uint16_t source_align = wav_header.block_align;
+        int read_ret = read_and_process_block(&processed);
+        if (read_ret < 0) {
+            status = EXIT_FAILURE;
+            break;
         }
-        
-        *output_length = output_pos;
-        return;
-    } else {
-        // Use PSOLA for all other speeds (1.5x, 2.0x, etc.)
-        printf("[%.1fx] Using PSOLA algorithm\n", speed_factor);
-        
-        // PSOLA parameters adjusted for different speeds
-        int frame_size = 512;
-        int synthesis_hop = 128;                            // Fixed output hop
-        int analysis_hop = (int)(synthesis_hop * speed_factor); // Variable input hop
-        
-        if (analysis_hop <= 0) analysis_hop = 1;
-        
-        printf("[%.1fx PSOLA] Frame: %d, Analysis hop: %d, Synthesis hop: %d\n", 
-               speed_factor, frame_size, analysis_hop, synthesis_hop);
-        
-        // Create normalized window for this speed
-        static float psola_window_other[512];
-        static bool window_initialized_other = false;
-        static float last_speed_factor = 0.0f;
-        
-        if (!window_initialized_other || need_reset_static_vars || 
-            last_speed_factor != speed_factor) {
-            
-            // Calculate window normalization for this hop size
-            for (int i = 0; i < frame_size; i++) {
-                float window_val = 0.5f * (1.0f - cosf(2.0f * M_PI * i / (frame_size - 1)));
-                float overlap_sum = 0.0f;
-                
-                // Sum overlapping windows
-                for (int j = -2; j <= 2; j++) {
-                    int offset = j * synthesis_hop;
-                    if (i + offset >= 0 && i + offset < frame_size) {
-                        overlap_sum += 0.5f * (1.0f - cosf(2.0f * M_PI * (i + offset) / (frame_size - 1)));
-                    }
-                }
-                
-                if (overlap_sum > 0.0f) {
-                    psola_window_other[i] = window_val / overlap_sum;
-                } else {
-                    psola_window_other[i] = window_val;
-                }
+        if (read_ret == 0) {
+            if (++tracks_done >= playlist_count) {
+                break;
             }
-            
-            window_initialized_other = true;
-            last_speed_factor = speed_factor;
-        }
-        
-        // PSOLA main processing loop
-        while (input_pos + frame_size <= input_length && 
-               output_pos + frame_size <= max_output_length) {
-            
-            // Extract and window the analysis frame
-            for (int i = 0; i < frame_size; i++) {
-                for (int ch = 0; ch < num_channels; ch++) {
-                    int in_idx = input_pos + i * num_channels + ch;
-                    int out_idx = output_pos + i * num_channels + ch;
-                    
-                    if (in_idx < input_length && out_idx < max_output_length) {
-                        // Apply normalized PSOLA window to input sample
-                        float windowed_sample = input[in_idx] * psola_window_other[i];
-                        
-                        // Overlap-add to output
-                        output[out_idx] += (short)(windowed_sample);
-                        
-                        // Prevent clipping
-                        if (output[out_idx] > 32767) output[out_idx] = 32767;
-                        if (output[out_idx] < -32768) output[out_idx] = -32768;
-                    }
-                }
+            // 与播放时不做无缝切换的路径相同: 换源后重新准备处理链，不重置节点状态
+            struct WAV_HEADER previous = wav_header;
+            current_track = (current_track + 1) % playlist_count;
+            close_music_file();
+            if (!open_music_file(playlist_path(current_track)) || !render_track_compatible(&previous)) {
+                fprintf(stderr, "Cannot render %s into the same output, stopping\n", playlist_path(current_track));
+                status = EXIT_FAILURE;
+                break;
             }
-            
-            // Advance positions according to PSOLA hop sizes
-            input_pos += analysis_hop * num_channels;
-            output_pos += synthesis_hop * num_channels;
+            if (!dsp_chain_prepare()) {
+                status = EXIT_FAILURE;
+                break;
+            }
+            continue;
+        }
+        source_frames += (uint64_t)(read_ret / source_align);
+        size_t frames_ready = processed.frames;
+        const unsigned char *block = processed.bytes;
+        if (processed.block != NULL) {
+            processed_block_emit(&processed, 0, frames_ready, dsp_output);
+            block = dsp_output;
         }
+        stats_record(&pipeline_stats.stage[STAGE_CONVERT], processed.convert_ns);
+
+        uint64_t write_started = monotonic_ns();
+        if (out != NULL && fwrite(block, frame_bytes, frames_ready, out) != frames_ready) {
+            fprintf(stderr, "Failed to write render output: %s\n", strerror(errno));
+            status = EXIT_FAILURE;
+            break;
+        }
+        stats_record(&pipeline_stats.stage[STAGE_WRITE], monotonic_ns() - write_started);
+        output_frames += frames_ready;
+        stats_poll();
     }
-    
-    *output_length = output_pos;
-    
-    // Reset the flag after processing
-    need_reset_static_vars = false;
+    uint64_t elapsed_ns = monotonic_ns() - started;
+    current_state = STOPPED;
+
+    if (out != NULL) {
+        if (!render_write_header(out, out_format, device_channels, out_rate, out_bits, frame_bytes,
+                                 output_frames * frame_bytes)) {
+            status = EXIT_FAILURE;
+        }
+        if (fclose(out) != 0) {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    double wall_s = elapsed_ns / 1e9;
+    double audio_s = out_rate > 0 ? (double)output_frames / out_rate : 0.0;
+    double samples_per_s = wall_s > 0.0 ? (double)output_frames * device_channels / wall_s : 0.0;
+    printf("\n=== 离线渲染 ===\n");
+    printf("源数据 %llu 帧, 输出 %llu 帧 (%.2f s 音频), 用时 %.3f s\n", (unsigned long long)source_frames,
+           (unsigned long long)output_frames, audio_s, wall_s);
+    printf("实时倍率: %.1fx (RTF %.4f), %.2f M 样本/秒\n", wall_s > 0.0 ? audio_s / wall_s : 0.0,
+           audio_s > 0.0 ? wall_s / audio_s : 0.0, samples_per_s / 1e6);
+    print_stats();
+    // 一行机器可读的结果，便于逐个提交记录
+    printf("render speed=%.2f eq=%d stretch=%d source_frames=%llu output_frames=%llu audio_s=%.3f wall_s=%.4f "
+           "realtime_x=%.2f samples_per_s=%.0f",
+           current_speed_factor, (int)current_eq_mode, (int)current_stretch_mode,
+           (unsigned long long)source_frames, (unsigned long long)output_frames, audio_s, wall_s,
+           wall_s > 0.0 ? audio_s / wall_s : 0.0, samples_per_s);
+    stats_print_fields();
+    printf("\n");
+
+    snprintf(info_msg, sizeof(info_msg), "Offline render finished: %llu frames in %.3f s",
+             (unsigned long long)output_frames, wall_s);
+    log_program_info("RENDER", info_msg);
+    return status;
 }
 
-void apply_fir_filter(short* input, short* output, int length, equalizer_mode_t mode) {
-    double* coeffs;
-    double gain = 1.0;
-    double mix_ratio = 0.7;  // Mix 70% filtered + 30% original for more natural sound
-    
-    switch(mode) {
-        case EQ_BASS_BOOST:
-            coeffs = bass_boost_coeffs;
-            gain = 2.0;  // Boost gain for bass
-            break;
-        case EQ_TREBLE_BOOST:
-            coeffs = treble_boost_coeffs;
-            gain = 1.5;  // Moderate gain for treble
-            break;
-        case EQ_VOCAL_ENHANCE:
-            coeffs = vocal_enhance_coeffs;
-            gain = 1.8;  // Boost vocals
-            mix_ratio = 0.6;  // Less mixing for vocals
-            break;
-        default:
-            // 无滤波，直接复制
-            for (int i = 0; i < length; i++) {
-                output[i] = input[i];
-            }
-            return;
+// benchmark.c 通过 #include "MusicApp.c" 复用这里的DSP代码，并定义 MUSICAPP_NO_MAIN 去掉 main()
+// 以及下面只有 main 和它的控制循环用到的状态和函数
+#ifndef MUSICAPP_NO_MAIN
+
+// 自适应延迟的状态，只由主线程访问
+static uint64_t adaptive_underruns_seen = 0;
+static uint64_t adaptive_changed_ns = 0;    // 上一次换档或欠载的时刻，降档的稳定时间从这里算起
+static uint8_t adaptive_backoff[LATENCY_LEVELS]; // 各档出过欠载的次数，降回该档前要稳定更久
+
+// 无缝播放中只由主线程访问的部分: gapless_next 在播放列表中的位置，以及已经尝试预读过的曲目
+static int gapless_next_index = -1;
+static int gapless_attempted_track = -1;
+static bool first_audio_reported = false;   // 只由主线程访问
+
+// 设置声卡访问方式；设备不支持 mmap 时回退到 snd_pcm_writei
+static int pcm_set_access(snd_pcm_hw_params_t *params) {
+    int err = snd_pcm_hw_params_set_access(pcm_handle, params, pcm_access);
+    if (err < 0 && pcm_access != SND_PCM_ACCESS_RW_INTERLEAVED) {
+        char msg[LOG_BUFFER_SIZE];
+        snprintf(msg, sizeof(msg), "Device does not support %s access (%s), falling back to rw",
+                 snd_pcm_access_name(pcm_access), snd_strerror(err));
+        log_program_info("WARNING", msg);
+        pcm_access = SND_PCM_ACCESS_RW_INTERLEAVED;
+        err = snd_pcm_hw_params_set_access(pcm_handle, params, pcm_access);
     }
-    
-    // 假设stereo (2 channels), 处理交错样本
-    int num_channels = wav_header.num_channels;
-    
-    for (int i = 0; i < length; i++) {
-        if (num_channels == 1) {
-            // 单声道处理
-            delay_buffer_left[delay_index_left] = input[i];
-            
-            double filtered_sample = 0.0;
-            for (int j = 0; j < FIR_TAP_NUM; j++) {
-                int index = (delay_index_left - j + FIR_TAP_NUM) % FIR_TAP_NUM;
-                filtered_sample += coeffs[j] * delay_buffer_left[index];
-            }
-            
-            delay_index_left = (delay_index_left + 1) % FIR_TAP_NUM;
-            
-            // Apply gain and mix with original
-            filtered_sample *= gain;
-            double mixed_sample = filtered_sample * mix_ratio + input[i] * (1.0 - mix_ratio);
-            
-            // 限制输出范围防止溢出
-            if (mixed_sample > 32767) mixed_sample = 32767;
-            if (mixed_sample < -32768) mixed_sample = -32768;
-            
-            output[i] = (short)mixed_sample;
-        } else {
-            // 立体声处理 - 左右声道分别处理
-            if (i % 2 == 0) {
-                // 左声道
-                delay_buffer_left[delay_index_left] = input[i];
-                
-                double filtered_sample = 0.0;
-                for (int j = 0; j < FIR_TAP_NUM; j++) {
-                    int index = (delay_index_left - j + FIR_TAP_NUM) % FIR_TAP_NUM;
-                    filtered_sample += coeffs[j] * delay_buffer_left[index];
-                }
-                
-                delay_index_left = (delay_index_left + 1) % FIR_TAP_NUM;
-                
-                // Apply gain and mix with original
-                filtered_sample *= gain;
-                double mixed_sample = filtered_sample * mix_ratio + input[i] * (1.0 - mix_ratio);
-                
-                // 限制输出范围防止溢出
-                if (mixed_sample > 32767) mixed_sample = 32767;
-                if (mixed_sample < -32768) mixed_sample = -32768;
-                
-                output[i] = (short)mixed_sample;
-            } else {
-                // 右声道
-                delay_buffer_right[delay_index_right] = input[i];
-                
-                double filtered_sample = 0.0;
-                for (int j = 0; j < FIR_TAP_NUM; j++) {
-                    int index = (delay_index_right - j + FIR_TAP_NUM) % FIR_TAP_NUM;
-                    filtered_sample += coeffs[j] * delay_buffer_right[index];
-                }
-                
-                delay_index_right = (delay_index_right + 1) % FIR_TAP_NUM;
-                
-                // Apply gain and mix with original
-                filtered_sample *= gain;
-                double mixed_sample = filtered_sample * mix_ratio + input[i] * (1.0 - mix_ratio);
-                
-                // 限制输出范围防止溢出
-                if (mixed_sample > 32767) mixed_sample = 32767;
-                if (mixed_sample < -32768) mixed_sample = -32768;
-                
-                output[i] = (short)mixed_sample;
-            }
+    return err;
+}
+
+// 记录驱动实际接受的周期/缓冲区大小 (可能与请求的不同)
+static void pcm_log_granted(snd_pcm_uframes_t period_frames, snd_pcm_uframes_t buffer_frames) {
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg),
+             "ALSA granted period %lu frames (%.2f ms), buffer %lu frames (%.2f ms); requested %lu / %lu",
+             period_frames, period_frames * 1000.0 / rate, buffer_frames, buffer_frames * 1000.0 / rate,
+             period_size / wav_header.block_align, buffer_size / wav_header.block_align);
+    log_program_info("INFO", info_msg);
+}
+
+// 本曲目还需要预先打开下一首 (未打开、未尝试过且没有等待中的换源)
+static bool gapless_preload_pending() {
+    return gapless_enabled && playlist_count >= 2 && !atomic_load(&gapless_next_ready) &&
+           !atomic_load(&gapless_switch_pending) && gapless_attempted_track != current_track;
+}
+
+// 距可以降一档还有多少毫秒，不能降时为 -1
+static int latency_shrink_timeout_ms() {
+    if (latency_profile != LATENCY_ADAPTIVE || latency_level == 0) {
+        return -1;
+    }
+    uint64_t stable_ns = ((uint64_t)ADAPTIVE_STABLE_SECONDS * 1000000000ull) << adaptive_backoff[latency_level - 1];
+    uint64_t due = adaptive_changed_ns + stable_ns;
+    uint64_t now = monotonic_ns();
+    return due <= now ? 0 : (int)((due - now + 999999) / 1000000);
+}
+
+// 按延迟档位设置 period_size / periods / buffer_size (字节，按当前曲目的格式换算)；
+// normal 保持原来的固定字节数。buffer_size 同时是读取/DSP 的块长
+static void latency_update_sizes() {
+    if (latency_profile != LATENCY_NORMAL && wav_header.sample_rate > 0) {
+        const latency_level_t *level = &latency_levels[latency_level];
+        snd_pcm_uframes_t period_frames = (snd_pcm_uframes_t)((uint64_t)level->period_us * wav_header.sample_rate / 1000000);
+        if (period_frames < 16) {
+            period_frames = 16;
         }
+        period_size = period_frames * wav_header.block_align;
+        periods = level->periods;
     }
+    buffer_size = period_size * periods;
 }
 
-// 播放控制功能
-void toggle_pause() {
-    if (current_state == PLAYING) {
-        current_state = PAUSED;
-        log_user_operation("PAUSE", "SUCCESS");
-        printf("暂停播放\n");
-    } else if (current_state == PAUSED) {
-        current_state = PLAYING;
-        log_user_operation("RESUME", "SUCCESS");
-        printf("继续播放\n");
+// 按当前曲目重新配置ALSA (流水线已停止)；rate / device_channels / *period_frames 取驱动实际接受的值
+static void reconfigure_pcm_for_track(snd_pcm_uframes_t *period_frames) {
+    snd_pcm_drop(pcm_handle);
+    if (hw_params) {
+        snd_pcm_hw_params_free(hw_params);
+        hw_params = NULL;
+    }
+
+    snd_pcm_hw_params_malloc(&hw_params);
+    snd_pcm_hw_params_any(pcm_handle, hw_params);
+    pcm_set_access(hw_params);
+    snd_pcm_hw_params_set_format(pcm_handle, hw_params, pcm_format);
+
+    unsigned int actual_rate_from_alsa = wav_header.sample_rate;
+    snd_pcm_hw_params_set_rate_near(pcm_handle, hw_params, &actual_rate_from_alsa, 0);
+    snd_pcm_hw_params_set_channels(pcm_handle, hw_params, wav_header.num_channels);
+
+    *period_frames = period_size / wav_header.block_align;
+    frames = buffer_size / wav_header.block_align;
+    snd_pcm_hw_params_set_buffer_size_near(pcm_handle, hw_params, &frames);
+    snd_pcm_hw_params_set_period_size_near(pcm_handle, hw_params, period_frames, 0);
+
+    int err = snd_pcm_hw_params(pcm_handle, hw_params);
+    if (err < 0) {
+        char error_msg[LOG_BUFFER_SIZE];
+        snprintf(error_msg, sizeof(error_msg), "Failed to reconfigure PCM: %s", snd_strerror(err));
+        log_program_info("ERROR", error_msg);
     }
+    snd_pcm_hw_params_get_period_size(hw_params, period_frames, 0);
+    snd_pcm_hw_params_get_buffer_size(hw_params, &frames);
+    snd_pcm_hw_params_free(hw_params);
+    hw_params = NULL;
+    snd_pcm_prepare(pcm_handle);
+
+    rate = actual_rate_from_alsa;
+    pcm_log_granted(*period_frames, frames);
+    device_channels = wav_header.num_channels;
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg), "ALSA reconfigured: %u Hz, %u channels", rate, device_channels);
+    log_program_info("INFO", info_msg);
 }
 
-void next_track() {
-    if (playlist_count <= 1) {
-        log_user_operation("NEXT_TRACK", "FAILED - No more tracks");
-        printf("没有下一首歌曲\n");
-        return;
+// 有曲目从标准输入读取时，键盘控制关闭
+static bool playlist_reads_stdin() {
+    for (int i = 0; i < playlist_count; i++) {
+        if (strcmp(playlist_path(i), STREAM_STDIN_NAME) == 0) {
+            return true;
+        }
     }
-    
-    current_track = (current_track + 1) % playlist_count;
-    log_user_operation("NEXT_TRACK", "SUCCESS");
-    printf("切换到下一首: %s\n", playlist[current_track]);
-    
-    // Set flag for main loop to handle the file change
-    track_change_requested = true;
+    return false;
 }
 
-void previous_track() {
-    if (playlist_count <= 1) {
-        log_user_operation("PREVIOUS_TRACK", "FAILED - No more tracks");
-        printf("没有上一首歌曲\n");
+static void dsp_chain_free() {
+    audio_arena_free(&dsp_arena);
+    memset(&dsp_input, 0, sizeof(dsp_input));
+    memset(&dsp_stretched, 0, sizeof(dsp_stretched));
+    memset(&dsp_resampled, 0, sizeof(dsp_resampled));
+    pthread_mutex_lock(&player_graph.lock);
+    memset(&player_graph.dry, 0, sizeof(player_graph.dry));
+    pthread_mutex_unlock(&player_graph.lock);
+    dsp_output = NULL;
+}
+
+// 丢弃预先打开的下一首 (手动切歌、停止时调用，流水线已停止)
+static void gapless_reset() {
+    if (atomic_load(&gapless_next_ready)) {
+        close_track(&gapless_next);
+        atomic_store(&gapless_next_ready, false);
+    }
+    atomic_store(&gapless_switch_pending, false);
+    gapless_attempted_track = -1;
+}
+
+// 主线程每次轮询: 输出越过换源边界时更新曲目信息；接近末尾时预先打开下一首
+static void gapless_poll() {
+    if (atomic_load(&gapless_switch_pending)) {
+        if (gapless_boundary_crossed()) {
+            atomic_store(&gapless_switch_pending, false);
+            current_track = gapless_next_index;
+            log_user_operation("AUTO_NEXT_TRACK", "SUCCESS - gapless");
+            printf("无缝切换到下一首: %s\n", playlist_path(current_track));
+        }
         return;
     }
-    
-    current_track = (current_track - 1 + playlist_count) % playlist_count;
-    log_user_operation("PREVIOUS_TRACK", "SUCCESS");
-    printf("切换到上一首: %s\n", playlist[current_track]);
-    
-    // Set flag for main loop to handle the file change
-    track_change_requested = true;
+    // 流式曲目不知道什么时候结束，不预先打开下一首 (下一首也可能是同一个标准输入)
+    if (!gapless_preload_pending() || music_source.stream != NULL ||
+        total_frames - current_position > (long)GAPLESS_PRELOAD_SECONDS * wav_header.sample_rate) {
+        return;
+    }
+
+    gapless_attempted_track = current_track;
+    int next_index = (current_track + 1) % playlist_count;
+    if (!open_track(playlist_path(next_index), &gapless_next)) {
+        return; // 到末尾时按原来的方式切换并报告错误
+    }
+
+    // 两首都走浮点处理链时只需声道数相同 (位深由格式转换处理，采样率由重采样器处理)；
+    // 否则源数据直接送往设备，格式必须完全一致。不满足时仍走原来的停止/重开路径
+    const struct WAV_HEADER *h = &gapless_next.header;
+    bool compatible;
+    if (dsp_path_supported(h) && dsp_path_supported(&wav_header)) {
+        compatible = h->num_channels == wav_header.num_channels &&
+                     (h->sample_rate == wav_header.sample_rate || sample_rate_conversion_usable(h));
+    } else {
+        compatible = !dsp_path_supported(h) && !dsp_path_supported(&wav_header) &&
+                     h->sample_rate == wav_header.sample_rate && h->num_channels == wav_header.num_channels &&
+                     h->bits_per_sample == wav_header.bits_per_sample && h->block_align == wav_header.block_align;
+    }
+    if (!compatible) {
+        log_program_info("INFO", "Next track format differs, gapless switch not possible");
+        close_track(&gapless_next);
+        return;
+    }
+
+    // 把下一首的开头读进页缓存，换源时读取线程不会等待存储。这里只预读，不提前解码和处理:
+    // 读取线程本来就领先输出整个环形缓冲区，换源后解码、处理好的开头在输出到达边界之前已经
+    // 写进环形缓冲区；提前处理则要另起一套 DSP 状态，拉伸、均衡和重采样的历史在边界处会断开
+    if (gapless_next.source.map != NULL) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t prefetch = (size_t)GAPLESS_PREFETCH_SECONDS * h->sample_rate * h->block_align;
+        if (prefetch > gapless_next.source.data_bytes) {
+            prefetch = gapless_next.source.data_bytes;
+        }
+        volatile unsigned char sink = 0;
+        for (size_t offset = 0; offset < prefetch; offset += page) {
+            sink ^= gapless_next.source.data[offset];
+        }
+        (void)sink;
+    }
+
+    gapless_next_index = next_index;
+    atomic_store_explicit(&gapless_next_ready, true, memory_order_release);
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg), "Gapless: pre-opened next track %s", playlist_path(next_index));
+    log_program_info("INFO", info_msg);
 }
 
-void change_speed() {
-    current_speed = (current_speed + 1) % 4;
-    const char* speed_names[] = {"0.5x", "1.0x", "1.5x", "2.0x"};
-    log_user_operation("CHANGE_SPEED", "SUCCESS");
-    printf("播放速度切换为: %s\n", speed_names[current_speed]);
+// 主线程每次轮询: 返回要切换到的档位，不需要换档时为 -1。出现新的欠载时升一档，
+// 连续稳定 ADAPTIVE_STABLE_SECONDS (按目标档的出错次数翻倍) 后降一档
+static int latency_adapt_poll() {
+    if (latency_profile != LATENCY_ADAPTIVE || current_state != PLAYING || atomic_load(&gapless_switch_pending)) {
+        return -1;
+    }
+    uint64_t now = monotonic_ns();
+    uint64_t underruns = STATS_GET(pipeline_stats.underruns);
+    if (underruns != adaptive_underruns_seen) {
+        adaptive_underruns_seen = underruns;
+        if (now - adaptive_changed_ns < ADAPTIVE_SETTLE_MS * 1000000ull) {
+            return -1;  // 换档时重新填充设备缓冲区造成的
+        }
+        adaptive_changed_ns = now;
+        if (adaptive_backoff[latency_level] < ADAPTIVE_MAX_BACKOFF) {
+            adaptive_backoff[latency_level]++;
+        }
+        return latency_level + 1 < LATENCY_LEVELS ? latency_level + 1 : -1;
+    }
+    return latency_shrink_timeout_ms() == 0 ? latency_level - 1 : -1;
 }
 
-void seek_forward() {
-    if (current_state == STOPPED) {
-        log_user_operation("SEEK_FORWARD", "FAILED - Not playing");
-        return;
+// 主线程休眠前复查: 流水线已结束/出错，输出已越过无缝换曲边界，或自适应模式下出现了新的欠载
+static bool control_events_pending() {
+    return atomic_load(&track_request) >= 0 || (atomic_load(&output_finished) && zones_finished()) ||
+           atomic_load(&output_failed) || gapless_boundary_crossed() ||
+           (latency_profile == LATENCY_ADAPTIVE && STATS_GET(pipeline_stats.underruns) != adaptive_underruns_seen) ||
+           (!first_audio_reported && STATS_GET(pipeline_stats.first_audio_ns) != 0);
+}
+
+// 主线程下一次需要主动醒来的毫秒数，-1 表示只等事件: -T 统计行，播放中等待预先打开下一首，
+// 以及自适应延迟的降档时刻
+static int control_loop_timeout_ms() {
+    int timeout = stats_poll_timeout_ms();
+    if (current_state == PLAYING && gapless_preload_pending() && (timeout < 0 || timeout > CONTROL_TICK_MS)) {
+        timeout = CONTROL_TICK_MS;
     }
-    
-    long seek_frames = 10 * wav_header.sample_rate; // 10秒
-    current_position += seek_frames;
-    if (current_position >= total_frames) {
-        current_position = total_frames - 1;
+    int shrink = current_state == PLAYING ? latency_shrink_timeout_ms() : -1;
+    if (shrink >= 0 && (timeout < 0 || shrink < timeout)) {
+        timeout = shrink;
     }
-    
-    fseek(fp, data_chunk_offset + current_position * wav_header.block_align, SEEK_SET);
-    log_user_operation("SEEK_FORWARD", "SUCCESS");
-    printf("快进10秒\n");
+    return timeout;
 }
 
-void seek_backward() {
-    if (current_state == STOPPED) {
-        log_user_operation("SEEK_BACKWARD", "FAILED - Not playing");
-        return;
+// 换曲时只有声道数变化，或采样率变化且不能重采样时才需要重新配置ALSA
+static bool track_needs_pcm_reconfigure() {
+    if (wav_header.num_channels != device_channels) {
+        return true;
     }
-    
-    long seek_frames = 10 * wav_header.sample_rate; // 10秒
-    current_position -= seek_frames;
-    if (current_position < 0) {
-        current_position = 0;
+    return wav_header.sample_rate != rate && !sample_rate_conversion_usable(&wav_header);
+}
+
+// 自适应换档: 记下正在输出的位置后停止流水线，按新档位重新协商ALSA周期/缓冲区，
+// 重新分配读取缓冲区和处理链后从该位置继续 (设备缓冲区中未播放的部分会重播)
+static bool latency_retune(int level, snd_pcm_uframes_t *period_frames) {
+    long position = playback_position(); // 已扣除声卡缓冲区中的帧
+    pipeline_stop();
+
+    const latency_level_t *from = &latency_levels[latency_level];
+    const latency_level_t *to = &latency_levels[level];
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg), "Adaptive latency: %.1f ms x %d -> %.1f ms x %d (underruns %llu)",
+             from->period_us / 1000.0, from->periods, to->period_us / 1000.0, to->periods,
+             (unsigned long long)adaptive_underruns_seen);
+    log_program_info("INFO", info_msg);
+    printf("自适应延迟: 周期 %.1f ms x %d\n", to->period_us / 1000.0, to->periods);
+
+    latency_level = level;
+    latency_update_sizes();
+    unsigned char *resized = (unsigned char *)realloc(buff, buffer_size);
+    if (resized == NULL) {
+        log_program_info("ERROR", "Failed to resize playback buffer");
+        return false;
     }
-    
-    fseek(fp, data_chunk_offset + current_position * wav_header.block_align, SEEK_SET);
-    log_user_operation("SEEK_BACKWARD", "SUCCESS");
-    printf("快退10秒\n");
-}
+    buff = resized;
 
-void toggle_equalizer() {
-    current_eq_mode = (current_eq_mode + 1) % 4;
-    const char* eq_names[] = {"正常", "低音增强", "高音增强", "人声增强"};
-    log_user_operation("TOGGLE_EQUALIZER", "SUCCESS");
-    printf("均衡器模式: %s\n", eq_names[current_eq_mode]);
-}
+    // 流不能回退，处理链和环形缓冲区里尚未播放的部分丢弃，从抖动缓冲区接着读
+    if (music_source.stream == NULL) {
+        current_position = position > 0 ? position : 0;
+        audio_source_seek(&music_source, (size_t)current_position);
+    }
+    dsp_graph_reset(&player_graph);
 
-void print_status() {
-    const char* state_names[] = {"播放中", "已暂停", "已停止"};
-    const char* speed_names[] = {"0.5x", "1.0x", "1.5x", "2.0x"};
-    const char* eq_names[] = {"正常", "低音增强", "高音增强", "人声增强"};
-    
-    printf("\n=== 播放状态 ===\n");
-    if (playlist_count > 0) {
-        printf("当前曲目: %d/%d - %s\n", current_track + 1, playlist_count, playlist[current_track]);
+    reconfigure_pcm_for_track(period_frames);
+    adaptive_changed_ns = monotonic_ns();
+    adaptive_underruns_seen = STATS_GET(pipeline_stats.underruns);
+    return pipeline_start(*period_frames);
+}
+// 混音器和键盘控制 (标准输入改为非阻塞)；快速启动时推迟到开始出声之后。没有混音器时按键照常工作，
+// 音量改用软件增益。返回是否读取按键
+static bool controls_init(int *original_stdin_flags) {
+    if (!init_mixer()) {
+        printf("Warning: Failed to initialize mixer, using software volume (%.0f dB).\n", control_params.volume_db);
     }
-    printf("播放状态: %s\n", state_names[current_state]);
-    printf("播放速度: %s\n", speed_names[current_speed]);
-    printf("均衡器: %s\n", eq_names[current_eq_mode]);
-    if (total_frames > 0) {
-        printf("进度: %ld/%ld (%.1f%%)\n", current_position, total_frames, 
-               (double)current_position / total_frames * 100.0);
+    if (playlist_reads_stdin()) {
+        printf("Audio is read from stdin, keyboard control is disabled.\n");
+        return false;
     }
-    printf("==============\n\n");
+    printf("Volume control initialized. Use '+' to increase, '-' to decrease volume.\n");
+    *original_stdin_flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+    if (*original_stdin_flags != -1) {
+        if (fcntl(STDIN_FILENO, F_SETFL, *original_stdin_flags | O_NONBLOCK) == -1) {
+            perror("fcntl F_SETFL O_NONBLOCK"); *original_stdin_flags = -1;
+        }
+    } else { perror("fcntl F_GETFL"); }
+    return *original_stdin_flags != -1;
 }
 
-void handle_user_input(char input) {
-    switch(input) {
-        case ' ': // 空格 - 暂停/继续
-            toggle_pause();
-            break;
-        case 'n': // 下一首
-            next_track();
-            break;
-        case 'p': // 上一首
-            previous_track();
-            break;
-        case 's': // 切换速度
-            if (current_state != STOPPED) {
-                change_speed();
-            } else {
-                log_user_operation("CHANGE_SPEED", "FAILED - Not playing");
-            }
-            break;
-        case 'f': // 快进
-            if (current_state != STOPPED) {
-                seek_forward();
-            } else {
-                log_user_operation("SEEK_FORWARD", "FAILED - Not playing");
-            }
-            break;
-        case 'b': // 快退
-            if (current_state != STOPPED) {
-                seek_backward();
-            } else {
-                log_user_operation("SEEK_BACKWARD", "FAILED - Not playing");
-            }
-            break;
-        case 'e': // 均衡器
-            toggle_equalizer();
-            break;
-        case '+': // 增加音量
-            increase_volume();
-            break;
-        case '-': // 减少音量
-            decrease_volume();
-            break;
-        case 'i': // 信息
-            print_status();
-            break;
-        case 'q': // 退出
-            log_user_operation("QUIT", "SUCCESS");
-            printf("退出程序\n");
-            exit(0);
-            break;
-        case 'h': // 帮助
-            printf("\n=== 操作帮助 ===\n");
-            printf("空格: 暂停/继续\n");
-            printf("n: 下一首\n");
-            printf("p: 上一首\n");
-            printf("s: 切换速度 (0.5x/1x/1.5x/2x)\n");
-            printf("f: 快进10秒\n");
-            printf("b: 快退10秒\n");
-            printf("e: 切换均衡器模式\n");
-            printf("+/-: 音量调节\n");
-            printf("i: 显示状态信息\n");
-            printf("h: 显示帮助\n");
-            printf("q: 退出\n");
-            printf("=================\n\n");
-            break;
-        default:
-            break;
-    }
+// 输出线程第一次写进声卡之后，主线程调用一次
+static void report_first_audio() {
+    char info_msg[LOG_BUFFER_SIZE];
+    snprintf(info_msg, sizeof(info_msg), "First audio %.1f ms after startup%s",
+             STATS_GET(pipeline_stats.first_audio_ns) / 1e6, fast_start ? " (fast start)" : "");
+    log_program_info("PLAYBACK", info_msg);
+    printf("首个音频: 启动后 %.1f ms\n", STATS_GET(pipeline_stats.first_audio_ns) / 1e6);
 }
 
 int main(int argc, char *argv[]) {
@@ -954,36 +8096,101 @@ int main(int argc, char *argv[]) {
     rate = 0; 
     pcm_format = SND_PCM_FORMAT_UNKNOWN; // Or another sentinel
 
-    bool file_opened = false;
     bool user_specified_rate = false;
     bool user_specified_format = false;
     int original_stdin_flags = -1;
     
     // 初始化日志
+    startup_ns = monotonic_ns();
+    stats_reset();
+    log_start();
     log_program_info("STARTUP", "Music player starting up");
     
     // 初始化播放列表
     playlist_count = 0;
     current_track = 0;
 
-    while ((opt_char = getopt(argc, argv, "m:f:r:d:")) != -1) {
+    while ((opt_char = getopt(argc, argv, "m:f:r:d:R:P:k:I:E:g:S:D:T:O:s:e:t:A:L:X:J:V:l:o:Z:F:v:")) != -1) {
         switch (opt_char) {
             case 'm':
                 printf("打开文件: %s\n", optarg);
-                // 添加到播放列表
-                if (playlist_count < 10) {
-                    strncpy(playlist[playlist_count], optarg, 255);
-                    playlist[playlist_count][255] = '\0';
-                    playlist_count++;
+                // 添加到播放列表 (-m 可重复，也可以是目录或 M3U 列表)
+                if (!playlist_load(optarg)) {
+                    fprintf(stderr, "Failed to load playlist entry: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'o':
+                // 主输出设备 (区域 0)，混音器也挂在这个设备上
+                sound_card_name = optarg;
+                break;
+            case 'v':
+                // 软件音量的初始值 (dB，SOFT_VOLUME_MIN_DB - 0)，没有混音器时 +/- 在此基础上调整
+                current_volume_db = strtof(optarg, NULL);
+                if (current_volume_db > 0.0f) current_volume_db = 0.0f;
+                if (current_volume_db < SOFT_VOLUME_MIN_DB) current_volume_db = SOFT_VOLUME_MIN_DB;
+                printf("Software volume: %.1f dB\n", current_volume_db);
+                break;
+            case 'F':
+                // 快速启动: 1 / 0 (默认)
+                fast_start = atoi(optarg) != 0;
+                break;
+            case 'Z':
+                // 附加输出区域: 设备[@eq=模式][@vol=dB][@rate=Hz]，可重复
+                if (!zone_parse(optarg)) {
+                    fprintf(stderr, "Invalid output zone: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'X':
+                track_index_path = strcmp(optarg, "none") == 0 ? NULL : optarg;
+                break;
+            case 'J': {
+                // 流式输入的抖动缓冲区: 深度[,预取水位]，单位毫秒
+                char *end;
+                jitter_buffer_ms = (int)strtol(optarg, &end, 10);
+                if (*end == ',') {
+                    jitter_prefetch_ms = atoi(end + 1);
+                }
+                if (jitter_buffer_ms <= 0 || jitter_prefetch_ms < 0) {
+                    fprintf(stderr, "Invalid jitter buffer: %s. Using %d,%d ms.\n", optarg,
+                            DEFAULT_JITTER_BUFFER_MS, DEFAULT_JITTER_PREFETCH_MS);
+                    jitter_buffer_ms = DEFAULT_JITTER_BUFFER_MS;
+                    jitter_prefetch_ms = DEFAULT_JITTER_PREFETCH_MS;
                 }
-                if (!file_opened) {
-                    if (!open_music_file(optarg)) {
-                        fprintf(stderr, "Failed to open music file: %s\n", optarg);
-                        exit(EXIT_FAILURE);
+                break;
+            }
+            case 'l':
+                // 输出限幅器: 限幅电平 (dBFS) / off
+                if (strcmp(optarg, "off") == 0) {
+                    limiter_enabled = false;
+                } else {
+                    float ceiling = (float)atof(optarg);
+                    if (ceiling < LIMITER_MIN_CEILING_DB || ceiling > 0.0f) {
+                        fprintf(stderr, "Limiter ceiling must be between %.0f and 0 dBFS, using %.1f.\n",
+                                LIMITER_MIN_CEILING_DB, DEFAULT_LIMITER_CEILING_DB);
+                        ceiling = DEFAULT_LIMITER_CEILING_DB;
                     }
-                    file_opened = true;
+                    limiter_enabled = true;
+                    limiter_ceiling_db = ceiling;
+                }
+                break;
+            case 'V': {
+                // 电平/频谱分析: 帧率[,快照文件]
+                char *end;
+                analyzer_fps = (int)strtol(optarg, &end, 10);
+                if (end == optarg) {
+                    analyzer_fps = DEFAULT_ANALYZER_FPS;
+                }
+                if (*end == ',' && end[1] != '\0') {
+                    analyzer_shm_path = end + 1;
+                }
+                if (analyzer_fps < 0 || analyzer_fps > ANALYZER_MAX_FPS) {
+                    fprintf(stderr, "Analyzer frame rate must be 0..%d, using %d.\n", ANALYZER_MAX_FPS, DEFAULT_ANALYZER_FPS);
+                    analyzer_fps = DEFAULT_ANALYZER_FPS;
                 }
                 break;
+            }
             case 'f': {
                 int format_code = atoi(optarg);
                 user_specified_format = true;
@@ -1034,15 +8241,158 @@ int main(int argc, char *argv[]) {
 				}
 				break;
 			}
+            case 'R': {
+                // 环形缓冲区深度，以ALSA周期为单位
+                int depth = atoi(optarg);
+                if (depth < 2) {
+                    fprintf(stderr, "Ring depth must be at least 2 periods, using %d.\n", DEFAULT_RING_DEPTH_PERIODS);
+                    depth = DEFAULT_RING_DEPTH_PERIODS;
+                }
+                ring_depth_periods = depth;
+                printf("Ring buffer depth: %d periods\n", ring_depth_periods);
+                break;
+            }
+            case 'L':
+                // 延迟档位: normal (默认) / low / deep / adaptive
+                if (strcmp(optarg, "low") == 0) {
+                    latency_profile = LATENCY_LOW;
+                    latency_level = 0;
+                } else if (strcmp(optarg, "deep") == 0) {
+                    latency_profile = LATENCY_DEEP;
+                    latency_level = LATENCY_LEVELS - 1;
+                } else if (strcmp(optarg, "adaptive") == 0) {
+                    latency_profile = LATENCY_ADAPTIVE;
+                    latency_level = 0;
+                } else if (strcmp(optarg, "normal") == 0) {
+                    latency_profile = LATENCY_NORMAL;
+                } else {
+                    fprintf(stderr, "Unknown latency profile: %s. Using normal.\n", optarg);
+                }
+                break;
+            case 'P':
+                // 输出线程 SCHED_FIFO 优先级，0 表示使用默认调度
+                output_rt_priority = atoi(optarg);
+                if (output_rt_priority < 0) output_rt_priority = 0;
+                printf("Output thread RT priority: %d\n", output_rt_priority);
+                break;
+            case 'k':
+                // FIR 内核: auto / scalar / sse / avx2 / neon
+                requested_fir_kernel = optarg;
+                break;
+            case 'I':
+                // 卷积均衡器的冲激响应: WAV 或文本系数文件
+                impulse_response_path = optarg;
+                break;
+            case 'g':
+                // 无缝播放: 1 (默认) / 0
+                gapless_enabled = atoi(optarg) != 0;
+                printf("Gapless playback: %s\n", gapless_enabled ? "on" : "off");
+                break;
+            case 'S':
+                // 采样率转换质量: off / fast / medium (默认) / high
+                if (strcmp(optarg, "off") == 0) {
+                    src_quality = SRC_OFF;
+                } else if (strcmp(optarg, "fast") == 0) {
+                    src_quality = SRC_FAST;
+                } else if (strcmp(optarg, "medium") == 0) {
+                    src_quality = SRC_MEDIUM;
+                } else if (strcmp(optarg, "high") == 0) {
+                    src_quality = SRC_HIGH;
+                } else {
+                    fprintf(stderr, "Unknown resampler quality: %s. Using medium.\n", optarg);
+                }
+                break;
+            case 'T':
+                // 每隔 N 秒输出一行机器可读的统计
+                stats_interval_seconds = atoi(optarg);
+                break;
+            case 'O':
+                // 离线渲染: 输出 WAV 文件，"null" 只计时不写文件
+                render_path = optarg;
+                break;
+            case 's': {
+                // 初始播放速度，范围 MIN_SPEED_FACTOR..MAX_SPEED_FACTOR
+                float speed = (float)atof(optarg);
+                if (speed < MIN_SPEED_FACTOR || speed > MAX_SPEED_FACTOR) {
+                    fprintf(stderr, "Speed must be between %.2f and %.2f, using 1.0.\n", MIN_SPEED_FACTOR, MAX_SPEED_FACTOR);
+                    speed = 1.0f;
+                }
+                current_speed_factor = roundf(speed / SPEED_STEP) * SPEED_STEP;
+                break;
+            }
+            case 'e':
+                // 初始均衡器模式: normal / bass / treble / vocal / conv (需要 -I)
+                if (strcmp(optarg, "normal") == 0) {
+                    current_eq_mode = EQ_NORMAL;
+                } else if (strcmp(optarg, "bass") == 0) {
+                    current_eq_mode = EQ_BASS_BOOST;
+                } else if (strcmp(optarg, "treble") == 0) {
+                    current_eq_mode = EQ_TREBLE_BOOST;
+                } else if (strcmp(optarg, "vocal") == 0) {
+                    current_eq_mode = EQ_VOCAL_ENHANCE;
+                } else if (strcmp(optarg, "conv") == 0) {
+                    current_eq_mode = EQ_CONVOLUTION;
+                } else {
+                    fprintf(stderr, "Unknown EQ mode: %s. Using normal.\n", optarg);
+                }
+                break;
+            case 't':
+                // 初始变速算法: psola / pv / wsola (默认)
+                if (strcmp(optarg, "psola") == 0) {
+                    current_stretch_mode = STRETCH_PSOLA;
+                } else if (strcmp(optarg, "pv") == 0) {
+                    current_stretch_mode = STRETCH_PHASE_VOCODER;
+                } else if (strcmp(optarg, "wsola") == 0) {
+                    current_stretch_mode = STRETCH_WSOLA;
+                } else {
+                    fprintf(stderr, "Unknown stretch mode: %s. Using wsola.\n", optarg);
+                }
+                break;
+            case 'A':
+                // 声卡写入方式: rw (snd_pcm_writei，默认) / mmap / mmap-planar
+                if (strcmp(optarg, "mmap") == 0) {
+                    pcm_access = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+                } else if (strcmp(optarg, "mmap-planar") == 0) {
+                    pcm_access = SND_PCM_ACCESS_MMAP_NONINTERLEAVED;
+                } else if (strcmp(optarg, "rw") == 0) {
+                    pcm_access = SND_PCM_ACCESS_RW_INTERLEAVED;
+                } else {
+                    fprintf(stderr, "Unknown access mode: %s. Using rw.\n", optarg);
+                }
+                break;
+            case 'D':
+                // 输出量化抖动: 1 (默认) / 0
+                dither_enabled = atoi(optarg) != 0;
+                printf("Dither: %s\n", dither_enabled ? "on" : "off");
+                break;
+            case 'E':
+                // 预设均衡器引擎: fir / biquad
+                if (strcmp(optarg, "biquad") == 0) {
+                    current_eq_engine = EQ_ENGINE_BIQUAD;
+                } else if (strcmp(optarg, "fir") == 0) {
+                    current_eq_engine = EQ_ENGINE_FIR;
+                } else {
+                    fprintf(stderr, "Unknown EQ engine: %s. Using fir.\n", optarg);
+                }
+                break;
             default:
                 exit(EXIT_FAILURE);
         }
     }
 
-    if (!file_opened) {
+    if (playlist_count == 0) {
         fprintf(stderr, "Error: Music file (-m option) is mandatory.\n");
         // Print usage here
-        fprintf(stderr, "Usage: %s -m <music_filename.wav> [-f <format_code>] [-r <rate_code>]\n", argv[0]);
+        fprintf(stderr, "Usage: %s -m <music_file.wav|.flac> [-f <format_code>] [-r <rate_code>] [-R <ring_periods>] [-P <rt_priority>] [-k <fir_kernel>] [-I <impulse_response>] [-E <fir|biquad>] [-g <0|1>] [-S <off|fast|medium|high>] [-D <0|1>] [-T <stats_seconds>] [-s <speed>] [-e <normal|bass|treble|vocal|conv>] [-t <psola|pv|wsola>] [-O <render.wav|null>] [-A <rw|mmap|mmap-planar>] [-L <normal|low|deep|adaptive>] [-X <index_file|none>] [-J <jitter_ms[,prefetch_ms]>] [-V <fps[,snapshot_file]>] [-l <ceiling_db|off>] [-o <device>] [-Z <device[@eq=mode][@vol=db][@rate=hz]>] [-F <0|1>] [-v <volume_db>]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    // 解析完所有选项后再打开第一首，-X 不受参数顺序影响；离线渲染不需要快速启动
+    if (render_path != NULL) {
+        fast_start = false;
+    }
+    track_header_deferred = fast_start;
+    if (!open_music_file(playlist_path(0))) {
+        fprintf(stderr, "Failed to open music file: %s\n", playlist_path(0));
         exit(EXIT_FAILURE);
     }
 
@@ -1079,22 +8429,44 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    debug_msg(snd_pcm_hw_params_malloc(&hw_params), "分配snd_pcm_hw_params_t结构体");
-    pcm_name = strdup(sound_card_name);
-    debug_msg(snd_pcm_open(&pcm_handle, pcm_name, stream, 0), "打开PCM设备");
-    debug_msg(snd_pcm_hw_params_any(pcm_handle, hw_params), "配置空间初始化");
-    debug_msg(snd_pcm_hw_params_set_access(pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED), "设置交错模式");
-    debug_msg(snd_pcm_hw_params_set_format(pcm_handle, hw_params, pcm_format), "设置样本格式");
-    
-    unsigned int actual_rate_from_alsa = rate;
-    debug_msg(snd_pcm_hw_params_set_rate_near(pcm_handle, hw_params, &actual_rate_from_alsa, 0), "设置采样率");
-    if (rate != actual_rate_from_alsa) {
-        printf("Notice: Requested sample rate %u Hz, ALSA set to %u Hz.\n", rate, actual_rate_from_alsa);
-        rate = actual_rate_from_alsa;
+    // 离线渲染写 WAV 文件: 4 字节容器的 S24 在 WAV 中没有对应的简单格式，改为紧凑的3字节
+    if (render_path != NULL && pcm_format == SND_PCM_FORMAT_S24_LE) {
+        pcm_format = SND_PCM_FORMAT_S24_3LE;
     }
 
-    debug_msg(snd_pcm_hw_params_set_channels(pcm_handle, hw_params, wav_header.num_channels), "设置通道数");
-    buffer_size = period_size * periods;
+    // 处理链内部统一用 float，输出时转换成设备格式
+    device_format = sample_format_from_pcm(pcm_format);
+    if (device_format == SAMPLE_FORMAT_UNKNOWN || !dsp_path_supported(&wav_header)) {
+        printf("Warning: sample format not supported by the DSP chain, effects are bypassed\n");
+    } else {
+        printf("Processing: %s -> float -> %s\n",
+               sample_format_name(sample_format_from_wav(&wav_header)), sample_format_name(device_format));
+    }
+
+    char kernel_msg[LOG_BUFFER_SIZE];
+    snprintf(kernel_msg, sizeof(kernel_msg), "FIR kernel: %s", fir_select_kernel(requested_fir_kernel));
+    log_program_info("INFO", kernel_msg);
+
+    if (impulse_response_path != NULL) {
+        conv_ir = conv_ir_load(impulse_response_path);
+        if (conv_ir == NULL) {
+            fprintf(stderr, "Failed to load impulse response: %s\n", impulse_response_path);
+            exit(EXIT_FAILURE);
+        }
+        if (conv_ir->sample_rate != 0 && conv_ir->sample_rate != wav_header.sample_rate) {
+            log_program_info("WARNING", "Impulse response sample rate differs from the music file");
+        }
+        printf("冲激响应: %d 抽头, %d 声道, 延迟 %d 帧 (按 e 切换到卷积模式)\n",
+               conv_ir->taps, conv_ir->channels, conv_ir->block);
+    }
+    if (current_eq_mode == EQ_CONVOLUTION && conv_ir == NULL) {
+        fprintf(stderr, "Convolution EQ needs an impulse response (-I), using normal.\n");
+        current_eq_mode = EQ_NORMAL;
+    }
+    dsp_params_init();
+
+    device_channels = wav_header.num_channels;
+    latency_update_sizes();
     
     // 确保不重复分配buff
     if (buff != NULL) {
@@ -1111,6 +8483,42 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error: WAV header block_align is zero.\n");
         exit(EXIT_FAILURE);
     }
+
+    if (render_path != NULL) {
+        int render_status = render_playlist();
+        dsp_chain_free();
+        close_music_file();
+        free(buff);
+        buff = NULL;
+        track_index_save();
+        track_index_free();
+        playlist_free();
+        log_stop();
+        return render_status;
+    }
+
+    if (!pipeline_events_init()) {
+        exit(EXIT_FAILURE);
+    }
+    if (!analyzer_start()) {
+        printf("Warning: level/spectrum analyzer could not be started.\n");
+    }
+    current_state = PLAYING;
+    // -F: 读取/DSP 线程先按请求的周期预读，与下面打开和配置声卡并行
+    bool preloaded = fast_start && pipeline_preload(period_size / wav_header.block_align);
+
+    debug_msg(snd_pcm_hw_params_malloc(&hw_params), "分配snd_pcm_hw_params_t结构体");
+    pcm_name = strdup(sound_card_name);
+    debug_msg(snd_pcm_open(&pcm_handle, pcm_name, stream, 0), "打开PCM设备");
+    debug_msg(snd_pcm_hw_params_any(pcm_handle, hw_params), "配置空间初始化");
+    debug_msg(pcm_set_access(hw_params), "设置访问方式");
+    debug_msg(snd_pcm_hw_params_set_format(pcm_handle, hw_params, pcm_format), "设置样本格式");
+    
+    // 预读的读取线程可能正在用 rate，设备协商出的采样率先放在局部变量里
+    unsigned int actual_rate_from_alsa = rate;
+    debug_msg(snd_pcm_hw_params_set_rate_near(pcm_handle, hw_params, &actual_rate_from_alsa, 0), "设置采样率");
+
+    debug_msg(snd_pcm_hw_params_set_channels(pcm_handle, hw_params, wav_header.num_channels), "设置通道数");
     snd_pcm_uframes_t local_period_size_frames = period_size / wav_header.block_align;
     frames = buffer_size / wav_header.block_align;
     debug_msg(snd_pcm_hw_params_set_buffer_size_near(pcm_handle, hw_params, &frames), "设置缓冲区大小");
@@ -1124,322 +8532,165 @@ int main(int argc, char *argv[]) {
     snd_pcm_hw_params_free(hw_params);
     hw_params = NULL;
 
-    if (!init_mixer()) {
-        printf("Warning: Failed to initialize mixer. Volume control will not be available.\n");
-    } else {
-        printf("Volume control initialized. Use '+' to increase, '-' to decrease volume.\n");
-        original_stdin_flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-        if (original_stdin_flags != -1) {
-            if (fcntl(STDIN_FILENO, F_SETFL, original_stdin_flags | O_NONBLOCK) == -1) {
-                perror("fcntl F_SETFL O_NONBLOCK"); original_stdin_flags = -1;
-            }
-        } else { perror("fcntl F_GETFL"); }
+    // 设备没有接受预读时的参数: 先停掉读取线程，丢掉预读的音频，之后才公布实际采样率并从头开始；
+    // 保留预读时采样率没有变，rate 不会被改写
+    bool preload_rejected = preloaded && !pipeline_preload_fits(local_period_size_frames, actual_rate_from_alsa);
+    if (preload_rejected) {
+        log_program_info("INFO", "Preloaded audio does not match the device configuration, restarting the track");
+        pipeline_stop();
+        preloaded = false;
+    }
+    if (rate != actual_rate_from_alsa) {
+        printf("Notice: Requested sample rate %u Hz, ALSA set to %u Hz.\n", rate, actual_rate_from_alsa);
+        rate = actual_rate_from_alsa;
+    }
+    pcm_log_granted(local_period_size_frames, frames);
+    zones_open();
+
+    if (preload_rejected) {
+        if (!open_music_file(playlist_path(0))) {
+            fprintf(stderr, "Failed to reopen music file: %s\n", playlist_path(0));
+            goto playback_end;
+        }
     }
+    // 快速启动时混音器和键盘控制等开始出声后再初始化
+    bool stdin_active = !fast_start && controls_init(&original_stdin_flags);
 
     printf("Starting playback...\n");
     printf("Press 'h' for help, 'q' to quit\n");
     
-    // 分配滤波后的缓冲区 (do this once outside the restart loop)
-    unsigned char *filtered_buff = (unsigned char *)malloc(buffer_size);
-    if (filtered_buff == NULL) {
-        log_program_info("ERROR", "Failed to allocate filtered buffer");
-        if (buff) free(buff);
-        exit(EXIT_FAILURE);
-    }
-    
-    // 分配时间拉伸缓冲区 (allocate once, reuse for all iterations)
-    short* temp_samples = (short*)malloc(buffer_size * 2); // 2x size for safety
-    if (temp_samples == NULL) {
-        log_program_info("ERROR", "Failed to allocate temp_samples buffer");
-        if (filtered_buff) free(filtered_buff);
-        if (buff) free(buff);
-        exit(EXIT_FAILURE);
-    }
-
 restart_playback:
     current_state = PLAYING;
     log_program_info("PLAYBACK", "Playback started");
     
-    int read_ret;
-    int speed_skip_counter = 0;
+    // 读取/DSP 和 ALSA 输出在各自线程中运行，主线程只负责控制
+    if (!pipeline_start(local_period_size_frames)) {
+        goto playback_end;
+    }
     
     while (1) {
-        // 处理用户输入
-        if (mixer_handle && original_stdin_flags != -1) {
-            char c_in = -1;
-            if (read(STDIN_FILENO, &c_in, 1) == 1) {
-                handle_user_input(c_in);
-                while(read(STDIN_FILENO, &c_in, 1) == 1 && c_in != '\n'); // Consume rest of line
-            }
-        }
-        
-        // 如果暂停，继续循环但不播放
-        if (current_state == PAUSED) {
-            usleep(50000); // 50ms
-            continue;
-        }
-        
         // 如果停止，退出循环
         if (current_state == STOPPED) {
+            pipeline_stop();
+            gapless_reset();
             break;
         }
         
-        // 处理手动切换曲目请求
-        if (track_change_requested) {
-            track_change_requested = false;
-            printf("DEBUG: Starting track change to: %s\n", playlist[current_track]);
-            if (fp) {
-                fclose(fp);
-                fp = NULL;
-            }
-            printf("DEBUG: Closed previous file, opening new file\n");
-            if (!open_music_file(playlist[current_track])) {
-                printf("ERROR: Failed to open new track: %s\n", playlist[current_track]);
+        // 处理手动切换曲目请求: 读取线程执行到切歌命令后已经结束
+        int requested = atomic_load(&track_request);
+        if (requested >= 0) {
+            atomic_store(&track_request, -1);
+            pipeline_stop();
+            gapless_reset();
+            current_track = requested;
+            if (requested_track == requested) {
+                requested_track = -1;
+            }
+            close_music_file();
+            if (!open_music_file(playlist_path(current_track))) {
+                printf("ERROR: Failed to open new track: %s\n", playlist_path(current_track));
                 current_state = STOPPED;
                 break;
             }
-            printf("DEBUG: Opened new file successfully\n");
             
             // 检查新文件的音频参数是否与当前ALSA配置匹配
-            if (wav_header.sample_rate != rate || wav_header.num_channels != 2) {
-                printf("DEBUG: Audio parameters changed, need to reconfigure ALSA\n");
-                printf("DEBUG: Old: %u Hz, New: %u Hz\n", rate, wav_header.sample_rate);
-                
-                // 重新配置ALSA以匹配新文件
-                snd_pcm_drop(pcm_handle);
-                
-                // Free existing hw_params if allocated
-                if (hw_params) {
-                    snd_pcm_hw_params_free(hw_params);
-                    hw_params = NULL;
-                }
-                
-                snd_pcm_hw_params_malloc(&hw_params);
-                snd_pcm_hw_params_any(pcm_handle, hw_params);
-                snd_pcm_hw_params_set_access(pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-                snd_pcm_hw_params_set_format(pcm_handle, hw_params, pcm_format);
-                
-                rate = wav_header.sample_rate;
-                unsigned int actual_rate_from_alsa = rate;
-                snd_pcm_hw_params_set_rate_near(pcm_handle, hw_params, &actual_rate_from_alsa, 0);
-                snd_pcm_hw_params_set_channels(pcm_handle, hw_params, wav_header.num_channels);
-                
-                snd_pcm_uframes_t local_period_size_frames = period_size / wav_header.block_align;
-                frames = buffer_size / wav_header.block_align;
-                snd_pcm_hw_params_set_buffer_size_near(pcm_handle, hw_params, &frames);
-                snd_pcm_hw_params_set_period_size_near(pcm_handle, hw_params, &local_period_size_frames, 0);
-                
-                snd_pcm_hw_params(pcm_handle, hw_params);
-                snd_pcm_hw_params_free(hw_params);
-                hw_params = NULL;
-                snd_pcm_prepare(pcm_handle);
-                
-                printf("DEBUG: ALSA reconfigured for new audio parameters\n");
+            if (track_needs_pcm_reconfigure()) {
+                reconfigure_pcm_for_track(&local_period_size_frames);
+            }
+            if (!pipeline_start(local_period_size_frames)) {
+                current_state = STOPPED;
+                break;
             }
             continue;
         }
         
-        // 获取播放速度因子
-        float speed_factor = 1.0f;
-        switch(current_speed) {
-            case SPEED_0_5X: speed_factor = 0.5f; break;
-            case SPEED_1_0X: speed_factor = 1.0f; break;
-            case SPEED_1_5X: speed_factor = 1.5f; break;
-            case SPEED_2_0X: speed_factor = 2.0f; break;
+        if (atomic_load(&output_failed)) {
+            pipeline_stop();
+            gapless_reset();
+            goto playback_end;
         }
         
-        read_ret = fread(buff, 1, buffer_size, fp);
-        if (read_ret == 0) {
-            log_program_info("PLAYBACK", "End of current track");
-            // 设置自动切换标志
+        // 读取线程到达文件末尾，且输出线程 (和各区域) 已排空环形缓冲区
+        if (atomic_load(&output_finished) && zones_finished()) {
+            pipeline_stop();
+            gapless_reset();
             if (playlist_count > 1) {
-                auto_next_requested = true;
-                break; // 退出循环，在安全位置处理切换
+                auto_next_requested = true; // 在安全位置处理切换
             } else {
                 printf("End of music file input! (fread returned 0)\n");
-                break;
             }
-        }
-        if (read_ret < 0) {
-            log_program_info("ERROR", "Error reading PCM data from file");
-            break;
-        }
-        
-        current_position += read_ret / wav_header.block_align;
-        
-        snd_pcm_uframes_t frames_to_write = read_ret / wav_header.block_align;
-        if (frames_to_write == 0 && read_ret > 0) {
-             log_program_info("WARNING", "Partial frame data at end of file");
-             break;
-        }
-        if (frames_to_write == 0) {
             break;
         }
         
-        // 应用时间拉伸和均衡器滤波
-        unsigned char *processing_buff = filtered_buff;
-        int processing_length = read_ret;
-        
-        if (wav_header.bits_per_sample == 16) {
-            short* input_samples = (short*)buff;
-            int sample_count = read_ret / sizeof(short);
-            short* output_samples = (short*)filtered_buff;
-            
-            // 首先应用时间拉伸（保持音调）
-            int stretched_length = 0;
-            if (speed_factor != 1.0f) {
-                // Use the pre-allocated temp_samples buffer
-                int max_output_samples = buffer_size / sizeof(short); // Use actual buffer size
-                apply_time_stretch(input_samples, temp_samples, sample_count, &stretched_length, speed_factor, max_output_samples);
-                processing_length = stretched_length * sizeof(short);
-            } else {
-                memcpy(temp_samples, input_samples, read_ret);
-                stretched_length = sample_count;
+        int retune_level = latency_adapt_poll();
+        if (retune_level >= 0) {
+            if (!latency_retune(retune_level, &local_period_size_frames)) {
+                current_state = STOPPED;
+                break;
             }
-            
-            // 然后应用均衡器滤波
-            apply_fir_filter(temp_samples, output_samples, stretched_length, current_eq_mode);
-            
-            // 更新写入帧数为拉伸后的长度
-            frames_to_write = stretched_length / wav_header.num_channels;
-        } else {
-            // 对于非16位样本，直接复制
-            memcpy(filtered_buff, buff, read_ret);
+            continue;
         }
         
-        snd_pcm_sframes_t frames_written_alsa;
-        unsigned char *ptr = filtered_buff;
-        snd_pcm_uframes_t remaining_frames = frames_to_write;
-
-        while(remaining_frames > 0) {
-            frames_written_alsa = snd_pcm_writei(pcm_handle, ptr, remaining_frames);
-            if (frames_written_alsa < 0) {
-                if (frames_written_alsa == -EPIPE) {
-                    log_program_info("WARNING", "Audio underrun occurred, preparing interface");
-                    snd_pcm_prepare(pcm_handle);
-                } else {
-                    char error_msg[LOG_BUFFER_SIZE];
-                    snprintf(error_msg, sizeof(error_msg), "Error from snd_pcm_writei: %s", snd_strerror(frames_written_alsa));
-                    log_program_info("ERROR", error_msg);
-                    goto playback_end;
-                }
-            } else {
-                ptr += frames_written_alsa * wav_header.block_align;
-                remaining_frames -= frames_written_alsa;
+        gapless_poll();
+        stats_poll();
+        if (!first_audio_reported && STATS_GET(pipeline_stats.first_audio_ns) != 0) {
+            first_audio_reported = true;
+            report_first_audio();
+            if (fast_start) {
+                stdin_active = controls_init(&original_stdin_flags);
+                track_header_deferred = false;
+                print_track_header();
             }
         }
+
+        // 睡到有按键、流水线事件或下一次定时检查；暂停且没有 -T 时只等事件
+        struct pollfd fds[2] = {{.fd = control_event.fd, .events = POLLIN}, {.fd = STDIN_FILENO, .events = POLLIN}};
+        wake_event_arm(&control_event);
+        int ready = control_events_pending() ? 0 : poll(fds, stdin_active ? 2 : 1, control_loop_timeout_ms());
+        wake_event_disarm(&control_event);
+        if (ready <= 0) {
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            wake_event_clear(&control_event);
+        }
         
-        if (read_ret < buffer_size) {
-            log_program_info("PLAYBACK", "End of music file (partial buffer read)");
-            // 播放最后一块数据，下次循环read_ret==0时会触发切换
+        // 处理用户输入
+        if (stdin_active && (fds[1].revents & (POLLIN | POLLHUP))) {
+            char c_in = -1;
+            ssize_t got = read(STDIN_FILENO, &c_in, 1);
+            if (got == 1) {
+                handle_user_input(c_in);
+                while(read(STDIN_FILENO, &c_in, 1) == 1 && c_in != '\n'); // Consume rest of line
+            } else if (got == 0) {
+                stdin_active = false; // 标准输入已关闭，不再 poll 它
+            }
         }
     }
     
     // 处理自动切换到下一首
     if (auto_next_requested) {
-        printf("DEBUG: Entering auto_next_requested block\n");
-        fflush(stdout);
         auto_next_requested = false;
-        printf("DEBUG: Set auto_next_requested to false\n");
-        fflush(stdout);
         current_track = (current_track + 1) % playlist_count;
-        printf("DEBUG: Updated current_track to %d\n", current_track);
-        fflush(stdout);
         log_user_operation("AUTO_NEXT_TRACK", "SUCCESS");
-        printf("DEBUG: Logged operation\n");
-        fflush(stdout);
-        printf("自动切换到下一首: %s\n", playlist[current_track]);
-        fflush(stdout);
+        printf("自动切换到下一首: %s\n", playlist_path(current_track));
         
-        printf("DEBUG: About to close file\n");
-        fflush(stdout);
-        fclose(fp);
-        fp = NULL; // Set to NULL after closing to prevent double close
-        printf("DEBUG: File closed, opening new file: %s\n", playlist[current_track]);
-        fflush(stdout);
-        if (open_music_file(playlist[current_track])) {
-            printf("DEBUG: Successfully opened new file\n");
-            fflush(stdout);
+        close_music_file(); // 同时解除映射，fp 置为 NULL 防止重复关闭
+        if (open_music_file(playlist_path(current_track))) {
             // 检查新文件的音频参数是否与当前ALSA配置匹配
-            if (wav_header.sample_rate != rate) {
-                printf("DEBUG: Auto-switch audio parameters changed, need to reconfigure ALSA\n");
-                fflush(stdout);
-                printf("DEBUG: Old: %u Hz, New: %u Hz\n", rate, wav_header.sample_rate);
-                fflush(stdout);
-                
-                // 重新配置ALSA以匹配新文件
-                printf("DEBUG: About to call snd_pcm_drop\n");
-                fflush(stdout);
-                snd_pcm_drop(pcm_handle);
-                printf("DEBUG: snd_pcm_drop completed\n");
-                fflush(stdout);
-                
-                // Free existing hw_params if allocated
-                printf("DEBUG: Checking hw_params: %p\n", hw_params);
-                fflush(stdout);
-                if (hw_params) {
-                    printf("DEBUG: About to free hw_params\n");
-                    fflush(stdout);
-                    snd_pcm_hw_params_free(hw_params);
-                    hw_params = NULL;
-                    printf("DEBUG: hw_params freed and set to NULL\n");
-                    fflush(stdout);
-                } else {
-                    printf("DEBUG: hw_params is NULL, skipping free\n");
-                    fflush(stdout);
-                }
-                
-                printf("DEBUG: About to allocate new hw_params\n");
-                fflush(stdout);
-                snd_pcm_hw_params_malloc(&hw_params);
-                printf("DEBUG: New hw_params allocated: %p\n", hw_params);
-                fflush(stdout);
-                snd_pcm_hw_params_any(pcm_handle, hw_params);
-                snd_pcm_hw_params_set_access(pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-                snd_pcm_hw_params_set_format(pcm_handle, hw_params, pcm_format);
-                
-                rate = wav_header.sample_rate;
-                unsigned int actual_rate_from_alsa = rate;
-                snd_pcm_hw_params_set_rate_near(pcm_handle, hw_params, &actual_rate_from_alsa, 0);
-                snd_pcm_hw_params_set_channels(pcm_handle, hw_params, wav_header.num_channels);
-                
-                snd_pcm_uframes_t local_period_size_frames = period_size / wav_header.block_align;
-                frames = buffer_size / wav_header.block_align;
-                snd_pcm_hw_params_set_buffer_size_near(pcm_handle, hw_params, &frames);
-                snd_pcm_hw_params_set_period_size_near(pcm_handle, hw_params, &local_period_size_frames, 0);
-                
-                snd_pcm_hw_params(pcm_handle, hw_params);
-                snd_pcm_hw_params_free(hw_params);
-                hw_params = NULL;
-                snd_pcm_prepare(pcm_handle);
-                
-                printf("DEBUG: ALSA reconfigured for auto-switch new audio parameters\n");
+            if (track_needs_pcm_reconfigure()) {
+                reconfigure_pcm_for_track(&local_period_size_frames);
             }
             // 重新开始播放循环，buffers will be cleaned up automatically at the end
             goto restart_playback;
         } else {
-            printf("ERROR: Failed to open next track: %s\n", playlist[current_track]);
+            printf("ERROR: Failed to open next track: %s\n", playlist_path(current_track));
         }
     }
     
     // 清理缓冲区（只在这里执行一次）
     printf("DEBUG: Starting buffer cleanup\n");
-    if (filtered_buff) {
-        printf("DEBUG: Freeing filtered_buff at %p\n", filtered_buff);
-        free(filtered_buff);
-        filtered_buff = NULL;
-        printf("DEBUG: filtered_buff freed and set to NULL\n");
-    } else {
-        printf("DEBUG: filtered_buff is already NULL\n");
-    }
-    if (temp_samples) {
-        printf("DEBUG: Freeing temp_samples at %p\n", temp_samples);
-        free(temp_samples);
-        temp_samples = NULL;
-        printf("DEBUG: temp_samples freed and set to NULL\n");
-    } else {
-        printf("DEBUG: temp_samples is already NULL\n");
-    }
+    dsp_chain_free();
     printf("DEBUG: Buffer cleanup completed\n");
 
 playback_end:
@@ -1448,14 +8699,20 @@ playback_end:
     printf("Playback finished or stopped.\n");
     
     snd_pcm_drain(pcm_handle);
-    if (mixer_handle && original_stdin_flags != -1) {
+    if (original_stdin_flags != -1) {
         if (fcntl(STDIN_FILENO, F_SETFL, original_stdin_flags) == -1) {
             log_program_info("WARNING", "Failed to restore stdin flags");
         }
     }
     
-    if (fp) fclose(fp);
+    close_music_file();
+    analyzer_stop();
+    pipeline_events_close();
+    track_index_save();
+    track_index_free();
+    playlist_free();
     snd_pcm_close(pcm_handle);
+    zones_close();
     if (mixer_handle) { snd_mixer_close(mixer_handle); }
     if (buff) {
         printf("DEBUG: Freeing buff at %p\n", buff);
@@ -1474,10 +8731,9 @@ playback_end:
         printf("DEBUG: pcm_name is already NULL\n");
     }
     
-    if (log_file) {
-        log_program_info("SHUTDOWN", "Music player shutting down");
-        fclose(log_file);
-    }
+    log_program_info("SHUTDOWN", "Music player shutting down");
+    log_stop();
     
     return 0;
-}
\ No newline at end of file
+}
+#endif // MUSICAPP_NO_MAIN
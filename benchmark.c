@@ -0,0 +1,1374 @@
+// DSP 微基准测试，与 MusicApp 使用完全相同的DSP代码
+// 编译: gcc -O2 -o benchmark benchmark.c -lasound -lm -lpthread
+// 运行: ./benchmark [--golden <dir>] [--update-golden] [--hours <h>]
+//   --golden         参考输出所在目录 (默认 golden)，输出与参考的 SNR 低于阈值时返回非0
+//   --update-golden  用当前输出重写参考文件 (算法有意改变时)，不做比较
+//   --hours          另外把 h 小时的扫频信号流式送过整条处理链，检查长时间运行的开销和分配
+// 与 MusicApp.c 第一行相同，必须在任何系统头文件之前 (SCHED_IDLE 等 GNU 扩展)
+#define _GNU_SOURCE
+#include <stdlib.h>
+
+// 分配计数: 在包含 MusicApp.c 之前把分配函数换成计数版本，处理循环里的分配会直接体现在结果中
+static long bench_allocations = 0;
+static void *bench_malloc(size_t size) { bench_allocations++; return malloc(size); }
+static void *bench_calloc(size_t n, size_t size) { bench_allocations++; return calloc(n, size); }
+static void *bench_realloc(void *p, size_t size) { bench_allocations++; return realloc(p, size); }
+static int bench_posix_memalign(void **p, size_t align, size_t size) {
+    bench_allocations++;
+    return posix_memalign(p, align, size);
+}
+#define malloc(size) bench_malloc(size)
+#define calloc(n, size) bench_calloc(n, size)
+#define realloc(p, size) bench_realloc(p, size)
+#define posix_memalign(p, align, size) bench_posix_memalign(p, align, size)
+
+#define TEST_TONE_NO_MAIN
+#include "generate_test_tone.c"
+#define MUSICAPP_NO_MAIN
+#include "MusicApp.c"
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// 可复现的伪随机输入信号
+static float bench_random(unsigned int *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return (float)((*state >> 8) & 0xFFFF) / 32768.0f - 1.0f;
+}
+
+static double max_abs_error(const Complex *a, const Complex *b, int n) {
+    double max_err = 0.0;
+    for (int i = 0; i < n; i++) {
+        double dr = fabs((double)a[i].real - b[i].real);
+        double di = fabs((double)a[i].imag - b[i].imag);
+        if (dr > max_err) max_err = dr;
+        if (di > max_err) max_err = di;
+    }
+    return max_err;
+}
+
+// 递归参考实现 vs 迭代FFT计划 (复数/实数)
+static void bench_fft() {
+    printf("=== FFT: recursive fft_reference vs fft_plan_t ===\n");
+    printf("%6s %14s %14s %14s %9s %12s %12s\n",
+           "N", "reference(ns)", "plan(ns)", "real plan(ns)", "speedup", "max err", "rt err");
+
+    for (int n = 64; n <= 8192; n <<= 1) {
+        Complex *input = (Complex *)malloc(n * sizeof(Complex));
+        Complex *ref = (Complex *)malloc(n * sizeof(Complex));
+        Complex *work = (Complex *)malloc(n * sizeof(Complex));
+        Complex *spectrum = (Complex *)malloc((n / 2 + 1) * sizeof(Complex));
+        float *real_input = (float *)malloc(n * sizeof(float));
+        float *real_output = (float *)malloc(n * sizeof(float));
+        fft_plan_t *plan = fft_plan_create(n);
+        if (!input || !ref || !work || !spectrum || !real_input || !real_output || !plan) {
+            fprintf(stderr, "Allocation failed for N=%d\n", n);
+            exit(EXIT_FAILURE);
+        }
+
+        unsigned int seed = 12345u + n;
+        for (int i = 0; i < n; i++) {
+            real_input[i] = bench_random(&seed);
+            input[i].real = real_input[i];
+            input[i].imag = 0.0f;
+        }
+
+        // 精度: 复数计划和实数计划都与参考实现比较，另测一次实数往返误差
+        memcpy(ref, input, n * sizeof(Complex));
+        fft_reference(ref, n);
+        memcpy(work, input, n * sizeof(Complex));
+        fft_forward(plan, work);
+        double err = max_abs_error(ref, work, n);
+        fft_real_forward(plan, real_input, spectrum);
+        double real_err = max_abs_error(ref, spectrum, n / 2 + 1);
+        if (real_err > err) err = real_err;
+        fft_real_inverse(plan, spectrum, real_output);
+        double rt_err = 0.0;
+        for (int i = 0; i < n; i++) {
+            double d = fabs((double)real_output[i] - real_input[i]);
+            if (d > rt_err) rt_err = d;
+        }
+
+        // 每个尺寸运行约相同的总样本数
+        int iterations = (1 << 22) / n;
+        double t0 = now_seconds();
+        for (int it = 0; it < iterations; it++) {
+            memcpy(work, input, n * sizeof(Complex));
+            fft_reference(work, n);
+        }
+        double t_ref = (now_seconds() - t0) / iterations;
+
+        t0 = now_seconds();
+        for (int it = 0; it < iterations; it++) {
+            memcpy(work, input, n * sizeof(Complex));
+            fft_forward(plan, work);
+        }
+        double t_plan = (now_seconds() - t0) / iterations;
+
+        t0 = now_seconds();
+        for (int it = 0; it < iterations; it++) {
+            fft_real_forward(plan, real_input, spectrum);
+        }
+        double t_real = (now_seconds() - t0) / iterations;
+
+        printf("%6d %14.0f %14.0f %14.0f %8.1fx %12.3g %12.3g\n",
+               n, t_ref * 1e9, t_plan * 1e9, t_real * 1e9, t_ref / t_plan, err, rt_err);
+
+        fft_plan_destroy(plan);
+        free(input); free(ref); free(work); free(spectrum);
+        free(real_input); free(real_output);
+    }
+    printf("\n");
+}
+
+// FIR 内核: 各SIMD内核与标量参考实现的吞吐量和最大误差
+static void bench_fir() {
+    const char *kernels[] = {"scalar", "sse", "avx2", "neon"};
+    const int frames = 4096;
+    const int history = FIR_TAP_NUM - 1;
+    float coeffs[FIR_TAP_NUM];
+    float *line = (float *)malloc((history + frames) * sizeof(float));
+    float *ref = (float *)malloc(frames * sizeof(float));
+    float *out = (float *)malloc(frames * sizeof(float));
+    if (!line || !ref || !out) {
+        fprintf(stderr, "Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fir_build_effective_coeffs(EQ_BASS_BOOST, coeffs);
+    unsigned int seed = 777u;
+    for (int i = 0; i < history + frames; i++) {
+        line[i] = bench_random(&seed);
+    }
+    fir_kernel_scalar(coeffs, line, ref, frames, FIR_TAP_NUM);
+
+    printf("=== FIR %d taps (auto selects: %s) ===\n", FIR_TAP_NUM, fir_select_kernel("auto"));
+    printf("%8s %12s %10s %14s\n", "kernel", "ns/sample", "speedup", "max rel err");
+    double scalar_ns = 0.0;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        fir_kernel_fn fn = fir_kernel_lookup(kernels[k]);
+        if (fn == NULL) {
+            printf("%8s %12s\n", kernels[k], "n/a");
+            continue;
+        }
+        fn(coeffs, line, out, frames, FIR_TAP_NUM);
+        double max_err = 0.0;
+        for (int i = 0; i < frames; i++) {
+            double e = fabs((double)out[i] - ref[i]);
+            if (e > max_err) max_err = e;
+        }
+
+        int iterations = 2000;
+        double t0 = now_seconds();
+        for (int it = 0; it < iterations; it++) {
+            fn(coeffs, line, out, frames, FIR_TAP_NUM);
+        }
+        double ns = (now_seconds() - t0) * 1e9 / ((double)iterations * frames);
+        if (k == 0) scalar_ns = ns;
+        printf("%8s %12.2f %9.1fx %14.3g\n", kernels[k], ns, scalar_ns / ns, max_err);
+    }
+    printf("\n");
+    free(line); free(ref); free(out);
+}
+
+// 样本格式转换: 各格式 PCM -> float -> PCM 往返是否比特精确、两个方向的吞吐量，
+// 以及16位输出的 TPDF 抖动: 误差与信号无关，均值为 0，RMS 理论值 sqrt(1/12 + 1/6) = 0.5 LSB
+// (S32 超出 float 的24位精度，往返不精确；播放器在信号未被处理时直接输出源数据)
+static void bench_sample_format() {
+    const sample_format_t formats[] = {SAMPLE_U8, SAMPLE_S16, SAMPLE_S24_3, SAMPLE_S24, SAMPLE_S32, SAMPLE_FLOAT};
+    const int channel_counts[] = {1, 2, 3};
+    const int frames = 4096;
+    const int max_channels = 3;
+    audio_block_t planar = {0};
+    unsigned char *pcm = (unsigned char *)malloc((size_t)frames * max_channels * 4);
+    unsigned char *back = (unsigned char *)malloc((size_t)frames * max_channels * 4);
+    if (!pcm || !back || !audio_block_reserve(&planar, max_channels, frames)) {
+        fprintf(stderr, "Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("=== Sample format conversion (ns/sample, to float / from float) ===\n");
+    printf("%8s %10s %14s %14s %14s\n", "format", "roundtrip", "mono", "stereo", "3ch");
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        sample_format_t format = formats[f];
+        int bytes = sample_format_bytes(format);
+        unsigned int seed = 31337u;
+        for (int i = 0; i < frames * max_channels * bytes; i++) {
+            pcm[i] = (unsigned char)(bench_random(&seed) * 127.0f + 128.0f);
+        }
+        if (format == SAMPLE_S24) {
+            // 24位放在32位容器的低位，高字节是符号扩展
+            for (int i = 0; i < frames * max_channels; i++) {
+                pcm[i * 4 + 3] = (pcm[i * 4 + 2] & 0x80) ? 0xFF : 0x00;
+            }
+        } else if (format == SAMPLE_FLOAT) {
+            float *samples = (float *)pcm;
+            for (int i = 0; i < frames * max_channels; i++) {
+                samples[i] = bench_random(&seed);
+            }
+        }
+
+        pcm_to_float(pcm, format, max_channels, frames, planar.channel);
+        float_to_pcm(planar.channel, max_channels, frames, format, back, NULL);
+        bool exact = memcmp(pcm, back, (size_t)frames * max_channels * bytes) == 0;
+        printf("%8s %10s", sample_format_name(format), exact ? "exact" : "LOSSY");
+
+        for (size_t c = 0; c < sizeof(channel_counts) / sizeof(channel_counts[0]); c++) {
+            int channels = channel_counts[c];
+            int iterations = 2000;
+            double t0 = now_seconds();
+            for (int it = 0; it < iterations; it++) {
+                pcm_to_float(pcm, format, channels, frames, planar.channel);
+            }
+            double to_ns = (now_seconds() - t0) * 1e9 / ((double)iterations * frames * channels);
+            t0 = now_seconds();
+            for (int it = 0; it < iterations; it++) {
+                float_to_pcm(planar.channel, channels, frames, format, back, NULL);
+            }
+            double from_ns = (now_seconds() - t0) * 1e9 / ((double)iterations * frames * channels);
+            printf(" %6.2f / %5.2f", to_ns, from_ns);
+        }
+        printf("\n");
+    }
+
+    // 抖动: 量化恒定的非整数值，统计输出与输入之差
+    for (int i = 0; i < frames; i++) {
+        planar.channel[0][i] = 0.3f / 32768.0f;
+        planar.channel[1][i] = 0.3f / 32768.0f;
+    }
+    uint32_t dither = 1u;
+    double sum = 0.0, sum_sq = 0.0;
+    long count = 0;
+    for (int it = 0; it < 256; it++) {
+        float_to_pcm(planar.channel, 2, frames, SAMPLE_S16, back, &dither);
+        const short *q = (const short *)back;
+        for (int i = 0; i < frames * 2; i++) {
+            double e = q[i] - 0.3;
+            sum += e;
+            sum_sq += e * e;
+            count++;
+        }
+    }
+    double mean = sum / count;
+    printf("TPDF dither (S16): error mean %.4f LSB, RMS %.3f LSB\n", mean, sqrt(sum_sq / count));
+
+    // 软件音量: 合并进定标的增益过渡 (SIMD 主体 + 标量尾部) 与逐样本的双精度参考比较，
+    // 再比较带过渡和不带增益的转换耗时
+    unsigned int gain_seed = 4242u;
+    for (int i = 0; i < frames; i++) {
+        planar.channel[0][i] = bench_random(&gain_seed) * 0.9f;
+        planar.channel[1][i] = bench_random(&gain_seed) * 0.9f;
+    }
+    int ramp_frames = frames - 3; // 不是 4 的倍数，覆盖标量尾部
+    float gain = 1.0f, gain_step = (0.25f - 1.0f) / ramp_frames;
+    int max_error = 0;
+    for (int channels = 1; channels <= 2; channels++) {
+        float_to_pcm_gain(planar.channel, channels, ramp_frames, SAMPLE_S16, back, NULL, gain, gain_step);
+        const short *q = (const short *)back;
+        for (int i = 0; i < ramp_frames; i++) {
+            for (int ch = 0; ch < channels; ch++) {
+                double expect = (double)planar.channel[ch][i] * (gain + (double)gain_step * i) * 32768.0;
+                int error = abs(q[i * channels + ch] - (int)lrint(expect));
+                if (error > max_error) {
+                    max_error = error;
+                }
+            }
+        }
+    }
+    int iterations = 2000;
+    double t0 = now_seconds();
+    for (int it = 0; it < iterations; it++) {
+        float_to_pcm(planar.channel, 2, frames, SAMPLE_S16, back, NULL);
+    }
+    double plain_ns = (now_seconds() - t0) * 1e9 / ((double)iterations * frames * 2);
+    t0 = now_seconds();
+    for (int it = 0; it < iterations; it++) {
+        float_to_pcm_gain(planar.channel, 2, frames, SAMPLE_S16, back, NULL, gain, gain_step);
+    }
+    double ramp_ns = (now_seconds() - t0) * 1e9 / ((double)iterations * frames * 2);
+    printf("Software gain ramp (S16): max error %d LSB %s, %.2f ns/sample (without gain %.2f)\n\n",
+           max_error, max_error <= 1 ? "ok" : "FAIL", ramp_ns, plain_ns);
+
+    audio_block_free(&planar);
+    free(pcm); free(back);
+}
+
+// 处理链执行器: 原地增益节点，测量旁路切换/插入/移除时的最大相邻样本跳变和每块的调度开销
+static audio_block_t *bench_gain_process(dsp_node_t *node, audio_block_t *input) {
+    (void)node;
+    for (int ch = 0; ch < input->channels; ch++) {
+        for (int i = 0; i < input->frames; i++) {
+            input->channel[ch][i] *= 0.5f;
+        }
+    }
+    return input;
+}
+
+static double bench_graph_max_step(dsp_graph_t *graph, audio_block_t *block, int blocks, void (*action)(dsp_graph_t *)) {
+    double max_step = 0.0;
+    float prev = 0.0f;
+    for (int b = 0; b < blocks; b++) {
+        if (b == blocks / 2) {
+            action(graph);
+        }
+        for (int ch = 0; ch < block->channels; ch++) {
+            for (int i = 0; i < 4096; i++) {
+                block->channel[ch][i] = 0.5f;
+            }
+        }
+        block->frames = 128;
+        bool modified;
+        audio_block_t *out = dsp_graph_process(graph, block, &modified);
+        for (int i = 0; i < out->frames; i++) {
+            double d = fabs((double)out->channel[0][i] - prev) * 32768.0;
+            if (b > 0 && d > max_step) max_step = d;
+            prev = out->channel[0][i];
+        }
+    }
+    return max_step;
+}
+
+static const dsp_node_ops_t bench_gain_ops = {
+    .name = "gain", .process = bench_gain_process, .same_length = true, .auto_bypass = false
+};
+static dsp_node_t bench_gain_node = {.ops = &bench_gain_ops};
+static void bench_graph_bypass(dsp_graph_t *g) { (void)g; dsp_node_set_bypass(&bench_gain_node, true); }
+static void bench_graph_enable(dsp_graph_t *g) { (void)g; dsp_node_set_bypass(&bench_gain_node, false); }
+static void bench_graph_remove(dsp_graph_t *g) { dsp_graph_remove(g, &bench_gain_node); }
+static void bench_graph_insert(dsp_graph_t *g) { dsp_graph_insert(g, 0, &bench_gain_node); }
+
+static void bench_dsp_graph() {
+    const int channels = 2;
+    dsp_graph_t graph;
+    dsp_graph_init(&graph);
+    audio_block_t block = {0};
+    if (!audio_block_reserve(&block, channels, 4096) || !audio_block_reserve(&graph.dry, channels, 4096)) {
+        fprintf(stderr, "Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // 0.5 的直流: 增益节点在 0.25 和 0.5 之间切换，直接切换的跳变是 8192 LSB
+    printf("=== DSP graph (0.5 DC, 128-frame blocks, %d-frame fades) ===\n", DSP_BYPASS_FADE_FRAMES);
+    dsp_graph_insert(&graph, 0, &bench_gain_node);
+    dsp_graph_reset(&graph);
+    printf("bypass: max step %.1f LSB\n", bench_graph_max_step(&graph, &block, 16, bench_graph_bypass));
+    printf("enable: max step %.1f LSB\n", bench_graph_max_step(&graph, &block, 16, bench_graph_enable));
+    double remove_step = bench_graph_max_step(&graph, &block, 16, bench_graph_remove);
+    printf("remove: max step %.1f LSB, nodes left %d\n", remove_step, graph.count);
+    printf("insert: max step %.1f LSB\n", bench_graph_max_step(&graph, &block, 16, bench_graph_insert));
+
+    // 块比干信号块长时不能淡化，旁路必须在这一块直接生效
+    int dry_capacity = graph.dry.capacity;
+    graph.dry.capacity = 64;
+    dsp_node_set_bypass(&bench_gain_node, true);
+    for (int ch = 0; ch < channels; ch++) {
+        for (int i = 0; i < 128; i++) {
+            block.channel[ch][i] = 0.5f;
+        }
+    }
+    block.frames = 128;
+    bool oversize_modified;
+    audio_block_t *oversize = dsp_graph_process(&graph, &block, &oversize_modified);
+    bool oversize_dry = oversize->channel[0][0] == 0.5f && oversize->channel[0][127] == 0.5f;
+    printf("oversize bypass: %s (fade left %d)\n", oversize_dry ? "ok" : "FAIL", bench_gain_node.fade_remaining);
+    graph.dry.capacity = dry_capacity;
+    dsp_node_set_bypass(&bench_gain_node, false);
+
+    // 调度开销: 经执行器处理与直接调用同一个节点的耗时之差 (全零输入，避免反复减半进入非规格化数)
+    dsp_graph_reset(&graph);
+    for (int ch = 0; ch < channels; ch++) {
+        memset(block.channel[ch], 0, 4096 * sizeof(float));
+    }
+    block.frames = 1024;
+    int iterations = 200000;
+    for (int it = 0; it < iterations; it++) {
+        bench_gain_process(&bench_gain_node, &block); // 预热
+    }
+    double t0 = now_seconds();
+    for (int it = 0; it < iterations; it++) {
+        bench_gain_process(&bench_gain_node, &block);
+    }
+    double direct_ns = (now_seconds() - t0) * 1e9 / iterations;
+    t0 = now_seconds();
+    for (int it = 0; it < iterations; it++) {
+        bool modified;
+        dsp_graph_process(&graph, &block, &modified);
+    }
+    double graph_ns = (now_seconds() - t0) * 1e9 / iterations;
+    printf("1024-frame stereo block: graph %.0f ns, direct call %.0f ns\n\n", graph_ns, direct_ns);
+
+    audio_block_free(&block);
+    audio_block_free(&graph.dry);
+    pthread_mutex_destroy(&graph.lock);
+}
+
+// 流式时间拉伸的稳态CPU开销: 立体声 44.1/48 kHz，各速度下处理 30 秒信号
+// 同时检查输出/输入帧数比是否等于 1/speed，以及 1 kHz 正弦的音调是否保持
+static void bench_time_stretch(stretch_mode_t mode) {
+    const unsigned int rates[] = {44100, 48000};
+    const float speeds[] = {0.25f, 0.5f, 0.75f, 1.5f, 2.0f, 4.0f};
+    const int num_speeds = sizeof(speeds) / sizeof(speeds[0]);
+    const int channels = 2;
+    const int block_frames = 6144;
+
+    printf("=== %s (stereo, 30 s input) ===\n", mode == STRETCH_WSOLA ? "WSOLA" : "Phase vocoder");
+    printf("%7s %6s %12s %10s %12s %10s\n", "rate", "speed", "ns/in-frame", "CPU %RT", "out/in*spd", "pitch Hz");
+
+    for (int r = 0; r < 2; r++) {
+        unsigned int sr = rates[r];
+        int total_frames_in = (int)sr * 30;
+        audio_block_t input = {0}, output = {0};
+        bool allocated = audio_block_reserve(&input, channels, block_frames) &&
+                         audio_block_reserve(&output, channels, block_frames * 8);
+        for (int s_idx = 0; s_idx < num_speeds; s_idx++) {
+            float speed = speeds[s_idx];
+            phase_vocoder_t *pv = NULL;
+            wsola_t *wsola = NULL;
+            if (mode == STRETCH_WSOLA) {
+                wsola = wsola_create(channels, sr, block_frames);
+            } else {
+                pv = phase_vocoder_create(channels, sr, block_frames);
+            }
+            if ((pv == NULL && wsola == NULL) || !allocated) {
+                fprintf(stderr, "Allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+
+            // 慢速时和播放器一样按比例减少每块输入
+            int in_block = speed < 1.0f ? (int)(block_frames * speed) : block_frames;
+            long frames_in = 0, frames_out = 0;
+            long crossings = 0, measured_frames = 0;
+            float prev = 0.0f;
+            double t0 = now_seconds();
+            while (frames_in < total_frames_in) {
+                for (int i = 0; i < in_block; i++) {
+                    float v = (float)(0.37 * sin(2.0 * M_PI * 1000.0 * (frames_in + i) / sr));
+                    input.channel[0][i] = v;
+                    input.channel[1][i] = v;
+                }
+                int produced = wsola != NULL
+                    ? wsola_process(wsola, input.channel, in_block, output.channel, block_frames * 8, speed)
+                    : phase_vocoder_process(pv, input.channel, in_block, output.channel, block_frames * 8, speed);
+                // 越过启动阶段后统计过零次数
+                if (frames_out > (long)sr) {
+                    for (int i = 0; i < produced; i++) {
+                        float v = output.channel[0][i];
+                        if (prev < 0 && v >= 0) crossings++;
+                        prev = v;
+                    }
+                    measured_frames += produced;
+                }
+                frames_in += in_block;
+                frames_out += produced;
+            }
+            double elapsed = now_seconds() - t0;
+            double audio_seconds = (double)frames_in / sr;
+
+            printf("%7u %5.2fx %12.1f %9.2f%% %12.3f %10.1f\n", sr, speed,
+                   elapsed * 1e9 / frames_in, elapsed / audio_seconds * 100.0,
+                   (double)frames_out / frames_in * speed,
+                   measured_frames > 0 ? (double)crossings * sr / measured_frames : 0.0);
+            phase_vocoder_destroy(pv);
+            wsola_destroy(wsola);
+        }
+        audio_block_free(&input);
+        audio_block_free(&output);
+    }
+    printf("\n");
+}
+
+// 分区卷积: 与直接型卷积比较精度 (扣除 B 帧延迟)，并测量立体声稳态开销
+static void bench_convolution() {
+    const int lengths[] = {1024, 8192, 65536, 262144};
+    const int channels = 2;
+    const unsigned int sr = 48000;
+    const int block_frames = 4096;
+    const int check_frames = 2048;
+
+    printf("=== Partitioned convolution (stereo, B=%d) ===\n", CONV_BLOCK_SIZE);
+    printf("%8s %11s %12s %10s %12s\n", "taps", "partitions", "ns/frame", "CPU %RT", "max err LSB");
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        int taps_len = lengths[l];
+        float *taps = (float *)malloc((size_t)taps_len * sizeof(float));
+        audio_block_t input = {0}, output = {0};
+        if (!taps || !audio_block_reserve(&input, channels, block_frames) ||
+            !audio_block_reserve(&output, channels, block_frames)) {
+            fprintf(stderr, "Allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // 指数衰减噪声，能量归一化，模拟房间冲激响应
+        unsigned int seed = 4242u + taps_len;
+        double energy = 0.0;
+        for (int i = 0; i < taps_len; i++) {
+            taps[i] = bench_random(&seed) * expf(-6.0f * i / taps_len);
+            energy += (double)taps[i] * taps[i];
+        }
+        for (int i = 0; i < taps_len; i++) {
+            taps[i] = (float)(taps[i] / sqrt(energy));
+        }
+        conv_ir_t *ir = conv_ir_create(taps, taps_len, 1, sr);
+        convolver_t *conv = convolver_create(ir, channels);
+        if (!ir || !conv) {
+            fprintf(stderr, "Allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // 精度: 输入是一次性的随机块，检查延迟后的前 check_frames 帧
+        for (int ch = 0; ch < channels; ch++) {
+            for (int i = 0; i < block_frames; i++) {
+                input.channel[ch][i] = bench_random(&seed) * 0.18f;
+            }
+        }
+        convolver_process(conv, input.channel, output.channel, block_frames);
+        // 误差按16位输出的 LSB 计
+        double max_err = 0.0;
+        for (int n = CONV_BLOCK_SIZE; n < CONV_BLOCK_SIZE + check_frames; n++) {
+            int m = n - CONV_BLOCK_SIZE;
+            double ref = 0.0;
+            for (int k = 0; k <= m && k < taps_len; k++) {
+                ref += (double)taps[k] * input.channel[0][m - k];
+            }
+            double err = fabs(output.channel[0][n] - ref) * 32768.0;
+            if (err > max_err) max_err = err;
+        }
+
+        long total_frames = (long)sr * 10;
+        double t0 = now_seconds();
+        for (long done = 0; done < total_frames; done += block_frames) {
+            convolver_process(conv, input.channel, output.channel, block_frames);
+        }
+        double elapsed = now_seconds() - t0;
+
+        printf("%8d %11d %12.1f %9.2f%% %12.2f\n", taps_len, ir->partitions,
+               elapsed * 1e9 / total_frames, elapsed / ((double)total_frames / sr) * 100.0, max_err);
+
+        convolver_destroy(conv);
+        conv_ir_destroy(ir);
+        free(taps);
+        audio_block_free(&input);
+        audio_block_free(&output);
+    }
+    printf("\n");
+}
+
+// |H(e^jw)| 的各频段乘积，单位 dB
+static double biquad_response_db(const biquad_coeffs_t *c, int bands, double freq, unsigned int sr) {
+    double w = 2.0 * M_PI * freq / sr;
+    double mag = 1.0;
+    for (int b = 0; b < bands; b++) {
+        double nr = c[b].b0 + c[b].b1 * cos(w) + c[b].b2 * cos(2 * w);
+        double ni = -c[b].b1 * sin(w) - c[b].b2 * sin(2 * w);
+        double dr = 1.0 + c[b].a1 * cos(w) + c[b].a2 * cos(2 * w);
+        double di = -c[b].a1 * sin(w) - c[b].a2 * sin(2 * w);
+        mag *= sqrt((nr * nr + ni * ni) / (dr * dr + di * di));
+    }
+    return 20.0 * log10(mag);
+}
+
+// 双二阶参数均衡器: 各预设的频响、与 FIR 的吞吐量对比、切换模式时的最大相邻样本跳变
+static void bench_biquad() {
+    const unsigned int sr = 44100;
+    const double freqs[] = {60, 150, 500, 1500, 3000, 6000, 12000};
+    const char *names[] = {"normal", "bass", "treble", "vocal"};
+    const int channels = 2;
+    const int frames = 4096;
+
+    printf("=== Biquad EQ response (dB, %u Hz) ===\n%8s", sr, "mode");
+    for (size_t f = 0; f < sizeof(freqs) / sizeof(freqs[0]); f++) {
+        printf(" %7.0f", freqs[f]);
+    }
+    printf("\n");
+    biquad_eq_t eq;
+    for (int m = EQ_NORMAL; m <= EQ_VOCAL_ENHANCE; m++) {
+        biquad_eq_init(&eq);
+        biquad_eq_set_mode(&eq, (equalizer_mode_t)m, sr);
+        printf("%8s", names[m]);
+        for (size_t f = 0; f < sizeof(freqs) / sizeof(freqs[0]); f++) {
+            printf(" %7.2f", biquad_response_db(eq.target, BIQUAD_MAX_BANDS, freqs[f], sr));
+        }
+        printf("\n");
+    }
+
+    audio_block_t input = {0}, output = {0};
+    if (!audio_block_reserve(&input, channels, frames) || !audio_block_reserve(&output, channels, frames)) {
+        fprintf(stderr, "Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    unsigned int seed = 99u;
+    for (int ch = 0; ch < channels; ch++) {
+        for (int i = 0; i < frames; i++) {
+            input.channel[ch][i] = bench_random(&seed) * 0.25f;
+        }
+    }
+    input.frames = frames;
+
+    // 两个引擎都按播放器的实际路径计时: 平面 float 输入到平面 float 输出
+    int iterations = 2000;
+    biquad_eq_init(&eq);
+    biquad_eq_set_mode(&eq, EQ_VOCAL_ENHANCE, sr);
+    biquad_eq_process(&eq, input.channel, output.channel, frames, channels); // 越过过渡期
+    double t0 = now_seconds();
+    for (int it = 0; it < iterations; it++) {
+        biquad_eq_process(&eq, input.channel, output.channel, frames, channels);
+    }
+    double biquad_ns = (now_seconds() - t0) * 1e9 / ((double)iterations * frames * channels);
+    printf("ns/sample (stereo, vocal): biquad x%d %.2f", BIQUAD_MAX_BANDS, biquad_ns);
+
+    wav_header.num_channels = channels;
+    wav_header.sample_rate = sr;
+    current_eq_engine = EQ_ENGINE_FIR;
+    const char *fir_kernels[] = {"scalar", fir_select_kernel("auto")};
+    for (int k = 0; k < 2; k++) {
+        fir_select_kernel(fir_kernels[k]);
+        t0 = now_seconds();
+        for (int it = 0; it < iterations; it++) {
+            apply_fir_filter(&input, &output, EQ_VOCAL_ENHANCE);
+        }
+        double fir_ns = (now_seconds() - t0) * 1e9 / ((double)iterations * frames * channels);
+        printf(", FIR %s %.2f", fir_kernel_name, fir_ns);
+    }
+    printf("\n");
+    fir_select_kernel("auto");
+
+    // 低频正弦上从 bass 切到 vocal: 比较线性过渡与直接替换系数时的最大相邻样本差
+    // (60 Hz 处两种预设的增益差最大，稳态的最大差值约为 2πf/sr * 振幅；按16位 LSB 报告)
+    const int tone_frames = sr / 2;
+    float *tone = (float *)malloc((size_t)tone_frames * sizeof(float));
+    float *tone_out = (float *)malloc((size_t)tone_frames * sizeof(float));
+    for (int i = 0; i < tone_frames; i++) {
+        tone[i] = (float)(0.25 * sin(2.0 * M_PI * 60.0 * i / sr));
+    }
+    for (int ramped = 1; ramped >= 0; ramped--) {
+        float *first_in[1] = {tone}, *first_out[1] = {tone_out};
+        float *second_in[1] = {tone + tone_frames / 2}, *second_out[1] = {tone_out + tone_frames / 2};
+        biquad_eq_init(&eq);
+        biquad_eq_set_mode(&eq, EQ_BASS_BOOST, sr);
+        biquad_eq_process(&eq, first_in, first_out, tone_frames / 2, 1);
+        biquad_eq_set_mode(&eq, EQ_VOCAL_ENHANCE, sr);
+        if (!ramped) {
+            memcpy(eq.current, eq.target, sizeof(eq.current));
+            eq.ramp_remaining = 0;
+        }
+        biquad_eq_process(&eq, second_in, second_out, tone_frames / 2, 1);
+        double max_step = 0.0;
+        for (int i = tone_frames / 2; i < tone_frames / 2 + (int)sr / 20; i++) {
+            double d = fabs((double)tone_out[i] - tone_out[i - 1]) * 32768.0;
+            if (d > max_step) max_step = d;
+        }
+        printf("bass->vocal on 60 Hz tone, %-19s max |x[n]-x[n-1]| = %.0f LSB\n",
+               ramped ? "ramped coefficients:" : "instant switch:", max_step);
+    }
+    printf("\n");
+
+    audio_block_free(&input);
+    audio_block_free(&output);
+    free(tone); free(tone_out);
+}
+
+// 限幅器: +6 dB 的随机信号和正弦过后峰值必须不超过上限，低于上限的信号原样延迟输出
+static void bench_limiter() {
+    const unsigned int sr = 44100;
+    const int channels = 2;
+    const int frames = 4096;
+    const int blocks = 200;
+    const float ceiling = powf(10.0f, DEFAULT_LIMITER_CEILING_DB / 20.0f);
+
+    printf("=== Look-ahead limiter (%.1f ms, ceiling %.1f dBFS) ===\n", LIMITER_LOOKAHEAD_MS, DEFAULT_LIMITER_CEILING_DB);
+    limiter_t *l = limiter_create(channels, sr, frames, DEFAULT_LIMITER_CEILING_DB);
+    audio_block_t block = {0};
+    if (l == NULL || !audio_block_reserve(&block, channels, frames)) {
+        fprintf(stderr, "Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    const char *inputs[] = {"noise x2", "sine x2", "sine x0.5"};
+    for (int k = 0; k < 3; k++) {
+        limiter_reset(l);
+        unsigned int seed = 7u;
+        float peak = 0.0f;
+        double max_error = 0.0, elapsed = 0.0;
+        long limited = 0, n = 0;
+        for (int b = 0; b < blocks; b++) {
+            for (int i = 0; i < frames; i++, n++) {
+                for (int ch = 0; ch < channels; ch++) {
+                    float x = k == 0 ? bench_random(&seed) : (float)sin(2.0 * M_PI * 997.0 * n / sr + ch);
+                    block.channel[ch][i] = x * (k == 2 ? 0.5f : 2.0f);
+                }
+            }
+            double t0 = now_seconds();
+            limited += limiter_process(l, block.channel, frames);
+            elapsed += now_seconds() - t0;
+            for (int ch = 0; ch < channels; ch++) {
+                for (int i = 0; i < frames; i++) {
+                    peak = fmaxf(peak, fabsf(block.channel[ch][i]));
+                    if (k == 2 && n - frames + i >= l->lookahead) {
+                        // 未触发限幅时输出就是延迟 L 帧的输入
+                        long m = n - frames + i - l->lookahead;
+                        double ref = 0.5 * sin(2.0 * M_PI * 997.0 * m / sr + ch);
+                        max_error = fmax(max_error, fabs(block.channel[ch][i] - ref));
+                    }
+                }
+            }
+        }
+        printf("%-10s peak %7.3f dBFS%s, limited %5.1f%% of frames, %.2f ns/frame",
+               inputs[k], 20.0 * log10(peak), peak <= ceiling ? "" : " OVER CEILING",
+               100.0 * limited / ((double)blocks * frames), elapsed * 1e9 / ((double)blocks * frames));
+        if (k == 2) {
+            printf(", max |error| vs delayed input %.2e", max_error);
+        }
+        printf("\n");
+    }
+    printf("\n");
+    audio_block_free(&block);
+    limiter_destroy(l);
+}
+
+// 以 freq 正弦 (幅度 amplitude) 为参考做最小二乘拟合，返回拟合残差相对信号的比值 (dB)；
+// 拟合同时吸收了重采样器的延迟和相位，不需要另外对齐
+static double sine_fit_snr_db(const float *x, int n, double freq, unsigned int sr) {
+    double ss = 0, cc = 0, sc = 0, xs = 0, xc = 0;
+    for (int i = 0; i < n; i++) {
+        double w = 2.0 * M_PI * freq * i / sr;
+        double s = sin(w), c = cos(w), v = x[i];
+        ss += s * s; cc += c * c; sc += s * c; xs += v * s; xc += v * c;
+    }
+    double det = ss * cc - sc * sc;
+    double a = (xs * cc - xc * sc) / det;
+    double b = (xc * ss - xs * sc) / det;
+    double signal = 0, noise = 0;
+    for (int i = 0; i < n; i++) {
+        double w = 2.0 * M_PI * freq * i / sr;
+        double fit = a * sin(w) + b * cos(w);
+        double e = x[i] - fit;
+        signal += fit * fit;
+        noise += e * e;
+    }
+    return 10.0 * log10(signal / (noise + 1e-9));
+}
+
+// 把 seconds 秒的 freq 正弦按播放器的块大小送入重采样器，返回输出帧数和耗时
+static int bench_resample_tone(resampler_t *r, double freq, double seconds, audio_block_t *out, double *elapsed) {
+    const int block = 4096;
+    int channels = r->channels;
+    audio_block_t input = {0};
+    audio_block_reserve(&input, channels, block);
+    int total_in = (int)(seconds * r->in_rate);
+    int produced = 0;
+    double t = 0.0;
+    for (int start = 0; start < total_in; start += block) {
+        int n = total_in - start < block ? total_in - start : block;
+        for (int i = 0; i < n; i++) {
+            float v = (float)(0.5 * sin(2.0 * M_PI * freq * (start + i) / r->in_rate));
+            for (int ch = 0; ch < channels; ch++) {
+                input.channel[ch][i] = v;
+            }
+        }
+        float *dst[FIR_MAX_CHANNELS];
+        for (int ch = 0; ch < channels; ch++) {
+            dst[ch] = out->channel[ch] + produced;
+        }
+        double t0 = now_seconds();
+        produced += resampler_process(r, input.channel, n, dst, out->capacity - produced);
+        t += now_seconds() - t0;
+    }
+    audio_block_free(&input);
+    *elapsed = t;
+    return produced;
+}
+
+// 采样率转换: 各档位在常见比例下的开销、1 kHz 正弦的 SNR，降采样时输出奈奎斯特以上音调的残留
+static void bench_resampler() {
+    const unsigned int ratios[][2] = {{44100, 48000}, {48000, 44100}, {44100, 88200}, {88200, 44100}, {8000, 44100}};
+    const char *quality_names[] = {"off", "fast", "medium", "high"};
+    const int channels = 2;
+    const double seconds = 4.0;
+
+    printf("=== Resampler (stereo, 1 kHz tone, %.0f s) ===\n", seconds);
+    printf("%15s %7s %6s %10s %8s %10s %9s\n", "ratio", "quality", "path", "ns/frame", "%RT", "SNR dB", "alias dB");
+    for (size_t k = 0; k < sizeof(ratios) / sizeof(ratios[0]); k++) {
+        unsigned int in_rate = ratios[k][0], out_rate = ratios[k][1];
+        audio_block_t out = {0};
+        if (!audio_block_reserve(&out, channels, (int)(seconds * out_rate) + 8192)) {
+            fprintf(stderr, "Allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int q = SRC_FAST; q <= SRC_HIGH; q++) {
+            resampler_t *r = resampler_create(in_rate, out_rate, channels, (src_quality_t)q);
+            double elapsed;
+            int produced = bench_resample_tone(r, 1000.0, seconds, &out, &elapsed);
+            int expected = (int)(seconds * out_rate);
+            if (abs(produced - expected) > r->taps) {
+                printf("  WARNING: %d frames out, expected about %d\n", produced, expected);
+            }
+            // 跳过开头的滤波器延迟
+            int skip = r->taps * (int)(out_rate / in_rate + 1);
+            double snr = sine_fit_snr_db(out.channel[0] + skip, produced - skip, 1000.0, out_rate);
+
+            // 降采样: 输入端在输出奈奎斯特频率以上 5% 处的音调应被滤除
+            char alias[16] = "-";
+            if (out_rate < in_rate) {
+                resampler_reset(r);
+                double t_unused;
+                double tone = 0.5 * out_rate * 1.05;
+                int n = bench_resample_tone(r, tone, 1.0, &out, &t_unused);
+                double energy = 0;
+                for (int i = skip; i < n; i++) {
+                    energy += (double)out.channel[0][i] * out.channel[0][i];
+                }
+                double rms = sqrt(energy / (n - skip) + 1e-30);
+                snprintf(alias, sizeof(alias), "%.1f", 20.0 * log10(rms / (0.5 / sqrt(2.0))));
+            }
+
+            char ratio[32];
+            snprintf(ratio, sizeof(ratio), "%u->%u", in_rate, out_rate);
+            printf("%15s %7s %6s %10.2f %8.3f %10.1f %9s\n", ratio, quality_names[q], r->exact ? "exact" : "interp",
+                   elapsed * 1e9 / produced, 100.0 * elapsed / seconds, snr, alias);
+            resampler_destroy(r);
+        }
+        audio_block_free(&out);
+    }
+
+    // 无法约分到精确相位表的比例走插值路径
+    resampler_t *r = resampler_create(44100, 47999, channels, SRC_MEDIUM);
+    audio_block_t out = {0};
+    audio_block_reserve(&out, channels, (int)(seconds * 47999) + 8192);
+    double elapsed;
+    int produced = bench_resample_tone(r, 1000.0, seconds, &out, &elapsed);
+    int skip = r->taps * 2;
+    printf("%15s %7s %6s %10.2f %8.3f %10.1f %9s\n", "44100->47999", "medium", r->exact ? "exact" : "interp",
+           elapsed * 1e9 / produced, 100.0 * elapsed / seconds,
+           sine_fit_snr_db(out.channel[0] + skip, produced - skip, 1000.0, 47999), "-");
+    audio_block_free(&out);
+    resampler_destroy(r);
+    printf("\n");
+}
+
+// --- 合成信号矩阵 ---
+// 信号 x 采样率 x 声道数 x 位深，每种组合按播放器的块大小跑一遍格式转换、FFT、FIR、两种时间拉伸
+// 和重采样，报告各内核的 ns/样本，以及第一块之后 (稳态) 的分配次数，正常应为 0
+#define MATRIX_SECONDS 1.0
+#define MATRIX_BLOCK 4096
+
+enum { MK_CONVERT = 0, MK_FFT, MK_FIR, MK_WSOLA, MK_PV, MK_SRC, MK_COUNT };
+
+static unsigned int matrix_src_target(unsigned int rate) {
+    return rate == 44100 ? 48000 : 44100;
+}
+
+static void bench_signal_matrix() {
+    const unsigned int rates[] = {44100, 48000, 96000};
+    const int channel_counts[] = {1, 2, 6};
+    const sample_format_t formats[] = {SAMPLE_S16, SAMPLE_S24_3, SAMPLE_S32};
+    const int max_channels = 6;
+
+    printf("=== Signal matrix (%.0f s each, %d-frame blocks, ns/sample; allocs after the first block) ===\n",
+           MATRIX_SECONDS, MATRIX_BLOCK);
+    printf("%9s %6s %3s %7s %8s %6s %6s %6s %6s %6s %7s\n", "signal", "rate", "ch", "format",
+           "convert", "fft", "fir", "wsola", "pv", "src", "allocs");
+
+    fft_plan_t *plan = fft_plan_create(MATRIX_BLOCK);
+    Complex *spectrum = (Complex *)malloc((MATRIX_BLOCK / 2 + 1) * sizeof(Complex));
+    audio_block_t in = {0}, fir_out = {0}, stretch_out = {0}, src_out = {0};
+    unsigned char *pcm_out = (unsigned char *)malloc((size_t)MATRIX_BLOCK * max_channels * 4);
+    if (!plan || !spectrum || !pcm_out || !audio_block_reserve(&in, max_channels, MATRIX_BLOCK) ||
+        !audio_block_reserve(&fir_out, max_channels, MATRIX_BLOCK) ||
+        !audio_block_reserve(&stretch_out, max_channels, MATRIX_BLOCK * 2) ||
+        !audio_block_reserve(&src_out, max_channels, MATRIX_BLOCK * 3)) {
+        fprintf(stderr, "Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    current_eq_engine = EQ_ENGINE_FIR;
+
+    for (int sig = 0; sig < NUM_SIGNALS; sig++) {
+        for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+            unsigned int rate = rates[r];
+            int total = (int)(MATRIX_SECONDS * rate);
+            for (size_t c = 0; c < sizeof(channel_counts) / sizeof(channel_counts[0]); c++) {
+                int channels = channel_counts[c];
+                // 生成一次浮点信号 (不计时)，再按各位深量化成交错 PCM
+                audio_block_t signal = {0};
+                unsigned char *pcm = (unsigned char *)malloc((size_t)total * channels * 4);
+                if (!pcm || !audio_block_reserve(&signal, channels, total)) {
+                    fprintf(stderr, "Allocation failed\n");
+                    exit(EXIT_FAILURE);
+                }
+                for (int ch = 0; ch < channels; ch++) {
+                    for (int i = 0; i < total; i++) {
+                        signal.channel[ch][i] = (float)test_signal_value((test_signal_t)sig, i, ch, rate);
+                    }
+                }
+
+                for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+                    sample_format_t format = formats[f];
+                    float_to_pcm(signal.channel, channels, total, format, pcm, NULL);
+
+                    wav_header.num_channels = channels;
+                    wav_header.sample_rate = rate;
+                    reset_fir_state();
+                    wsola_t *wsola = wsola_create(channels, rate, MATRIX_BLOCK);
+                    phase_vocoder_t *pv = phase_vocoder_create(channels, rate, MATRIX_BLOCK);
+                    resampler_t *src = resampler_create(rate, matrix_src_target(rate), channels, SRC_MEDIUM);
+                    if (!wsola || !pv || !src) {
+                        fprintf(stderr, "Allocation failed\n");
+                        exit(EXIT_FAILURE);
+                    }
+
+                    double elapsed[MK_COUNT] = {0};
+                    long allocs = 0;
+                    int bytes = sample_format_bytes(format);
+                    for (int start = 0; start < total; start += MATRIX_BLOCK) {
+                        int n = total - start < MATRIX_BLOCK ? total - start : MATRIX_BLOCK;
+                        long allocs_before = bench_allocations;
+
+                        double t0 = now_seconds();
+                        pcm_to_float(pcm + (size_t)start * channels * bytes, format, channels, n, in.channel);
+                        in.channels = channels;
+                        in.frames = n;
+                        double t1 = now_seconds();
+                        if (n == MATRIX_BLOCK) {
+                            for (int ch = 0; ch < channels; ch++) {
+                                fft_real_forward(plan, in.channel[ch], spectrum);
+                            }
+                        }
+                        double t2 = now_seconds();
+                        apply_fir_filter(&in, &fir_out, EQ_BASS_BOOST);
+                        double t3 = now_seconds();
+                        wsola_process(wsola, in.channel, n, stretch_out.channel, stretch_out.capacity, 1.25f);
+                        double t4 = now_seconds();
+                        phase_vocoder_process(pv, in.channel, n, stretch_out.channel, stretch_out.capacity, 1.25f);
+                        double t5 = now_seconds();
+                        resampler_process(src, in.channel, n, src_out.channel, src_out.capacity);
+                        double t6 = now_seconds();
+                        float_to_pcm(fir_out.channel, channels, n, format, pcm_out, NULL);
+                        double t7 = now_seconds();
+
+                        elapsed[MK_CONVERT] += (t1 - t0) + (t7 - t6);
+                        elapsed[MK_FFT] += t2 - t1;
+                        elapsed[MK_FIR] += t3 - t2;
+                        elapsed[MK_WSOLA] += t4 - t3;
+                        elapsed[MK_PV] += t5 - t4;
+                        elapsed[MK_SRC] += t6 - t5;
+                        if (start > 0) {
+                            allocs += bench_allocations - allocs_before;
+                        }
+                    }
+
+                    double samples = (double)total * channels;
+                    printf("%9s %6u %3d %7s", test_signal_names[sig], rate, channels, sample_format_name(format));
+                    printf(" %8.2f", elapsed[MK_CONVERT] * 1e9 / samples);
+                    for (int k = MK_FFT; k < MK_COUNT; k++) {
+                        printf(" %6.2f", elapsed[k] * 1e9 / samples);
+                    }
+                    printf(" %7ld\n", allocs);
+
+                    wsola_destroy(wsola);
+                    phase_vocoder_destroy(pv);
+                    resampler_destroy(src);
+                }
+                audio_block_free(&signal);
+                free(pcm);
+            }
+        }
+    }
+    printf("\n");
+
+    fft_plan_destroy(plan);
+    free(spectrum);
+    free(pcm_out);
+    audio_block_free(&in);
+    audio_block_free(&fir_out);
+    audio_block_free(&stretch_out);
+    audio_block_free(&src_out);
+}
+
+// --- 参考输出 ---
+// 每个用例把 1 s 立体声合成信号按块送入一个内核，保存声道 0 的一段输出 (跳过启动阶段)；
+// 与目录中的 <name>.f32 (小端 float32) 比较 SNR，低于阈值即判为回归。
+// 浮点舍入的差异 (不同 SIMD 内核、编译器) 在 100 dB 以上；时间拉伸有搜索/相位估计，阈值放宽
+#define GOLDEN_SAMPLES 4096
+#define GOLDEN_OFFSET 8192
+#define GOLDEN_BLOCK 4096
+
+typedef int (*golden_process_fn)(void *ctx, audio_block_t *in, audio_block_t *out);
+
+typedef struct {
+    const char *name;
+    test_signal_t signal;
+    unsigned int rate;
+    double min_snr_db;
+} golden_case_t;
+
+static int golden_fir(void *ctx, audio_block_t *in, audio_block_t *out) {
+    apply_fir_filter(in, out, *(equalizer_mode_t *)ctx);
+    return out->frames;
+}
+
+static int golden_wsola(void *ctx, audio_block_t *in, audio_block_t *out) {
+    return wsola_process((wsola_t *)ctx, in->channel, in->frames, out->channel, out->capacity, 1.5f);
+}
+
+static int golden_pv(void *ctx, audio_block_t *in, audio_block_t *out) {
+    return phase_vocoder_process((phase_vocoder_t *)ctx, in->channel, in->frames, out->channel, out->capacity, 0.75f);
+}
+
+static int golden_src(void *ctx, audio_block_t *in, audio_block_t *out) {
+    return resampler_process((resampler_t *)ctx, in->channel, in->frames, out->channel, out->capacity);
+}
+
+// 把 1 s 信号按块送入 process，收集声道 0 输出中 [GOLDEN_OFFSET, GOLDEN_OFFSET + GOLDEN_SAMPLES) 的部分
+static bool golden_collect(const golden_case_t *gc, golden_process_fn process, void *ctx, float *result) {
+    const int channels = 2;
+    audio_block_t in = {0}, out = {0};
+    if (!audio_block_reserve(&in, channels, GOLDEN_BLOCK) || !audio_block_reserve(&out, channels, GOLDEN_BLOCK * 4)) {
+        return false;
+    }
+    int produced = 0;
+    for (int start = 0; start < (int)gc->rate && produced < GOLDEN_OFFSET + GOLDEN_SAMPLES; start += GOLDEN_BLOCK) {
+        for (int ch = 0; ch < channels; ch++) {
+            for (int i = 0; i < GOLDEN_BLOCK; i++) {
+                in.channel[ch][i] = (float)test_signal_value(gc->signal, start + i, ch, gc->rate);
+            }
+        }
+        in.channels = channels;
+        in.frames = GOLDEN_BLOCK;
+        int n = process(ctx, &in, &out);
+        for (int i = 0; i < n; i++, produced++) {
+            if (produced >= GOLDEN_OFFSET && produced < GOLDEN_OFFSET + GOLDEN_SAMPLES) {
+                result[produced - GOLDEN_OFFSET] = out.channel[0][i];
+            }
+        }
+    }
+    audio_block_free(&in);
+    audio_block_free(&out);
+    return produced >= GOLDEN_OFFSET + GOLDEN_SAMPLES;
+}
+
+// 计算一个用例的当前输出
+static bool golden_render(const golden_case_t *gc, float *result) {
+    wav_header.num_channels = 2;
+    wav_header.sample_rate = gc->rate;
+    if (strncmp(gc->name, "fft_", 4) == 0) {
+        // 4096 点实数 FFT 的前半个频谱 (实部, 虚部交错)
+        fft_plan_t *plan = fft_plan_create(GOLDEN_SAMPLES);
+        float *x = (float *)malloc(GOLDEN_SAMPLES * sizeof(float));
+        Complex *spectrum = (Complex *)malloc((GOLDEN_SAMPLES / 2 + 1) * sizeof(Complex));
+        for (int i = 0; i < GOLDEN_SAMPLES; i++) {
+            x[i] = (float)test_signal_value(gc->signal, GOLDEN_OFFSET + i, 0, gc->rate);
+        }
+        fft_real_forward(plan, x, spectrum);
+        for (int i = 0; i < GOLDEN_SAMPLES / 2; i++) {
+            result[2 * i] = spectrum[i].real;
+            result[2 * i + 1] = spectrum[i].imag;
+        }
+        fft_plan_destroy(plan);
+        free(x);
+        free(spectrum);
+        return true;
+    }
+    if (strncmp(gc->name, "fir_", 4) == 0 || strncmp(gc->name, "biquad_", 7) == 0) {
+        equalizer_mode_t mode = strstr(gc->name, "bass") ? EQ_BASS_BOOST
+                              : strstr(gc->name, "treble") ? EQ_TREBLE_BOOST : EQ_VOCAL_ENHANCE;
+        current_eq_engine = gc->name[0] == 'b' ? EQ_ENGINE_BIQUAD : EQ_ENGINE_FIR;
+        reset_fir_state();
+        biquad_eq_init(&biquad_eq);
+        bool ok = golden_collect(gc, golden_fir, &mode, result);
+        current_eq_engine = EQ_ENGINE_FIR;
+        return ok;
+    }
+    if (strncmp(gc->name, "wsola_", 6) == 0) {
+        wsola_t *w = wsola_create(2, gc->rate, GOLDEN_BLOCK);
+        bool ok = w != NULL && golden_collect(gc, golden_wsola, w, result);
+        wsola_destroy(w);
+        return ok;
+    }
+    if (strncmp(gc->name, "pv_", 3) == 0) {
+        phase_vocoder_t *pv = phase_vocoder_create(2, gc->rate, GOLDEN_BLOCK);
+        bool ok = pv != NULL && golden_collect(gc, golden_pv, pv, result);
+        phase_vocoder_destroy(pv);
+        return ok;
+    }
+    resampler_t *r = resampler_create(gc->rate, matrix_src_target(gc->rate), 2, SRC_MEDIUM);
+    bool ok = r != NULL && golden_collect(gc, golden_src, r, result);
+    resampler_destroy(r);
+    return ok;
+}
+
+// 返回不通过的用例数
+static int bench_golden(const char *dir, bool update) {
+    const golden_case_t cases[] = {
+        {"fft_noise",           SIGNAL_NOISE,     44100, 100.0},
+        {"fir_bass_sweep",      SIGNAL_SWEEP,     44100, 100.0},
+        {"fir_vocal_multitone", SIGNAL_MULTITONE, 44100, 100.0},
+        {"biquad_treble_sweep", SIGNAL_SWEEP,     44100, 100.0},
+        {"wsola_1.5x_multitone", SIGNAL_MULTITONE, 44100, 60.0},
+        {"pv_0.75x_multitone",  SIGNAL_MULTITONE, 44100, 60.0},
+        {"src_44k_48k_sweep",   SIGNAL_SWEEP,     44100, 100.0},
+        {"src_48k_44k_noise",   SIGNAL_NOISE,     48000, 100.0},
+    };
+    float *result = (float *)malloc(GOLDEN_SAMPLES * sizeof(float));
+    float *reference = (float *)malloc(GOLDEN_SAMPLES * sizeof(float));
+    if (!result || !reference) {
+        fprintf(stderr, "Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fir_select_kernel("auto");
+    printf("=== Golden references (%s, %d samples each) ===\n", dir, GOLDEN_SAMPLES);
+    printf("%22s %10s %8s %8s\n", "case", "SNR dB", "min dB", "result");
+    int failures = 0;
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+        const golden_case_t *gc = &cases[k];
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s.f32", dir, gc->name);
+        if (!golden_render(gc, result)) {
+            printf("%22s %10s %8.0f %8s\n", gc->name, "-", gc->min_snr_db, "ERROR");
+            failures++;
+            continue;
+        }
+
+        if (update) {
+            FILE *file = fopen(path, "wb");
+            bool written = file != NULL && fwrite(result, sizeof(float), GOLDEN_SAMPLES, file) == GOLDEN_SAMPLES;
+            if (file) fclose(file);
+            printf("%22s %10s %8.0f %8s\n", gc->name, "-", gc->min_snr_db, written ? "written" : "ERROR");
+            failures += written ? 0 : 1;
+            continue;
+        }
+
+        FILE *file = fopen(path, "rb");
+        size_t got = file ? fread(reference, sizeof(float), GOLDEN_SAMPLES, file) : 0;
+        if (file) fclose(file);
+        if (got != GOLDEN_SAMPLES) {
+            printf("%22s %10s %8.0f %8s\n", gc->name, "-", gc->min_snr_db, "MISSING");
+            failures++;
+            continue;
+        }
+        double signal = 0.0, noise = 0.0;
+        for (int i = 0; i < GOLDEN_SAMPLES; i++) {
+            double e = (double)result[i] - reference[i];
+            signal += (double)reference[i] * reference[i];
+            noise += e * e;
+        }
+        bool pass = noise == 0.0 || 10.0 * log10(signal / noise) >= gc->min_snr_db;
+        char snr[16];
+        if (noise == 0.0) {
+            snprintf(snr, sizeof(snr), "exact");
+        } else {
+            snprintf(snr, sizeof(snr), "%.1f", 10.0 * log10(signal / noise));
+        }
+        printf("%22s %10s %8.0f %8s\n", gc->name, snr, gc->min_snr_db, pass ? "ok" : "FAIL");
+        failures += pass ? 0 : 1;
+    }
+    printf("\n");
+    free(result);
+    free(reference);
+    return failures;
+}
+
+// --- FLAC 解码 ---
+// 目录中的 multitone_s16.flac 是 generate_test_tone 的 multitone (44.1 kHz 立体声 16 位) 前 8192 帧，
+// 256 帧一块，覆盖各种子帧类型、声道去相关方式和 SEEKTABLE。按顺序和随机定位读出的样本
+// 必须与重新生成的信号逐位一致
+#define FLAC_FIXTURE_FRAMES 8192
+static int bench_flac(const char *dir) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/multitone_s16.flac", dir);
+    printf("=== FLAC decoder (%s) ===\n", path);
+    track_t track;
+    if (!open_track(path, &track)) {
+        printf("cannot open fixture: FAIL\n\n");
+        return 1;
+    }
+    const int channels = 2;
+    int16_t *expected = (int16_t *)malloc((size_t)FLAC_FIXTURE_FRAMES * channels * sizeof(int16_t));
+    unsigned char *buf = (unsigned char *)malloc((size_t)FLAC_FIXTURE_FRAMES * channels * sizeof(int16_t));
+    for (int i = 0; i < FLAC_FIXTURE_FRAMES; i++) {
+        for (int ch = 0; ch < channels; ch++) {
+            // 与 generate_test_tone 写 16 位样本时的量化相同
+            expected[i * channels + ch] = (int16_t)(test_signal_value(SIGNAL_MULTITONE, i, ch, 44100) * 32767);
+        }
+    }
+
+    int failures = 0;
+    bool format_ok = track.total_frames == FLAC_FIXTURE_FRAMES && track.header.num_channels == channels &&
+                     sample_format_from_wav(&track.header) == SAMPLE_S16;
+    const unsigned char *out;
+    double t0 = now_seconds();
+    int iterations = 50;
+    size_t got = 0;
+    for (int it = 0; it < iterations && format_ok; it++) {
+        got = audio_source_read(&track.source, 0, FLAC_FIXTURE_FRAMES, buf, &out);
+    }
+    double decode_ns = (now_seconds() - t0) * 1e9 / ((double)iterations * FLAC_FIXTURE_FRAMES * channels);
+    bool sequential = format_ok && got == FLAC_FIXTURE_FRAMES && memcmp(out, expected, got * channels * 2) == 0;
+    failures += sequential ? 0 : 1;
+
+    // 随机定位: 一半经 audio_source_seek，一半直接按不连续的位置读取
+    unsigned int seed = 5u;
+    int seeks = 500, bad = 0;
+    double seek_max = 0.0;
+    for (int k = 0; k < seeks && format_ok; k++) {
+        seed = seed * 1664525u + 1013904223u;
+        size_t target = (seed >> 8) % FLAC_FIXTURE_FRAMES;
+        size_t want = 1 + (seed >> 20) % 600;
+        double s = now_seconds();
+        if (k & 1) {
+            audio_source_seek(&track.source, target);
+        }
+        size_t n = audio_source_read(&track.source, target, want, buf, &out);
+        seek_max = fmax(seek_max, now_seconds() - s);
+        size_t expect_n = FLAC_FIXTURE_FRAMES - target < want ? FLAC_FIXTURE_FRAMES - target : want;
+        if (n != expect_n || memcmp(out, expected + target * channels, n * channels * 2) != 0) {
+            bad++;
+        }
+    }
+    failures += bad == 0 && format_ok ? 0 : 1;
+    printf("sequential %s, %.2f ns/sample; %d random seeks %s (max %.0f us)\n\n",
+           sequential ? "exact" : "FAIL", decode_ns, seeks, bad == 0 && format_ok ? "exact" : "FAIL", seek_max * 1e6);
+    close_track(&track);
+    free(expected);
+    free(buf);
+    return failures;
+}
+
+// --- 长时间运行 ---
+// 立体声 44.1 kHz 16 位扫频按播放器的路径处理: 转换 -> FIR -> WSOLA 1.25x -> 44.1->48k -> 16 位抖动输出；
+// 每个小时报告一次内核耗时 (不含信号生成)、分配次数和输出/输入帧数比的偏差
+static void bench_soak(double hours) {
+    const unsigned int rate = 44100, out_rate = 48000;
+    const int channels = 2;
+    const float speed = 1.25f;
+    audio_block_t signal = {0}, in = {0}, fir_out = {0}, stretched = {0}, resampled = {0};
+    short *pcm = (short *)malloc((size_t)MATRIX_BLOCK * channels * sizeof(short));
+    unsigned char *out_pcm = (unsigned char *)malloc((size_t)MATRIX_BLOCK * 3 * channels * sizeof(short));
+    wsola_t *wsola = wsola_create(channels, rate, MATRIX_BLOCK);
+    resampler_t *src = resampler_create(rate, out_rate, channels, SRC_MEDIUM);
+    if (!pcm || !out_pcm || !wsola || !src || !audio_block_reserve(&signal, channels, MATRIX_BLOCK) ||
+        !audio_block_reserve(&in, channels, MATRIX_BLOCK) || !audio_block_reserve(&fir_out, channels, MATRIX_BLOCK) ||
+        !audio_block_reserve(&stretched, channels, MATRIX_BLOCK * 2) ||
+        !audio_block_reserve(&resampled, channels, MATRIX_BLOCK * 3)) {
+        fprintf(stderr, "Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    // 和 dsp_chain_prepare 一样按最大块长预先分配，之后的处理循环不应再分配
+    if (!resampler_ensure_capacity(src, stretched.capacity) || !fir_ensure_capacity(channels, MATRIX_BLOCK)) {
+        fprintf(stderr, "Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    // 扫频每 TEST_SWEEP_SECONDS 秒重复一次，预先生成一个周期，循环取用
+    int period = (int)(TEST_SWEEP_SECONDS * rate);
+    float *sweep = (float *)malloc((size_t)period * sizeof(float));
+    if (!sweep) {
+        fprintf(stderr, "Allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < period; i++) {
+        sweep[i] = (float)test_signal_value(SIGNAL_SWEEP, i, 0, rate);
+    }
+    wav_header.num_channels = channels;
+    wav_header.sample_rate = rate;
+    current_eq_engine = EQ_ENGINE_FIR;
+    reset_fir_state();
+
+    printf("=== Soak: %.2f h stereo sweep, convert -> FIR -> WSOLA %.2fx -> %u Hz -> S16 ===\n", hours, speed, out_rate);
+    printf("%6s %10s %8s %8s %14s\n", "hour", "ns/frame", "CPU %RT", "allocs", "out/in error");
+    uint64_t total = (uint64_t)(hours * 3600.0 * rate);
+    uint64_t frames_in = 0, frames_out = 0, next_report = (uint64_t)3600 * rate;
+    double kernel_seconds = 0.0, report_seconds = 0.0;
+    uint64_t report_frames = 0;
+    long allocs = 0;
+    uint32_t dither = 1u;
+    while (frames_in < total) {
+        int n = total - frames_in < MATRIX_BLOCK ? (int)(total - frames_in) : MATRIX_BLOCK;
+        for (int i = 0; i < n; i++) {
+            float v = sweep[(frames_in + i) % period];
+            for (int ch = 0; ch < channels; ch++) {
+                signal.channel[ch][i] = v;
+            }
+        }
+        float_to_pcm(signal.channel, channels, n, SAMPLE_S16, (unsigned char *)pcm, NULL);
+
+        long allocs_before = bench_allocations;
+        double t0 = now_seconds();
+        pcm_to_float((const unsigned char *)pcm, SAMPLE_S16, channels, n, in.channel);
+        in.channels = channels;
+        in.frames = n;
+        apply_fir_filter(&in, &fir_out, EQ_BASS_BOOST);
+        int stretched_frames = wsola_process(wsola, fir_out.channel, n, stretched.channel, stretched.capacity, speed);
+        int produced = resampler_process(src, stretched.channel, stretched_frames, resampled.channel, resampled.capacity);
+        float_to_pcm(resampled.channel, channels, produced, SAMPLE_S16, out_pcm, &dither);
+        double dt = now_seconds() - t0;
+        allocs += bench_allocations - allocs_before;
+
+        kernel_seconds += dt;
+        report_seconds += dt;
+        report_frames += n;
+        frames_in += n;
+        frames_out += produced;
+        if (frames_in >= next_report || frames_in >= total) {
+            double expected = (double)frames_in / speed * out_rate / rate;
+            printf("%6.2f %10.1f %7.2f%% %8ld %13.2e\n", (double)frames_in / rate / 3600.0,
+                   report_seconds * 1e9 / report_frames, report_seconds / ((double)report_frames / rate) * 100.0,
+                   allocs, (frames_out - expected) / expected);
+            next_report += (uint64_t)3600 * rate;
+            report_seconds = 0.0;
+            report_frames = 0;
+        }
+    }
+    printf("total kernel time %.1f s for %.2f h of audio\n\n", kernel_seconds, hours);
+
+    free(sweep);
+    free(pcm);
+    free(out_pcm);
+    wsola_destroy(wsola);
+    resampler_destroy(src);
+    audio_block_free(&signal);
+    audio_block_free(&in);
+    audio_block_free(&fir_out);
+    audio_block_free(&stretched);
+    audio_block_free(&resampled);
+}
+
+int main(int argc, char *argv[]) {
+    const char *golden_dir = "golden";
+    bool update_golden = false;
+    double soak_hours = 0.0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            golden_dir = argv[++i];
+        } else if (strcmp(argv[i], "--update-golden") == 0) {
+            update_golden = true;
+        } else if (strcmp(argv[i], "--hours") == 0 && i + 1 < argc) {
+            soak_hours = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--golden <dir>] [--update-golden] [--hours <h>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    bench_fft();
+    bench_sample_format();
+    bench_fir();
+    bench_biquad();
+    bench_convolution();
+    bench_limiter();
+    bench_resampler();
+    bench_dsp_graph();
+    bench_time_stretch(STRETCH_PHASE_VOCODER);
+    bench_time_stretch(STRETCH_WSOLA);
+    bench_signal_matrix();
+    int failures = bench_golden(golden_dir, update_golden);
+    failures += bench_flac(golden_dir);
+    if (soak_hours > 0.0) {
+        bench_soak(soak_hours);
+    }
+    if (failures > 0) {
+        printf("%d golden reference check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
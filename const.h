@@ -53,12 +53,35 @@ snd_pcm_uframes_t period_size = 12 * 1024;
 snd_pcm_uframes_t frames;
 snd_pcm_uframes_t buffer_size;
 
+// 延迟档位 (-L): normal 保持上面固定的字节数；low / deep 取档位阶梯的两端；
+// adaptive 从最低档开始，出现欠载时升一档，长时间稳定后再降一档
+typedef enum {
+    LATENCY_NORMAL = 0,
+    LATENCY_LOW,
+    LATENCY_DEEP,
+    LATENCY_ADAPTIVE
+} latency_profile_t;
+
+typedef struct {
+    unsigned int period_us;     // 周期时长
+    int periods;                // 缓冲区中的周期数
+} latency_level_t;
+
+#define LATENCY_LEVELS 6
+#define ADAPTIVE_SETTLE_MS 1000         // 换档后这段时间内的欠载算作换档本身造成的
+#define ADAPTIVE_STABLE_SECONDS 30      // 没有欠载多久后降一档；某档出过欠载后每次翻倍
+#define ADAPTIVE_MAX_BACKOFF 5
+latency_profile_t latency_profile;
+int latency_level;
+
 
 
 
 
 // 初始化采样率
 unsigned int rate;
+// ALSA 当前配置的声道数 (与 rate 一起决定换曲时是否需要重新配置)
+unsigned int device_channels;
 
 // 音乐文件指针变量
 FILE *fp;
@@ -84,7 +107,8 @@ typedef enum {
     EQ_NORMAL = 0,
     EQ_BASS_BOOST = 1,
     EQ_TREBLE_BOOST = 2,
-    EQ_VOCAL_ENHANCE = 3
+    EQ_VOCAL_ENHANCE = 3,
+    EQ_CONVOLUTION = 4      // 用户加载的冲激响应 (-I)，未加载时不参与切换
 } equalizer_mode_t;
 
 // 全局播放状态变量
@@ -93,8 +117,14 @@ playback_speed_t current_speed;
 equalizer_mode_t current_eq_mode;
 long current_position;
 long total_frames;
-char playlist[10][256]; // 简单播放列表，最多10首歌
+// 播放列表: 所有路径依次存放在一块按需增长的字符串池中，没有条数上限和每条的固定长度。
+// -m 可以重复，参数可以是 WAV 文件、.m3u/.m3u8 列表或目录 (递归查找 .wav，按路径排序)
+#define PLAYLIST_MAX_DEPTH 8
 int playlist_count;
+bool playlist_add(const char *path);
+bool playlist_load(const char *arg);
+const char *playlist_path(int index);
+void playlist_free();
 int current_track;
 
 // FIR滤波器参数
@@ -108,6 +138,34 @@ int current_track;
 
 // 日志相关
 #define LOG_BUFFER_SIZE 256
+// 异步日志: 调用方只把定长记录放进无锁队列 (多生产者、单消费者，每个槽位带序号)，
+// 由后台线程格式化、写文件并每批 fflush 一次；队列满时直接丢弃并计数，音频线程永不阻塞
+#define LOG_QUEUE_SIZE 256              // 必须是2的幂
+#define LOG_FLUSH_INTERVAL_MS 100       // 队列为空时后台线程的轮询间隔
+#define LOG_REPEAT_WINDOW_MS 1000       // 同一条消息在窗口内重复出现时只记一次，其余计数
+#define LOG_REPEAT_SLOTS 32
+typedef struct {
+    struct timespec time;               // 入队时刻 (CLOCK_REALTIME)，格式化留给后台线程
+    uint32_t repeated;                  // 此前被限流省略的相同消息条数
+    char type[8];
+    char message[LOG_BUFFER_SIZE];
+} log_record_t;
+
+typedef struct {
+    atomic_size_t sequence;
+    log_record_t record;
+} log_cell_t;
+
+typedef struct {
+    atomic_uint_least64_t hash;         // type + message 的 FNV-1a 散列
+    atomic_uint_least64_t last_ns;      // 最近一次真正入队的时刻
+    atomic_uint_least32_t suppressed;   // 窗口内被省略的次数，随下一次入队的记录带出
+} log_repeat_slot_t;
+
+void log_start();
+void log_stop();
+uint64_t log_dropped_count();
+uint64_t log_suppressed_count();
 void write_log(const char* type, const char* message);
 void log_user_operation(const char* operation, const char* result);
 void log_program_info(const char* info_type, const char* message);
@@ -115,6 +173,8 @@ void log_program_info(const char* info_type, const char* message);
 // 函数声明
 bool debug_msg(int result, const char *str);
 bool open_music_file(const char *path_name);
+void print_track_header();
+bool track_header_deferred;     // 打开曲目时不输出文件头信息 (快速启动的第一首，出声后再补)
 void toggle_pause();
 void next_track();
 void previous_track();
@@ -122,10 +182,864 @@ void change_speed();
 void seek_forward();
 void seek_backward();
 void toggle_equalizer();
-void apply_fir_filter(short* input, short* output, int length, equalizer_mode_t mode);
-void apply_time_stretch(short* input, short* output, int input_length, int* output_length, float speed_factor, int max_output_length);
+void toggle_stretch_mode();
+void toggle_eq_engine();
 void reset_time_stretch_static_vars();
 void print_status();
+long playback_position();
 void handle_user_input(char input);
 
 
+
+// 播放流水线 (decode/DSP -> 环形缓冲区 -> ALSA 输出线程)
+// 无锁单生产者单消费者环形缓冲区，以帧为单位，容量为2的幂
+typedef struct {
+    unsigned char *data;
+    size_t capacity;            // 帧数 (2的幂)
+    size_t frame_bytes;         // 每帧字节数
+    atomic_size_t write_pos;    // 只由生产者(读取/DSP线程)推进
+    atomic_size_t read_pos;     // 只由消费者(输出线程)推进
+} audio_ring_t;
+
+// 环形缓冲区深度 (以ALSA周期为单位) 和输出线程的实时优先级 (0 = 不使用 SCHED_FIFO)
+#define DEFAULT_RING_DEPTH_PERIODS 4
+#define DEFAULT_OUTPUT_RT_PRIORITY 70
+int ring_depth_periods;
+int output_rt_priority;
+
+bool audio_ring_init(audio_ring_t *ring, size_t min_frames, size_t frame_bytes);
+void audio_ring_free(audio_ring_t *ring);
+void audio_ring_reset(audio_ring_t *ring);
+size_t audio_ring_fill(audio_ring_t *ring);
+size_t audio_ring_space(audio_ring_t *ring);
+size_t audio_ring_write(audio_ring_t *ring, const void *src, size_t frames);
+size_t audio_ring_reserve(audio_ring_t *ring, unsigned char **ptr);
+void audio_ring_commit(audio_ring_t *ring, size_t frames);
+size_t audio_ring_peek(audio_ring_t *ring, unsigned char **ptr);
+void audio_ring_consume(audio_ring_t *ring, size_t frames);
+
+// 输出方式 (-A): RW_INTERLEAVED 经 snd_pcm_writei 复制；MMAP_INTERLEAVED / MMAP_NONINTERLEAVED 时
+// 输出线程把环形缓冲区中的帧直接写进 snd_pcm_mmap_begin 返回的硬件缓冲区区域
+snd_pcm_access_t pcm_access;
+
+bool pipeline_start(snd_pcm_uframes_t period_frames);
+void pipeline_stop();
+
+// 快速启动 (-F 1): 打开声卡之前就启动读取/DSP 线程，第一批缓冲区的读取、解码和处理与设备协商并行；
+// 混音器、键盘控制和文件头的详细信息推迟到开始出声之后。设备给出的采样率与预读时不同则从头重新开始
+bool fast_start;
+bool pipeline_preload(snd_pcm_uframes_t period_frames);
+bool pipeline_preload_fits(snd_pcm_uframes_t period_frames, unsigned int device_rate);
+
+// 线程唤醒事件: eventfd 加等待标志。等待方先 wake_event_arm 再复查条件，条件仍不满足才 poll；
+// 通知方只在有线程等待时才写 eventfd，稳态下不产生系统调用
+typedef struct {
+    int fd;
+    atomic_bool waiting;
+} wake_event_t;
+
+// 等待的上限，只用作兜底 (正常情况下都由通知唤醒)
+#define PIPELINE_WAIT_TIMEOUT_MS 1000
+// mmap 输出时 poll 的 ALSA 描述符个数上限
+#define OUTPUT_MAX_POLL_FDS 8
+
+bool wake_event_init(wake_event_t *ev);
+void wake_event_close(wake_event_t *ev);
+void wake_event_arm(wake_event_t *ev);
+void wake_event_disarm(wake_event_t *ev);
+void wake_event_wait(wake_event_t *ev, int timeout_ms);
+void wake_event_clear(wake_event_t *ev);
+void wake_event_signal(wake_event_t *ev);
+bool pipeline_events_init();
+void pipeline_events_close();
+
+// 复数和FFT计划 (相位声码器、频谱分析、快速卷积共用)
+typedef struct {
+    float real;
+    float imag;
+} Complex;
+
+// 每个尺寸创建一次: 位反转表和旋转因子在创建时计算，变换时不分配内存
+// scratch 为实数FFT的工作区，所以同一个计划不能被多个线程同时使用
+typedef struct {
+    int size;               // 复数变换点数 / 实数变换的实数点数 (2的幂)
+    int log2_size;
+    int *bitrev;            // size 点位反转置换表
+    int *bitrev_half;       // size/2 点位反转置换表 (供实数FFT内部使用)
+    Complex *twiddles;      // W_N^k, k = 0 .. size/2-1
+    Complex *scratch;       // size/2+1 个复数
+} fft_plan_t;
+
+fft_plan_t *fft_plan_create(int n);
+void fft_plan_destroy(fft_plan_t *plan);
+void fft_forward(const fft_plan_t *plan, Complex *x);
+void fft_inverse(const fft_plan_t *plan, Complex *x);
+void fft_real_forward(fft_plan_t *plan, const float *input, Complex *output);
+void fft_real_inverse(fft_plan_t *plan, const Complex *input, float *output);
+void fft_reference(Complex* x, int N);
+void ifft_reference(Complex* x, int N);
+
+// 时间拉伸算法选择
+typedef enum {
+    STRETCH_PSOLA = 0,          // 固定跳步的加窗重叠相加
+    STRETCH_PHASE_VOCODER = 1,  // 相位声码器 (带相位锁定)
+    STRETCH_WSOLA = 2           // 波形相似重叠相加
+} stretch_mode_t;
+#define NUM_STRETCH_MODES 3
+stretch_mode_t current_stretch_mode;
+bool stretch_mode_is_streaming(stretch_mode_t mode);
+
+// 相位声码器参数: 合成跳步为 FFT 长度的 1/4 (Hann 窗 75% 重叠)
+#define PV_MAX_CHANNELS 8
+#define PV_FFT_SIZE 2048            // <= 48kHz
+#define PV_FFT_SIZE_HIGH_RATE 4096  // > 48kHz，保持相近的时间分辨率
+#define PV_HOP_DIVISOR 4
+
+// 每个声道的流式状态，跨 buffer_size 块保持
+typedef struct {
+    float *input;           // 输入FIFO，分析帧从这里取
+    int input_fill;
+    double input_pos;       // 下一分析帧在FIFO中的起点 (小数，支持任意速度)
+    float *accum;           // 重叠相加累加器 (fft_size)
+    float *ready;           // 已合成、等待输出的样本
+    int ready_fill;
+    float *last_phase;      // 上一分析帧的相位
+    float *synth_phase;     // 累积的合成相位
+    bool primed;            // 是否已处理过第一帧
+} pv_channel_t;
+
+typedef struct {
+    int fft_size;
+    int hop;                // 合成跳步 Hs
+    int bins;               // fft_size/2 + 1
+    int channels;
+    unsigned int sample_rate;
+    int input_capacity;
+    int ready_capacity;
+    int block_capacity;     // 创建时的最大输入块长，块长变大时需要重建
+    float norm;             // 分析窗 x 合成窗 重叠相加的归一化系数
+    fft_plan_t *plan;
+    float *window;
+    float *frame;
+    Complex *spectrum;
+    float *magnitude;
+    float *phase;
+    int *peaks;
+    pv_channel_t channel[PV_MAX_CHANNELS];
+} phase_vocoder_t;
+
+phase_vocoder_t *phase_vocoder_create(int channels, unsigned int sample_rate, int max_block_frames);
+void phase_vocoder_destroy(phase_vocoder_t *pv);
+void phase_vocoder_reset(phase_vocoder_t *pv);
+int phase_vocoder_process(phase_vocoder_t *pv, float *const *input, int input_frames,
+                          float *const *output, int max_output_frames, float speed_factor);
+
+// PSOLA 逐块处理，块长至少要有一个分析帧
+#define PSOLA_FRAME_SIZE 512
+
+// 连续变速: 's' 在预设速度之间循环，'['/']' 以 SPEED_STEP 微调
+#define MIN_SPEED_FACTOR 0.25f
+#define MAX_SPEED_FACTOR 4.0f
+#define SPEED_STEP 0.05f
+float current_speed_factor;
+
+// 软件音量: 混音器不可用 (init_mixer 失败，例如经 PulseAudio 的路由) 时 '+'/'-' 按 SOFT_VOLUME_STEP_DB
+// 调整。增益与最后一次格式转换的定标合并成一次 (SIMD) 乘法，音量变化的那一块内从旧增益线性过渡到新增益，
+// 没有阶跃噪声。只衰减不放大，限幅器之后也不会超出满幅；作用于主环形缓冲区中的帧，各区域的音量在此之上叠加。
+// 0 dB 时直通路径不受影响
+#define SOFT_VOLUME_STEP_DB 1.0f
+#define SOFT_VOLUME_MIN_DB -60.0f
+float current_volume_db;        // 处理链使用的软件音量 (dB)，-v 设置初始值
+
+// WSOLA (波形相似重叠相加) 参数
+#define WSOLA_MAX_CHANNELS 8
+#define WSOLA_FRAME_MS 30           // 分析/合成帧长
+#define WSOLA_COARSE_STEP 4         // 粗搜索步长，之后在最佳位置附近逐点细搜
+
+typedef struct {
+    float *input;           // 输入FIFO
+    float *overlap;         // 上一帧后半部分 (已加窗)，与下一帧前半部分相加
+    float *ready;           // 已合成、等待输出的样本
+} wsola_channel_t;
+
+typedef struct {
+    int frame_size;         // N
+    int hop;                // 合成跳步 Hs = N/2 (Hann 窗 50% 重叠和为1)
+    int search;             // 搜索半径 Δ
+    int channels;
+    unsigned int sample_rate;
+    int input_capacity;
+    int ready_capacity;
+    int block_capacity;     // 创建时的最大输入块长，块长变大时需要重建
+    int input_fill;         // 所有声道共享同一个填充量
+    int ready_fill;
+    double nominal_pos;     // 下一帧的名义起点 (FIFO内，小数)
+    int prev_pos;           // 上一帧实际选中的起点
+    bool primed;
+    float *window;
+    float *mix;             // 各声道平均，用于相关搜索，保证声道间对齐
+    double *energy_prefix;  // 候选段能量的前缀和
+    wsola_channel_t channel[WSOLA_MAX_CHANNELS];
+} wsola_t;
+
+float dsp_dot_product(const float *a, const float *b, int n);
+wsola_t *wsola_create(int channels, unsigned int sample_rate, int max_block_frames);
+void wsola_destroy(wsola_t *w);
+void wsola_reset(wsola_t *w);
+int wsola_process(wsola_t *w, float *const *input, int input_frames,
+                  float *const *output, int max_output_frames, float speed_factor);
+void adjust_speed(float delta);
+
+// FIR 均衡器内核: out[i] = Σ coeffs[j] * line[i + j]
+// coeffs 为反转后的有效系数 (已并入增益和干湿混合)，line 为单声道线性延迟线
+typedef void (*fir_kernel_fn)(const float *coeffs, const float *line, float *out, int n, int taps);
+#define FIR_MAX_CHANNELS 8
+
+// 每个声道一条线性延迟线: [FIR_TAP_NUM-1 个历史样本 | 当前块]，没有取模运算
+typedef struct {
+    float *line[FIR_MAX_CHANNELS];
+    int capacity;               // 当前块最多可容纳的帧数
+} fir_state_t;
+
+const char *fir_select_kernel(const char *requested);
+void fir_kernel_scalar(const float *coeffs, const float *line, float *out, int n, int taps);
+fir_kernel_fn fir_kernel_lookup(const char *name);
+void reset_fir_state();
+
+// 浮点处理链: 文件样本先转换成平面 float (满幅 ±1.0)，时间拉伸、均衡器、重采样都在 float 上进行，
+// 最后一次转换成设备格式 (8/16位输出可加 TPDF 抖动)
+typedef enum {
+    SAMPLE_FORMAT_UNKNOWN = 0,
+    SAMPLE_U8,
+    SAMPLE_S16,
+    SAMPLE_S24_3,           // 3字节小端 (常见的24位WAV)
+    SAMPLE_S24,             // 4字节容器中的24位，低3字节有效 (SND_PCM_FORMAT_S24_LE)
+    SAMPLE_S32,
+    SAMPLE_FLOAT            // 32位浮点 (WAV audio_format 3)
+} sample_format_t;
+sample_format_t device_format;  // ALSA 设备的样本格式，UNKNOWN 时源数据原样输出
+bool dither_enabled;
+
+// 平面音频块: 每个声道一段连续、64字节对齐的 float 样本
+typedef struct {
+    float *channel[FIR_MAX_CHANNELS];
+    int channels;
+    int frames;             // 有效帧数
+    int capacity;           // 每个声道可容纳的帧数
+} audio_block_t;
+
+// 音频块内存池: 打开曲目时按最大块长一次分配，处理链的各个块从中切分，播放循环中不再 malloc；
+// 切出的块随内存池一起释放，不能单独 audio_block_free
+#define AUDIO_BLOCK_ALIGN 64
+typedef struct {
+    unsigned char *base;
+    size_t size;
+    size_t used;
+} audio_arena_t;
+
+#define DITHER_CHUNK_FRAMES 256     // 抖动噪声按块生成，放在栈上
+
+int sample_format_bytes(sample_format_t format);
+int sample_format_bits(sample_format_t format);
+const char *sample_format_name(sample_format_t format);
+sample_format_t sample_format_from_wav(const struct WAV_HEADER *header);
+sample_format_t sample_format_from_pcm(snd_pcm_format_t format);
+bool audio_block_reserve(audio_block_t *block, int channels, int frames);
+void audio_block_free(audio_block_t *block);
+size_t audio_block_bytes(int channels, int frames);
+bool audio_arena_reserve(audio_arena_t *arena, size_t bytes);
+void *audio_arena_alloc(audio_arena_t *arena, size_t bytes);
+bool audio_block_carve(audio_arena_t *arena, audio_block_t *block, int channels, int frames);
+void audio_arena_free(audio_arena_t *arena);
+void pcm_to_float(const unsigned char *src, sample_format_t format, int channels, int frames, float *const *dst);
+void float_to_pcm(float *const *src, int channels, int frames, sample_format_t format,
+                  unsigned char *dst, uint32_t *dither_seed);
+void float_to_pcm_gain(float *const *src, int channels, int frames, sample_format_t format,
+                       unsigned char *dst, uint32_t *dither_seed, float gain, float gain_step);
+
+// 读取线程处理完的一块: 直通时 bytes 指向设备格式的源数据，否则 block 是尚未转换的浮点块；
+// 最后一次格式转换由消费方直接写进目标 (环形缓冲区或渲染输出)，不再经过中间缓冲区
+typedef struct {
+    const unsigned char *bytes;
+    audio_block_t *block;
+    bool dither;
+    float gain, gain_step;      // 软件音量: 第一帧的增益和每帧的增量，在最后一次格式转换中乘上
+    size_t frames;
+    size_t frame_bytes;         // 输出端每帧字节数
+    uint64_t convert_ns;        // 两个方向格式转换的累计耗时
+} processed_block_t;
+
+void apply_fir_filter(const audio_block_t *input, audio_block_t *output, equalizer_mode_t mode); // 可原地处理
+void apply_time_stretch(const audio_block_t *input, audio_block_t *output, float speed_factor);
+
+// 运行统计: 每个阶段一个耗时直方图 (每倍频程4个桶，1 us 到约 70 分钟)，由唯一的写线程用
+// relaxed 原子操作更新，主线程随时读取；每块只多几次 clock_gettime，可以一直开着
+#define STATS_BUCKETS 128
+typedef struct {
+    const char *name;
+    atomic_uint_least64_t count;
+    atomic_uint_least64_t total_ns;
+    atomic_uint_least64_t max_ns;
+    atomic_uint_least32_t buckets[STATS_BUCKETS];
+} stage_stats_t;
+
+typedef enum {
+    STAGE_READ = 0,         // 从映射/文件读取一块
+    STAGE_STRETCH,
+    STAGE_EQ,
+    STAGE_SRC,
+    STAGE_LIMIT,            // 输出限幅器
+    STAGE_CONVERT,          // 源格式 -> float、float -> 设备格式
+    STAGE_WRITE,            // snd_pcm_writei
+    STAGE_SEEK,             // 定位命令发出到新音频接到输出线程 (每次定位记一次)
+    STAGE_ANALYZE,          // 电平/频谱分析线程每帧的计算 (-V)
+    STAGE_COUNT
+} stage_id_t;
+
+typedef struct {
+    stage_stats_t stage[STAGE_COUNT];
+    atomic_uint_least64_t underruns;        // snd_pcm_writei 返回 -EPIPE
+    atomic_uint_least64_t ring_empty;       // 输出线程发现环形缓冲区为空 (读取/DSP 跟不上)
+    atomic_uint_least64_t stream_rebuffers; // 流式输入的抖动缓冲区读空，等待重新缓冲
+    atomic_uint_least64_t limited_frames;   // 限幅器衰减过的帧数 (否则会削波)
+    atomic_uint_least64_t ring_fill;        // 最近一次输出前的填充量 (帧)
+    atomic_uint_least64_t ring_fill_min;
+    atomic_int_least64_t pcm_delay;         // 最近一次 snd_pcm_delay (帧)
+    atomic_uint_least64_t pcm_delay_ns;     // 取样的时刻，多区域输出据此外推
+    atomic_int_least64_t pcm_delay_min;
+    atomic_int_least64_t pcm_delay_max;
+    atomic_bool delay_valid;
+    atomic_uint_least64_t first_audio_ns;   // 程序启动到第一次写进声卡，0 表示还没有
+} pipeline_stats_t;
+
+int stats_interval_seconds;     // -T: 每隔多少秒输出一行机器可读的统计，0 表示不输出
+
+uint64_t monotonic_ns();
+void stats_reset();
+void stats_record(stage_stats_t *stats, uint64_t ns);
+uint64_t stats_percentile_ns(const stage_stats_t *stats, double fraction);
+void print_stats();
+void stats_poll();
+int stats_poll_timeout_ms();
+
+// 离线渲染 (-O): 不打开声卡，主线程按播放时相同的读取/DSP 路径尽快把整个播放列表处理一遍，
+// 结果写成 WAV 文件 (路径为 "null" 时丢弃)，结束后报告实时倍率、每秒样本数和各阶段耗时
+#define RENDER_NULL_SINK "null"
+const char *render_path;
+int render_playlist();
+
+// DSP 节点: 处理链中的一级。process 返回输出块 (原地处理时就是 input，否则是 node->output)，
+// 出错返回 NULL；latency 是节点内部缓存、尚未输出的样本，按节点输入端的帧数计；
+// input_per_output 是每个输出帧对应的输入帧数 (变速、重采样节点)，为 NULL 时视为 1；
+// transparent 返回 true 表示当前样本原样通过，执行器跳过该节点；
+// auto_bypass 的节点在前面所有节点都原样通过时自动旁路 (限幅器: 没有处理过的信号不会超出满幅)
+typedef struct dsp_node dsp_node_t;
+typedef struct {
+    const char *name;
+    audio_block_t *(*process)(dsp_node_t *node, audio_block_t *input);
+    void (*reset)(dsp_node_t *node);
+    double (*latency)(const dsp_node_t *node);
+    double (*input_per_output)(const dsp_node_t *node);
+    bool (*transparent)(const dsp_node_t *node);
+    bool same_length;           // 输出帧数总等于输入帧数，旁路切换时可以交叉淡化
+    bool auto_bypass;
+} dsp_node_ops_t;
+
+struct dsp_node {
+    const dsp_node_ops_t *ops;
+    audio_block_t *output;      // 非原地节点的输出块
+    stage_stats_t *stats;       // 非 NULL 时执行器记录 process 的耗时
+    atomic_bool bypass_requested;
+    bool bypassed;
+    bool remove_pending;        // 淡出完成后从处理链中摘除
+    int fade_remaining;         // 旁路切换的交叉淡化还剩多少帧
+};
+
+#define DSP_GRAPH_MAX_NODES 8
+#define DSP_BYPASS_FADE_FRAMES 256
+
+// 处理链执行器: 节点按顺序执行；插入/移除节点持有 lock，可以在播放时从其他线程调用，
+// 在块与块之间生效。dry 用于旁路切换时保存未处理的信号，容量不足时直接切换
+typedef struct {
+    dsp_node_t *nodes[DSP_GRAPH_MAX_NODES];
+    int count;
+    audio_block_t dry;
+    pthread_mutex_t lock;
+    double latency;             // 最近一块处理后的总延迟 (源采样率的帧数)
+    double input_per_output;    // 最近一块每个输出帧对应的源帧数
+} dsp_graph_t;
+
+void dsp_graph_init(dsp_graph_t *graph);
+bool dsp_graph_insert(dsp_graph_t *graph, int index, dsp_node_t *node);
+bool dsp_graph_remove(dsp_graph_t *graph, dsp_node_t *node);
+void dsp_node_set_bypass(dsp_node_t *node, bool bypass);
+audio_block_t *dsp_graph_process(dsp_graph_t *graph, audio_block_t *input, bool *modified);
+void dsp_graph_reset(dsp_graph_t *graph);
+double dsp_graph_latency(dsp_graph_t *graph, double *input_per_output);
+
+// 分区卷积均衡器 (uniformly partitioned overlap-save)
+// 冲激响应切成长度为 B 的分区，每个分区预先做 2B 点实数FFT；每来 B 帧做一次
+// 正变换、P 次复数乘加和一次逆变换，每块开销固定，延迟为 B 帧
+#define CONV_BLOCK_SIZE 256
+#define CONV_MAX_TAPS 262144
+
+typedef struct {
+    int block;              // 分区长度 B
+    int bins;               // B + 1
+    int partitions;         // 分区数 P
+    int channels;           // 冲激响应声道数，1 表示所有声道共用
+    int taps;               // 冲激响应长度
+    unsigned int sample_rate; // WAV 冲激响应的采样率，文本系数文件为 0
+    fft_plan_t *plan;       // 2B 点
+    Complex *spectra;       // [channels][partitions][bins]
+} conv_ir_t;
+
+typedef struct {
+    float *input;           // 2B: 上一块 | 当前块
+    float *output;          // B: 上一块的卷积结果，按位置与当前块输入交换
+    Complex *fdl;           // 频域延迟线 [partitions][bins]
+} conv_channel_t;
+
+typedef struct {
+    const conv_ir_t *ir;
+    int channels;
+    int pos;                // 当前块已填入的帧数
+    int fdl_head;           // 频域延迟线中最新一块输入谱的下标
+    Complex *accum;
+    float *time;
+    conv_channel_t channel[FIR_MAX_CHANNELS];
+} convolver_t;
+
+conv_ir_t *conv_ir_create(const float *taps, int length, int channels, unsigned int sample_rate);
+conv_ir_t *conv_ir_load(const char *path);
+void conv_ir_destroy(conv_ir_t *ir);
+convolver_t *convolver_create(const conv_ir_t *ir, int channels);
+void convolver_destroy(convolver_t *c);
+void convolver_reset(convolver_t *c);
+void convolver_process(convolver_t *c, float *const *input, float *const *output, int frames);
+
+// 参数均衡器 (RBJ Audio EQ Cookbook 双二阶滤波器级联)，作为预设模式的低开销引擎
+typedef enum {
+    EQ_ENGINE_FIR = 0,      // 32阶FIR (原实现)
+    EQ_ENGINE_BIQUAD = 1    // 双二阶级联
+} eq_engine_t;
+eq_engine_t current_eq_engine;
+
+typedef enum {
+    BIQUAD_PEAKING,
+    BIQUAD_LOW_SHELF,
+    BIQUAD_HIGH_SHELF
+} biquad_type_t;
+
+// freq 为 0 表示未使用的频段 (直通)
+typedef struct {
+    biquad_type_t type;
+    double freq;            // 中心/转折频率 Hz
+    double q;
+    double gain_db;
+} eq_band_t;
+
+// 已按 a0 归一化
+typedef struct {
+    double b0, b1, b2, a1, a2;
+} biquad_coeffs_t;
+
+#define BIQUAD_MAX_BANDS 3
+#define BIQUAD_RAMP_MS 20          // 切换模式时系数线性过渡的时长
+#define BIQUAD_DENORMAL_GUARD 1e-18
+
+typedef struct {
+    int mode;                       // 当前目标模式，-1 表示尚未设计
+    unsigned int sample_rate;
+    biquad_coeffs_t current[BIQUAD_MAX_BANDS];
+    biquad_coeffs_t step[BIQUAD_MAX_BANDS];
+    biquad_coeffs_t target[BIQUAD_MAX_BANDS];
+    int ramp_remaining;             // 剩余的过渡帧数
+    int active_bands;               // 需要计算的频段数 (预设的频段从前往后排列)
+    int target_bands;
+    double z[FIR_MAX_CHANNELS][BIQUAD_MAX_BANDS][2]; // 转置直接II型状态，跨缓冲区保留
+} biquad_eq_t;
+
+void biquad_design(const eq_band_t *band, unsigned int sample_rate, biquad_coeffs_t *out);
+void biquad_eq_init(biquad_eq_t *eq);
+void biquad_eq_set_mode(biquad_eq_t *eq, equalizer_mode_t mode, unsigned int sample_rate);
+void biquad_eq_process(biquad_eq_t *eq, float *const *input, float *const *output, int frames, int channels);
+
+// 控制面: 按键只修改 control_params，再用 dsp_params_publish 发布一份快照；拥有处理链的线程在
+// 每块开始时 dsp_params_sync 取最新的快照写进 current_* (处理链只读这些变量)，一块之内参数不变。
+// 三个槽位轮换，发布和读取各只做一次原子交换，双方都不会等待对方
+typedef struct {
+    float speed_factor;
+    equalizer_mode_t eq_mode;
+    eq_engine_t eq_engine;
+    stretch_mode_t stretch_mode;
+    float volume_db;
+} dsp_params_t;
+
+#define DSP_PARAMS_FRESH 4u     // middle 中的标志: 发布后还没有被读取线程取走
+typedef struct {
+    dsp_params_t slot[3];
+    atomic_uint middle;         // 中间槽位的编号 | DSP_PARAMS_FRESH
+    unsigned int back;          // 只由控制线程访问: 下一次发布写入的槽位
+    unsigned int front;         // 只由读取线程访问: 正在使用的槽位
+} dsp_params_exchange_t;
+dsp_params_t control_params;
+
+void dsp_params_init();
+void dsp_params_publish();
+bool dsp_params_sync();
+
+// 定位和切歌排成命令 (控制线程写，读取线程在块边界执行)，控制线程从不直接改动数据源和
+// current_position。切歌命令使读取线程结束，由主线程停止流水线后打开新曲目
+typedef enum {
+    CONTROL_CMD_SEEK,           // value: 相对当前读取位置移动的帧数
+    CONTROL_CMD_TRACK           // value: 播放列表中的序号
+} control_cmd_type_t;
+
+typedef struct {
+    control_cmd_type_t type;
+    long value;
+    uint64_t issued_ns;         // 入队时刻，用于统计定位延迟
+} control_cmd_t;
+
+#define CONTROL_QUEUE_DEPTH 64
+bool control_send(control_cmd_type_t type, long value);
+
+// 定位: 读取线程从目标前 SEEK_PREROLL_MS 开始把处理链跑一遍 (输出丢弃)，再跳过处理链内部
+// 还压着的输出，第一帧新输出对应目标帧；输出线程丢掉环形缓冲区中的旧音频，并在接缝处用
+// SEEK_CROSSFADE_MS 的等功率交叉淡化代替直接跳变。声卡中已有的数据照常播完，不会被截断
+#define SEEK_PREROLL_MS 20
+#define SEEK_CROSSFADE_MS 5
+
+// 流式输入: -m - (标准输入)、tcp:主机:端口，以及命名管道、套接字等不能定位的文件。
+// 头部直接从描述符上解析，data 块长度为 0 或 0xFFFFFFFF 时读到对端关闭为止；
+// 接收线程把数据读进有界的抖动缓冲区，读取线程只从缓冲区取数据。缓冲区读空后先重新
+// 填到预取水位再继续，网络短暂停顿不会传到输出环形缓冲区。流式曲目不能快进/快退
+#define STREAM_STDIN_NAME "-"
+#define STREAM_TCP_PREFIX "tcp:"
+#define DEFAULT_JITTER_BUFFER_MS 2000   // -J 抖动缓冲区深度
+#define DEFAULT_JITTER_PREFETCH_MS 500  // 开始播放 / 读空后恢复前要缓冲的时长
+typedef struct {
+    int fd;
+    audio_ring_t ring;          // 字节环形缓冲区 (frame_bytes = 1)，满了接收线程就暂停读取
+    size_t prefetch_bytes;
+    size_t frame_bytes;         // 交给读取线程的数据按整帧对齐
+    bool buffering;             // 只由读取线程访问: 正在等待填到预取水位
+    atomic_size_t wanted_bytes; // 读取线程在等多少字节，填够了接收线程才通知
+    atomic_bool eof;            // 对端关闭或出错，缓冲区中剩下的数据仍可读完
+    atomic_bool stop;
+    wake_event_t data_event;    // 唤醒读取线程
+    wake_event_t space_event;   // 唤醒接收线程 (取走数据或要求停止)
+    pthread_t thread;
+} stream_buffer_t;
+int jitter_buffer_ms;
+int jitter_prefetch_ms;
+
+// 音乐数据源: 普通文件整个映射到内存，DSP 直接读取映射中的样本，定位只是指针运算；
+// 无法映射的文件退回 stdio (fread/fseek)，流式输入经抖动缓冲区读取。
+// 读取和定位按帧经曲目的解码器进行，WAV 直接给出 data 块中的样本，FLAC 在读取线程中解码
+struct audio_decoder_ops;
+typedef struct {
+    FILE *file;                 // 解析头部用的文件，也是 stdio 回退路径
+    const unsigned char *map;   // 整个文件的映射，NULL 表示使用 stdio
+    size_t map_size;
+    const unsigned char *data;  // data 块 (FLAC 为第一帧) 起点
+    size_t data_bytes;          // data 块中文件里实际存在的字节数 (长度未知的流为 SIZE_MAX)
+    stream_buffer_t *stream;    // 流式输入的抖动缓冲区，NULL 表示文件
+    size_t frame_bytes;         // 读出的每帧字节数 (格式信息中的 block_align)
+    const struct audio_decoder_ops *decoder;
+    void *codec;                // 解码器私有状态，WAV 为 NULL
+} audio_source_t;
+audio_source_t music_source;
+
+bool audio_source_open(audio_source_t *src, FILE *file, long data_offset, size_t data_bytes);
+void audio_source_close(audio_source_t *src);
+size_t audio_source_read(audio_source_t *src, size_t frame, size_t frames,
+                         unsigned char *copy_buf, const unsigned char **out);
+void audio_source_seek(audio_source_t *src, size_t frame);
+FILE *stream_fopen(const char *path_name);
+bool stream_source_open(audio_source_t *src, FILE *file, size_t frame_bytes, size_t data_bytes, uint32_t byte_rate);
+size_t stream_buffer_read(stream_buffer_t *sb, unsigned char *dst, size_t bytes);
+void stream_buffer_close(stream_buffer_t *sb);
+void close_music_file();
+
+// 无缝播放: 当前曲目快结束时由主线程预先打开并解析下一首，读取线程在文件末尾直接换源，
+// 环形缓冲区和输出线程不停，两首歌在同一个帧边界上衔接
+#define GAPLESS_PRELOAD_SECONDS 5   // 距离末尾多少秒 (源时间) 时预先打开下一首
+#define GAPLESS_PREFETCH_SECONDS 2  // 预读到页缓存的下一首开头长度
+typedef struct {
+    char path[256];
+    struct WAV_HEADER header;
+    long data_chunk_offset;
+    long total_frames;
+    audio_source_t source;
+} track_t;
+bool gapless_enabled;
+
+bool open_track(const char *path_name, track_t *track);
+void close_track(track_t *track);
+
+// 解码器: open 解析头部，把解码输出的格式写进 track->header (交错的小端 PCM，DSP 和声卡
+// 配置只看这份格式信息) 并打开 track->source；read_frames 从第 frame 帧起最多读 frames 帧，
+// *out 指向数据 (可以直接指向映射，否则写进 buf)，返回帧数，0 表示结束；seek_frame 提示
+// 下一次读取的位置。read_frames 的 frame 与上次读到的位置不连续时解码器自行定位
+typedef struct audio_decoder_ops {
+    const char *name;
+    bool (*probe)(const unsigned char *magic, size_t bytes);
+    bool (*open)(track_t *track, FILE *file, const char *path_name, const struct stat *st);
+    size_t (*read_frames)(audio_source_t *src, size_t frame, size_t frames, unsigned char *buf,
+                          const unsigned char **out);
+    void (*seek_frame)(audio_source_t *src, size_t frame);
+    void (*close)(audio_source_t *src);
+} audio_decoder_ops_t;
+
+// FLAC: 整个文件映射到内存，读取线程逐帧解码 (定长/变长块，CONSTANT/VERBATIM/FIXED/LPC 子帧，
+// 左/侧、侧/右、中/侧声道去相关)，帧头 CRC-8 和整帧 CRC-16 不符的帧输出静音。
+// 定位时先用 SEEKTABLE 找到目标之前最近的帧 (没有时按帧头中的样本号二分查找)，
+// 再只解析帧头逐帧跳到包含目标的那一帧，解码后丢掉目标之前的样本
+#define FLAC_MAX_CHANNELS 8
+#define FLAC_MAX_BLOCK_SIZE 65535
+#define FLAC_MAX_LPC_ORDER 32
+#define FLAC_MAX_BITS 24            // 32 位 FLAC 的侧声道要 33 位，不支持
+#define FLAC_BISECT_BYTES 65536     // 二分查找缩小到这个范围后顺序跳帧
+typedef struct {
+    uint64_t sample;            // 该点所在帧的第一个样本号
+    uint64_t offset;            // 帧头相对第一帧的字节偏移
+} flac_seek_point_t;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;                 // 下一个装入缓存的字节
+    uint64_t cache;             // 高位对齐，有效位之后全为 0
+    int bits;                   // 缓存中的有效位数
+    bool overrun;               // 读过了末尾 (数据损坏)
+} flac_bits_t;
+
+typedef struct {
+    uint64_t sample;            // 帧中第一个样本号
+    int block_size;
+    int channel_mode;           // 0-7: 独立声道；8 左/侧，9 侧/右，10 中/侧
+    int header_bytes;
+} flac_frame_header_t;
+
+typedef struct {
+    const unsigned char *data;  // 第一帧起点 (映射中)
+    size_t size;                // 第一帧到文件末尾的字节数
+    unsigned int sample_rate;
+    int channels;
+    int bits;
+    int container_bytes;        // 输出格式每个样本的字节数
+    int min_block, max_block;
+    int min_frame_bytes;
+    uint64_t total_samples;     // 0 表示未知
+    flac_seek_point_t *seek_points;
+    int seek_count;
+    size_t next;                // 下一帧在 data 中的偏移
+    uint64_t position;          // 下一次读取的第一个样本号
+    uint64_t block_sample;      // decoded 中第一个样本的样本号
+    int block_frames;           // decoded 中的帧数
+    int32_t *decoded[FLAC_MAX_CHANNELS];
+    long corrupt_frames;        // 校验失败、以静音代替的帧数
+} flac_decoder_t;
+
+// 曲目头部索引: 按路径缓存解析好的 WAV 头部和 data 块位置，用文件的修改时间和大小校验，
+// 命中时打开曲目不再遍历 RIFF 块。保存在 -X 指定的文件中 (默认 music_app.index，none 关闭)
+#define TRACK_INDEX_MAGIC 0x5844494dU   // "MIDX"
+#define TRACK_INDEX_VERSION 1
+typedef struct {
+    uint64_t mtime_ns;
+    uint64_t size;
+    uint32_t path_offset;       // 在索引字符串池中的偏移
+    uint32_t path_len;
+    struct WAV_HEADER header;
+    int64_t data_chunk_offset;
+} track_index_entry_t;
+
+const char *track_index_path;
+bool track_index_load(const char *path);
+bool track_index_save();
+void track_index_free();
+
+// 采样率转换 (加窗 sinc 多相滤波器)，位于DSP链之后、环形缓冲区之前，
+// 设备保持在一个固定采样率，换曲时不必重新配置ALSA
+typedef enum {
+    SRC_OFF = 0,            // 不重采样，采样率不同时按原方式重新配置ALSA
+    SRC_FAST = 1,
+    SRC_MEDIUM = 2,
+    SRC_HIGH = 3
+} src_quality_t;
+src_quality_t src_quality;
+
+#define SRC_MAX_EXACT_PHASES 1024   // 输出/输入 = L/M 且 L 不超过此值时使用精确相位表
+#define SRC_INTERP_PHASES 256       // 否则使用 256 相的表并在相邻相之间线性插值
+
+typedef struct {
+    unsigned int in_rate, out_rate;
+    int channels;
+    src_quality_t quality;
+    int taps;               // 每相抽头数
+    int L, M;               // 约分后的 out_rate / in_rate
+    bool exact;             // 精确有理数路径 (含 44.1k -> 88.2k 之类的整数倍)
+    int phases;             // 系数表相数: exact 时为 L，否则 SRC_INTERP_PHASES + 1
+    float *coeffs;          // [phases][taps]，和延迟线按时间顺序相乘
+    int phase;              // exact: 当前输出样本的相位 (0..L-1)
+    uint64_t frac;          // 插值路径: 当前位置的小数部分 (32位定点)
+    uint64_t step;          // 插值路径: 每个输出样本前进的输入样本数 (32.32 定点)
+    int index;              // 下一个输出样本的窗口在延迟线中的起点
+    float *line[FIR_MAX_CHANNELS]; // [taps-1 个历史样本 | 当前块]
+    int capacity;
+} resampler_t;
+
+resampler_t *resampler_create(unsigned int in_rate, unsigned int out_rate, int channels, src_quality_t quality);
+void resampler_destroy(resampler_t *r);
+void resampler_reset(resampler_t *r);
+int resampler_max_output(const resampler_t *r, int input_frames);
+int resampler_process(resampler_t *r, float *const *input, int input_frames, float *const *output, int max_output_frames);
+bool dsp_path_supported(const struct WAV_HEADER *header);
+bool sample_rate_conversion_usable(const struct WAV_HEADER *header);
+
+// 前瞻峰值限幅器: 处理链的最后一级 (采样率转换之后)，均衡器增益、重叠相加和重采样的过冲都在 float 中
+// 保留，到这里才统一压到 ceiling 以下，代替格式转换时的削波。信号延迟 lookahead 帧；增益由各声道
+// 最大绝对值的滑动最大值求出，经释放平滑和 lookahead+1 帧的箱式平均，峰值到达时增益已经线性降到位。
+// 增益乘法不含分支，用 SSE/NEON 处理
+#define LIMITER_LOOKAHEAD_MS 1.5
+#define LIMITER_RELEASE_MS 80.0
+#define DEFAULT_LIMITER_CEILING_DB -0.3f
+#define LIMITER_MIN_CEILING_DB -20.0f
+typedef struct {
+    int channels;
+    unsigned int sample_rate;
+    int lookahead;                  // L: 前瞻帧数，也是限幅器的延迟
+    int capacity;                   // 每块最多帧数
+    float ceiling;                  // 线性
+    float release;                  // 增益每帧向目标恢复的比例
+    float *line[FIR_MAX_CHANNELS];  // [L 个延迟样本 | 当前块]
+    float *gain;                    // 当前块每帧的增益
+    float *max_value;               // 滑动最大值的单调队列 (L+1 个槽位的环)
+    long *max_index;
+    int max_head, max_count;
+    long frame;                     // 已处理的输入帧数
+    float *hold;                    // 箱式平均窗口 (L+1)
+    double hold_sum;
+    int hold_pos;
+    float envelope;                 // 释放平滑后的目标增益
+    bool primed;                    // 复位后第一块用首样本填满延迟线，从旁路淡入时没有空洞
+} limiter_t;
+float limiter_ceiling_db;           // -l，limiter_enabled 为 false 时退回格式转换的削波
+bool limiter_enabled;
+
+limiter_t *limiter_create(int channels, unsigned int sample_rate, int max_block_frames, float ceiling_db);
+void limiter_destroy(limiter_t *l);
+void limiter_reset(limiter_t *l);
+int limiter_process(limiter_t *l, float *const *samples, int frames); // 原地处理，返回增益小于1的帧数
+
+// 电平/频谱分析 (-V): 均衡器之后的分析节点把处理后的样本复制进只追加的历史缓冲区，读取线程从不等待；
+// 低优先级 (SCHED_IDLE) 的分析线程按设定的帧率取出与当前听到的位置对齐的一段，计算每声道 RMS/峰值、
+// Hann 窗 FFT 幅度谱和按对数频率划分的频段电平，写进带序号的快照。读取方前后两次读到同一个偶数
+// 序号才算拿到完整的一帧，不需要锁。快照可以用 'v' 键查看，也可以映射到文件 (如 /dev/shm 下) 供其他进程读取
+#define ANALYZER_FFT_SIZE 2048
+#define ANALYZER_BINS (ANALYZER_FFT_SIZE / 2 + 1)
+#define ANALYZER_BANDS 24
+#define ANALYZER_MIN_HZ 20.0
+#define ANALYZER_MAX_HZ 20000.0
+#define ANALYZER_HISTORY_FRAMES 65536   // 2的幂，要容纳分析窗口加上环形缓冲区和声卡中尚未播放的音频
+#define ANALYZER_FLOOR_DB -120.0f
+#define ANALYZER_FALL_DB_PER_S 24.0f    // 峰值和频段电平的回落速度 (上升立即跟随)
+#define ANALYZER_MAX_FPS 200
+#define DEFAULT_ANALYZER_FPS 30
+#define ANALYZER_MAGIC 0x5a4c564dU      // "MVLZ"
+#define ANALYZER_VERSION 1
+
+// 共享内存中的布局与此相同 (小端、定长)，外部读取方按 magic/version 校验
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    atomic_uint_least32_t sequence;     // 奇数表示正在更新
+    uint32_t sample_rate;               // 分析的是处理后、重采样前的信号
+    uint32_t channels;
+    uint32_t fft_size;
+    uint32_t bands;
+    uint32_t fps;
+    uint64_t timestamp_ns;              // CLOCK_MONOTONIC，停止更新说明播放器已退出或暂停
+    float rms_db[FIR_MAX_CHANNELS];     // 上一帧以来每声道的 RMS，dBFS
+    float peak_db[FIR_MAX_CHANNELS];    // 每声道峰值 (带回落)，dBFS
+    float band_hz[ANALYZER_BANDS + 1];  // 频段边界
+    float band_db[ANALYZER_BANDS];      // 频段电平 (带回落)，满幅正弦为 0 dB
+    float magnitude_db[ANALYZER_BINS];  // 各声道平均后的幅度谱，第 k 个频点为 k * sample_rate / fft_size Hz
+} analyzer_snapshot_t;
+
+int analyzer_fps;                       // 0 表示关闭
+const char *analyzer_shm_path;
+bool analyzer_start();
+void analyzer_stop();
+bool analyzer_read(analyzer_snapshot_t *out);
+void print_levels();
+
+// 多区域输出 (-Z，可重复): 解码和共享的处理链只运行一次，读取线程把写进主环形缓冲区的帧同时复制进每个
+// 附加区域的环形缓冲区 (放不下时丢弃并计数，读取线程从不等待区域)。每个区域有自己的 snd_pcm_t 和输出线程，
+// 依次做漂移补偿重采样 (同时转换到区域的采样率)、区域均衡器、音量、限幅和格式转换。主输出 (区域 0) 的
+// 时钟是基准: 区域线程每次写入后比较自己与主输出的端到端延迟，用 PI 控制器微调重采样比例
+// (不超过 ZONE_MAX_DRIFT_PPM)；误差超过 ZONE_RESYNC_MS (开始播放、欠载之后) 时直接丢帧或补静音
+#define MAX_ZONES 4                 // 含主输出
+#define ZONE_MAX_DRIFT_PPM 1000.0
+#define ZONE_RESYNC_MS 20.0
+#define ZONE_SETTLE_MS 300          // 开始或重新对齐后等设备缓冲区稳定再测量
+#define ZONE_ERROR_TAU_S 0.5        // 对齐误差的平滑时间常数
+#define ZONE_KP 0.25                // 每秒误差对应的比例调整 (1 ms -> 250 ppm)
+#define ZONE_KI (ZONE_KP * ZONE_KP / 4.0) // 临界阻尼
+#define ZONE_FADE_MS 5              // 定位后新音频的淡入
+
+typedef struct {
+    const char *device;
+    equalizer_mode_t eq_mode;       // 只用预设 (normal / bass / treble / vocal)，双二阶实现
+    float gain;                     // 线性音量
+    unsigned int requested_rate;    // 0 表示跟随主输出
+    snd_pcm_t *pcm;                 // 打开失败时为 NULL，区域不输出
+    unsigned int rate;              // 设备实际接受的采样率
+    int channels;
+    snd_pcm_uframes_t period_frames, buffer_frames;
+
+    // 以下只在流水线运行期间有效
+    pthread_t thread;
+    atomic_bool running;            // 快速启动时区域在读取线程运行中加入，置位前 ring 等已准备好
+    audio_ring_t ring;              // 与主环形缓冲区相同的设备格式帧 (主输出的采样率)
+    wake_event_t data_event;
+    atomic_size_t flush_frame;      // 定位后新音频在 ring 中的起点 + 1，0 表示没有
+    atomic_bool finished;           // 区域线程已排空并退出 (或出错)
+    resampler_t *src;               // 比例可微调，总走插值路径
+    limiter_t *limiter;
+    biquad_eq_t eq;
+    audio_block_t in, out;
+    unsigned char *pcm_buf;
+    int chunk_frames;               // 每次从 ring 取出的最大帧数
+    uint32_t dither_seed;
+    int fade_remaining, fade_frames;
+    double extra_latency;           // 重采样器和限幅器的固有延迟 (秒)
+    double error_avg, integral;     // 平滑后的对齐误差和积分项 (秒、秒*秒)
+    uint64_t settle_until_ns, measured_ns;
+
+    // 统计，主线程读取
+    atomic_int_least64_t error_us;      // 区域比主输出晚多少微秒 (负数为早)
+    atomic_int_least64_t correction_ppb; // 当前的比例调整，正数表示区域消费得更快
+    atomic_uint_least64_t underruns;
+    atomic_uint_least64_t dropped_frames; // ring 放不下而丢弃的帧
+    atomic_uint_least64_t resyncs;
+} output_zone_t;
+
+const char *sound_card_name;        // -o 主输出设备
+output_zone_t output_zones[MAX_ZONES - 1];
+int output_zone_count;
+
+bool zone_parse(const char *spec);
+void zones_open();
+void zones_close();
+bool zones_start();
+void zones_stop();
+void zones_feed(const unsigned char *frames, size_t count);
+void zones_flush();
+void zones_wake();
+bool zones_finished();
+void print_zones();
+resampler_t *resampler_create_adjustable(unsigned int in_rate, unsigned int out_rate, int channels, src_quality_t quality);
+void resampler_set_ratio(resampler_t *r, double ratio);
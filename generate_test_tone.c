@@ -1,42 +1,166 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <stdint.h>
+#include <unistd.h>
 
-// Generate a 1kHz test tone WAV file
-int main() {
-    FILE *fp = fopen("1khz_tone.wav", "wb");
+// Synthetic test signals. benchmark.c includes this file with TEST_TONE_NO_MAIN defined,
+// so the player's kernels are measured and checked on exactly the signals written here.
+typedef enum {
+    SIGNAL_TONE = 0,        // 1 kHz sine, amplitude 0.5
+    SIGNAL_SWEEP,           // logarithmic sweep 20 Hz .. min(20 kHz, 0.45 * rate), repeating every 10 s
+    SIGNAL_NOISE,           // white noise, amplitude 0.5, independent per channel
+    SIGNAL_MULTITONE,       // five tones from 100 Hz to 8 kHz, 0.1 each
+    NUM_SIGNALS
+} test_signal_t;
+
+static const char *test_signal_names[NUM_SIGNALS] = {"tone", "sweep", "noise", "multitone"};
+
+#define TEST_SWEEP_SECONDS 10.0
+
+// Stateless hash so any frame can be generated on its own (long files are written in pieces)
+static double test_noise_value(uint64_t frame, int channel) {
+    uint64_t x = frame * 0x9E3779B97F4A7C15ull + (uint64_t)(channel + 1) * 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 31;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 29;
+    return (double)(x >> 11) / (double)(1ull << 53) * 2.0 - 1.0;
+}
+
+// Value in [-1, 1) of the given signal at a frame
+double test_signal_value(test_signal_t kind, uint64_t frame, int channel, unsigned int rate) {
+    double t = (double)frame / rate;
+    switch (kind) {
+        case SIGNAL_TONE:
+            return 0.5 * sin(2.0 * M_PI * 1000.0 * t);
+        case SIGNAL_SWEEP: {
+            double f0 = 20.0;
+            double f1 = 0.45 * rate < 20000.0 ? 0.45 * rate : 20000.0;
+            double k = log(f1 / f0);
+            double ts = fmod(t, TEST_SWEEP_SECONDS);
+            return 0.5 * sin(2.0 * M_PI * f0 * TEST_SWEEP_SECONDS / k * (exp(k * ts / TEST_SWEEP_SECONDS) - 1.0));
+        }
+        case SIGNAL_NOISE:
+            return 0.5 * test_noise_value(frame, channel);
+        case SIGNAL_MULTITONE: {
+            static const double freqs[] = {100.0, 440.0, 1000.0, 3150.0, 8000.0};
+            double v = 0.0;
+            for (int i = 0; i < 5; i++) {
+                if (freqs[i] < 0.45 * rate) {
+                    v += 0.1 * sin(2.0 * M_PI * freqs[i] * t + 0.7 * i * (channel + 1));
+                }
+            }
+            return v;
+        }
+        default:
+            return 0.0;
+    }
+}
+
+test_signal_t test_signal_from_name(const char *name) {
+    for (int i = 0; i < NUM_SIGNALS; i++) {
+        if (strcmp(name, test_signal_names[i]) == 0) {
+            return (test_signal_t)i;
+        }
+    }
+    return NUM_SIGNALS;
+}
+
+#ifndef TEST_TONE_NO_MAIN
+static void write_sample(FILE *fp, double value, uint16_t bits_per_sample) {
+    unsigned char bytes[4];
+    switch (bits_per_sample) {
+        case 8:
+            bytes[0] = (unsigned char)((int)(value * 127) + 128);
+            break;
+        case 16: {
+            int16_t sample = (int16_t)(value * 32767);
+            memcpy(bytes, &sample, 2);
+            break;
+        }
+        case 24: {
+            int32_t sample = (int32_t)(value * 8388607);
+            bytes[0] = sample & 0xFF;
+            bytes[1] = (sample >> 8) & 0xFF;
+            bytes[2] = (sample >> 16) & 0xFF;
+            break;
+        }
+        default: {
+            int32_t sample = (int32_t)(value * 2147483647.0);
+            memcpy(bytes, &sample, 4);
+            break;
+        }
+    }
+    fwrite(bytes, 1, bits_per_sample / 8, fp);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s tone|sweep|noise|multitone] [-r rate] [-c channels] [-b 8|16|24|32] "
+                    "[-d seconds] [-o file.wav]\n", prog);
+}
+
+// Generate a test signal WAV file (default: 5 s 1 kHz stereo tone, 44.1 kHz 16-bit, 1khz_tone.wav)
+int main(int argc, char *argv[]) {
+    test_signal_t kind = SIGNAL_TONE;
+    uint32_t sample_rate = 44100;
+    uint16_t num_channels = 2;  // Stereo
+    uint16_t bits_per_sample = 16;
+    double duration_seconds = 5;
+    const char *path = "1khz_tone.wav";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:c:b:d:o:")) != -1) {
+        switch (opt) {
+            case 's': kind = test_signal_from_name(optarg); break;
+            case 'r': sample_rate = (uint32_t)atoi(optarg); break;
+            case 'c': num_channels = (uint16_t)atoi(optarg); break;
+            case 'b': bits_per_sample = (uint16_t)atoi(optarg); break;
+            case 'd': duration_seconds = atof(optarg); break;
+            case 'o': path = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (kind == NUM_SIGNALS || sample_rate == 0 || num_channels == 0 || duration_seconds <= 0 ||
+        (bits_per_sample != 8 && bits_per_sample != 16 && bits_per_sample != 24 && bits_per_sample != 32)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint64_t num_samples = (uint64_t)(sample_rate * duration_seconds);
+    uint16_t block_align = num_channels * bits_per_sample / 8;
+    uint64_t data_bytes = num_samples * block_align;
+    if (data_bytes > UINT32_MAX - 36) {
+        fprintf(stderr, "Too long for a WAV file (%.1f GB of data, limit 4 GB)\n", data_bytes / 1e9);
+        return 1;
+    }
+
+    FILE *fp = fopen(path, "wb");
     if (!fp) {
         printf("Failed to create file\n");
         return 1;
     }
-    
+
     // WAV header
     const char *riff = "RIFF";
     const char *wave = "WAVE";
     const char *fmt = "fmt ";
     const char *data = "data";
-    
-    uint32_t sample_rate = 44100;
-    uint16_t num_channels = 2;  // Stereo
-    uint16_t bits_per_sample = 16;
-    uint32_t duration_seconds = 5;
-    uint32_t num_samples = sample_rate * duration_seconds;
-    uint32_t data_size = num_samples * num_channels * (bits_per_sample / 8);
+
+    uint32_t data_size = (uint32_t)data_bytes;
     uint32_t file_size = 36 + data_size;
-    
+
     // Write RIFF header
     fwrite(riff, 1, 4, fp);
     fwrite(&file_size, 4, 1, fp);
     fwrite(wave, 1, 4, fp);
-    
+
     // Write fmt chunk
     fwrite(fmt, 1, 4, fp);
     uint32_t fmt_size = 16;
     uint16_t audio_format = 1;  // PCM
     uint32_t byte_rate = sample_rate * num_channels * bits_per_sample / 8;
-    uint16_t block_align = num_channels * bits_per_sample / 8;
-    
+
     fwrite(&fmt_size, 4, 1, fp);
     fwrite(&audio_format, 2, 1, fp);
     fwrite(&num_channels, 2, 1, fp);
@@ -44,26 +168,24 @@ int main() {
     fwrite(&byte_rate, 4, 1, fp);
     fwrite(&block_align, 2, 1, fp);
     fwrite(&bits_per_sample, 2, 1, fp);
-    
+
     // Write data chunk
     fwrite(data, 1, 4, fp);
     fwrite(&data_size, 4, 1, fp);
-    
-    // Generate 1kHz sine wave
-    double frequency = 1000.0;
-    double amplitude = 0.5;
-    
-    for (uint32_t i = 0; i < num_samples; i++) {
-        double t = (double)i / sample_rate;
-        double value = amplitude * sin(2.0 * M_PI * frequency * t);
-        int16_t sample = (int16_t)(value * 32767);
-        
-        // Write stereo sample (same for both channels)
-        fwrite(&sample, 2, 1, fp);
-        fwrite(&sample, 2, 1, fp);
+
+    // Samples are generated frame by frame, so multi-hour files need no extra memory
+    for (uint64_t i = 0; i < num_samples; i++) {
+        for (int ch = 0; ch < num_channels; ch++) {
+            write_sample(fp, test_signal_value(kind, i, ch, sample_rate), bits_per_sample);
+        }
+    }
+
+    if (fclose(fp) != 0) {
+        printf("Failed to write file\n");
+        return 1;
     }
-    
-    fclose(fp);
-    printf("Generated 1khz_tone.wav - 5 seconds, 44.1kHz, stereo, 1kHz sine wave\n");
+    printf("Generated %s - %.1f seconds, %u Hz, %u channels, %u-bit, %s\n", path, duration_seconds,
+           sample_rate, num_channels, bits_per_sample, test_signal_names[kind]);
     return 0;
-}
\ No newline at end of file
+}
+#endif // TEST_TONE_NO_MAIN